@@ -6,7 +6,7 @@ include $(CLEAR_VARS)
 LOCAL_CFLAGS += -DANDROID_BUILD
 LOCAL_CFLAGS += -Wall
 
-LOCAL_SRC_FILES += host/main.c
+LOCAL_SRC_FILES += host/main.c host/bench.c host/keyinfo.c host/pubkey.c
 
 LOCAL_C_INCLUDES := $(LOCAL_PATH)/ta/include \
 		    $(OPTEE_CLIENT_EXPORT)/include
@@ -0,0 +1,557 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2018, Linaro Limited
+ */
+
+/*
+ * Benchmark of the acipher TA: for each key type and size, M threads, each
+ * with its own session and key, run key generation, encryption, decryption,
+ * signature, verification or key agreement. Throughput, latency of the
+ * invokes and the peak TA heap usage are reported as JSON on stdout.
+ */
+
+#include <err.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* OP-TEE TEE client API (built by optee_client) */
+#include <tee_client_api.h>
+
+/* For the UUID (found in the TA's h-file(s)) */
+#include <acipher_ta.h>
+
+#include "bench.h"
+
+/* Large enough for the ciphertexts and signatures of RSA 4096 */
+#define BENCH_BUF_SIZE	1024
+#define DIGEST_SIZE	32
+/* No signature algorithm for the key type */
+#define NO_ALG		UINT32_MAX
+
+struct bench_key {
+	const char *name;
+	uint32_t key_type;	/* TA_ACIPHER_KEY_xxx */
+	uint32_t key_size;
+	uint32_t sign_alg;	/* TA_ACIPHER_ALG_xxx or NO_ALG */
+};
+
+static const struct bench_key bench_keys[] = {
+	{ "rsa1024", TA_ACIPHER_KEY_RSA, 1024,
+	  TA_ACIPHER_ALG_RSASSA_PKCS1_V1_5_SHA256 },
+	{ "rsa2048", TA_ACIPHER_KEY_RSA, 2048,
+	  TA_ACIPHER_ALG_RSASSA_PKCS1_V1_5_SHA256 },
+	{ "rsa3072", TA_ACIPHER_KEY_RSA, 3072,
+	  TA_ACIPHER_ALG_RSASSA_PKCS1_V1_5_SHA256 },
+	{ "rsa4096", TA_ACIPHER_KEY_RSA, 4096,
+	  TA_ACIPHER_ALG_RSASSA_PKCS1_V1_5_SHA256 },
+	{ "ecdsa-p256", TA_ACIPHER_KEY_ECDSA_P256, 256,
+	  TA_ACIPHER_ALG_ECDSA_P256_SHA256 },
+	{ "ecdh-p256", TA_ACIPHER_KEY_ECDH_P256, 256, NO_ALG },
+	{ "ed25519", TA_ACIPHER_KEY_ED25519, 256, TA_ACIPHER_ALG_ED25519 },
+	{ "x25519", TA_ACIPHER_KEY_X25519, 256, NO_ALG },
+};
+
+#define BENCH_NUM_KEYS	(sizeof(bench_keys) / sizeof(bench_keys[0]))
+
+enum bench_op {
+	/* GEN_KEY, through the RSA key pools if refilled beforehand */
+	BENCH_KEYGEN,
+	BENCH_ENCRYPT,
+	BENCH_DECRYPT,
+	BENCH_SIGN,
+	BENCH_VERIFY,
+	/* DERIVE, with the public key of the session key as peer key */
+	BENCH_DERIVE,
+	BENCH_NUM_OPS
+};
+
+static const char * const op_names[BENCH_NUM_OPS] = {
+	[BENCH_KEYGEN] = "keygen",
+	[BENCH_ENCRYPT] = "encrypt",
+	[BENCH_DECRYPT] = "decrypt",
+	[BENCH_SIGN] = "sign",
+	[BENCH_VERIFY] = "verify",
+	[BENCH_DERIVE] = "derive",
+};
+
+struct bench_cfg {
+	const struct bench_key *key;
+	enum bench_op op;
+	unsigned int threads;
+	unsigned int invokes;		/* per thread */
+	unsigned int keygen_invokes;	/* per thread, for BENCH_KEYGEN */
+};
+
+struct bench_thread {
+	const struct bench_cfg *cfg;
+	/* Released once every thread has its session and key */
+	pthread_barrier_t *ready;
+	uint64_t *lat_ns;	/* latency of each invoke */
+	uint64_t end_ns;	/* end of the last invoke */
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void open_session(TEEC_Context *ctx, TEEC_Session *sess)
+{
+	TEEC_UUID uuid = TA_ACIPHER_UUID;
+	uint32_t err_origin;
+	TEEC_Result res;
+
+	res = TEEC_InitializeContext(NULL, ctx);
+	if (res != TEEC_SUCCESS)
+		errx(1, "TEEC_InitializeContext failed with code 0x%x", res);
+
+	res = TEEC_OpenSession(ctx, sess, &uuid, TEEC_LOGIN_PUBLIC, NULL,
+			       NULL, &err_origin);
+	if (res != TEEC_SUCCESS)
+		errx(1, "TEEC_Opensession failed with code 0x%x origin 0x%x",
+		     res, err_origin);
+}
+
+static void invoke(TEEC_Session *sess, uint32_t cmd, TEEC_Operation *op)
+{
+	uint32_t err_origin;
+	TEEC_Result res;
+
+	res = TEEC_InvokeCommand(sess, cmd, op, &err_origin);
+	if (res != TEEC_SUCCESS)
+		errx(1, "TEEC_InvokeCommand(%u) failed with code 0x%x "
+		     "origin 0x%x", cmd, res, err_origin);
+}
+
+static bool op_applies(const struct bench_key *key, enum bench_op op)
+{
+	switch (op) {
+	case BENCH_ENCRYPT:
+	case BENCH_DECRYPT:
+		return key->key_type == TA_ACIPHER_KEY_RSA;
+	case BENCH_SIGN:
+	case BENCH_VERIFY:
+		return key->sign_alg != NO_ALG;
+	case BENCH_DERIVE:
+		return key->key_type == TA_ACIPHER_KEY_ECDH_P256 ||
+		       key->key_type == TA_ACIPHER_KEY_X25519;
+	default:
+		return true;
+	}
+}
+
+static void gen_key(TEEC_Session *sess, const struct bench_key *key)
+{
+	TEEC_Operation op = { 0 };
+
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_NONE,
+					 TEEC_NONE, TEEC_NONE);
+	op.params[0].value.a = key->key_size;
+	op.params[0].value.b = key->key_type;
+	invoke(sess, TA_ACIPHER_CMD_GEN_KEY, &op);
+}
+
+/*
+ * Set up @op for the benchmarked command, @in holding its input, and
+ * return the command ID.
+ */
+static uint32_t prepare_op(TEEC_Session *sess, const struct bench_cfg *cfg,
+			   TEEC_Operation *op, uint8_t *in, uint8_t *out)
+{
+	const struct bench_key *key = cfg->key;
+	TEEC_Operation setup = { 0 };
+	size_t pub_len;
+
+	memset(op, 0, sizeof(*op));
+	memset(in, 0x5a, BENCH_BUF_SIZE);
+	memset(out, 0xa5, BENCH_BUF_SIZE);
+
+	switch (cfg->op) {
+	case BENCH_KEYGEN:
+		op->paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_NONE,
+						  TEEC_NONE, TEEC_NONE);
+		op->params[0].value.a = key->key_size;
+		op->params[0].value.b = key->key_type;
+		return TA_ACIPHER_CMD_GEN_KEY;
+	case BENCH_ENCRYPT:
+		op->paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+						  TEEC_MEMREF_TEMP_OUTPUT,
+						  TEEC_NONE, TEEC_NONE);
+		op->params[0].tmpref.buffer = in;
+		op->params[0].tmpref.size = DIGEST_SIZE;
+		op->params[1].tmpref.buffer = out;
+		return TA_ACIPHER_CMD_ENCRYPT;
+	case BENCH_DECRYPT:
+		/* Decrypt the same ciphertext over and over */
+		setup.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+						    TEEC_MEMREF_TEMP_OUTPUT,
+						    TEEC_NONE, TEEC_NONE);
+		setup.params[0].tmpref.buffer = out;
+		setup.params[0].tmpref.size = DIGEST_SIZE;
+		setup.params[1].tmpref.buffer = in;
+		setup.params[1].tmpref.size = BENCH_BUF_SIZE;
+		invoke(sess, TA_ACIPHER_CMD_ENCRYPT, &setup);
+
+		op->paramTypes = setup.paramTypes;
+		op->params[0].tmpref.buffer = in;
+		op->params[0].tmpref.size = setup.params[1].tmpref.size;
+		op->params[1].tmpref.buffer = out;
+		return TA_ACIPHER_CMD_DECRYPT;
+	case BENCH_SIGN:
+		op->paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+						  TEEC_MEMREF_TEMP_OUTPUT,
+						  TEEC_VALUE_INPUT, TEEC_NONE);
+		op->params[0].tmpref.buffer = in;
+		op->params[0].tmpref.size = DIGEST_SIZE;
+		op->params[1].tmpref.buffer = out;
+		op->params[2].value.a = key->sign_alg;
+		return TA_ACIPHER_CMD_SIGN;
+	case BENCH_VERIFY:
+		/* Verify the same signature over and over */
+		setup.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+						    TEEC_MEMREF_TEMP_OUTPUT,
+						    TEEC_VALUE_INPUT,
+						    TEEC_NONE);
+		setup.params[0].tmpref.buffer = in;
+		setup.params[0].tmpref.size = DIGEST_SIZE;
+		setup.params[1].tmpref.buffer = out;
+		setup.params[1].tmpref.size = BENCH_BUF_SIZE;
+		setup.params[2].value.a = key->sign_alg;
+		invoke(sess, TA_ACIPHER_CMD_SIGN, &setup);
+
+		op->paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+						  TEEC_MEMREF_TEMP_INPUT,
+						  TEEC_VALUE_INPUT, TEEC_NONE);
+		op->params[0].tmpref.buffer = in;
+		op->params[0].tmpref.size = DIGEST_SIZE;
+		op->params[1].tmpref.buffer = out;
+		op->params[1].tmpref.size = setup.params[1].tmpref.size;
+		op->params[2].value.a = key->sign_alg;
+		return TA_ACIPHER_CMD_VERIFY;
+	case BENCH_DERIVE:
+		/*
+		 * The public value ends the exported SubjectPublicKeyInfo:
+		 * X || Y for P-256, the raw value for X25519.
+		 */
+		setup.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
+						    TEEC_MEMREF_TEMP_OUTPUT,
+						    TEEC_NONE, TEEC_NONE);
+		setup.params[0].value.a = TA_ACIPHER_PUBKEY_DER;
+		setup.params[1].tmpref.buffer = in;
+		setup.params[1].tmpref.size = BENCH_BUF_SIZE;
+		invoke(sess, TA_ACIPHER_CMD_EXPORT_PUBKEY, &setup);
+
+		pub_len = key->key_type == TA_ACIPHER_KEY_X25519 ? 32 : 64;
+		op->paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+						  TEEC_MEMREF_TEMP_OUTPUT,
+						  TEEC_NONE, TEEC_NONE);
+		op->params[0].tmpref.buffer = in +
+					      setup.params[1].tmpref.size -
+					      pub_len;
+		op->params[0].tmpref.size = pub_len;
+		op->params[1].tmpref.buffer = out;
+		return TA_ACIPHER_CMD_DERIVE;
+	default:
+		errx(1, "Unexpected operation %d", cfg->op);
+	}
+}
+
+static unsigned int thread_invokes(const struct bench_cfg *cfg)
+{
+	return cfg->op == BENCH_KEYGEN ? cfg->keygen_invokes : cfg->invokes;
+}
+
+static void *bench_thread(void *arg)
+{
+	struct bench_thread *t = arg;
+	const struct bench_cfg *cfg = t->cfg;
+	uint8_t in[BENCH_BUF_SIZE];
+	uint8_t out[BENCH_BUF_SIZE];
+	TEEC_Operation op;
+	TEEC_Context ctx;
+	TEEC_Session sess;
+	unsigned int i;
+	uint64_t start;
+	uint32_t cmd;
+
+	open_session(&ctx, &sess);
+	gen_key(&sess, cfg->key);
+	cmd = prepare_op(&sess, cfg, &op, in, out);
+
+	pthread_barrier_wait(t->ready);
+
+	for (i = 0; i < thread_invokes(cfg); i++) {
+		/* Output sizes are updated by each invoke */
+		if (cfg->op != BENCH_KEYGEN && cfg->op != BENCH_VERIFY)
+			op.params[1].tmpref.size = BENCH_BUF_SIZE;
+
+		start = now_ns();
+		invoke(&sess, cmd, &op);
+		t->lat_ns[i] = now_ns() - start;
+	}
+	t->end_ns = now_ns();
+
+	TEEC_CloseSession(&sess);
+	TEEC_FinalizeContext(&ctx);
+
+	return NULL;
+}
+
+/*
+ * Get the peak TA heap usage since the last call, false if the TA is
+ * built without heap statistics.
+ */
+static bool heap_stats(TEEC_Session *sess, uint32_t *max_allocated,
+		       uint32_t *size)
+{
+	TEEC_Operation op = { 0 };
+	uint32_t err_origin;
+
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_OUTPUT, TEEC_VALUE_OUTPUT,
+					 TEEC_VALUE_INPUT, TEEC_NONE);
+	op.params[2].value.a = 1;
+
+	if (TEEC_InvokeCommand(sess, TA_ACIPHER_CMD_HEAP_STATS, &op,
+			       &err_origin))
+		return false;
+
+	*max_allocated = op.params[0].value.b;
+	*size = op.params[1].value.a;
+	return true;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile_us(const uint64_t *sorted, size_t n, unsigned int p)
+{
+	size_t idx = (n * p + 99) / 100;
+
+	if (idx)
+		idx--;
+	return sorted[idx] / 1000.0;
+}
+
+static void run(TEEC_Session *sess, const struct bench_cfg *cfg, bool first)
+{
+	size_t total = (size_t)cfg->threads * thread_invokes(cfg);
+	struct bench_thread *threads;
+	pthread_barrier_t ready;
+	pthread_t *tids;
+	uint64_t *lat_ns;
+	uint64_t start, end = 0;
+	uint64_t sum = 0;
+	uint32_t heap_max;
+	uint32_t heap_size;
+	bool heap;
+	double seconds;
+	unsigned int i;
+
+	threads = calloc(cfg->threads, sizeof(*threads));
+	tids = calloc(cfg->threads, sizeof(*tids));
+	lat_ns = calloc(total, sizeof(*lat_ns));
+	if (!threads || !tids || !lat_ns)
+		errx(1, "Cannot allocate %zu latency samples", total);
+
+	/* Reset the peak heap usage */
+	heap_stats(sess, &heap_max, &heap_size);
+
+	if (pthread_barrier_init(&ready, NULL, cfg->threads + 1))
+		errx(1, "Cannot initialize barrier");
+
+	for (i = 0; i < cfg->threads; i++) {
+		threads[i].cfg = cfg;
+		threads[i].ready = &ready;
+		threads[i].lat_ns = lat_ns + (size_t)i * thread_invokes(cfg);
+		if (pthread_create(&tids[i], NULL, bench_thread, &threads[i]))
+			errx(1, "Cannot create thread %u", i);
+	}
+
+	/* Only time the invokes, not the session and key set up */
+	pthread_barrier_wait(&ready);
+	start = now_ns();
+	for (i = 0; i < cfg->threads; i++) {
+		pthread_join(tids[i], NULL);
+		if (threads[i].end_ns > end)
+			end = threads[i].end_ns;
+	}
+	seconds = (end - start) / 1e9;
+	pthread_barrier_destroy(&ready);
+
+	heap = heap_stats(sess, &heap_max, &heap_size);
+
+	for (i = 0; i < total; i++)
+		sum += lat_ns[i];
+	qsort(lat_ns, total, sizeof(*lat_ns), cmp_u64);
+
+	printf("%s  {\"key\": \"%s\", \"op\": \"%s\", \"threads\": %u, "
+	       "\"invokes\": %zu, \"seconds\": %.6f, \"ops_per_s\": %.1f, "
+	       "\"latency_us\": {\"mean\": %.1f, \"p50\": %.1f, "
+	       "\"p99\": %.1f, \"max\": %.1f}, ",
+	       first ? "" : ",\n", cfg->key->name, op_names[cfg->op],
+	       cfg->threads, total, seconds,
+	       seconds > 0 ? total / seconds : 0.0,
+	       sum / 1000.0 / total,
+	       percentile_us(lat_ns, total, 50),
+	       percentile_us(lat_ns, total, 99),
+	       lat_ns[total - 1] / 1000.0);
+	if (heap)
+		printf("\"ta_heap\": {\"max_allocated\": %" PRIu32
+		       ", \"size\": %" PRIu32 "}}", heap_max, heap_size);
+	else
+		printf("\"ta_heap\": null}");
+	fflush(stdout);
+
+	free(threads);
+	free(tids);
+	free(lat_ns);
+}
+
+static void bench_usage(const char *pname)
+{
+	size_t n;
+
+	fprintf(stderr, "usage: %s bench [-k keys] [-o operations]"
+		" [-t threads] [-i invokes per thread]"
+		" [-g key generations per thread]\n", pname);
+	fprintf(stderr, "keys, comma separated, or all:");
+	for (n = 0; n < BENCH_NUM_KEYS; n++)
+		fprintf(stderr, " %s", bench_keys[n].name);
+	fprintf(stderr, "\noperations, comma separated, or all:");
+	for (n = 0; n < BENCH_NUM_OPS; n++)
+		fprintf(stderr, " %s", op_names[n]);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+static unsigned int parse_uint(const char *pname, const char *str,
+			       unsigned int min, unsigned int max)
+{
+	unsigned long val;
+	char *ep;
+
+	val = strtoul(str, &ep, 0);
+	if (*ep || val < min || val > max) {
+		warnx("bad value \"%s\", expected %u..%u", str, min, max);
+		bench_usage(pname);
+	}
+
+	return val;
+}
+
+/* Bit mask of the names of @list found in the comma separated @str */
+static uint32_t parse_list(const char *pname, char *str,
+			   const char *(*name)(size_t n), size_t count)
+{
+	uint32_t mask = 0;
+	char *tok;
+	size_t n;
+
+	if (!strcmp(str, "all"))
+		return (1U << count) - 1;
+
+	for (tok = strtok(str, ","); tok; tok = strtok(NULL, ",")) {
+		for (n = 0; n < count; n++)
+			if (!strcmp(tok, name(n)))
+				break;
+		if (n == count) {
+			warnx("unknown \"%s\"", tok);
+			bench_usage(pname);
+		}
+		mask |= 1U << n;
+	}
+
+	return mask;
+}
+
+static const char *key_name(size_t n)
+{
+	return bench_keys[n].name;
+}
+
+static const char *op_name(size_t n)
+{
+	return op_names[n];
+}
+
+int acipher_bench(int argc, char *argv[])
+{
+	struct bench_cfg cfg = {
+		.threads = 1,
+		.invokes = 100,
+		.keygen_invokes = 3,
+	};
+	const char *pname = "optee_example_acipher";
+	uint32_t keys = (1U << BENCH_NUM_KEYS) - 1;
+	uint32_t ops = (1U << BENCH_NUM_OPS) - 1;
+	TEEC_Context ctx;
+	TEEC_Session sess;
+	bool first = true;
+	size_t k;
+	int opt;
+	int o;
+
+	while ((opt = getopt(argc, argv, "hk:o:t:i:g:")) != -1) {
+		switch (opt) {
+		case 'k':
+			keys = parse_list(pname, optarg, key_name,
+					  BENCH_NUM_KEYS);
+			break;
+		case 'o':
+			ops = parse_list(pname, optarg, op_name,
+					 BENCH_NUM_OPS);
+			break;
+		case 't':
+			cfg.threads = parse_uint(pname, optarg, 1, 256);
+			break;
+		case 'i':
+			cfg.invokes = parse_uint(pname, optarg, 1, 10000000);
+			break;
+		case 'g':
+			cfg.keygen_invokes = parse_uint(pname, optarg, 1,
+							10000);
+			break;
+		default:
+			bench_usage(pname);
+		}
+	}
+	if (optind != argc)
+		bench_usage(pname);
+
+	/* For the heap statistics, shared by all sessions */
+	open_session(&ctx, &sess);
+
+	printf("[\n");
+	for (k = 0; k < BENCH_NUM_KEYS; k++) {
+		if (!(keys & (1U << k)))
+			continue;
+		cfg.key = bench_keys + k;
+		for (o = 0; o < BENCH_NUM_OPS; o++) {
+			if (!(ops & (1U << o)) || !op_applies(cfg.key, o))
+				continue;
+			cfg.op = o;
+			run(&sess, &cfg, first);
+			first = false;
+		}
+	}
+	printf("\n]\n");
+
+	TEEC_CloseSession(&sess);
+	TEEC_FinalizeContext(&ctx);
+
+	return 0;
+}
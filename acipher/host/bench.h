@@ -0,0 +1,15 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (c) 2018, Linaro Limited
+ */
+
+#ifndef __ACIPHER_BENCH_H__
+#define __ACIPHER_BENCH_H__
+
+/*
+ * Run the benchmark mode of the acipher example, argv[0] being "bench".
+ * Returns the exit status of the program.
+ */
+int acipher_bench(int argc, char *argv[]);
+
+#endif /* __ACIPHER_BENCH_H__ */
@@ -0,0 +1,168 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2018, Linaro Limited
+ */
+
+/*
+ * Cache of the sizes of the keys of the TA. Operations whose output size
+ * is not known beforehand would otherwise be invoked twice: once to get
+ * TEEC_ERROR_SHORT_BUFFER and the size, once more with the right buffer.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* OP-TEE TEE client API (built by optee_client) */
+#include <tee_client_api.h>
+
+/* For the commands (found in the TA's h-file(s)) */
+#include <acipher_ta.h>
+
+#include "keyinfo.h"
+
+/* Same bound as TEE_OBJECT_ID_MAX_LEN in the TA */
+#define KEY_ID_MAX_LEN	64
+
+struct cached_info {
+	TEEC_Session *sess;	/* NULL for an unused entry */
+	char key_id[KEY_ID_MAX_LEN + 1];	/* Empty for the session key */
+	struct acipher_key_info info;
+};
+
+/* Sessions may be used from several threads, as the benchmark does */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct cached_info cache[ACIPHER_KEYINFO_CACHE_SIZE];
+static size_t next_evicted;
+
+static struct cached_info *find_info(TEEC_Session *sess, const char *key_id)
+{
+	size_t n;
+
+	for (n = 0; n < ACIPHER_KEYINFO_CACHE_SIZE; n++)
+		if (cache[n].sess == sess && !strcmp(cache[n].key_id, key_id))
+			return cache + n;
+
+	return NULL;
+}
+
+/* Let params[3] name the key, unless it is the session key */
+static void set_key_id(TEEC_Operation *op, const char *key_id)
+{
+	if (!*key_id)
+		return;
+
+	op->paramTypes |= TEEC_PARAM_TYPES(TEEC_NONE, TEEC_NONE, TEEC_NONE,
+					   TEEC_MEMREF_TEMP_INPUT);
+	op->params[3].tmpref.buffer = (void *)key_id;
+	op->params[3].tmpref.size = strlen(key_id);
+}
+
+TEEC_Result acipher_key_info(TEEC_Session *sess, const char *key_id,
+			     struct acipher_key_info *info)
+{
+	struct cached_info *ci;
+	TEEC_Operation op;
+	TEEC_Result res;
+	uint32_t eo;
+
+	if (!key_id)
+		key_id = "";
+	if (strlen(key_id) > KEY_ID_MAX_LEN)
+		return TEEC_ERROR_BAD_PARAMETERS;
+
+	pthread_mutex_lock(&cache_lock);
+	ci = find_info(sess, key_id);
+	if (ci)
+		*info = ci->info;
+	pthread_mutex_unlock(&cache_lock);
+	if (ci)
+		return TEEC_SUCCESS;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE,
+					 TEEC_NONE, TEEC_NONE);
+	op.params[0].tmpref.buffer = info;
+	op.params[0].tmpref.size = sizeof(*info);
+	set_key_id(&op, key_id);
+
+	res = TEEC_InvokeCommand(sess, TA_ACIPHER_CMD_KEY_INFO, &op, &eo);
+	if (res)
+		return res;
+
+	pthread_mutex_lock(&cache_lock);
+	ci = find_info(sess, key_id);
+	if (!ci) {
+		ci = cache + next_evicted;
+		next_evicted = (next_evicted + 1) % ACIPHER_KEYINFO_CACHE_SIZE;
+		ci->sess = sess;
+		strcpy(ci->key_id, key_id);
+	}
+	ci->info = *info;
+	pthread_mutex_unlock(&cache_lock);
+
+	return TEEC_SUCCESS;
+}
+
+void acipher_key_info_forget(TEEC_Session *sess, const char *key_id)
+{
+	struct cached_info *ci;
+
+	pthread_mutex_lock(&cache_lock);
+	ci = find_info(sess, key_id ? key_id : "");
+	if (ci)
+		ci->sess = NULL;
+	pthread_mutex_unlock(&cache_lock);
+}
+
+void acipher_key_info_flush(TEEC_Session *sess)
+{
+	size_t n;
+
+	pthread_mutex_lock(&cache_lock);
+	for (n = 0; n < ACIPHER_KEYINFO_CACHE_SIZE; n++)
+		if (cache[n].sess == sess)
+			cache[n].sess = NULL;
+	pthread_mutex_unlock(&cache_lock);
+}
+
+TEEC_Result acipher_encrypt(TEEC_Session *sess, const char *key_id,
+			    const void *in, size_t in_len, void **out,
+			    size_t *out_len)
+{
+	struct acipher_key_info info;
+	TEEC_Operation op;
+	TEEC_Result res;
+	uint32_t eo;
+
+	res = acipher_key_info(sess, key_id, &info);
+	if (res)
+		return res;
+	if (in_len > info.max_pt_pkcs1_v1_5)
+		return TEEC_ERROR_BAD_PARAMETERS;
+
+	*out = malloc(info.mod_len);
+	if (!*out)
+		return TEEC_ERROR_OUT_OF_MEMORY;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_NONE, TEEC_NONE);
+	op.params[0].tmpref.buffer = (void *)in;
+	op.params[0].tmpref.size = in_len;
+	op.params[1].tmpref.buffer = *out;
+	op.params[1].tmpref.size = info.mod_len;
+	if (key_id)
+		set_key_id(&op, key_id);
+
+	res = TEEC_InvokeCommand(sess, TA_ACIPHER_CMD_ENCRYPT, &op, &eo);
+	if (res) {
+		free(*out);
+		*out = NULL;
+		return res;
+	}
+
+	*out_len = op.params[1].tmpref.size;
+	return TEEC_SUCCESS;
+}
@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (c) 2018, Linaro Limited
+ */
+
+#ifndef __ACIPHER_KEYINFO_H__
+#define __ACIPHER_KEYINFO_H__
+
+#include <stddef.h>
+
+#include <tee_client_api.h>
+
+#include <acipher_ta.h>
+
+/*
+ * struct acipher_key_info of the keys of the TA, from
+ * TA_ACIPHER_CMD_KEY_INFO, cached per session and key ID so that the
+ * buffers of later operations are sized right on their first invoke. A NULL
+ * key ID stands for the session key.
+ */
+
+/* Number of keys of which the information is cached */
+#define ACIPHER_KEYINFO_CACHE_SIZE	16
+
+TEEC_Result acipher_key_info(TEEC_Session *sess, const char *key_id,
+			     struct acipher_key_info *info);
+
+/*
+ * Drop the cached information of a key, to be called once the key changes:
+ * after TA_ACIPHER_CMD_GEN_KEY, KEY_LOAD or KEY_IMPORT
+ */
+void acipher_key_info_forget(TEEC_Session *sess, const char *key_id);
+
+/*
+ * Drop the cached information of all the keys of a session, to be called
+ * before TEEC_CloseSession(): entries are keyed on the address of the
+ * session, which a session opened later may reuse.
+ */
+void acipher_key_info_flush(TEEC_Session *sess);
+
+/*
+ * TA_ACIPHER_CMD_ENCRYPT in a single invoke. @out is allocated with the
+ * size of the ciphertext, to be freed by the caller. Returns
+ * TEEC_ERROR_BAD_PARAMETERS without invoking the TA when @in_len exceeds
+ * the largest plaintext of the key.
+ */
+TEEC_Result acipher_encrypt(TEEC_Session *sess, const char *key_id,
+			    const void *in, size_t in_len, void **out,
+			    size_t *out_len);
+
+#endif /* __ACIPHER_KEYINFO_H__ */
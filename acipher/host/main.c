@@ -6,6 +6,7 @@
 #include <err.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,6 +17,10 @@
 /* To the the UUID (found the the TA's h-file(s)) */
 #include <acipher_ta.h>
 
+#include "bench.h"
+#include "keyinfo.h"
+#include "pubkey.h"
+
 static void usage(int argc, char *argv[])
 {
 	const char *pname = "acipher";
@@ -24,31 +29,48 @@ static void usage(int argc, char *argv[])
 		pname = argv[0];
 
 	fprintf(stderr, "usage: %s <key_size> <string to encrypt>\n", pname);
+	fprintf(stderr, "       %s pool <key_size> <depth>\n", pname);
+	fprintf(stderr, "       %s sign <rsa|ecdsa|ed25519>\n", pname);
+	fprintf(stderr, "       %s envelope <key_size> <file>\n", pname);
+	fprintf(stderr, "       %s store <key_size> <key_id>\n", pname);
+	fprintf(stderr, "       %s load <key_id> <string to encrypt>\n", pname);
+	fprintf(stderr, "       %s pubkey <key_size> <string to encrypt>\n",
+		pname);
+	fprintf(stderr, "       %s import <ecdsa|ecdh> <PKCS#8 DER file>...\n",
+		pname);
+	fprintf(stderr, "       %s derive\n", pname);
+	fprintf(stderr, "       %s bench [options], see %s bench -h\n",
+		pname, pname);
 	exit(1);
 }
 
-static void get_args(int argc, char *argv[], size_t *key_size, void **inbuf,
-		     size_t *inbuf_len)
+static size_t get_size_arg(int argc, char *argv[], const char *name, int n)
 {
 	char *ep;
 	long ks;
 
-	if (argc != 3) {
-		warnx("Unexpected number of arguments %d (expected 2)",
-		      argc - 1);
-		usage(argc, argv);
-	}
-
-	ks = strtol(argv[1], &ep, 0);
+	ks = strtol(argv[n], &ep, 0);
 	if (*ep) {
-		warnx("cannot parse key_size \"%s\"", argv[1]);
+		warnx("cannot parse %s \"%s\"", name, argv[n]);
 		usage(argc, argv);
 	}
 	if (ks < 0 || ks == LONG_MAX) {
-		warnx("bad key_size \"%s\" (%ld)", argv[1], ks);
+		warnx("bad %s \"%s\" (%ld)", name, argv[n], ks);
+		usage(argc, argv);
+	}
+	return ks;
+}
+
+static void get_args(int argc, char *argv[], size_t *key_size, void **inbuf,
+		     size_t *inbuf_len)
+{
+	if (argc != 3) {
+		warnx("Unexpected number of arguments %d (expected 2)",
+		      argc - 1);
 		usage(argc, argv);
 	}
-	*key_size = ks;
+
+	*key_size = get_size_arg(argc, argv, "key_size", 1);
 
 	*inbuf = argv[2];
 	*inbuf_len = strlen(argv[2]);
@@ -59,62 +81,708 @@ static void teec_err(TEEC_Result res, uint32_t eo, const char *str)
 	errx(1, "%s: %#" PRIx32 " (error origin %#" PRIx32 ")", str, res, eo);
 }
 
-int main(int argc, char *argv[])
+/*
+ * Fill the pool of keys of the given size, one key per invoke, then print
+ * the statistics of all pools.
+ */
+static void pool_refill(TEEC_Session *sess, size_t key_size, size_t depth)
 {
+	struct acipher_pool_stats stats[TA_ACIPHER_POOL_MAX_SIZES];
 	TEEC_Result res;
+	TEEC_Operation op;
 	uint32_t eo;
-	TEEC_Context ctx;
-	TEEC_Session sess;
+	size_t n;
+
+	do {
+		memset(&op, 0, sizeof(op));
+		op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
+						 TEEC_VALUE_OUTPUT,
+						 TEEC_NONE, TEEC_NONE);
+		op.params[0].value.a = key_size;
+		op.params[0].value.b = depth;
+
+		res = TEEC_InvokeCommand(sess, TA_ACIPHER_CMD_POOL_REFILL, &op,
+					 &eo);
+		if (res)
+			teec_err(res, eo,
+				 "TEEC_InvokeCommand(TA_ACIPHER_CMD_POOL_REFILL)");
+	} while (op.params[1].value.b);
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE,
+					 TEEC_NONE, TEEC_NONE);
+	op.params[0].tmpref.buffer = stats;
+	op.params[0].tmpref.size = sizeof(stats);
+
+	res = TEEC_InvokeCommand(sess, TA_ACIPHER_CMD_POOL_STATS, &op, &eo);
+	if (res)
+		teec_err(res, eo, "TEEC_InvokeCommand(TA_ACIPHER_CMD_POOL_STATS)");
+
+	for (n = 0; n < op.params[0].tmpref.size / sizeof(stats[0]); n++)
+		printf("pool %" PRIu32 ": depth %" PRIu32 "/%" PRIu32
+		       ", hits %" PRIu32 ", misses %" PRIu32
+		       ", generated %" PRIu32 "\n",
+		       stats[n].key_size, stats[n].depth, stats[n].target,
+		       stats[n].hits, stats[n].misses, stats[n].generated);
+}
+
+static void decrypt(TEEC_Session *sess, void *ct, size_t ct_len,
+		    const void *expected, size_t expected_len)
+{
+	TEEC_Result res;
 	TEEC_Operation op;
-	size_t key_size;
-	void *inbuf;
-	size_t inbuf_len;
+	uint32_t eo;
+	char *pt;
+
+	pt = malloc(ct_len);
+	if (!pt)
+		err(1, "Cannot allocate out buffer of size %zu", ct_len);
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_NONE, TEEC_NONE);
+	op.params[0].tmpref.buffer = ct;
+	op.params[0].tmpref.size = ct_len;
+	op.params[1].tmpref.buffer = pt;
+	op.params[1].tmpref.size = ct_len;
+
+	res = TEEC_InvokeCommand(sess, TA_ACIPHER_CMD_DECRYPT, &op, &eo);
+	if (res)
+		teec_err(res, eo, "TEEC_InvokeCommand(TA_ACIPHER_CMD_DECRYPT)");
+
+	if (op.params[1].tmpref.size != expected_len ||
+	    memcmp(pt, expected, expected_len))
+		errx(1, "Decrypted buffer does not match");
+	printf("Decrypted buffer: %.*s\n", (int)expected_len, pt);
+	free(pt);
+}
+
+#define DEMO_BATCH	4
+#define DIGEST_SIZE	32
+
+/*
+ * Sign a few digests in one invoke, verify them in one invoke too, then
+ * check that a corrupted signature is rejected.
+ */
+static void sign_verify(TEEC_Session *sess, uint32_t alg, size_t sig_len)
+{
+	TEEC_Result res;
+	TEEC_Operation op;
+	uint32_t eo;
+	uint32_t results[DEMO_BATCH];
+	uint8_t digests[DEMO_BATCH][DIGEST_SIZE];
+	uint8_t *sigs;
+	uint8_t *pairs;
+	size_t pair_len = DIGEST_SIZE + sig_len;
 	size_t n;
-	const TEEC_UUID uuid = TA_ACIPHER_UUID;
 
-	get_args(argc, argv, &key_size, &inbuf, &inbuf_len);
+	sigs = malloc(DEMO_BATCH * sig_len);
+	pairs = malloc(DEMO_BATCH * pair_len);
+	if (!sigs || !pairs)
+		err(1, "Cannot allocate signature buffers");
 
-	res = TEEC_InitializeContext(NULL, &ctx);
+	/* Any 32 bytes will do as a SHA-256 digest here */
+	for (n = 0; n < sizeof(digests); n++)
+		digests[n / DIGEST_SIZE][n % DIGEST_SIZE] = n;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_VALUE_INPUT, TEEC_NONE);
+	op.params[0].tmpref.buffer = digests;
+	op.params[0].tmpref.size = sizeof(digests);
+	op.params[1].tmpref.buffer = sigs;
+	op.params[1].tmpref.size = DEMO_BATCH * sig_len;
+	op.params[2].value.a = alg;
+
+	res = TEEC_InvokeCommand(sess, TA_ACIPHER_CMD_SIGN_BATCH, &op, &eo);
 	if (res)
-		errx(1, "TEEC_InitializeContext(NULL, x): %#" PRIx32, res);
+		teec_err(res, eo,
+			 "TEEC_InvokeCommand(TA_ACIPHER_CMD_SIGN_BATCH)");
 
-	res = TEEC_OpenSession(&ctx, &sess, &uuid, TEEC_LOGIN_PUBLIC, NULL,
-			       NULL, &eo);
+	for (n = 0; n < DEMO_BATCH; n++) {
+		memcpy(pairs + n * pair_len, digests[n], DIGEST_SIZE);
+		memcpy(pairs + n * pair_len + DIGEST_SIZE, sigs + n * sig_len,
+		       sig_len);
+	}
+	/* Corrupt the last signature */
+	pairs[DEMO_BATCH * pair_len - 1] ^= 1;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_VALUE_INPUT, TEEC_NONE);
+	op.params[0].tmpref.buffer = pairs;
+	op.params[0].tmpref.size = DEMO_BATCH * pair_len;
+	op.params[1].tmpref.buffer = results;
+	op.params[1].tmpref.size = sizeof(results);
+	op.params[2].value.a = alg;
+
+	res = TEEC_InvokeCommand(sess, TA_ACIPHER_CMD_VERIFY_BATCH, &op, &eo);
 	if (res)
-		teec_err(res, eo, "TEEC_OpenSession(TEEC_LOGIN_PUBLIC)");
+		teec_err(res, eo,
+			 "TEEC_InvokeCommand(TA_ACIPHER_CMD_VERIFY_BATCH)");
+
+	for (n = 0; n < DEMO_BATCH; n++)
+		printf("Signature %zu: %s\n", n,
+		       results[n] == TEEC_SUCCESS ? "valid" : "invalid");
+
+	/* Same check on the first signature, one item at a time */
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_VALUE_INPUT, TEEC_NONE);
+	op.params[0].tmpref.buffer = digests[0];
+	op.params[0].tmpref.size = DIGEST_SIZE;
+	op.params[1].tmpref.buffer = sigs;
+	op.params[1].tmpref.size = sig_len;
+	op.params[2].value.a = alg;
+
+	res = TEEC_InvokeCommand(sess, TA_ACIPHER_CMD_VERIFY, &op, &eo);
+	if (res)
+		teec_err(res, eo, "TEEC_InvokeCommand(TA_ACIPHER_CMD_VERIFY)");
+
+	free(pairs);
+	free(sigs);
+}
+
+static void gen_key(TEEC_Session *sess, uint32_t key_type, size_t key_size)
+{
+	TEEC_Result res;
+	TEEC_Operation op;
+	uint32_t eo;
 
 	memset(&op, 0, sizeof(op));
 	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_NONE,
 					 TEEC_NONE, TEEC_NONE);
 	op.params[0].value.a = key_size;
+	op.params[0].value.b = key_type;
 
-	res = TEEC_InvokeCommand(&sess, TA_ACIPHER_CMD_GEN_KEY, &op, &eo);
+	res = TEEC_InvokeCommand(sess, TA_ACIPHER_CMD_GEN_KEY, &op, &eo);
 	if (res)
 		teec_err(res, eo, "TEEC_InvokeCommand(TA_ACIPHER_CMD_GEN_KEY)");
+	acipher_key_info_forget(sess, NULL);
+}
+
+/* Store the session key, or load a stored key in the session */
+static void key_cmd(TEEC_Session *sess, uint32_t cmd, const char *key_id)
+{
+	TEEC_Result res;
+	TEEC_Operation op;
+	uint32_t eo;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_NONE,
+					 TEEC_NONE, TEEC_NONE);
+	op.params[0].tmpref.buffer = (void *)key_id;
+	op.params[0].tmpref.size = strlen(key_id);
+
+	res = TEEC_InvokeCommand(sess, cmd, &op, &eo);
+	if (res)
+		teec_err(res, eo, cmd == TA_ACIPHER_CMD_KEY_STORE ?
+			 "TEEC_InvokeCommand(TA_ACIPHER_CMD_KEY_STORE)" :
+			 "TEEC_InvokeCommand(TA_ACIPHER_CMD_KEY_LOAD)");
+	if (cmd == TA_ACIPHER_CMD_KEY_LOAD)
+		acipher_key_info_forget(sess, NULL);
+}
+
+/* Sign and verify with a key of the named type */
+static void sign_demo(TEEC_Session *sess, const char *name)
+{
+	if (!strcmp(name, "rsa")) {
+		gen_key(sess, TA_ACIPHER_KEY_RSA, 2048);
+		sign_verify(sess, TA_ACIPHER_ALG_RSASSA_PKCS1_V1_5_SHA256,
+			    2048 / 8);
+	} else if (!strcmp(name, "ecdsa")) {
+		gen_key(sess, TA_ACIPHER_KEY_ECDSA_P256, 0);
+		sign_verify(sess, TA_ACIPHER_ALG_ECDSA_P256_SHA256, 64);
+	} else if (!strcmp(name, "ed25519")) {
+		gen_key(sess, TA_ACIPHER_KEY_ED25519, 0);
+		sign_verify(sess, TA_ACIPHER_ALG_ED25519, 64);
+	} else {
+		errx(1, "unknown key type \"%s\"", name);
+	}
+}
+
+static void *read_file(const char *name, size_t *size)
+{
+	FILE *f;
+	void *buf;
+	long len;
+
+	f = fopen(name, "rb");
+	if (!f)
+		err(1, "%s", name);
+	if (fseek(f, 0, SEEK_END) || (len = ftell(f)) < 0 ||
+	    fseek(f, 0, SEEK_SET))
+		err(1, "%s", name);
+
+	/* One more byte so that empty files still get a buffer */
+	buf = malloc(len + 1);
+	if (!buf)
+		err(1, "Cannot allocate %ld bytes", len);
+	if (fread(buf, 1, len, f) != (size_t)len)
+		errx(1, "%s: short read", name);
+
+	fclose(f);
+	*size = len;
+	return buf;
+}
+
+#define ENVELOPE_CHUNK_SIZE	4096
+
+/*
+ * Seal a file in an envelope in one invoke, then open the envelope chunk by
+ * chunk as a receiver streaming it would.
+ */
+static void envelope(TEEC_Session *sess, size_t key_size, const char *name)
+{
+	TEEC_Result res;
+	TEEC_Operation op;
+	uint32_t eo;
+	struct acipher_envelope hdr;
+	uint8_t *payload;
+	size_t payload_len;
+	uint8_t *env;
+	size_t env_len;
+	uint8_t *ct;
+	uint8_t *pt;
+	size_t pt_len = 0;
+	size_t pos;
+	size_t chunk;
+
+	payload = read_file(name, &payload_len);
+	env_len = TA_ACIPHER_ENVELOPE_SIZE(key_size / 8, payload_len);
+	env = malloc(env_len);
+	pt = malloc(payload_len + 1);
+	if (!env || !pt)
+		err(1, "Cannot allocate envelope buffers");
+
+	gen_key(sess, TA_ACIPHER_KEY_RSA, key_size);
 
 	memset(&op, 0, sizeof(op));
 	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
 					 TEEC_MEMREF_TEMP_OUTPUT,
 					 TEEC_NONE, TEEC_NONE);
-	op.params[0].tmpref.buffer = inbuf;
-	op.params[0].tmpref.size = inbuf_len;
+	op.params[0].tmpref.buffer = payload;
+	op.params[0].tmpref.size = payload_len;
+	op.params[1].tmpref.buffer = env;
+	op.params[1].tmpref.size = env_len;
 
-	res = TEEC_InvokeCommand(&sess, TA_ACIPHER_CMD_ENCRYPT, &op, &eo);
-	if (eo != TEEC_ORIGIN_TRUSTED_APP || res != TEEC_ERROR_SHORT_BUFFER)
-		teec_err(res, eo, "TEEC_InvokeCommand(TA_ACIPHER_CMD_ENCRYPT)");
+	res = TEEC_InvokeCommand(sess, TA_ACIPHER_CMD_ENVELOPE_SEAL, &op, &eo);
+	if (res)
+		teec_err(res, eo,
+			 "TEEC_InvokeCommand(TA_ACIPHER_CMD_ENVELOPE_SEAL)");
+	printf("Sealed %zu bytes in an envelope of %zu bytes\n", payload_len,
+	       op.params[1].tmpref.size);
 
-	op.params[1].tmpref.buffer = malloc(op.params[1].tmpref.size);
-	if (!op.params[1].tmpref.buffer)
-		err(1, "Cannot allocate out buffer of size %zu",
-		    op.params[1].tmpref.size);
+	memcpy(&hdr, env, sizeof(hdr));
+	ct = env + sizeof(hdr) + hdr.wrapped_key_len;
 
-	res = TEEC_InvokeCommand(&sess, TA_ACIPHER_CMD_ENCRYPT, &op, &eo);
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_NONE,
+					 TEEC_NONE, TEEC_NONE);
+	op.params[0].tmpref.buffer = env;
+	op.params[0].tmpref.size = sizeof(hdr) + hdr.wrapped_key_len;
+
+	res = TEEC_InvokeCommand(sess, TA_ACIPHER_CMD_ENVELOPE_OPEN_INIT, &op,
+				 &eo);
 	if (res)
-		teec_err(res, eo, "TEEC_InvokeCommand(TA_ACIPHER_CMD_ENCRYPT)");
+		teec_err(res, eo,
+			 "TEEC_InvokeCommand(TA_ACIPHER_CMD_ENVELOPE_OPEN_INIT)");
+
+	for (pos = 0; pos < hdr.payload_len; pos += chunk) {
+		chunk = hdr.payload_len - pos;
+		if (chunk > ENVELOPE_CHUNK_SIZE)
+			chunk = ENVELOPE_CHUNK_SIZE;
+
+		memset(&op, 0, sizeof(op));
+		op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+						 TEEC_MEMREF_TEMP_OUTPUT,
+						 TEEC_NONE, TEEC_NONE);
+		op.params[0].tmpref.buffer = ct + pos;
+		op.params[0].tmpref.size = chunk;
+		op.params[1].tmpref.buffer = pt + pt_len;
+		op.params[1].tmpref.size = payload_len - pt_len;
+
+		res = TEEC_InvokeCommand(sess,
+					 TA_ACIPHER_CMD_ENVELOPE_OPEN_UPDATE,
+					 &op, &eo);
+		if (res)
+			teec_err(res, eo,
+				 "TEEC_InvokeCommand(TA_ACIPHER_CMD_ENVELOPE_OPEN_UPDATE)");
+		pt_len += op.params[1].tmpref.size;
+	}
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_MEMREF_TEMP_INPUT, TEEC_NONE);
+	op.params[0].tmpref.buffer = ct + pos;
+	op.params[0].tmpref.size = 0;
+	op.params[1].tmpref.buffer = pt + pt_len;
+	op.params[1].tmpref.size = payload_len - pt_len;
+	op.params[2].tmpref.buffer = ct + hdr.payload_len;
+	op.params[2].tmpref.size = TA_ACIPHER_ENVELOPE_TAG_SIZE;
+
+	res = TEEC_InvokeCommand(sess, TA_ACIPHER_CMD_ENVELOPE_OPEN_FINAL, &op,
+				 &eo);
+	if (res)
+		teec_err(res, eo,
+			 "TEEC_InvokeCommand(TA_ACIPHER_CMD_ENVELOPE_OPEN_FINAL)");
+	pt_len += op.params[1].tmpref.size;
+
+	if (pt_len != payload_len || memcmp(pt, payload, payload_len))
+		errx(1, "Opened envelope does not match");
+	printf("Opened envelope in %zu byte chunks\n",
+	       (size_t)ENVELOPE_CHUNK_SIZE);
+
+	free(pt);
+	free(env);
+	free(payload);
+}
+
+/*
+ * Export the public key and use it in the normal world: encrypt locally
+ * and decrypt in the TA, sign in the TA and verify locally.
+ */
+static void pubkey_demo(TEEC_Session *sess, size_t key_size, void *inbuf,
+			size_t inbuf_len)
+{
+	struct acipher_pubkey key;
+	TEEC_Result res;
+	TEEC_Operation op;
+	uint32_t eo;
+	char pem[2 * ACIPHER_PUBKEY_MAX_DER];
+	uint8_t ct[ACIPHER_PUBKEY_MAX_BITS / 8];
+	size_t ct_len = sizeof(ct);
+	uint8_t digest[DIGEST_SIZE] = { 0 };
+	uint8_t sig[ACIPHER_PUBKEY_MAX_BITS / 8];
+
+	gen_key(sess, TA_ACIPHER_KEY_RSA, key_size);
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_NONE, TEEC_NONE);
+	op.params[0].value.a = TA_ACIPHER_PUBKEY_PEM;
+	op.params[1].tmpref.buffer = pem;
+	op.params[1].tmpref.size = sizeof(pem);
+
+	res = TEEC_InvokeCommand(sess, TA_ACIPHER_CMD_EXPORT_PUBKEY, &op, &eo);
+	if (res)
+		teec_err(res, eo,
+			 "TEEC_InvokeCommand(TA_ACIPHER_CMD_EXPORT_PUBKEY)");
+	printf("%.*s", (int)op.params[1].tmpref.size, pem);
+
+	res = acipher_pubkey_get(sess, &key);
+	if (res)
+		errx(1, "acipher_pubkey_get: %#" PRIx32, res);
+
+	res = acipher_pubkey_encrypt(&key, inbuf, inbuf_len, ct, &ct_len);
+	if (res)
+		errx(1, "acipher_pubkey_encrypt: %#" PRIx32, res);
+	decrypt(sess, ct, ct_len, inbuf, inbuf_len);
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_VALUE_INPUT, TEEC_NONE);
+	op.params[0].tmpref.buffer = digest;
+	op.params[0].tmpref.size = sizeof(digest);
+	op.params[1].tmpref.buffer = sig;
+	op.params[1].tmpref.size = sizeof(sig);
+	op.params[2].value.a = TA_ACIPHER_ALG_RSASSA_PKCS1_V1_5_SHA256;
+
+	res = TEEC_InvokeCommand(sess, TA_ACIPHER_CMD_SIGN, &op, &eo);
+	if (res)
+		teec_err(res, eo, "TEEC_InvokeCommand(TA_ACIPHER_CMD_SIGN)");
+
+	res = acipher_pubkey_verify(&key, digest, sig,
+				    op.params[1].tmpref.size);
+	printf("Signature verified locally: %s\n",
+	       res == TEEC_SUCCESS ? "valid" : "invalid");
+}
+
+static TEEC_Result derive_secret(TEEC_Session *sess, uint8_t *pub,
+				 size_t pub_len)
+{
+	TEEC_Operation op;
+	uint8_t secret[32];
+	uint32_t eo;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_NONE, TEEC_NONE);
+	op.params[0].tmpref.buffer = pub;
+	op.params[0].tmpref.size = pub_len;
+	op.params[1].tmpref.buffer = secret;
+	op.params[1].tmpref.size = sizeof(secret);
+
+	return TEEC_InvokeCommand(sess, TA_ACIPHER_CMD_DERIVE, &op, &eo);
+}
+
+/*
+ * ECDH P-256 with the public key of the session key as peer key, then with
+ * peer keys that are not points of the curve, which the TA must reject.
+ */
+static void derive_demo(TEEC_Session *sess)
+{
+	TEEC_Result res;
+	TEEC_Operation op;
+	uint32_t eo;
+	uint8_t der[ACIPHER_PUBKEY_MAX_DER];
+	uint8_t pub[64];
+
+	gen_key(sess, TA_ACIPHER_KEY_ECDH_P256, 0);
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_NONE, TEEC_NONE);
+	op.params[0].value.a = TA_ACIPHER_PUBKEY_DER;
+	op.params[1].tmpref.buffer = der;
+	op.params[1].tmpref.size = sizeof(der);
+
+	res = TEEC_InvokeCommand(sess, TA_ACIPHER_CMD_EXPORT_PUBKEY, &op, &eo);
+	if (res)
+		teec_err(res, eo,
+			 "TEEC_InvokeCommand(TA_ACIPHER_CMD_EXPORT_PUBKEY)");
+	/* X || Y ends the SubjectPublicKeyInfo */
+	memcpy(pub, der + op.params[1].tmpref.size - sizeof(pub), sizeof(pub));
+
+	res = derive_secret(sess, pub, sizeof(pub));
+	if (res)
+		errx(1, "TA_ACIPHER_CMD_DERIVE: %#" PRIx32, res);
+	printf("Derived a shared secret\n");
+
+	pub[sizeof(pub) - 1] ^= 1;
+	res = derive_secret(sess, pub, sizeof(pub));
+	printf("Point off the curve: %s\n",
+	       res == TEEC_ERROR_BAD_PARAMETERS ? "rejected" : "NOT rejected");
+
+	memset(pub, 0, sizeof(pub));
+	res = derive_secret(sess, pub, sizeof(pub));
+	printf("Point at infinity: %s\n",
+	       res == TEEC_ERROR_BAD_PARAMETERS ? "rejected" : "NOT rejected");
+
+	/* The TA instance survived the invalid points */
+	res = derive_secret(sess,
+			    der + op.params[1].tmpref.size - sizeof(pub),
+			    sizeof(pub));
+	if (res)
+		errx(1, "TA_ACIPHER_CMD_DERIVE: %#" PRIx32, res);
+}
+
+/*
+ * Import DER private keys into secure storage, each under the name of its
+ * file, TA_ACIPHER_MAX_BATCH keys per invoke. P-256 keys are imported with
+ * the given type, TA_ACIPHER_KEY_ECDSA_P256 or TA_ACIPHER_KEY_ECDH_P256.
+ */
+static void import_keys(TEEC_Session *sess, uint32_t p256_type, int count,
+			char *names[])
+{
+	TEEC_Result res;
+	TEEC_Operation op;
+	uint32_t eo;
+	struct acipher_key_import hdr;
+	uint32_t results[TA_ACIPHER_MAX_BATCH];
+	uint8_t *buf = NULL;
+	size_t buf_len;
+	size_t der_len;
+	void *der;
+	int first;
+	int n;
+
+	for (first = 0; first < count; first += TA_ACIPHER_MAX_BATCH) {
+		buf_len = 0;
+		for (n = first; n < count && n < first + TA_ACIPHER_MAX_BATCH;
+		     n++) {
+			der = read_file(names[n], &der_len);
+			hdr.key_type = p256_type;
+			hdr.id_len = strlen(names[n]);
+			hdr.der_len = der_len;
+
+			buf = realloc(buf, buf_len +
+				      TA_ACIPHER_KEY_IMPORT_SIZE(hdr.id_len,
+								 der_len));
+			if (!buf)
+				err(1, "Cannot allocate import buffer");
+			memcpy(buf + buf_len, &hdr, sizeof(hdr));
+			buf_len += sizeof(hdr);
+			memcpy(buf + buf_len, names[n], hdr.id_len);
+			buf_len += hdr.id_len;
+			memcpy(buf + buf_len, der, der_len);
+			buf_len += der_len;
+			free(der);
+		}
+
+		memset(&op, 0, sizeof(op));
+		op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+						 TEEC_MEMREF_TEMP_OUTPUT,
+						 TEEC_VALUE_INPUT, TEEC_NONE);
+		op.params[0].tmpref.buffer = buf;
+		op.params[0].tmpref.size = buf_len;
+		op.params[1].tmpref.buffer = results;
+		op.params[1].tmpref.size = sizeof(results);
+		op.params[2].value.a = TA_ACIPHER_IMPORT_PERSIST;
+
+		res = TEEC_InvokeCommand(sess, TA_ACIPHER_CMD_KEY_IMPORT, &op,
+					 &eo);
+		if (res)
+			teec_err(res, eo,
+				 "TEEC_InvokeCommand(TA_ACIPHER_CMD_KEY_IMPORT)");
+
+		for (n = first; n < count && n < first + TA_ACIPHER_MAX_BATCH;
+		     n++) {
+			if (results[n - first])
+				printf("%s: error %#" PRIx32 "\n", names[n],
+				       results[n - first]);
+			else
+				printf("Imported key \"%s\"\n", names[n]);
+		}
+	}
+
+	free(buf);
+}
+
+int main(int argc, char *argv[])
+{
+	TEEC_Result res;
+	uint32_t eo;
+	TEEC_Context ctx;
+	TEEC_Session sess;
+	size_t key_size = 0;
+	void *inbuf = NULL;
+	size_t inbuf_len = 0;
+	void *outbuf;
+	size_t outbuf_len;
+	size_t n = 0;
+	const TEEC_UUID uuid = TA_ACIPHER_UUID;
+	bool pool = argc > 1 && !strcmp(argv[1], "pool");
+	bool sign = argc > 1 && !strcmp(argv[1], "sign");
+	bool env = argc > 1 && !strcmp(argv[1], "envelope");
+	bool store = argc > 1 && !strcmp(argv[1], "store");
+	bool load = argc > 1 && !strcmp(argv[1], "load");
+	bool pubkey = argc > 1 && !strcmp(argv[1], "pubkey");
+	bool import = argc > 1 && !strcmp(argv[1], "import");
+	bool derive = argc > 1 && !strcmp(argv[1], "derive");
+	uint32_t p256_type = TA_ACIPHER_KEY_ECDSA_P256;
+
+	if (argc > 1 && !strcmp(argv[1], "bench"))
+		return acipher_bench(argc - 1, argv + 1);
+
+	if (import) {
+		if (argc < 4)
+			usage(argc, argv);
+		if (!strcmp(argv[2], "ecdh"))
+			p256_type = TA_ACIPHER_KEY_ECDH_P256;
+		else if (strcmp(argv[2], "ecdsa"))
+			usage(argc, argv);
+	} else if (pubkey) {
+		if (argc != 4)
+			usage(argc, argv);
+		key_size = get_size_arg(argc, argv, "key_size", 2);
+		inbuf = argv[3];
+		inbuf_len = strlen(argv[3]);
+	} else if (store || load) {
+		if (argc != 4)
+			usage(argc, argv);
+		if (store) {
+			key_size = get_size_arg(argc, argv, "key_size", 2);
+		} else {
+			inbuf = argv[3];
+			inbuf_len = strlen(argv[3]);
+		}
+	} else if (derive) {
+		if (argc != 2)
+			usage(argc, argv);
+	} else if (sign) {
+		if (argc != 3)
+			usage(argc, argv);
+	} else if (env) {
+		if (argc != 4)
+			usage(argc, argv);
+		key_size = get_size_arg(argc, argv, "key_size", 2);
+	} else if (pool) {
+		if (argc != 4)
+			usage(argc, argv);
+		key_size = get_size_arg(argc, argv, "key_size", 2);
+		n = get_size_arg(argc, argv, "depth", 3);
+	} else {
+		get_args(argc, argv, &key_size, &inbuf, &inbuf_len);
+	}
+
+	res = TEEC_InitializeContext(NULL, &ctx);
+	if (res)
+		errx(1, "TEEC_InitializeContext(NULL, x): %#" PRIx32, res);
+
+	res = TEEC_OpenSession(&ctx, &sess, &uuid, TEEC_LOGIN_PUBLIC, NULL,
+			       NULL, &eo);
+	if (res)
+		teec_err(res, eo, "TEEC_OpenSession(TEEC_LOGIN_PUBLIC)");
+
+	if (pool) {
+		pool_refill(&sess, key_size, n);
+		return 0;
+	}
+
+	if (sign) {
+		sign_demo(&sess, argv[2]);
+		return 0;
+	}
+
+	if (env) {
+		envelope(&sess, key_size, argv[3]);
+		return 0;
+	}
+
+	if (import) {
+		import_keys(&sess, p256_type, argc - 3, argv + 3);
+		return 0;
+	}
+
+	if (derive) {
+		derive_demo(&sess);
+		return 0;
+	}
+
+	if (pubkey) {
+		pubkey_demo(&sess, key_size, inbuf, inbuf_len);
+		return 0;
+	}
+
+	if (store) {
+		gen_key(&sess, TA_ACIPHER_KEY_RSA, key_size);
+		key_cmd(&sess, TA_ACIPHER_CMD_KEY_STORE, argv[3]);
+		printf("Stored key \"%s\"\n", argv[3]);
+		return 0;
+	}
+
+	if (load)
+		key_cmd(&sess, TA_ACIPHER_CMD_KEY_LOAD, argv[2]);
+	else
+		gen_key(&sess, TA_ACIPHER_KEY_RSA, key_size);
+
+	/* The ciphertext size comes from the key info, one invoke is enough */
+	res = acipher_encrypt(&sess, NULL, inbuf, inbuf_len, &outbuf,
+			      &outbuf_len);
+	if (res)
+		errx(1, "acipher_encrypt: %#" PRIx32, res);
 
 	printf("Encrypted buffer: ");
-	for (n = 0; n < op.params[1].tmpref.size; n++)
-		printf("%02x ", ((uint8_t *)op.params[1].tmpref.buffer)[n]);
+	for (n = 0; n < outbuf_len; n++)
+		printf("%02x ", ((uint8_t *)outbuf)[n]);
 	printf("\n");
+
+	decrypt(&sess, outbuf, outbuf_len, inbuf, inbuf_len);
+	sign_verify(&sess, TA_ACIPHER_ALG_RSASSA_PSS_SHA256, outbuf_len);
+	free(outbuf);
+
+	acipher_key_info_flush(&sess);
+	TEEC_CloseSession(&sess);
+	TEEC_FinalizeContext(&ctx);
 	return 0;
 }
@@ -0,0 +1,411 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2018, Linaro Limited
+ */
+
+/*
+ * Normal world public key operations, so that encryption and signature
+ * verification do not need to switch to the secure world. The RSA public
+ * operation is a plain Montgomery exponentiation: the public exponent is
+ * small and the data public, there is no need for constant time code.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+/* OP-TEE TEE client API (built by optee_client) */
+#include <tee_client_api.h>
+
+/* For the commands and key types (found in the TA's h-file(s)) */
+#include <acipher_ta.h>
+
+#include "pubkey.h"
+
+#define DER_SEQUENCE	0x30
+#define DER_INTEGER	0x02
+#define DER_BIT_STRING	0x03
+
+/* Contents of the AlgorithmIdentifier of each key type */
+static const uint8_t der_alg_rsa[] = {
+	0x06, 0x09, 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x01, 0x01,
+	0x05, 0x00
+};
+static const uint8_t der_alg_p256[] = {
+	0x06, 0x07, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x02, 0x01,
+	0x06, 0x08, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x03, 0x01, 0x07
+};
+static const uint8_t der_alg_ed25519[] = { 0x06, 0x03, 0x2b, 0x65, 0x70 };
+static const uint8_t der_alg_x25519[] = { 0x06, 0x03, 0x2b, 0x65, 0x6e };
+
+/* DER encoded DigestInfo of a SHA-256 digest, less the digest itself */
+static const uint8_t sha256_digest_info[] = {
+	0x30, 0x31, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01, 0x65,
+	0x03, 0x04, 0x02, 0x01, 0x05, 0x00, 0x04, 0x20
+};
+
+#define SHA256_SIZE		32
+/* Minimum size of the PKCS#1 v1.5 padding */
+#define PKCS1_PAD_MIN		11
+/* 512-bit keys, room enough for a padded SHA-256 DigestInfo */
+#define RSA_MIN_MOD_LEN		64
+
+struct der {
+	const uint8_t *p;
+	size_t len;
+};
+
+/* Take the TLV of type @tag at the start of @d, @val gets its value */
+static bool der_get(struct der *d, uint8_t tag, struct der *val)
+{
+	size_t hdr_len = 2;
+	size_t len;
+	size_t n;
+
+	if (d->len < 2 || d->p[0] != tag)
+		return false;
+
+	len = d->p[1];
+	if (len & 0x80) {
+		n = len & 0x7f;
+		if (!n || n > 2 || d->len < 2 + n)
+			return false;
+		len = 0;
+		for (; hdr_len < 2 + n; hdr_len++)
+			len = (len << 8) | d->p[hdr_len];
+	}
+	if (d->len - hdr_len < len)
+		return false;
+
+	val->p = d->p + hdr_len;
+	val->len = len;
+	d->p += hdr_len + len;
+	d->len -= hdr_len + len;
+	return true;
+}
+
+static bool der_is(const struct der *d, const uint8_t *v, size_t len)
+{
+	return d->len == len && !memcmp(d->p, v, len);
+}
+
+/* Big numbers, as arrays of 32-bit limbs, least significant first */
+
+static void bn_from_bytes(uint32_t *a, size_t limbs, const uint8_t *b,
+			  size_t len)
+{
+	size_t n;
+
+	memset(a, 0, limbs * sizeof(*a));
+	for (n = 0; n < len; n++)
+		a[n / 4] |= (uint32_t)b[len - 1 - n] << (8 * (n % 4));
+}
+
+static void bn_to_bytes(uint8_t *b, size_t len, const uint32_t *a)
+{
+	size_t n;
+
+	for (n = 0; n < len; n++)
+		b[len - 1 - n] = a[n / 4] >> (8 * (n % 4));
+}
+
+static int bn_cmp(const uint32_t *a, const uint32_t *b, size_t limbs)
+{
+	while (limbs--) {
+		if (a[limbs] != b[limbs])
+			return a[limbs] > b[limbs] ? 1 : -1;
+	}
+	return 0;
+}
+
+static void bn_sub(uint32_t *a, const uint32_t *b, size_t limbs)
+{
+	uint64_t borrow = 0;
+	uint64_t d;
+	size_t n;
+
+	for (n = 0; n < limbs; n++) {
+		d = (uint64_t)a[n] - b[n] - borrow;
+		a[n] = d;
+		borrow = (d >> 32) & 1;
+	}
+}
+
+/* r = a * b / R mod n, with R = 2^(32 * limbs) */
+static void mont_mul(uint32_t *r, const uint32_t *a, const uint32_t *b,
+		     const struct acipher_pubkey *key)
+{
+	uint32_t t[ACIPHER_PUBKEY_MAX_LIMBS + 2] = { 0 };
+	size_t k = key->limbs;
+	uint64_t c;
+	uint32_t m;
+	size_t i;
+	size_t j;
+
+	for (i = 0; i < k; i++) {
+		c = 0;
+		for (j = 0; j < k; j++) {
+			c += (uint64_t)a[j] * b[i] + t[j];
+			t[j] = c;
+			c >>= 32;
+		}
+		c += t[k];
+		t[k] = c;
+		t[k + 1] = c >> 32;
+
+		m = t[0] * key->n0inv;
+		c = ((uint64_t)m * key->n[0] + t[0]) >> 32;
+		for (j = 1; j < k; j++) {
+			c += (uint64_t)m * key->n[j] + t[j];
+			t[j - 1] = c;
+			c >>= 32;
+		}
+		c += t[k];
+		t[k - 1] = c;
+		t[k] = t[k + 1] + (c >> 32);
+	}
+
+	if (t[k] || bn_cmp(t, key->n, k) >= 0)
+		bn_sub(t, key->n, k);
+	memcpy(r, t, k * sizeof(*r));
+}
+
+/* out = in^e mod n, both key->mod_len bytes long, in < n */
+static void rsa_public(const struct acipher_pubkey *key, const uint8_t *in,
+		       uint8_t *out)
+{
+	uint32_t x[ACIPHER_PUBKEY_MAX_LIMBS];
+	uint32_t acc[ACIPHER_PUBKEY_MAX_LIMBS];
+	int bit = 63;
+
+	bn_from_bytes(x, key->limbs, in, key->mod_len);
+	mont_mul(x, x, key->rr, key);
+	memcpy(acc, x, key->limbs * sizeof(*x));
+
+	while (!((key->e >> bit) & 1))
+		bit--;
+	while (bit--) {
+		mont_mul(acc, acc, acc, key);
+		if ((key->e >> bit) & 1)
+			mont_mul(acc, acc, x, key);
+	}
+
+	/* Out of the Montgomery domain */
+	memset(x, 0, key->limbs * sizeof(*x));
+	x[0] = 1;
+	mont_mul(acc, acc, x, key);
+	bn_to_bytes(out, key->mod_len, acc);
+}
+
+static bool rsa_input_ok(const struct acipher_pubkey *key, const uint8_t *in)
+{
+	uint32_t x[ACIPHER_PUBKEY_MAX_LIMBS];
+
+	bn_from_bytes(x, key->limbs, in, key->mod_len);
+	return bn_cmp(x, key->n, key->limbs) < 0;
+}
+
+static TEEC_Result rsa_setup(struct acipher_pubkey *key, struct der *n,
+			     struct der *e)
+{
+	uint32_t inv;
+	size_t i;
+
+	/* Strip the sign byte */
+	while (n->len && !*n->p) {
+		n->p++;
+		n->len--;
+	}
+	while (e->len && !*e->p) {
+		e->p++;
+		e->len--;
+	}
+	if (n->len < RSA_MIN_MOD_LEN ||
+	    n->len > ACIPHER_PUBKEY_MAX_BITS / 8 ||
+	    !(n->p[n->len - 1] & 1) || !e->len || e->len > sizeof(key->e))
+		return TEEC_ERROR_NOT_SUPPORTED;
+
+	key->mod_len = n->len;
+	key->limbs = (n->len + 3) / 4;
+	bn_from_bytes(key->n, key->limbs, n->p, n->len);
+	key->e = 0;
+	for (i = 0; i < e->len; i++)
+		key->e = (key->e << 8) | e->p[i];
+
+	/* Newton iteration, each step doubles the number of correct bits */
+	inv = key->n[0];
+	for (i = 0; i < 4; i++)
+		inv *= 2 - key->n[0] * inv;
+	key->n0inv = -inv;
+
+	/* R^2 mod n by doubling 1, 2 * 32 * limbs times */
+	memset(key->rr, 0, sizeof(key->rr));
+	key->rr[0] = 1;
+	for (i = 0; i < 64 * key->limbs; i++) {
+		uint32_t carry = key->rr[key->limbs - 1] >> 31;
+		size_t j;
+
+		for (j = key->limbs - 1; j; j--)
+			key->rr[j] = (key->rr[j] << 1) |
+				     (key->rr[j - 1] >> 31);
+		key->rr[0] <<= 1;
+		if (carry || bn_cmp(key->rr, key->n, key->limbs) >= 0)
+			bn_sub(key->rr, key->n, key->limbs);
+	}
+
+	return TEEC_SUCCESS;
+}
+
+TEEC_Result acipher_pubkey_parse(const uint8_t *der, size_t der_len,
+				 struct acipher_pubkey *key)
+{
+	struct der d = { .p = der, .len = der_len };
+	struct der spki;
+	struct der alg;
+	struct der bits;
+	struct der rsa;
+	struct der n;
+	struct der e;
+
+	if (!der_get(&d, DER_SEQUENCE, &spki) ||
+	    !der_get(&spki, DER_SEQUENCE, &alg) ||
+	    !der_get(&spki, DER_BIT_STRING, &bits) ||
+	    !bits.len || *bits.p)
+		return TEEC_ERROR_BAD_FORMAT;
+	/* No unused bits */
+	bits.p++;
+	bits.len--;
+
+	memset(key, 0, sizeof(*key));
+
+	if (der_is(&alg, der_alg_rsa, sizeof(der_alg_rsa))) {
+		key->key_type = TA_ACIPHER_KEY_RSA;
+		if (!der_get(&bits, DER_SEQUENCE, &rsa) ||
+		    !der_get(&rsa, DER_INTEGER, &n) ||
+		    !der_get(&rsa, DER_INTEGER, &e))
+			return TEEC_ERROR_BAD_FORMAT;
+		return rsa_setup(key, &n, &e);
+	}
+
+	/*
+	 * P-256 cannot tell ECDSA from ECDH keys, both are reported as
+	 * ECDSA keys.
+	 */
+	if (der_is(&alg, der_alg_p256, sizeof(der_alg_p256)))
+		key->key_type = TA_ACIPHER_KEY_ECDSA_P256;
+	else if (der_is(&alg, der_alg_ed25519, sizeof(der_alg_ed25519)))
+		key->key_type = TA_ACIPHER_KEY_ED25519;
+	else if (der_is(&alg, der_alg_x25519, sizeof(der_alg_x25519)))
+		key->key_type = TA_ACIPHER_KEY_X25519;
+	else
+		return TEEC_ERROR_NOT_SUPPORTED;
+
+	key->mod_len = 32;
+	return TEEC_SUCCESS;
+}
+
+TEEC_Result acipher_pubkey_get(TEEC_Session *sess, struct acipher_pubkey *key)
+{
+	uint8_t der[ACIPHER_PUBKEY_MAX_DER];
+	TEEC_Operation op;
+	TEEC_Result res;
+	uint32_t eo;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_NONE, TEEC_NONE);
+	op.params[0].value.a = TA_ACIPHER_PUBKEY_DER;
+	op.params[1].tmpref.buffer = der;
+	op.params[1].tmpref.size = sizeof(der);
+
+	res = TEEC_InvokeCommand(sess, TA_ACIPHER_CMD_EXPORT_PUBKEY, &op, &eo);
+	if (res)
+		return res;
+
+	return acipher_pubkey_parse(der, op.params[1].tmpref.size, key);
+}
+
+/* Nonzero random bytes, for the encryption padding */
+static TEEC_Result get_pad(uint8_t *buf, size_t len)
+{
+	TEEC_Result res = TEEC_SUCCESS;
+	FILE *f;
+	size_t n;
+
+	f = fopen("/dev/urandom", "rb");
+	if (!f)
+		return TEEC_ERROR_GENERIC;
+
+	if (fread(buf, 1, len, f) != len)
+		res = TEEC_ERROR_GENERIC;
+	for (n = 0; !res && n < len; n++)
+		while (!buf[n] && !res)
+			if (fread(buf + n, 1, 1, f) != 1)
+				res = TEEC_ERROR_GENERIC;
+
+	fclose(f);
+	return res;
+}
+
+TEEC_Result acipher_pubkey_encrypt(const struct acipher_pubkey *key,
+				   const void *in, size_t in_len,
+				   void *out, size_t *out_len)
+{
+	uint8_t em[ACIPHER_PUBKEY_MAX_BITS / 8];
+	size_t pad_len;
+	TEEC_Result res;
+
+	if (key->key_type != TA_ACIPHER_KEY_RSA)
+		return TEEC_ERROR_NOT_SUPPORTED;
+	if (in_len > key->mod_len - PKCS1_PAD_MIN)
+		return TEEC_ERROR_BAD_PARAMETERS;
+	if (*out_len < key->mod_len) {
+		*out_len = key->mod_len;
+		return TEEC_ERROR_SHORT_BUFFER;
+	}
+
+	/* EM = 0x00 || 0x02 || nonzero random || 0x00 || M */
+	pad_len = key->mod_len - in_len - 3;
+	em[0] = 0;
+	em[1] = 2;
+	res = get_pad(em + 2, pad_len);
+	if (res)
+		return res;
+	em[2 + pad_len] = 0;
+	memcpy(em + 3 + pad_len, in, in_len);
+
+	rsa_public(key, em, out);
+	*out_len = key->mod_len;
+	return TEEC_SUCCESS;
+}
+
+TEEC_Result acipher_pubkey_verify(const struct acipher_pubkey *key,
+				  const uint8_t digest[32],
+				  const void *sig, size_t sig_len)
+{
+	uint8_t em[ACIPHER_PUBKEY_MAX_BITS / 8];
+	size_t pad_len;
+	uint8_t *p = em;
+
+	if (key->key_type != TA_ACIPHER_KEY_RSA)
+		return TEEC_ERROR_NOT_SUPPORTED;
+	if (sig_len != key->mod_len || !rsa_input_ok(key, sig))
+		return TEEC_ERROR_SIGNATURE_INVALID;
+
+	rsa_public(key, sig, em);
+
+	/* EM = 0x00 || 0x01 || 0xff... || 0x00 || DigestInfo || digest */
+	pad_len = key->mod_len - sizeof(sha256_digest_info) - SHA256_SIZE - 3;
+	if (*p++ != 0 || *p++ != 1)
+		return TEEC_ERROR_SIGNATURE_INVALID;
+	for (; p < em + 2 + pad_len; p++)
+		if (*p != 0xff)
+			return TEEC_ERROR_SIGNATURE_INVALID;
+	if (*p++ != 0 ||
+	    memcmp(p, sha256_digest_info, sizeof(sha256_digest_info)) ||
+	    memcmp(p + sizeof(sha256_digest_info), digest, SHA256_SIZE))
+		return TEEC_ERROR_SIGNATURE_INVALID;
+
+	return TEEC_SUCCESS;
+}
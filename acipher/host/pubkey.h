@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (c) 2018, Linaro Limited
+ */
+
+#ifndef __ACIPHER_PUBKEY_H__
+#define __ACIPHER_PUBKEY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <tee_client_api.h>
+
+/*
+ * Public key operations done in the normal world with the public key
+ * exported by TA_ACIPHER_CMD_EXPORT_PUBKEY. Only RSA keys are supported:
+ * encryption with PKCS#1 v1.5 padding and verification of PKCS#1 v1.5
+ * signatures of SHA-256 digests. Other keys are parsed but their
+ * operations remain with the TA.
+ */
+
+#define ACIPHER_PUBKEY_MAX_BITS		4096
+#define ACIPHER_PUBKEY_MAX_LIMBS	(ACIPHER_PUBKEY_MAX_BITS / 32)
+/* Largest SubjectPublicKeyInfo exported by the TA */
+#define ACIPHER_PUBKEY_MAX_DER		(ACIPHER_PUBKEY_MAX_BITS / 8 + 64)
+
+#ifndef TEEC_ERROR_SIGNATURE_INVALID
+#define TEEC_ERROR_SIGNATURE_INVALID	0xFFFF3072
+#endif
+
+struct acipher_pubkey {
+	uint32_t key_type;	/* TA_ACIPHER_KEY_xxx */
+	size_t mod_len;		/* Modulus or curve size in bytes */
+	/* RSA, in Montgomery friendly form */
+	uint32_t n[ACIPHER_PUBKEY_MAX_LIMBS];
+	uint32_t rr[ACIPHER_PUBKEY_MAX_LIMBS];	/* R^2 mod n */
+	uint32_t n0inv;				/* -n^-1 mod 2^32 */
+	size_t limbs;
+	uint64_t e;
+};
+
+/* Export the public key of the session key and parse it */
+TEEC_Result acipher_pubkey_get(TEEC_Session *sess, struct acipher_pubkey *key);
+
+/* Parse a DER SubjectPublicKeyInfo */
+TEEC_Result acipher_pubkey_parse(const uint8_t *der, size_t der_len,
+				 struct acipher_pubkey *key);
+
+/*
+ * RSAES-PKCS1-v1_5 encryption, the output is key->mod_len bytes long and
+ * can be decrypted by TA_ACIPHER_CMD_DECRYPT.
+ */
+TEEC_Result acipher_pubkey_encrypt(const struct acipher_pubkey *key,
+				   const void *in, size_t in_len,
+				   void *out, size_t *out_len);
+
+/*
+ * Verify a TA_ACIPHER_ALG_RSASSA_PKCS1_V1_5_SHA256 signature, returns
+ * TEEC_ERROR_SIGNATURE_INVALID if it does not match.
+ */
+TEEC_Result acipher_pubkey_verify(const struct acipher_pubkey *key,
+				  const uint8_t digest[32],
+				  const void *sig, size_t sig_len);
+
+#endif /* __ACIPHER_PUBKEY_H__ */
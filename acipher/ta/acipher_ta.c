@@ -4,107 +4,2418 @@
  */
 
 #include <inttypes.h>
+#ifdef CFG_WITH_STATS
+#include <malloc.h>
+#endif
 
 #include <tee_internal_api.h>
 
 #include <acipher_ta.h>
+#include <user_ta_header_defines.h>
+
+#define SHA256_SIZE	32
+
+/* Size of the AES keys of envelopes */
+#define ENV_KEY_SIZE	256
+
+/* Maximum number of operations cached for a session, see get_op() */
+#define MAX_OPS		6
+
+struct keyed_op {
+	uint32_t alg;
+	uint32_t mode;
+	TEE_OperationHandle op;
+};
+
+struct key_id {
+	uint8_t id[TEE_OBJECT_ID_MAX_LEN];
+	uint32_t len;
+};
+
+struct acipher_key {
+	struct key_id id;	/* Empty for the session key */
+	TEE_ObjectHandle handle;
+	uint32_t type;		/* TEE_TYPE_xxx_KEYPAIR */
+	uint32_t size;		/* In bits */
+	/* Operations keyed with @handle, reused until the key changes */
+	struct keyed_op ops[MAX_OPS];
+	size_t next_evicted_op;
+	uint32_t last_use;	/* For the eviction of named keys */
+};
+
+/*
+ * Named keys, selected by the key ID in params[3] of a command, of all
+ * sessions together. A named key takes an entry of the table of its session
+ * in the TA heap, its transient object and operations being held by the
+ * core. Half of TA_NAMED_KEYS_SIZE is left for a table to be reallocated
+ * while it grows.
+ */
+#define MAX_NAMED_KEYS	(TA_NAMED_KEYS_SIZE / \
+			 (2 * sizeof(struct acipher_key)))
+
+/* Entries of the named key tables of all sessions */
+static size_t named_key_total;
 
 struct acipher {
+	/* Key of the current command, the session key or a named key */
+	struct acipher_key *key;
+	struct acipher_key session_key;
+	struct acipher_key *named_keys;
+	size_t named_key_count;
+	uint32_t use_count;
+	/* Envelope encryption, set up on first use by env_alloc() */
+	TEE_ObjectHandle env_key;
+	TEE_OperationHandle env_seal_op;
+	TEE_OperationHandle env_open_op;
+	bool env_opening;
+};
+
+/*
+ * Pools of pre-generated keys, shared by all sessions: key generation
+ * takes from hundreds of milliseconds to seconds, TA_ACIPHER_CMD_POOL_REFILL
+ * allows to do it ahead of TA_ACIPHER_CMD_GEN_KEY.
+ */
+struct key_pool {
+	TEE_ObjectHandle keys[TA_ACIPHER_POOL_MAX_DEPTH];
+	struct acipher_pool_stats stats;
+};
+
+static struct key_pool pools[TA_ACIPHER_POOL_MAX_SIZES];
+
+/* RSA key sizes accepted for the pools, in bits */
+#define POOL_MIN_KEY_SIZE	256
+#define POOL_MAX_KEY_SIZE	4096
+
+/*
+ * Keys loaded from secure storage, shared by all sessions: the persistent
+ * object is read once, sessions then get their own copy of the key.
+ */
+#define KEY_CACHE_SIZE	8
+
+struct cached_key {
+	struct key_id id;
 	TEE_ObjectHandle key;
 };
 
+static struct cached_key key_cache[KEY_CACHE_SIZE];
+static size_t next_evicted_key;
+
+static struct key_pool *find_pool(uint32_t key_size, bool alloc)
+{
+	size_t n;
+
+	for (n = 0; n < TA_ACIPHER_POOL_MAX_SIZES; n++)
+		if (pools[n].stats.key_size == key_size)
+			return &pools[n];
+
+	if (!alloc)
+		return NULL;
+
+	for (n = 0; n < TA_ACIPHER_POOL_MAX_SIZES; n++) {
+		if (!pools[n].stats.key_size) {
+			pools[n].stats.key_size = key_size;
+			return &pools[n];
+		}
+	}
+
+	return NULL;
+}
+
+static TEE_Result ta2tee_key_type(uint32_t param, uint32_t *key_type,
+				  uint32_t *key_size)
+{
+	switch (param) {
+	case TA_ACIPHER_KEY_RSA:
+		*key_type = TEE_TYPE_RSA_KEYPAIR;
+		return TEE_SUCCESS;
+	case TA_ACIPHER_KEY_ECDSA_P256:
+		*key_type = TEE_TYPE_ECDSA_KEYPAIR;
+		break;
+	case TA_ACIPHER_KEY_ECDH_P256:
+		*key_type = TEE_TYPE_ECDH_KEYPAIR;
+		break;
+	case TA_ACIPHER_KEY_ED25519:
+		*key_type = TEE_TYPE_ED25519_KEYPAIR;
+		break;
+	case TA_ACIPHER_KEY_X25519:
+		*key_type = TEE_TYPE_X25519_KEYPAIR;
+		break;
+	default:
+		EMSG("Invalid key type %#" PRIx32, param);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	/* All the supported curves have 256-bit keys */
+	*key_size = 256;
+	return TEE_SUCCESS;
+}
+
+/* Type of the key pair an algorithm operates with */
+static uint32_t alg_key_type(uint32_t alg)
+{
+	switch (alg) {
+	case TEE_ALG_ECDSA_P256:
+		return TEE_TYPE_ECDSA_KEYPAIR;
+	case TEE_ALG_ECDH_P256:
+		return TEE_TYPE_ECDH_KEYPAIR;
+	case TEE_ALG_ED25519:
+		return TEE_TYPE_ED25519_KEYPAIR;
+	case TEE_ALG_X25519:
+		return TEE_TYPE_X25519_KEYPAIR;
+	default:
+		return TEE_TYPE_RSA_KEYPAIR;
+	}
+}
+
+static TEE_Result generate_key(uint32_t key_type, uint32_t key_size,
+			       TEE_ObjectHandle *key)
+{
+	TEE_Result res;
+	TEE_Attribute curve;
+	uint32_t attr_count = 0;
+
+	if (key_type == TEE_TYPE_ECDSA_KEYPAIR ||
+	    key_type == TEE_TYPE_ECDH_KEYPAIR) {
+		TEE_InitValueAttribute(&curve, TEE_ATTR_ECC_CURVE,
+				       TEE_ECC_CURVE_NIST_P256, 0);
+		attr_count = 1;
+	}
+
+	res = TEE_AllocateTransientObject(key_type, key_size, key);
+	if (res) {
+		EMSG("TEE_AllocateTransientObject(%#" PRIx32 ", %" PRId32 "): %#" PRIx32, key_type, key_size, res);
+		return res;
+	}
+
+	res = TEE_GenerateKey(*key, key_size, &curve, attr_count);
+	if (res) {
+		EMSG("TEE_GenerateKey(%" PRId32 "): %#" PRIx32,
+		     key_size, res);
+		TEE_FreeTransientObject(*key);
+		*key = TEE_HANDLE_NULL;
+	}
+
+	return res;
+}
+
+/*
+ * Take a ready key from the pool, or generate one. Only RSA keys are
+ * pooled, elliptic curve keys are cheap enough to generate on demand.
+ */
+static TEE_Result get_key(uint32_t key_type, uint32_t key_size,
+			  TEE_ObjectHandle *key)
+{
+	struct key_pool *pool = NULL;
+
+	if (key_type == TEE_TYPE_RSA_KEYPAIR)
+		pool = find_pool(key_size, false);
+
+	if (pool && pool->stats.depth) {
+		pool->stats.depth--;
+		pool->stats.hits++;
+		*key = pool->keys[pool->stats.depth];
+		pool->keys[pool->stats.depth] = TEE_HANDLE_NULL;
+		return TEE_SUCCESS;
+	}
+
+	if (pool)
+		pool->stats.misses++;
+
+	return generate_key(key_type, key_size, key);
+}
+
+static TEE_Result alloc_keyed_op(TEE_ObjectHandle key, uint32_t alg,
+				 uint32_t mode, TEE_OperationHandle *op)
+{
+	TEE_Result res;
+	TEE_ObjectInfo key_info;
+
+	res = TEE_GetObjectInfo1(key, &key_info);
+	if (res) {
+		EMSG("TEE_GetObjectInfo1: %#" PRIx32, res);
+		return res;
+	}
+
+	res = TEE_AllocateOperation(op, alg, mode, key_info.keySize);
+	if (res) {
+		EMSG("TEE_AllocateOperation(%#" PRIx32 ", %#" PRIx32 ", %" PRId32 "): %#" PRIx32, alg, mode, key_info.keySize, res);
+		return res;
+	}
+
+	res = TEE_SetOperationKey(*op, key);
+	if (res) {
+		EMSG("TEE_SetOperationKey: %#" PRIx32, res);
+		TEE_FreeOperation(*op);
+		*op = TEE_HANDLE_NULL;
+	}
+
+	return res;
+}
+
+/*
+ * Get the operation of the given algorithm and mode keyed with the session
+ * key, setting it up on first use.
+ */
+static TEE_Result get_op(struct acipher *state, uint32_t alg, uint32_t mode,
+			 TEE_OperationHandle *op)
+{
+	TEE_Result res;
+	struct acipher_key *key = state->key;
+	struct keyed_op *kop = NULL;
+	size_t n;
+
+	if (!key->handle)
+		return TEE_ERROR_BAD_STATE;
+
+	/* Using a key of another type would panic the TA */
+	if (alg_key_type(alg) != key->type) {
+		EMSG("Algorithm %#" PRIx32 " does not apply to key type %#" PRIx32, alg, key->type);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	for (n = 0; n < MAX_OPS; n++) {
+		if (key->ops[n].op && key->ops[n].alg == alg &&
+		    key->ops[n].mode == mode) {
+			*op = key->ops[n].op;
+			return TEE_SUCCESS;
+		}
+		if (!key->ops[n].op && !kop)
+			kop = key->ops + n;
+	}
+
+	if (!kop) {
+		kop = key->ops + key->next_evicted_op;
+		key->next_evicted_op = (key->next_evicted_op + 1) % MAX_OPS;
+		TEE_FreeOperation(kop->op);
+		kop->op = TEE_HANDLE_NULL;
+	}
+
+	res = alloc_keyed_op(key->handle, alg, mode, &kop->op);
+	if (res)
+		return res;
+
+	kop->alg = alg;
+	kop->mode = mode;
+	*op = kop->op;
+	return TEE_SUCCESS;
+}
+
+static void free_ops(struct acipher_key *key)
+{
+	size_t n;
+
+	for (n = 0; n < MAX_OPS; n++) {
+		if (key->ops[n].op)
+			TEE_FreeOperation(key->ops[n].op);
+		key->ops[n].op = TEE_HANDLE_NULL;
+	}
+}
+
+static void free_key(struct acipher_key *key)
+{
+	free_ops(key);
+	TEE_FreeTransientObject(key->handle);
+	key->handle = TEE_HANDLE_NULL;
+}
+
+/*
+ * Replace the key of the current command, dropping the operations keyed
+ * with the former
+ */
+static TEE_Result set_key(struct acipher *state, TEE_ObjectHandle key)
+{
+	TEE_Result res;
+	TEE_ObjectInfo key_info;
+
+	res = TEE_GetObjectInfo1(key, &key_info);
+	if (res) {
+		EMSG("TEE_GetObjectInfo1: %#" PRIx32, res);
+		return res;
+	}
+
+	free_key(state->key);
+	state->key->handle = key;
+	state->key->type = key_info.objectType;
+	state->key->size = key_info.keySize;
+	return TEE_SUCCESS;
+}
+
+static uint32_t mod_len(struct acipher *state)
+{
+	return (state->key->size + 7) / 8;
+}
+
+/* Curve P-256: y^2 = x^3 - 3x + b mod p */
+static const uint8_t p256_p[] = {
+	0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0x01,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+static const uint8_t p256_b[] = {
+	0x5a, 0xc6, 0x35, 0xd8, 0xaa, 0x3a, 0x93, 0xe7,
+	0xb3, 0xeb, 0xbd, 0x55, 0x76, 0x98, 0x86, 0xbc,
+	0x65, 0x1d, 0x06, 0xb0, 0xcc, 0x53, 0xb0, 0xf6,
+	0x3b, 0xce, 0x3c, 0x3e, 0x27, 0xd2, 0x60, 0x4b,
+};
+
+#define P256_BIGINT_LEN	TEE_BigIntSizeInU32(256)
+
+/*
+ * Check that X || Y, from the normal world, is a point of P-256 other than
+ * the point at infinity: TEE_DeriveKey() panics on an invalid point, which
+ * would end the TA instance for all sessions.
+ */
+static bool p256_point_valid(const uint8_t *pub)
+{
+	TEE_BigInt p[P256_BIGINT_LEN];
+	TEE_BigInt x[P256_BIGINT_LEN];
+	TEE_BigInt y[P256_BIGINT_LEN];
+	TEE_BigInt l[P256_BIGINT_LEN];
+	TEE_BigInt r[P256_BIGINT_LEN];
+	TEE_BigInt t[P256_BIGINT_LEN];
+
+	TEE_BigIntInit(p, P256_BIGINT_LEN);
+	TEE_BigIntInit(x, P256_BIGINT_LEN);
+	TEE_BigIntInit(y, P256_BIGINT_LEN);
+	TEE_BigIntInit(l, P256_BIGINT_LEN);
+	TEE_BigIntInit(r, P256_BIGINT_LEN);
+	TEE_BigIntInit(t, P256_BIGINT_LEN);
+	if (TEE_BigIntConvertFromOctetString(p, p256_p, sizeof(p256_p), 0) ||
+	    TEE_BigIntConvertFromOctetString(x, pub, sizeof(p256_p), 0) ||
+	    TEE_BigIntConvertFromOctetString(y, pub + sizeof(p256_p),
+					     sizeof(p256_p), 0))
+		return false;
+
+	/* (0, 0) encodes the point at infinity */
+	if (!TEE_BigIntCmpS32(x, 0) && !TEE_BigIntCmpS32(y, 0))
+		return false;
+	if (TEE_BigIntCmp(x, p) >= 0 || TEE_BigIntCmp(y, p) >= 0)
+		return false;
+
+	TEE_BigIntSquareMod(l, y, p);
+	TEE_BigIntSquareMod(t, x, p);
+	TEE_BigIntMulMod(r, t, x, p);		/* x^3 */
+	TEE_BigIntAddMod(t, x, x, p);
+	TEE_BigIntAddMod(y, t, x, p);		/* 3x */
+	TEE_BigIntSubMod(t, r, y, p);
+	if (TEE_BigIntConvertFromOctetString(y, p256_b, sizeof(p256_b), 0))
+		return false;
+	TEE_BigIntAddMod(r, t, y, p);
+
+	return !TEE_BigIntCmp(l, r);
+}
+
+static uint32_t sig_len(struct acipher *state)
+{
+	if (state->key->type == TEE_TYPE_RSA_KEYPAIR)
+		return mod_len(state);
+	return 2 * mod_len(state);
+}
+
+static TEE_Result ta2tee_sign_alg(uint32_t param, uint32_t *alg,
+				  uint32_t *digest_len)
+{
+	switch (param) {
+	case TA_ACIPHER_ALG_RSASSA_PKCS1_V1_5_SHA256:
+		*alg = TEE_ALG_RSASSA_PKCS1_V1_5_SHA256;
+		*digest_len = SHA256_SIZE;
+		return TEE_SUCCESS;
+	case TA_ACIPHER_ALG_RSASSA_PSS_SHA256:
+		*alg = TEE_ALG_RSASSA_PKCS1_PSS_MGF1_SHA256;
+		*digest_len = SHA256_SIZE;
+		return TEE_SUCCESS;
+	case TA_ACIPHER_ALG_ECDSA_P256_SHA256:
+		*alg = TEE_ALG_ECDSA_P256;
+		*digest_len = SHA256_SIZE;
+		return TEE_SUCCESS;
+	case TA_ACIPHER_ALG_ED25519:
+		*alg = TEE_ALG_ED25519;
+		*digest_len = SHA256_SIZE;
+		return TEE_SUCCESS;
+	default:
+		EMSG("Invalid algorithm %#" PRIx32, param);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+}
+
+/*
+ * Make @key the session key, taking ownership of it. The encryption
+ * operation of RSA keys is set up right away: it is reused by every
+ * TA_ACIPHER_CMD_ENCRYPT until the key changes.
+ */
+static TEE_Result use_key(struct acipher *state, TEE_ObjectHandle key)
+{
+	TEE_Result res;
+	TEE_OperationHandle op;
+
+	res = set_key(state, key);
+	if (res) {
+		TEE_FreeTransientObject(key);
+		return res;
+	}
+
+	if (state->key->type != TEE_TYPE_RSA_KEYPAIR)
+		return TEE_SUCCESS;
+
+	return get_op(state, TEE_ALG_RSAES_PKCS1_V1_5, TEE_MODE_ENCRYPT, &op);
+}
+
 static TEE_Result cmd_gen_key(struct acipher *state, uint32_t pt,
 			      TEE_Param params[TEE_NUM_PARAMS])
 {
 	TEE_Result res;
-	uint32_t key_size;
-	TEE_ObjectHandle key;
-	const uint32_t key_type = TEE_TYPE_RSA_KEYPAIR;
+	uint32_t key_size;
+	TEE_ObjectHandle key;
+	uint32_t key_type;
+	const uint32_t exp_pt = TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+						TEE_PARAM_TYPE_NONE,
+						TEE_PARAM_TYPE_NONE,
+						TEE_PARAM_TYPE_NONE);
+
+	if (pt != exp_pt)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	key_size = params[0].value.a;
+	res = ta2tee_key_type(params[0].value.b, &key_type, &key_size);
+	if (res)
+		return res;
+
+	res = get_key(key_type, key_size, &key);
+	if (res)
+		return res;
+
+	return use_key(state, key);
+}
+
+static TEE_Result cmd_pool_refill(uint32_t pt,
+				  TEE_Param params[TEE_NUM_PARAMS])
+{
+	TEE_Result res;
+	struct key_pool *pool;
+	bool new_pool = false;
+	uint32_t key_size;
+	uint32_t target;
+	const uint32_t exp_pt = TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+						TEE_PARAM_TYPE_VALUE_OUTPUT,
+						TEE_PARAM_TYPE_NONE,
+						TEE_PARAM_TYPE_NONE);
+
+	if (pt != exp_pt)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	key_size = params[0].value.a;
+	target = params[0].value.b;
+	if (key_size < POOL_MIN_KEY_SIZE || key_size > POOL_MAX_KEY_SIZE ||
+	    target > TA_ACIPHER_POOL_MAX_DEPTH)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	/*
+	 * Pools are never freed, so only take a new one for a key size that
+	 * can actually be generated, see below.
+	 */
+	pool = find_pool(key_size, false);
+	if (!pool && target) {
+		pool = find_pool(key_size, true);
+		if (!pool) {
+			EMSG("No pool left for key size %" PRId32, key_size);
+			return TEE_ERROR_OUT_OF_MEMORY;
+		}
+		new_pool = true;
+	}
+	if (!pool) {
+		params[1].value.a = 0;
+		params[1].value.b = 0;
+		return TEE_SUCCESS;
+	}
+
+	if (pool->stats.depth < target) {
+		res = generate_key(TEE_TYPE_RSA_KEYPAIR, key_size,
+				   &pool->keys[pool->stats.depth]);
+		if (res) {
+			if (new_pool)
+				pool->stats.key_size = 0;
+			return res;
+		}
+		pool->stats.depth++;
+		pool->stats.generated++;
+	}
+
+	params[1].value.a = pool->stats.depth;
+	params[1].value.b = target > pool->stats.depth ?
+			    target - pool->stats.depth : 0;
+	pool->stats.target = target;
+	return TEE_SUCCESS;
+}
+
+static TEE_Result cmd_pool_stats(uint32_t pt,
+				 TEE_Param params[TEE_NUM_PARAMS])
+{
+	struct acipher_pool_stats stats[TA_ACIPHER_POOL_MAX_SIZES];
+	uint32_t count = 0;
+	size_t n;
+	const uint32_t exp_pt = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_OUTPUT,
+						TEE_PARAM_TYPE_NONE,
+						TEE_PARAM_TYPE_NONE,
+						TEE_PARAM_TYPE_NONE);
+
+	if (pt != exp_pt)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	for (n = 0; n < TA_ACIPHER_POOL_MAX_SIZES; n++)
+		if (pools[n].stats.key_size)
+			stats[count++] = pools[n].stats;
+
+	if (params[0].memref.size < count * sizeof(stats[0])) {
+		params[0].memref.size = count * sizeof(stats[0]);
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+
+	TEE_MemMove(params[0].memref.buffer, stats, count * sizeof(stats[0]));
+	params[0].memref.size = count * sizeof(stats[0]);
+	return TEE_SUCCESS;
+}
+
+static TEE_Result cmd_enc(struct acipher *state, uint32_t pt,
+			  TEE_Param params[TEE_NUM_PARAMS])
+{
+	TEE_Result res;
+	const void *inbuf;
+	uint32_t inbuf_len;
+	void *outbuf;
+	uint32_t outbuf_len;
+	TEE_OperationHandle op;
+	const uint32_t exp_pt = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+						TEE_PARAM_TYPE_MEMREF_OUTPUT,
+						TEE_PARAM_TYPE_NONE,
+						TEE_PARAM_TYPE_NONE);
+
+	if (pt != exp_pt)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = get_op(state, TEE_ALG_RSAES_PKCS1_V1_5, TEE_MODE_ENCRYPT, &op);
+	if (res)
+		return res;
+
+	inbuf = params[0].memref.buffer;
+	inbuf_len = params[0].memref.size;
+	outbuf = params[1].memref.buffer;
+	outbuf_len = params[1].memref.size;
+
+	res = TEE_AsymmetricEncrypt(op, NULL, 0, inbuf, inbuf_len, outbuf,
+				    &outbuf_len);
+	if (res) {
+		EMSG("TEE_AsymmetricEncrypt(%" PRId32 ", %" PRId32 "): %#" PRIx32, inbuf_len, params[1].memref.size, res);
+	}
+	params[1].memref.size = outbuf_len;
+
+	return res;
+}
+
+static TEE_Result cmd_dec(struct acipher *state, uint32_t pt,
+			  TEE_Param params[TEE_NUM_PARAMS])
+{
+	TEE_Result res;
+	uint32_t outbuf_len;
+	TEE_OperationHandle op;
+	const uint32_t exp_pt = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+						TEE_PARAM_TYPE_MEMREF_OUTPUT,
+						TEE_PARAM_TYPE_NONE,
+						TEE_PARAM_TYPE_NONE);
+
+	if (pt != exp_pt)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = get_op(state, TEE_ALG_RSAES_PKCS1_V1_5, TEE_MODE_DECRYPT, &op);
+	if (res)
+		return res;
+
+	outbuf_len = params[1].memref.size;
+	res = TEE_AsymmetricDecrypt(op, NULL, 0, params[0].memref.buffer,
+				    params[0].memref.size,
+				    params[1].memref.buffer, &outbuf_len);
+	if (res && res != TEE_ERROR_SHORT_BUFFER)
+		EMSG("TEE_AsymmetricDecrypt: %#" PRIx32, res);
+	params[1].memref.size = outbuf_len;
+
+	return res;
+}
+
+static TEE_Result cmd_sign(struct acipher *state, uint32_t pt,
+			   TEE_Param params[TEE_NUM_PARAMS])
+{
+	TEE_Result res;
+	uint32_t alg;
+	uint32_t digest_len;
+	uint32_t sig_len;
+	TEE_OperationHandle op;
+	const uint32_t exp_pt = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+						TEE_PARAM_TYPE_MEMREF_OUTPUT,
+						TEE_PARAM_TYPE_VALUE_INPUT,
+						TEE_PARAM_TYPE_NONE);
+
+	if (pt != exp_pt)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = ta2tee_sign_alg(params[2].value.a, &alg, &digest_len);
+	if (res)
+		return res;
+	if (params[0].memref.size != digest_len)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = get_op(state, alg, TEE_MODE_SIGN, &op);
+	if (res)
+		return res;
+
+	sig_len = params[1].memref.size;
+	res = TEE_AsymmetricSignDigest(op, NULL, 0, params[0].memref.buffer,
+				       digest_len, params[1].memref.buffer,
+				       &sig_len);
+	if (res && res != TEE_ERROR_SHORT_BUFFER)
+		EMSG("TEE_AsymmetricSignDigest: %#" PRIx32, res);
+	params[1].memref.size = sig_len;
+
+	return res;
+}
+
+static TEE_Result cmd_verify(struct acipher *state, uint32_t pt,
+			     TEE_Param params[TEE_NUM_PARAMS])
+{
+	TEE_Result res;
+	uint32_t alg;
+	uint32_t digest_len;
+	TEE_OperationHandle op;
+	const uint32_t exp_pt = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+						TEE_PARAM_TYPE_MEMREF_INPUT,
+						TEE_PARAM_TYPE_VALUE_INPUT,
+						TEE_PARAM_TYPE_NONE);
+
+	if (pt != exp_pt)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = ta2tee_sign_alg(params[2].value.a, &alg, &digest_len);
+	if (res)
+		return res;
+	if (params[0].memref.size != digest_len)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = get_op(state, alg, TEE_MODE_VERIFY, &op);
+	if (res)
+		return res;
+
+	return TEE_AsymmetricVerifyDigest(op, NULL, 0, params[0].memref.buffer,
+					  digest_len, params[1].memref.buffer,
+					  params[1].memref.size);
+}
+
+/*
+ * Get the number of items of @item_len bytes in a batch input buffer, and
+ * check that the output buffer can hold as many items of @out_len bytes.
+ */
+static TEE_Result batch_count(TEE_Param params[TEE_NUM_PARAMS],
+			      uint32_t item_len, uint32_t out_len,
+			      uint32_t *count)
+{
+	uint32_t n = params[0].memref.size / item_len;
+
+	if (!n || n > TA_ACIPHER_MAX_BATCH ||
+	    params[0].memref.size % item_len)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	if (params[1].memref.size < n * out_len) {
+		params[1].memref.size = n * out_len;
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+
+	params[1].memref.size = n * out_len;
+	*count = n;
+	return TEE_SUCCESS;
+}
+
+static TEE_Result cmd_sign_batch(struct acipher *state, uint32_t pt,
+				 TEE_Param params[TEE_NUM_PARAMS])
+{
+	TEE_Result res;
+	uint32_t alg;
+	uint32_t digest_len;
+	uint32_t len;
+	uint32_t n;
+	uint32_t count;
+	uint8_t *in;
+	uint8_t *out;
+	TEE_OperationHandle op;
+	const uint32_t exp_pt = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+						TEE_PARAM_TYPE_MEMREF_OUTPUT,
+						TEE_PARAM_TYPE_VALUE_INPUT,
+						TEE_PARAM_TYPE_NONE);
+
+	if (pt != exp_pt)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = ta2tee_sign_alg(params[2].value.a, &alg, &digest_len);
+	if (res)
+		return res;
+
+	res = get_op(state, alg, TEE_MODE_SIGN, &op);
+	if (res)
+		return res;
+
+	res = batch_count(params, digest_len, sig_len(state), &count);
+	if (res)
+		return res;
+
+	in = params[0].memref.buffer;
+	out = params[1].memref.buffer;
+	for (n = 0; n < count; n++) {
+		len = sig_len(state);
+		res = TEE_AsymmetricSignDigest(op, NULL, 0,
+					       in + n * digest_len, digest_len,
+					       out + n * sig_len(state), &len);
+		if (res) {
+			EMSG("TEE_AsymmetricSignDigest(%" PRId32 "): %#" PRIx32, n, res);
+			return res;
+		}
+	}
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result cmd_verify_batch(struct acipher *state, uint32_t pt,
+				   TEE_Param params[TEE_NUM_PARAMS])
+{
+	TEE_Result res;
+	uint32_t alg;
+	uint32_t digest_len;
+	uint32_t item_len;
+	uint32_t n;
+	uint32_t count;
+	uint32_t item_res;
+	uint8_t *in;
+	uint8_t *out;
+	TEE_OperationHandle op;
+	const uint32_t exp_pt = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+						TEE_PARAM_TYPE_MEMREF_OUTPUT,
+						TEE_PARAM_TYPE_VALUE_INPUT,
+						TEE_PARAM_TYPE_NONE);
+
+	if (pt != exp_pt)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = ta2tee_sign_alg(params[2].value.a, &alg, &digest_len);
+	if (res)
+		return res;
+
+	res = get_op(state, alg, TEE_MODE_VERIFY, &op);
+	if (res)
+		return res;
+
+	item_len = digest_len + sig_len(state);
+	res = batch_count(params, item_len, sizeof(uint32_t), &count);
+	if (res)
+		return res;
+
+	in = params[0].memref.buffer;
+	out = params[1].memref.buffer;
+	for (n = 0; n < count; n++) {
+		item_res = TEE_AsymmetricVerifyDigest(op, NULL, 0,
+						      in + n * item_len,
+						      digest_len,
+						      in + n * item_len +
+						      digest_len,
+						      sig_len(state));
+		TEE_MemMove(out + n * sizeof(item_res), &item_res,
+			    sizeof(item_res));
+	}
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result cmd_dec_batch(struct acipher *state, uint32_t pt,
+				TEE_Param params[TEE_NUM_PARAMS])
+{
+	TEE_Result res;
+	struct acipher_dec_slot slot;
+	uint32_t slot_len;
+	uint32_t n;
+	uint32_t count;
+	uint8_t *in;
+	uint8_t *out;
+	TEE_OperationHandle op;
+	const uint32_t exp_pt = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+						TEE_PARAM_TYPE_MEMREF_OUTPUT,
+						TEE_PARAM_TYPE_NONE,
+						TEE_PARAM_TYPE_NONE);
+
+	if (pt != exp_pt)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = get_op(state, TEE_ALG_RSAES_PKCS1_V1_5, TEE_MODE_DECRYPT, &op);
+	if (res)
+		return res;
+
+	slot_len = TA_ACIPHER_DEC_SLOT_SIZE(mod_len(state));
+	res = batch_count(params, mod_len(state), slot_len, &count);
+	if (res)
+		return res;
+
+	in = params[0].memref.buffer;
+	out = params[1].memref.buffer;
+	for (n = 0; n < count; n++) {
+		slot.len = mod_len(state);
+		slot.res = TEE_AsymmetricDecrypt(op, NULL, 0,
+						 in + n * mod_len(state),
+						 mod_len(state),
+						 out + n * slot_len +
+						 sizeof(slot), &slot.len);
+		if (slot.res)
+			slot.len = 0;
+		TEE_MemMove(out + n * slot_len, &slot, sizeof(slot));
+	}
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result cmd_derive(struct acipher *state, uint32_t pt,
+			     TEE_Param params[TEE_NUM_PARAMS])
+{
+	TEE_Result res;
+	TEE_Attribute attrs[2];
+	uint32_t attr_count;
+	uint32_t alg;
+	uint32_t len;
+	uint8_t *pub = params[0].memref.buffer;
+	TEE_ObjectHandle secret;
+	TEE_OperationHandle op;
+	const uint32_t exp_pt = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+						TEE_PARAM_TYPE_MEMREF_OUTPUT,
+						TEE_PARAM_TYPE_NONE,
+						TEE_PARAM_TYPE_NONE);
+
+	if (pt != exp_pt)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	switch (state->key->type) {
+	case TEE_TYPE_ECDH_KEYPAIR:
+		if (params[0].memref.size != 2 * mod_len(state) ||
+		    !p256_point_valid(pub))
+			return TEE_ERROR_BAD_PARAMETERS;
+		alg = TEE_ALG_ECDH_P256;
+		TEE_InitRefAttribute(attrs, TEE_ATTR_ECC_PUBLIC_VALUE_X,
+				     pub, mod_len(state));
+		TEE_InitRefAttribute(attrs + 1, TEE_ATTR_ECC_PUBLIC_VALUE_Y,
+				     pub + mod_len(state), mod_len(state));
+		attr_count = 2;
+		break;
+	case TEE_TYPE_X25519_KEYPAIR:
+		if (params[0].memref.size != mod_len(state))
+			return TEE_ERROR_BAD_PARAMETERS;
+		alg = TEE_ALG_X25519;
+		TEE_InitRefAttribute(attrs, TEE_ATTR_X25519_PUBLIC_VALUE,
+				     pub, mod_len(state));
+		attr_count = 1;
+		break;
+	default:
+		return TEE_ERROR_BAD_STATE;
+	}
+
+	res = get_op(state, alg, TEE_MODE_DERIVE, &op);
+	if (res)
+		return res;
+
+	res = TEE_AllocateTransientObject(TEE_TYPE_GENERIC_SECRET,
+					  state->key->size, &secret);
+	if (res) {
+		EMSG("TEE_AllocateTransientObject: %#" PRIx32, res);
+		return res;
+	}
+
+	TEE_DeriveKey(op, attrs, attr_count, secret);
+
+	len = params[1].memref.size;
+	res = TEE_GetObjectBufferAttribute(secret, TEE_ATTR_SECRET_VALUE,
+					   params[1].memref.buffer, &len);
+	params[1].memref.size = len;
+
+	TEE_FreeTransientObject(secret);
+	return res;
+}
+
+static void env_free(struct acipher *state)
+{
+	if (state->env_seal_op)
+		TEE_FreeOperation(state->env_seal_op);
+	if (state->env_open_op)
+		TEE_FreeOperation(state->env_open_op);
+	TEE_FreeTransientObject(state->env_key);
+	state->env_seal_op = TEE_HANDLE_NULL;
+	state->env_open_op = TEE_HANDLE_NULL;
+	state->env_key = TEE_HANDLE_NULL;
+	state->env_opening = false;
+}
+
+/* The AES key and GCM operations are reused by all the envelopes */
+static TEE_Result env_alloc(struct acipher *state)
+{
+	TEE_Result res;
+
+	if (state->env_key)
+		return TEE_SUCCESS;
+
+	res = TEE_AllocateTransientObject(TEE_TYPE_AES, ENV_KEY_SIZE,
+					  &state->env_key);
+	if (res) {
+		EMSG("TEE_AllocateTransientObject: %#" PRIx32, res);
+		goto err;
+	}
+
+	res = TEE_AllocateOperation(&state->env_seal_op, TEE_ALG_AES_GCM,
+				    TEE_MODE_ENCRYPT, ENV_KEY_SIZE);
+	if (res) {
+		EMSG("TEE_AllocateOperation(ENCRYPT): %#" PRIx32, res);
+		goto err;
+	}
+
+	res = TEE_AllocateOperation(&state->env_open_op, TEE_ALG_AES_GCM,
+				    TEE_MODE_DECRYPT, ENV_KEY_SIZE);
+	if (res) {
+		EMSG("TEE_AllocateOperation(DECRYPT): %#" PRIx32, res);
+		goto err;
+	}
+
+	return TEE_SUCCESS;
+err:
+	env_free(state);
+	return res;
+}
+
+/* Key a GCM operation with the current envelope key and start a message */
+static TEE_Result env_init(struct acipher *state, TEE_OperationHandle op,
+			   const struct acipher_envelope *hdr)
+{
+	TEE_Result res;
+	TEE_OperationInfo info;
+
+	/* A former message may have been left unfinished */
+	TEE_GetOperationInfo(op, &info);
+	if (info.handleState & TEE_HANDLE_FLAG_INITIALIZED)
+		TEE_ResetOperation(op);
+
+	res = TEE_SetOperationKey(op, state->env_key);
+	if (res) {
+		EMSG("TEE_SetOperationKey: %#" PRIx32, res);
+		return res;
+	}
+
+	res = TEE_AEInit(op, hdr->iv, sizeof(hdr->iv),
+			 TA_ACIPHER_ENVELOPE_TAG_SIZE * 8, sizeof(*hdr),
+			 hdr->payload_len);
+	if (res) {
+		EMSG("TEE_AEInit: %#" PRIx32, res);
+		return res;
+	}
+
+	TEE_AEUpdateAAD(op, hdr, sizeof(*hdr));
+	return TEE_SUCCESS;
+}
+
+static TEE_Result cmd_env_seal(struct acipher *state, uint32_t pt,
+			       TEE_Param params[TEE_NUM_PARAMS])
+{
+	TEE_Result res;
+	struct acipher_envelope hdr;
+	uint8_t aes_key[ENV_KEY_SIZE / 8];
+	uint32_t key_len = sizeof(aes_key);
+	uint8_t *out = params[1].memref.buffer;
+	uint32_t env_len;
+	uint32_t len;
+	uint32_t tag_len;
+	TEE_OperationHandle wrap_op;
+	const uint32_t exp_pt = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+						TEE_PARAM_TYPE_MEMREF_OUTPUT,
+						TEE_PARAM_TYPE_NONE,
+						TEE_PARAM_TYPE_NONE);
+
+	if (pt != exp_pt)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = get_op(state, TEE_ALG_RSAES_PKCS1_OAEP_MGF1_SHA256,
+		     TEE_MODE_ENCRYPT, &wrap_op);
+	if (res)
+		return res;
+
+	res = env_alloc(state);
+	if (res)
+		return res;
+
+	env_len = TA_ACIPHER_ENVELOPE_SIZE(mod_len(state),
+					   params[0].memref.size);
+	if (params[1].memref.size < env_len) {
+		params[1].memref.size = env_len;
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+
+	TEE_ResetTransientObject(state->env_key);
+	res = TEE_GenerateKey(state->env_key, ENV_KEY_SIZE, NULL, 0);
+	if (res) {
+		EMSG("TEE_GenerateKey: %#" PRIx32, res);
+		return res;
+	}
+
+	res = TEE_GetObjectBufferAttribute(state->env_key,
+					   TEE_ATTR_SECRET_VALUE, aes_key,
+					   &key_len);
+	if (res) {
+		EMSG("TEE_GetObjectBufferAttribute: %#" PRIx32, res);
+		return res;
+	}
+
+	hdr.wrapped_key_len = mod_len(state);
+	hdr.payload_len = params[0].memref.size;
+	TEE_GenerateRandom(hdr.iv, sizeof(hdr.iv));
+
+	len = hdr.wrapped_key_len;
+	res = TEE_AsymmetricEncrypt(wrap_op, NULL, 0, aes_key, key_len,
+				    out + sizeof(hdr), &len);
+	TEE_MemFill(aes_key, 0, sizeof(aes_key));
+	if (res) {
+		EMSG("TEE_AsymmetricEncrypt: %#" PRIx32, res);
+		return res;
+	}
+
+	res = env_init(state, state->env_seal_op, &hdr);
+	if (res)
+		return res;
+
+	len = hdr.payload_len;
+	tag_len = TA_ACIPHER_ENVELOPE_TAG_SIZE;
+	res = TEE_AEEncryptFinal(state->env_seal_op, params[0].memref.buffer,
+				 hdr.payload_len,
+				 out + sizeof(hdr) + hdr.wrapped_key_len, &len,
+				 out + env_len - tag_len, &tag_len);
+	if (res) {
+		EMSG("TEE_AEEncryptFinal: %#" PRIx32, res);
+		return res;
+	}
+
+	TEE_MemMove(out, &hdr, sizeof(hdr));
+	params[1].memref.size = env_len;
+	return TEE_SUCCESS;
+}
+
+static TEE_Result cmd_env_open_init(struct acipher *state, uint32_t pt,
+				    TEE_Param params[TEE_NUM_PARAMS])
+{
+	TEE_Result res;
+	struct acipher_envelope hdr;
+	uint8_t aes_key[ENV_KEY_SIZE / 8];
+	uint32_t key_len = sizeof(aes_key);
+	uint8_t *in = params[0].memref.buffer;
+	TEE_Attribute attr;
+	TEE_OperationHandle unwrap_op;
+	const uint32_t exp_pt = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+						TEE_PARAM_TYPE_NONE,
+						TEE_PARAM_TYPE_NONE,
+						TEE_PARAM_TYPE_NONE);
+
+	if (pt != exp_pt)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	state->env_opening = false;
+
+	if (params[0].memref.size < sizeof(hdr))
+		return TEE_ERROR_BAD_PARAMETERS;
+	TEE_MemMove(&hdr, in, sizeof(hdr));
+	if (hdr.wrapped_key_len != params[0].memref.size - sizeof(hdr))
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = get_op(state, TEE_ALG_RSAES_PKCS1_OAEP_MGF1_SHA256,
+		     TEE_MODE_DECRYPT, &unwrap_op);
+	if (res)
+		return res;
+
+	res = env_alloc(state);
+	if (res)
+		return res;
+
+	res = TEE_AsymmetricDecrypt(unwrap_op, NULL, 0, in + sizeof(hdr),
+				    hdr.wrapped_key_len, aes_key, &key_len);
+	if (res) {
+		EMSG("TEE_AsymmetricDecrypt: %#" PRIx32, res);
+		return res;
+	}
+
+	TEE_InitRefAttribute(&attr, TEE_ATTR_SECRET_VALUE, aes_key, key_len);
+	TEE_ResetTransientObject(state->env_key);
+	res = TEE_PopulateTransientObject(state->env_key, &attr, 1);
+	TEE_MemFill(aes_key, 0, sizeof(aes_key));
+	if (res) {
+		EMSG("TEE_PopulateTransientObject: %#" PRIx32, res);
+		return res;
+	}
+
+	res = env_init(state, state->env_open_op, &hdr);
+	if (res)
+		return res;
+
+	state->env_opening = true;
+	return TEE_SUCCESS;
+}
+
+static TEE_Result cmd_env_open_update(struct acipher *state, uint32_t pt,
+				      TEE_Param params[TEE_NUM_PARAMS])
+{
+	TEE_Result res;
+	uint32_t len;
+	const uint32_t exp_pt = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+						TEE_PARAM_TYPE_MEMREF_OUTPUT,
+						TEE_PARAM_TYPE_NONE,
+						TEE_PARAM_TYPE_NONE);
+
+	if (pt != exp_pt)
+		return TEE_ERROR_BAD_PARAMETERS;
+	if (!state->env_opening)
+		return TEE_ERROR_BAD_STATE;
+
+	len = params[1].memref.size;
+	res = TEE_AEUpdate(state->env_open_op, params[0].memref.buffer,
+			   params[0].memref.size, params[1].memref.buffer,
+			   &len);
+	params[1].memref.size = len;
+
+	return res;
+}
+
+static TEE_Result cmd_env_open_final(struct acipher *state, uint32_t pt,
+				     TEE_Param params[TEE_NUM_PARAMS])
+{
+	TEE_Result res;
+	uint32_t len;
+	const uint32_t exp_pt = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+						TEE_PARAM_TYPE_MEMREF_OUTPUT,
+						TEE_PARAM_TYPE_MEMREF_INPUT,
+						TEE_PARAM_TYPE_NONE);
+
+	if (pt != exp_pt)
+		return TEE_ERROR_BAD_PARAMETERS;
+	if (!state->env_opening)
+		return TEE_ERROR_BAD_STATE;
+
+	len = params[1].memref.size;
+	res = TEE_AEDecryptFinal(state->env_open_op, params[0].memref.buffer,
+				 params[0].memref.size,
+				 params[1].memref.buffer, &len,
+				 params[2].memref.buffer,
+				 params[2].memref.size);
+	params[1].memref.size = len;
+
+	/* The caller may retry with a larger output buffer */
+	if (res != TEE_ERROR_SHORT_BUFFER)
+		state->env_opening = false;
+
+	return res;
+}
+
+static TEE_Result get_key_id(TEE_Param *param, struct key_id *id)
+{
+	if (!param->memref.size || param->memref.size > sizeof(id->id))
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	/* Object IDs must not be in shared memory */
+	TEE_MemMove(id->id, param->memref.buffer, param->memref.size);
+	id->len = param->memref.size;
+	return TEE_SUCCESS;
+}
+
+static struct cached_key *find_cached_key(const struct key_id *id)
+{
+	size_t n;
+
+	for (n = 0; n < KEY_CACHE_SIZE; n++)
+		if (key_cache[n].key && key_cache[n].id.len == id->len &&
+		    !TEE_MemCompare(key_cache[n].id.id, id->id, id->len))
+			return key_cache + n;
+
+	return NULL;
+}
+
+/* Copy a key, persistent or not, into a new transient object */
+static TEE_Result copy_key(TEE_ObjectHandle src, TEE_ObjectHandle *dst)
+{
+	TEE_Result res;
+	TEE_ObjectInfo key_info;
+
+	res = TEE_GetObjectInfo1(src, &key_info);
+	if (res) {
+		EMSG("TEE_GetObjectInfo1: %#" PRIx32, res);
+		return res;
+	}
+
+	res = TEE_AllocateTransientObject(key_info.objectType,
+					  key_info.keySize, dst);
+	if (res) {
+		EMSG("TEE_AllocateTransientObject: %#" PRIx32, res);
+		return res;
+	}
+
+	res = TEE_CopyObjectAttributes1(*dst, src);
+	if (res) {
+		EMSG("TEE_CopyObjectAttributes1: %#" PRIx32, res);
+		TEE_FreeTransientObject(*dst);
+		*dst = TEE_HANDLE_NULL;
+	}
+
+	return res;
+}
+
+static TEE_Result load_cached_key(const struct key_id *id,
+				  struct cached_key **ck)
+{
+	TEE_Result res;
+	TEE_ObjectHandle obj;
+	TEE_ObjectHandle key;
+
+	*ck = find_cached_key(id);
+	if (*ck)
+		return TEE_SUCCESS;
+
+	res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE, id->id, id->len,
+				       TEE_DATA_FLAG_ACCESS_READ, &obj);
+	if (res) {
+		if (res != TEE_ERROR_ITEM_NOT_FOUND)
+			EMSG("TEE_OpenPersistentObject: %#" PRIx32, res);
+		return res;
+	}
+
+	res = copy_key(obj, &key);
+	TEE_CloseObject(obj);
+	if (res)
+		return res;
+
+	*ck = key_cache + next_evicted_key;
+	next_evicted_key = (next_evicted_key + 1) % KEY_CACHE_SIZE;
+	TEE_FreeTransientObject((*ck)->key);
+	(*ck)->id = *id;
+	(*ck)->key = key;
+	return TEE_SUCCESS;
+}
+
+/* Store @key under @id, replacing any key stored under this ID */
+static TEE_Result store_key(const struct key_id *id, TEE_ObjectHandle key)
+{
+	TEE_Result res;
+	struct cached_key *ck;
+	TEE_ObjectHandle obj;
+
+	res = TEE_CreatePersistentObject(TEE_STORAGE_PRIVATE, id->id, id->len,
+					 TEE_DATA_FLAG_ACCESS_READ |
+					 TEE_DATA_FLAG_ACCESS_WRITE_META |
+					 TEE_DATA_FLAG_OVERWRITE,
+					 key, NULL, 0, &obj);
+	if (res) {
+		EMSG("TEE_CreatePersistentObject: %#" PRIx32, res);
+		return res;
+	}
+	TEE_CloseObject(obj);
+
+	/* A key formerly stored under this ID is now stale */
+	ck = find_cached_key(id);
+	if (ck) {
+		TEE_FreeTransientObject(ck->key);
+		ck->key = TEE_HANDLE_NULL;
+	}
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result cmd_key_store(struct acipher *state, uint32_t pt,
+				TEE_Param params[TEE_NUM_PARAMS])
+{
+	TEE_Result res;
+	struct key_id id;
+	const uint32_t exp_pt = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+						TEE_PARAM_TYPE_NONE,
+						TEE_PARAM_TYPE_NONE,
+						TEE_PARAM_TYPE_NONE);
+
+	if (pt != exp_pt)
+		return TEE_ERROR_BAD_PARAMETERS;
+	if (!state->key->handle)
+		return TEE_ERROR_BAD_STATE;
+
+	res = get_key_id(params, &id);
+	if (res)
+		return res;
+
+	return store_key(&id, state->key->handle);
+}
+
+static TEE_Result cmd_key_load(struct acipher *state, uint32_t pt,
+			       TEE_Param params[TEE_NUM_PARAMS])
+{
+	TEE_Result res;
+	struct key_id id;
+	struct cached_key *ck;
+	TEE_ObjectHandle key;
+	const uint32_t exp_pt = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+						TEE_PARAM_TYPE_NONE,
+						TEE_PARAM_TYPE_NONE,
+						TEE_PARAM_TYPE_NONE);
+
+	if (pt != exp_pt)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = get_key_id(params, &id);
+	if (res)
+		return res;
+
+	res = load_cached_key(&id, &ck);
+	if (res)
+		return res;
+
+	res = copy_key(ck->key, &key);
+	if (res)
+		return res;
+
+	return use_key(state, key);
+}
+
+static struct acipher_key *find_named_key(struct acipher *state,
+					  const struct key_id *id)
+{
+	struct acipher_key *key;
+	size_t n;
+
+	for (n = 0; n < state->named_key_count; n++) {
+		key = state->named_keys + n;
+		if (key->id.len == id->len &&
+		    !TEE_MemCompare(key->id.id, id->id, id->len))
+			return key;
+	}
+
+	return NULL;
+}
+
+/*
+ * Get an entry for a new named key: a free one, a new one while the tables
+ * of all sessions have fewer than MAX_NAMED_KEYS entries, or the least
+ * recently used one, of which the key is dropped.
+ */
+static TEE_Result alloc_named_key(struct acipher *state,
+				  const struct key_id *id,
+				  struct acipher_key **key)
+{
+	struct acipher_key *keys;
+	struct acipher_key *lru = NULL;
+	size_t count;
+	size_t n;
+
+	for (n = 0; n < state->named_key_count; n++) {
+		if (!state->named_keys[n].id.len) {
+			lru = state->named_keys + n;
+			break;
+		}
+		if (!lru || state->named_keys[n].last_use < lru->last_use)
+			lru = state->named_keys + n;
+	}
+
+	if ((!lru || lru->id.len) && named_key_total < MAX_NAMED_KEYS) {
+		count = state->named_key_count * 2;
+		if (!count)
+			count = 4;
+		if (count - state->named_key_count >
+		    MAX_NAMED_KEYS - named_key_total)
+			count = state->named_key_count + MAX_NAMED_KEYS -
+				named_key_total;
+
+		keys = TEE_Realloc(state->named_keys, count * sizeof(*keys));
+		if (!keys)
+			return TEE_ERROR_OUT_OF_MEMORY;
+
+		for (n = state->named_key_count; n < count; n++) {
+			keys[n].id.len = 0;
+			keys[n].handle = TEE_HANDLE_NULL;
+			keys[n].next_evicted_op = 0;
+			TEE_MemFill(keys[n].ops, 0, sizeof(keys[n].ops));
+		}
+		lru = keys + state->named_key_count;
+		named_key_total += count - state->named_key_count;
+		state->named_keys = keys;
+		state->named_key_count = count;
+	}
+
+	/* Other sessions have all the entries */
+	if (!lru)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	free_key(lru);
+	lru->id = *id;
+	*key = lru;
+	return TEE_SUCCESS;
+}
+
+/*
+ * Make the named key of ID @param the key of the current command. A key
+ * not yet in the session is loaded from secure storage when @load is set,
+ * otherwise it is left empty for the command to set.
+ */
+static TEE_Result select_named_key(struct acipher *state, TEE_Param *param,
+				   bool load)
+{
+	TEE_Result res;
+	struct key_id id;
+	struct acipher_key *key;
+	struct cached_key *ck;
+	TEE_ObjectHandle handle;
+
+	res = get_key_id(param, &id);
+	if (res)
+		return res;
+
+	key = find_named_key(state, &id);
+	if (!key) {
+		res = alloc_named_key(state, &id, &key);
+		if (res)
+			return res;
+
+		state->key = key;
+		if (load) {
+			res = load_cached_key(&id, &ck);
+			if (!res)
+				res = copy_key(ck->key, &handle);
+			if (!res)
+				res = use_key(state, handle);
+			if (res) {
+				free_key(key);
+				key->id.len = 0;
+				state->key = &state->session_key;
+				return res;
+			}
+		}
+	}
+
+	key->last_use = ++state->use_count;
+	state->key = key;
+	return TEE_SUCCESS;
+}
+
+/* Back to the session key once a command is done with a named key */
+static void unselect_named_key(struct acipher *state)
+{
+	/* The command did not set the key, release the entry */
+	if (!state->key->handle)
+		state->key->id.len = 0;
+
+	state->key = &state->session_key;
+}
+
+/*
+ * DER encoding of public keys as SubjectPublicKeyInfo:
+ *
+ * SEQUENCE {
+ *	SEQUENCE { algorithm OID, parameters }
+ *	BIT STRING { public key }
+ * }
+ *
+ * where the public key is SEQUENCE { INTEGER modulus, INTEGER exponent } for
+ * RSA, the uncompressed point 04 || X || Y for P-256, and the raw public
+ * value for Ed25519 and X25519.
+ */
+#define DER_SEQUENCE	0x30
+#define DER_INTEGER	0x02
+#define DER_BIT_STRING	0x03
+
+/* Room for the DER headers around the public key values */
+#define PUBKEY_DER_OVERHEAD	64
+
+/* Contents of the AlgorithmIdentifier of each key type */
+static const uint8_t der_alg_rsa[] = {
+	/* rsaEncryption, NULL */
+	0x06, 0x09, 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x01, 0x01,
+	0x05, 0x00
+};
+static const uint8_t der_alg_p256[] = {
+	/* id-ecPublicKey, prime256v1 */
+	0x06, 0x07, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x02, 0x01,
+	0x06, 0x08, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x03, 0x01, 0x07
+};
+static const uint8_t der_alg_ed25519[] = { 0x06, 0x03, 0x2b, 0x65, 0x70 };
+static const uint8_t der_alg_x25519[] = { 0x06, 0x03, 0x2b, 0x65, 0x6e };
+
+static uint32_t der_size(uint32_t len)
+{
+	if (len < 0x80)
+		return 2 + len;
+	if (len < 0x100)
+		return 3 + len;
+	return 4 + len;
+}
+
+static uint8_t *der_put_hdr(uint8_t *p, uint8_t tag, uint32_t len)
+{
+	*p++ = tag;
+	if (len >= 0x100) {
+		*p++ = 0x82;
+		*p++ = len >> 8;
+	} else if (len >= 0x80) {
+		*p++ = 0x81;
+	}
+	*p++ = len;
+	return p;
+}
+
+/* Write a big endian unsigned value as a DER INTEGER */
+static uint8_t *der_put_uint(uint8_t *p, const uint8_t *v, uint32_t len)
+{
+	while (len > 1 && !*v) {
+		v++;
+		len--;
+	}
+
+	if (*v & 0x80) {
+		p = der_put_hdr(p, DER_INTEGER, len + 1);
+		*p++ = 0;
+	} else {
+		p = der_put_hdr(p, DER_INTEGER, len);
+	}
+	TEE_MemMove(p, v, len);
+	return p + len;
+}
+
+static uint32_t der_uint_size(const uint8_t *v, uint32_t len)
+{
+	while (len > 1 && !*v) {
+		v++;
+		len--;
+	}
+	return der_size(len + (*v >> 7));
+}
+
+static TEE_Result get_pub_attr(TEE_ObjectHandle key, uint32_t attr,
+			       uint8_t *buf, uint32_t *len)
+{
+	TEE_Result res;
+
+	res = TEE_GetObjectBufferAttribute(key, attr, buf, len);
+	if (res)
+		EMSG("TEE_GetObjectBufferAttribute(%#" PRIx32 "): %#" PRIx32, attr, res);
+	return res;
+}
+
+/*
+ * Get an EC public value into the @len bytes at @buf, left padded with
+ * zeroes as it may be returned without its leading zeroes.
+ */
+static TEE_Result get_ec_coord(TEE_ObjectHandle key, uint32_t attr,
+			       uint8_t *buf, uint32_t len)
+{
+	TEE_Result res;
+	uint32_t l = len;
+
+	res = get_pub_attr(key, attr, buf, &l);
+	if (res)
+		return res;
+
+	TEE_MemMove(buf + len - l, buf, l);
+	TEE_MemFill(buf, 0, len - l);
+	return TEE_SUCCESS;
+}
+
+/* Write the SubjectPublicKeyInfo of the session key at @der */
+static TEE_Result pubkey_der(struct acipher *state, uint8_t *der,
+			     uint32_t *der_len)
+{
+	TEE_Result res;
+	TEE_ObjectHandle key = state->key->handle;
+	uint8_t *p;
+	uint8_t *bits;
+	uint32_t bits_len;
+	uint8_t *n;
+	uint32_t n_len = mod_len(state);
+	uint8_t e[8];
+	uint32_t e_len = sizeof(e);
+	const uint8_t *alg;
+	uint32_t alg_len;
+	uint32_t len = mod_len(state);
+
+	/*
+	 * The public key is built past room for the headers, then moved
+	 * down next to them. RSA values are read further up for the same
+	 * reason.
+	 */
+	bits = der + PUBKEY_DER_OVERHEAD / 2;
+
+	switch (state->key->type) {
+	case TEE_TYPE_RSA_KEYPAIR:
+		alg = der_alg_rsa;
+		alg_len = sizeof(der_alg_rsa);
+		n = bits + PUBKEY_DER_OVERHEAD / 2;
+		res = get_pub_attr(key, TEE_ATTR_RSA_MODULUS, n,
+				   &n_len);
+		if (res)
+			return res;
+		res = get_pub_attr(key, TEE_ATTR_RSA_PUBLIC_EXPONENT,
+				   e, &e_len);
+		if (res)
+			return res;
+		bits_len = der_size(der_uint_size(n, n_len) +
+				    der_uint_size(e, e_len));
+		/* The modulus is moved down as it is encoded */
+		p = der_put_hdr(bits, DER_SEQUENCE,
+				der_uint_size(n, n_len) +
+				der_uint_size(e, e_len));
+		p = der_put_uint(p, n, n_len);
+		der_put_uint(p, e, e_len);
+		break;
+	case TEE_TYPE_ECDSA_KEYPAIR:
+	case TEE_TYPE_ECDH_KEYPAIR:
+		alg = der_alg_p256;
+		alg_len = sizeof(der_alg_p256);
+		bits[0] = 0x04;
+		res = get_ec_coord(key, TEE_ATTR_ECC_PUBLIC_VALUE_X,
+				   bits + 1, len);
+		if (res)
+			return res;
+		res = get_ec_coord(key, TEE_ATTR_ECC_PUBLIC_VALUE_Y,
+				   bits + 1 + len, len);
+		if (res)
+			return res;
+		bits_len = 1 + 2 * len;
+		break;
+	case TEE_TYPE_ED25519_KEYPAIR:
+		alg = der_alg_ed25519;
+		alg_len = sizeof(der_alg_ed25519);
+		bits_len = len;
+		res = get_pub_attr(key, TEE_ATTR_ED25519_PUBLIC_VALUE,
+				   bits, &bits_len);
+		if (res)
+			return res;
+		break;
+	case TEE_TYPE_X25519_KEYPAIR:
+		alg = der_alg_x25519;
+		alg_len = sizeof(der_alg_x25519);
+		bits_len = len;
+		res = get_pub_attr(key, TEE_ATTR_X25519_PUBLIC_VALUE,
+				   bits, &bits_len);
+		if (res)
+			return res;
+		break;
+	default:
+		return TEE_ERROR_NOT_SUPPORTED;
+	}
+
+	len = der_size(der_size(alg_len) + der_size(bits_len + 1));
+	p = der + len - bits_len;
+	TEE_MemMove(p, bits, bits_len);
+
+	p = der_put_hdr(der, DER_SEQUENCE, der_size(alg_len) +
+			der_size(bits_len + 1));
+	p = der_put_hdr(p, DER_SEQUENCE, alg_len);
+	TEE_MemMove(p, alg, alg_len);
+	p = der_put_hdr(p + alg_len, DER_BIT_STRING, bits_len + 1);
+	*p = 0;	/* No unused bits */
+
+	*der_len = len;
+	return TEE_SUCCESS;
+}
+
+static const char pem_header[] = "-----BEGIN PUBLIC KEY-----\n";
+static const char pem_footer[] = "-----END PUBLIC KEY-----\n";
+
+/* Base64 line length of PEM */
+#define PEM_LINE_LEN	64
+
+static uint32_t pem_size(uint32_t der_len)
+{
+	uint32_t b64_len = (der_len + 2) / 3 * 4;
+
+	return sizeof(pem_header) - 1 + b64_len +
+	       (b64_len + PEM_LINE_LEN - 1) / PEM_LINE_LEN +
+	       sizeof(pem_footer) - 1;
+}
+
+static void pem_encode(const uint8_t *der, uint32_t der_len, char *pem)
+{
+	static const char b64[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	uint32_t n;
+	uint32_t col = 0;
+	uint32_t v;
+
+	TEE_MemMove(pem, pem_header, sizeof(pem_header) - 1);
+	pem += sizeof(pem_header) - 1;
+
+	for (n = 0; n < der_len; n += 3) {
+		v = der[n] << 16;
+		if (n + 1 < der_len)
+			v |= der[n + 1] << 8;
+		if (n + 2 < der_len)
+			v |= der[n + 2];
+
+		*pem++ = b64[v >> 18];
+		*pem++ = b64[(v >> 12) & 0x3f];
+		*pem++ = n + 1 < der_len ? b64[(v >> 6) & 0x3f] : '=';
+		*pem++ = n + 2 < der_len ? b64[v & 0x3f] : '=';
+
+		col += 4;
+		if (col == PEM_LINE_LEN || n + 3 >= der_len) {
+			*pem++ = '\n';
+			col = 0;
+		}
+	}
+
+	TEE_MemMove(pem, pem_footer, sizeof(pem_footer) - 1);
+}
+
+static TEE_Result cmd_export_pubkey(struct acipher *state, uint32_t pt,
+				    TEE_Param params[TEE_NUM_PARAMS])
+{
+	TEE_Result res;
+	uint8_t *der;
+	uint32_t der_len;
+	uint32_t out_len;
 	const uint32_t exp_pt = TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
-						TEE_PARAM_TYPE_NONE,
+						TEE_PARAM_TYPE_MEMREF_OUTPUT,
 						TEE_PARAM_TYPE_NONE,
 						TEE_PARAM_TYPE_NONE);
 
 	if (pt != exp_pt)
 		return TEE_ERROR_BAD_PARAMETERS;
+	if (params[0].value.a != TA_ACIPHER_PUBKEY_DER &&
+	    params[0].value.a != TA_ACIPHER_PUBKEY_PEM)
+		return TEE_ERROR_BAD_PARAMETERS;
+	if (!state->key->handle)
+		return TEE_ERROR_BAD_STATE;
 
-	key_size = params[0].value.a;
+	der = TEE_Malloc(2 * mod_len(state) + PUBKEY_DER_OVERHEAD, 0);
+	if (!der)
+		return TEE_ERROR_OUT_OF_MEMORY;
 
-	res = TEE_AllocateTransientObject(key_type, key_size, &key);
-	if (res) {
-		EMSG("TEE_AllocateTransientObject(%#" PRIx32 ", %" PRId32 "): %#" PRIx32, key_type, key_size, res);
+	res = pubkey_der(state, der, &der_len);
+	if (res)
+		goto out;
+
+	if (params[0].value.a == TA_ACIPHER_PUBKEY_DER)
+		out_len = der_len;
+	else
+		out_len = pem_size(der_len);
+
+	if (params[1].memref.size < out_len) {
+		res = TEE_ERROR_SHORT_BUFFER;
+	} else if (params[0].value.a == TA_ACIPHER_PUBKEY_DER) {
+		TEE_MemMove(params[1].memref.buffer, der, der_len);
+	} else {
+		pem_encode(der, der_len, params[1].memref.buffer);
+	}
+	params[1].memref.size = out_len;
+out:
+	TEE_Free(der);
+	return res;
+}
+
+/*
+ * DER decoding of private keys as PKCS#8 PrivateKeyInfo (RFC 5208), or
+ * OneAsymmetricKey (RFC 5958) which adds the public key:
+ *
+ * SEQUENCE {
+ *	INTEGER version
+ *	SEQUENCE { algorithm OID, parameters }
+ *	OCTET STRING { private key }
+ *	[0] attributes OPTIONAL
+ *	[1] IMPLICIT BIT STRING { public key } OPTIONAL
+ * }
+ *
+ * where the private key is an RSAPrivateKey (RFC 8017) for RSA, an
+ * ECPrivateKey (RFC 5915) for P-256, and an OCTET STRING holding the raw
+ * private value for Ed25519 and X25519 (RFC 8410). The AlgorithmIdentifier
+ * is the same as in the SubjectPublicKeyInfo of the key.
+ */
+#define DER_OCTET_STRING	0x04
+#define DER_CONTEXT_0		0xa0
+#define DER_CONTEXT_1		0xa1
+#define DER_IMPLICIT_1		0x81
+
+/* Maximum number of attributes of a key pair, those of RSA */
+#define MAX_KEY_ATTRS		8
+
+struct der_reader {
+	const uint8_t *p;
+	uint32_t len;
+};
+
+struct parsed_key {
+	uint32_t key_type;	/* TEE_TYPE_xxx_KEYPAIR */
+	uint32_t key_size;	/* In bits */
+	TEE_Attribute attrs[MAX_KEY_ATTRS];
+	uint32_t attr_count;
+};
+
+static bool der_peek(struct der_reader *r, uint8_t tag)
+{
+	return r->len && r->p[0] == tag;
+}
+
+/* Read the next element of @r, which must be tagged @tag, into @val */
+static TEE_Result der_get(struct der_reader *r, uint8_t tag,
+			  struct der_reader *val)
+{
+	uint32_t hdr_len = 2;
+	uint32_t len;
+	uint32_t n;
+
+	if (r->len < 2 || r->p[0] != tag)
+		return TEE_ERROR_BAD_FORMAT;
+
+	len = r->p[1];
+	if (len & 0x80) {
+		/* Keys of up to 4096 bits take two length bytes */
+		n = len & 0x7f;
+		if (!n || n > 2 || r->len < 2 + n)
+			return TEE_ERROR_BAD_FORMAT;
+		len = 0;
+		while (n--)
+			len = (len << 8) | r->p[hdr_len++];
+	}
+	if (len > r->len - hdr_len)
+		return TEE_ERROR_BAD_FORMAT;
+
+	val->p = r->p + hdr_len;
+	val->len = len;
+	r->p += hdr_len + len;
+	r->len -= hdr_len + len;
+	return TEE_SUCCESS;
+}
+
+/* Read a non-negative INTEGER, without its leading zeroes */
+static TEE_Result der_get_uint(struct der_reader *r, struct der_reader *val)
+{
+	TEE_Result res;
+
+	res = der_get(r, DER_INTEGER, val);
+	if (res)
 		return res;
+	if (!val->len || val->p[0] & 0x80)
+		return TEE_ERROR_BAD_FORMAT;
+
+	while (val->len > 1 && !val->p[0]) {
+		val->p++;
+		val->len--;
 	}
+	return TEE_SUCCESS;
+}
 
-	res = TEE_GenerateKey(key, key_size, NULL, 0);
-	if (res) {
-		EMSG("TEE_GenerateKey(%" PRId32 "): %#" PRIx32,
-		     key_size, res);
-		TEE_FreeTransientObject(key);
+/* Read a BIT STRING of @len bytes with no unused bits */
+static TEE_Result der_get_bits(struct der_reader *r, uint8_t tag,
+			       uint32_t len, struct der_reader *val)
+{
+	TEE_Result res;
+
+	res = der_get(r, tag, val);
+	if (res)
+		return res;
+	if (val->len != len + 1 || val->p[0])
+		return TEE_ERROR_BAD_FORMAT;
+
+	val->p++;
+	val->len--;
+	return TEE_SUCCESS;
+}
+
+static void add_ref_attr(struct parsed_key *key, uint32_t attr,
+			 const struct der_reader *val)
+{
+	TEE_InitRefAttribute(key->attrs + key->attr_count, attr, val->p,
+			     val->len);
+	key->attr_count++;
+}
+
+static TEE_Result parse_rsa_key(struct der_reader *priv,
+				struct parsed_key *key)
+{
+	static const uint32_t rsa_attrs[MAX_KEY_ATTRS] = {
+		TEE_ATTR_RSA_MODULUS, TEE_ATTR_RSA_PUBLIC_EXPONENT,
+		TEE_ATTR_RSA_PRIVATE_EXPONENT, TEE_ATTR_RSA_PRIME1,
+		TEE_ATTR_RSA_PRIME2, TEE_ATTR_RSA_EXPONENT1,
+		TEE_ATTR_RSA_EXPONENT2, TEE_ATTR_RSA_COEFFICIENT,
+	};
+	TEE_Result res;
+	struct der_reader seq;
+	struct der_reader val;
+	uint8_t top;
+	size_t n;
+
+	res = der_get(priv, DER_SEQUENCE, &seq);
+	if (res)
+		return res;
+
+	/* Only two-prime keys, version 0 */
+	res = der_get_uint(&seq, &val);
+	if (res)
 		return res;
+	if (val.len != 1 || val.p[0])
+		return TEE_ERROR_NOT_SUPPORTED;
+
+	for (n = 0; n < MAX_KEY_ATTRS; n++) {
+		res = der_get_uint(&seq, &val);
+		if (res)
+			return res;
+		add_ref_attr(key, rsa_attrs[n], &val);
 	}
 
-	TEE_FreeTransientObject(state->key);
-	state->key = key;
+	/* The key size is the size of the modulus in bits */
+	val.p = key->attrs[0].content.ref.buffer;
+	val.len = key->attrs[0].content.ref.length;
+	if (!val.p[0])
+		return TEE_ERROR_BAD_FORMAT;
+	key->key_size = val.len * 8;
+	for (top = val.p[0]; !(top & 0x80); top <<= 1)
+		key->key_size--;
+
+	key->key_type = TEE_TYPE_RSA_KEYPAIR;
 	return TEE_SUCCESS;
 }
 
-static TEE_Result cmd_enc(struct acipher *state, uint32_t pt,
-			  TEE_Param params[TEE_NUM_PARAMS])
+static TEE_Result parse_p256_key(struct der_reader *priv,
+				 struct der_reader *pub,
+				 uint32_t key_type, struct parsed_key *key)
+{
+	TEE_Result res;
+	struct der_reader seq;
+	struct der_reader val;
+	struct der_reader ctx;
+	const uint32_t len = 256 / 8;
+
+	res = der_get(priv, DER_SEQUENCE, &seq);
+	if (res)
+		return res;
+
+	res = der_get_uint(&seq, &val);
+	if (res)
+		return res;
+	if (val.len != 1 || val.p[0] != 1)
+		return TEE_ERROR_BAD_FORMAT;
+
+	res = der_get(&seq, DER_OCTET_STRING, &val);
+	if (res)
+		return res;
+	if (!val.len || val.len > len)
+		return TEE_ERROR_BAD_FORMAT;
+	add_ref_attr(key, TEE_ATTR_ECC_PRIVATE_VALUE, &val);
+
+	/* The curve is already given by the AlgorithmIdentifier */
+	if (der_peek(&seq, DER_CONTEXT_0)) {
+		res = der_get(&seq, DER_CONTEXT_0, &ctx);
+		if (res)
+			return res;
+	}
+
+	/* The public key is usually here, and optionally in PKCS#8 */
+	if (der_peek(&seq, DER_CONTEXT_1)) {
+		res = der_get(&seq, DER_CONTEXT_1, &ctx);
+		if (res)
+			return res;
+		pub = &ctx;
+		res = der_get_bits(pub, DER_BIT_STRING, 1 + 2 * len, &val);
+	} else if (pub->len) {
+		res = der_get_bits(pub, DER_IMPLICIT_1, 1 + 2 * len, &val);
+	} else {
+		EMSG("P-256 key without its public key");
+		return TEE_ERROR_NOT_SUPPORTED;
+	}
+	if (res)
+		return res;
+
+	/* Uncompressed point */
+	if (val.p[0] != 0x04)
+		return TEE_ERROR_NOT_SUPPORTED;
+	val.p++;
+	val.len = len;
+	add_ref_attr(key, TEE_ATTR_ECC_PUBLIC_VALUE_X, &val);
+	val.p += len;
+	add_ref_attr(key, TEE_ATTR_ECC_PUBLIC_VALUE_Y, &val);
+
+	TEE_InitValueAttribute(key->attrs + key->attr_count,
+			       TEE_ATTR_ECC_CURVE, TEE_ECC_CURVE_NIST_P256, 0);
+	key->attr_count++;
+
+	key->key_type = key_type;
+	key->key_size = 256;
+	return TEE_SUCCESS;
+}
+
+static TEE_Result parse_25519_key(struct der_reader *priv,
+				  struct der_reader *pub,
+				  uint32_t key_type, struct parsed_key *key)
+{
+	TEE_Result res;
+	struct der_reader val;
+	const uint32_t len = 256 / 8;
+
+	res = der_get(priv, DER_OCTET_STRING, &val);
+	if (res)
+		return res;
+	if (val.len != len)
+		return TEE_ERROR_BAD_FORMAT;
+	add_ref_attr(key, key_type == TEE_TYPE_ED25519_KEYPAIR ?
+			  TEE_ATTR_ED25519_PRIVATE_VALUE :
+			  TEE_ATTR_X25519_PRIVATE_VALUE, &val);
+
+	/* The public key cannot be computed with the GP API */
+	if (!pub->len) {
+		EMSG("Curve25519 key without its public key");
+		return TEE_ERROR_NOT_SUPPORTED;
+	}
+	res = der_get_bits(pub, DER_IMPLICIT_1, len, &val);
+	if (res)
+		return res;
+	add_ref_attr(key, key_type == TEE_TYPE_ED25519_KEYPAIR ?
+			  TEE_ATTR_ED25519_PUBLIC_VALUE :
+			  TEE_ATTR_X25519_PUBLIC_VALUE, &val);
+
+	key->key_type = key_type;
+	key->key_size = 256;
+	return TEE_SUCCESS;
+}
+
+static bool der_equal(const struct der_reader *r, const uint8_t *v,
+		      uint32_t len)
+{
+	return r->len == len && !TEE_MemCompare(r->p, v, len);
+}
+
+/*
+ * Parse a DER private key into the attributes of its key pair, which point
+ * into @der. @ta_key_type tells the use of P-256 keys.
+ */
+static TEE_Result parse_private_key(const uint8_t *der, uint32_t der_len,
+				    uint32_t ta_key_type,
+				    struct parsed_key *key)
+{
+	TEE_Result res;
+	struct der_reader r = { .p = der, .len = der_len };
+	struct der_reader seq;
+	struct der_reader val;
+	struct der_reader alg;
+	struct der_reader priv;
+
+	res = der_get(&r, DER_SEQUENCE, &seq);
+	if (res)
+		return res;
+	if (r.len)
+		return TEE_ERROR_BAD_FORMAT;
+
+	/* Version 0 (PrivateKeyInfo) or 1 (OneAsymmetricKey) */
+	res = der_get_uint(&seq, &val);
+	if (res)
+		return res;
+	if (val.len != 1 || val.p[0] > 1)
+		return TEE_ERROR_NOT_SUPPORTED;
+
+	res = der_get(&seq, DER_SEQUENCE, &alg);
+	if (res)
+		return res;
+	res = der_get(&seq, DER_OCTET_STRING, &priv);
+	if (res)
+		return res;
+	if (der_peek(&seq, DER_CONTEXT_0)) {
+		res = der_get(&seq, DER_CONTEXT_0, &val);
+		if (res)
+			return res;
+	}
+	/* What is left is the public key, if any */
+
+	key->attr_count = 0;
+
+	if (der_equal(&alg, der_alg_rsa, sizeof(der_alg_rsa)))
+		return parse_rsa_key(&priv, key);
+
+	if (der_equal(&alg, der_alg_p256, sizeof(der_alg_p256))) {
+		if (ta_key_type == TA_ACIPHER_KEY_ECDH_P256)
+			return parse_p256_key(&priv, &seq,
+					      TEE_TYPE_ECDH_KEYPAIR, key);
+		return parse_p256_key(&priv, &seq, TEE_TYPE_ECDSA_KEYPAIR,
+				      key);
+	}
+
+	if (der_equal(&alg, der_alg_ed25519, sizeof(der_alg_ed25519)))
+		return parse_25519_key(&priv, &seq, TEE_TYPE_ED25519_KEYPAIR,
+				       key);
+
+	if (der_equal(&alg, der_alg_x25519, sizeof(der_alg_x25519)))
+		return parse_25519_key(&priv, &seq, TEE_TYPE_X25519_KEYPAIR,
+				       key);
+
+	EMSG("Unsupported private key algorithm");
+	return TEE_ERROR_NOT_SUPPORTED;
+}
+
+/*
+ * Populate @key with @parsed. The transient object is reused when it already
+ * has the right type and size, as keys imported together usually do.
+ */
+static TEE_Result populate_key(const struct parsed_key *parsed,
+			       TEE_ObjectHandle *key)
 {
 	TEE_Result res;
-	const void *inbuf;
-	uint32_t inbuf_len;
-	void *outbuf;
-	uint32_t outbuf_len;
-	TEE_OperationHandle op;
 	TEE_ObjectInfo key_info;
-	const uint32_t alg = TEE_ALG_RSAES_PKCS1_V1_5;
+
+	if (*key) {
+		res = TEE_GetObjectInfo1(*key, &key_info);
+		if (res) {
+			EMSG("TEE_GetObjectInfo1: %#" PRIx32, res);
+			return res;
+		}
+		if (key_info.objectType == parsed->key_type &&
+		    key_info.maxKeySize == parsed->key_size) {
+			TEE_ResetTransientObject(*key);
+		} else {
+			TEE_FreeTransientObject(*key);
+			*key = TEE_HANDLE_NULL;
+		}
+	}
+
+	if (!*key) {
+		res = TEE_AllocateTransientObject(parsed->key_type,
+						  parsed->key_size, key);
+		if (res) {
+			EMSG("TEE_AllocateTransientObject(%#" PRIx32 ", %" PRId32 "): %#" PRIx32, parsed->key_type, parsed->key_size, res);
+			return res;
+		}
+	}
+
+	res = TEE_PopulateTransientObject(*key, parsed->attrs,
+					  parsed->attr_count);
+	if (res)
+		EMSG("TEE_PopulateTransientObject: %#" PRIx32, res);
+	return res;
+}
+
+/*
+ * Get the next key of the packed keys at @r. They are in shared memory, so
+ * the header and the ID are copied, and the DER key is copied to the
+ * @der_size bytes at @der before being parsed.
+ */
+static TEE_Result get_import_item(struct der_reader *r,
+				  struct acipher_key_import *hdr,
+				  struct key_id *id, uint8_t *der,
+				  uint32_t der_size)
+{
+	if (r->len < sizeof(*hdr))
+		return TEE_ERROR_BAD_PARAMETERS;
+	TEE_MemMove(hdr, r->p, sizeof(*hdr));
+	if (hdr->id_len > sizeof(id->id) || hdr->der_len > der_size ||
+	    r->len - sizeof(*hdr) < hdr->id_len ||
+	    r->len - sizeof(*hdr) - hdr->id_len < hdr->der_len)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	TEE_MemMove(id->id, r->p + sizeof(*hdr), hdr->id_len);
+	id->len = hdr->id_len;
+	TEE_MemMove(der, r->p + sizeof(*hdr) + hdr->id_len, hdr->der_len);
+
+	r->p += TA_ACIPHER_KEY_IMPORT_SIZE(hdr->id_len, hdr->der_len);
+	r->len -= TA_ACIPHER_KEY_IMPORT_SIZE(hdr->id_len, hdr->der_len);
+	return TEE_SUCCESS;
+}
+
+static TEE_Result import_key(struct acipher *state, uint32_t mode,
+			     const struct acipher_key_import *hdr,
+			     const struct key_id *id, const uint8_t *der,
+			     TEE_ObjectHandle *key)
+{
+	TEE_Result res;
+	struct parsed_key parsed;
+
+	if ((mode == TA_ACIPHER_IMPORT_SESSION) != !id->len)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = parse_private_key(der, hdr->der_len, hdr->key_type, &parsed);
+	if (res)
+		return res;
+
+	res = populate_key(&parsed, key);
+	if (res)
+		return res;
+
+	if (mode == TA_ACIPHER_IMPORT_PERSIST)
+		return store_key(id, *key);
+
+	res = use_key(state, *key);
+	*key = TEE_HANDLE_NULL;
+	return res;
+}
+
+static TEE_Result cmd_key_import(struct acipher *state, uint32_t pt,
+				 TEE_Param params[TEE_NUM_PARAMS])
+{
+	TEE_Result res = TEE_SUCCESS;
+	struct der_reader r;
+	struct acipher_key_import hdr;
+	struct key_id id;
+	TEE_ObjectHandle key = TEE_HANDLE_NULL;
+	uint8_t *der;
+	uint32_t der_size = 0;
+	uint32_t item_res;
+	uint32_t mode;
+	uint8_t *out;
+	uint32_t count = 0;
+	uint32_t n;
 	const uint32_t exp_pt = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
 						TEE_PARAM_TYPE_MEMREF_OUTPUT,
-						TEE_PARAM_TYPE_NONE,
+						TEE_PARAM_TYPE_VALUE_INPUT,
 						TEE_PARAM_TYPE_NONE);
 
 	if (pt != exp_pt)
 		return TEE_ERROR_BAD_PARAMETERS;
-	if (!state->key)
-		return TEE_ERROR_BAD_STATE;
 
-	res = TEE_GetObjectInfo1(state->key, &key_info);
-	if (res) {
-		EMSG("TEE_GetObjectInfo1: %#" PRIx32, res);
-		return res;
+	mode = params[2].value.a;
+	if (mode != TA_ACIPHER_IMPORT_SESSION &&
+	    mode != TA_ACIPHER_IMPORT_PERSIST)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	/*
+	 * Count the keys and find the largest, their headers are checked
+	 * again when imported.
+	 */
+	r.p = params[0].memref.buffer;
+	r.len = params[0].memref.size;
+	while (r.len) {
+		if (r.len < sizeof(hdr))
+			return TEE_ERROR_BAD_PARAMETERS;
+		TEE_MemMove(&hdr, r.p, sizeof(hdr));
+		if (hdr.id_len > r.len - sizeof(hdr) ||
+		    hdr.der_len > r.len - sizeof(hdr) - hdr.id_len)
+			return TEE_ERROR_BAD_PARAMETERS;
+		r.p += TA_ACIPHER_KEY_IMPORT_SIZE(hdr.id_len, hdr.der_len);
+		r.len -= TA_ACIPHER_KEY_IMPORT_SIZE(hdr.id_len, hdr.der_len);
+		if (hdr.der_len > der_size)
+			der_size = hdr.der_len;
+		count++;
 	}
+	if (!count || !der_size || count > TA_ACIPHER_MAX_BATCH ||
+	    (mode == TA_ACIPHER_IMPORT_SESSION && count != 1))
+		return TEE_ERROR_BAD_PARAMETERS;
 
-	inbuf = params[0].memref.buffer;
-	inbuf_len = params[0].memref.size;
-	outbuf = params[1].memref.buffer;
-	outbuf_len = params[1].memref.size;
+	if (params[1].memref.size < count * sizeof(uint32_t)) {
+		params[1].memref.size = count * sizeof(uint32_t);
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+	params[1].memref.size = count * sizeof(uint32_t);
 
-	res = TEE_AllocateOperation(&op, alg, TEE_MODE_ENCRYPT,
-				    key_info.keySize);
-	if (res) {
-		EMSG("TEE_AllocateOperation(TEE_MODE_ENCRYPT, %#" PRIx32 ", %" PRId32 "): %#" PRIx32, alg, key_info.keySize, res);
-		return res;
+	der = TEE_Malloc(der_size, 0);
+	if (!der)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	r.p = params[0].memref.buffer;
+	r.len = params[0].memref.size;
+	out = params[1].memref.buffer;
+	for (n = 0; n < count; n++) {
+		res = get_import_item(&r, &hdr, &id, der, der_size);
+		if (res)
+			break;
+
+		item_res = import_key(state, mode, &hdr, &id, der, &key);
+		TEE_MemMove(out + n * sizeof(item_res), &item_res,
+			    sizeof(item_res));
 	}
 
-	res = TEE_SetOperationKey(op, state->key);
-	if (res) {
-		EMSG("TEE_SetOperationKey: %#" PRIx32, res);
-		goto out;
+	/* Do not leave private keys behind in the heap */
+	TEE_MemFill(der, 0, der_size);
+	TEE_Free(der);
+	TEE_FreeTransientObject(key);
+	return res;
+}
+
+static uint32_t tee2ta_key_type(uint32_t key_type)
+{
+	switch (key_type) {
+	case TEE_TYPE_ECDSA_KEYPAIR:
+		return TA_ACIPHER_KEY_ECDSA_P256;
+	case TEE_TYPE_ECDH_KEYPAIR:
+		return TA_ACIPHER_KEY_ECDH_P256;
+	case TEE_TYPE_ED25519_KEYPAIR:
+		return TA_ACIPHER_KEY_ED25519;
+	case TEE_TYPE_X25519_KEYPAIR:
+		return TA_ACIPHER_KEY_X25519;
+	default:
+		return TA_ACIPHER_KEY_RSA;
 	}
+}
 
-	res = TEE_AsymmetricEncrypt(op, NULL, 0, inbuf, inbuf_len, outbuf,
-				    &outbuf_len);
-	if (res) {
-		EMSG("TEE_AsymmetricEncrypt(%" PRId32 ", %" PRId32 "): %#" PRIx32, inbuf_len, params[1].memref.size, res);
+static TEE_Result cmd_key_info(struct acipher *state, uint32_t pt,
+			       TEE_Param params[TEE_NUM_PARAMS])
+{
+	struct acipher_key_info info = { };
+	const uint32_t exp_pt = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_OUTPUT,
+						TEE_PARAM_TYPE_NONE,
+						TEE_PARAM_TYPE_NONE,
+						TEE_PARAM_TYPE_NONE);
+
+	if (pt != exp_pt)
+		return TEE_ERROR_BAD_PARAMETERS;
+	if (!state->key->handle)
+		return TEE_ERROR_BAD_STATE;
+
+	if (params[0].memref.size < sizeof(info)) {
+		params[0].memref.size = sizeof(info);
+		return TEE_ERROR_SHORT_BUFFER;
 	}
-	params[1].memref.size = outbuf_len;
 
-out:
-	TEE_FreeOperation(op);
-	return res;
+	info.key_type = tee2ta_key_type(state->key->type);
+	info.key_size = state->key->size;
+	info.mod_len = mod_len(state);
+
+	switch (state->key->type) {
+	case TEE_TYPE_RSA_KEYPAIR:
+		/* RFC 8017: 11 bytes of padding, or two digests and 2 bytes */
+		info.sig_len = sig_len(state);
+		if (info.mod_len > 11)
+			info.max_pt_pkcs1_v1_5 = info.mod_len - 11;
+		if (info.mod_len > 2 * SHA256_SIZE + 2)
+			info.max_pt_oaep_sha256 = info.mod_len -
+						  2 * SHA256_SIZE - 2;
+		break;
+	case TEE_TYPE_ECDSA_KEYPAIR:
+	case TEE_TYPE_ED25519_KEYPAIR:
+		info.sig_len = sig_len(state);
+		break;
+	default:
+		break;
+	}
+
+	TEE_MemMove(params[0].memref.buffer, &info, sizeof(info));
+	params[0].memref.size = sizeof(info);
+	return TEE_SUCCESS;
+}
+
+static TEE_Result cmd_heap_stats(uint32_t pt,
+				 TEE_Param params[TEE_NUM_PARAMS])
+{
+	const uint32_t exp_pt = TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_OUTPUT,
+						TEE_PARAM_TYPE_VALUE_OUTPUT,
+						TEE_PARAM_TYPE_VALUE_INPUT,
+						TEE_PARAM_TYPE_NONE);
+#ifdef CFG_WITH_STATS
+	struct malloc_stats stats;
+
+	if (pt != exp_pt)
+		return TEE_ERROR_BAD_PARAMETERS;
 
+	malloc_get_stats(&stats);
+	params[0].value.a = stats.allocated;
+	params[0].value.b = stats.max_allocated;
+	params[1].value.a = stats.size;
+	params[1].value.b = 0;
+
+	if (params[2].value.a)
+		malloc_reset_stats();
+
+	return TEE_SUCCESS;
+#else
+	if (pt != exp_pt)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	return TEE_ERROR_NOT_SUPPORTED;
+#endif
 }
 
 TEE_Result TA_CreateEntryPoint(void)
@@ -115,7 +2426,15 @@ TEE_Result TA_CreateEntryPoint(void)
 
 void TA_DestroyEntryPoint(void)
 {
-	/* Nothing to do */
+	size_t n;
+	size_t k;
+
+	for (n = 0; n < TA_ACIPHER_POOL_MAX_SIZES; n++)
+		for (k = 0; k < pools[n].stats.depth; k++)
+			TEE_FreeTransientObject(pools[n].keys[k]);
+
+	for (n = 0; n < KEY_CACHE_SIZE; n++)
+		TEE_FreeTransientObject(key_cache[n].key);
 }
 
 TEE_Result TA_OpenSessionEntryPoint(uint32_t __unused param_types,
@@ -123,6 +2442,7 @@ TEE_Result TA_OpenSessionEntryPoint(uint32_t __unused param_types,
 					void **session)
 {
 	struct acipher *state;
+	size_t n;
 
 	/*
 	 * Allocate and init state for the session.
@@ -131,7 +2451,17 @@ TEE_Result TA_OpenSessionEntryPoint(uint32_t __unused param_types,
 	if (!state)
 		return TEE_ERROR_OUT_OF_MEMORY;
 
-	state->key = TEE_HANDLE_NULL;
+	state->key = &state->session_key;
+	state->session_key.handle = TEE_HANDLE_NULL;
+	state->session_key.id.len = 0;
+	for (n = 0; n < MAX_OPS; n++)
+		state->session_key.ops[n].op = TEE_HANDLE_NULL;
+	state->named_keys = NULL;
+	state->named_key_count = 0;
+	state->use_count = 0;
+	state->env_key = TEE_HANDLE_NULL;
+	state->env_seal_op = TEE_HANDLE_NULL;
+	state->env_open_op = TEE_HANDLE_NULL;
 
 	*session = state;
 
@@ -142,21 +2472,103 @@ void TA_CloseSessionEntryPoint(void *session)
 {
 	struct acipher *state = session;
 
-	TEE_FreeTransientObject(state->key);
+	size_t n;
+
+	env_free(state);
+	free_key(&state->session_key);
+	for (n = 0; n < state->named_key_count; n++)
+		free_key(state->named_keys + n);
+	TEE_Free(state->named_keys);
+	named_key_total -= state->named_key_count;
 	TEE_Free(state);
 }
 
-TEE_Result TA_InvokeCommandEntryPoint(void *session, uint32_t cmd,
-				      uint32_t param_types,
-				      TEE_Param params[TEE_NUM_PARAMS])
+static TEE_Result invoke_command(void *session, uint32_t cmd,
+				 uint32_t param_types,
+				 TEE_Param params[TEE_NUM_PARAMS])
 {
 	switch (cmd) {
 	case TA_ACIPHER_CMD_GEN_KEY:
 		return cmd_gen_key(session, param_types, params);
 	case TA_ACIPHER_CMD_ENCRYPT:
 		return cmd_enc(session, param_types, params);
+	case TA_ACIPHER_CMD_POOL_REFILL:
+		return cmd_pool_refill(param_types, params);
+	case TA_ACIPHER_CMD_POOL_STATS:
+		return cmd_pool_stats(param_types, params);
+	case TA_ACIPHER_CMD_DECRYPT:
+		return cmd_dec(session, param_types, params);
+	case TA_ACIPHER_CMD_SIGN:
+		return cmd_sign(session, param_types, params);
+	case TA_ACIPHER_CMD_VERIFY:
+		return cmd_verify(session, param_types, params);
+	case TA_ACIPHER_CMD_SIGN_BATCH:
+		return cmd_sign_batch(session, param_types, params);
+	case TA_ACIPHER_CMD_VERIFY_BATCH:
+		return cmd_verify_batch(session, param_types, params);
+	case TA_ACIPHER_CMD_DECRYPT_BATCH:
+		return cmd_dec_batch(session, param_types, params);
+	case TA_ACIPHER_CMD_DERIVE:
+		return cmd_derive(session, param_types, params);
+	case TA_ACIPHER_CMD_ENVELOPE_SEAL:
+		return cmd_env_seal(session, param_types, params);
+	case TA_ACIPHER_CMD_ENVELOPE_OPEN_INIT:
+		return cmd_env_open_init(session, param_types, params);
+	case TA_ACIPHER_CMD_ENVELOPE_OPEN_UPDATE:
+		return cmd_env_open_update(session, param_types, params);
+	case TA_ACIPHER_CMD_ENVELOPE_OPEN_FINAL:
+		return cmd_env_open_final(session, param_types, params);
+	case TA_ACIPHER_CMD_KEY_STORE:
+		return cmd_key_store(session, param_types, params);
+	case TA_ACIPHER_CMD_KEY_LOAD:
+		return cmd_key_load(session, param_types, params);
+	case TA_ACIPHER_CMD_EXPORT_PUBKEY:
+		return cmd_export_pubkey(session, param_types, params);
+	case TA_ACIPHER_CMD_HEAP_STATS:
+		return cmd_heap_stats(param_types, params);
+	case TA_ACIPHER_CMD_KEY_IMPORT:
+		return cmd_key_import(session, param_types, params);
+	case TA_ACIPHER_CMD_KEY_INFO:
+		return cmd_key_info(session, param_types, params);
 	default:
 		EMSG("Command ID %#" PRIx32 " is not supported", cmd);
 		return TEE_ERROR_NOT_SUPPORTED;
 	}
 }
+
+TEE_Result TA_InvokeCommandEntryPoint(void *session, uint32_t cmd,
+				      uint32_t param_types,
+				      TEE_Param params[TEE_NUM_PARAMS])
+{
+	TEE_Result res;
+	struct acipher *state = session;
+	bool load = true;
+
+	if (TEE_PARAM_TYPE_GET(param_types, 3) != TEE_PARAM_TYPE_MEMREF_INPUT)
+		return invoke_command(session, cmd, param_types, params);
+
+	/* params[3] names the key of the command */
+	switch (cmd) {
+	case TA_ACIPHER_CMD_POOL_REFILL:
+	case TA_ACIPHER_CMD_POOL_STATS:
+	case TA_ACIPHER_CMD_HEAP_STATS:
+		return TEE_ERROR_BAD_PARAMETERS;
+	case TA_ACIPHER_CMD_GEN_KEY:
+	case TA_ACIPHER_CMD_KEY_LOAD:
+	case TA_ACIPHER_CMD_KEY_IMPORT:
+		/* These set the key */
+		load = false;
+		break;
+	default:
+		break;
+	}
+
+	res = select_named_key(state, params + 3, load);
+	if (res)
+		return res;
+
+	param_types &= ~TEE_PARAM_TYPES(0, 0, 0, 0xf);
+	res = invoke_command(session, cmd, param_types, params);
+	unselect_named_key(state);
+	return res;
+}
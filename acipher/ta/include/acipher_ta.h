@@ -6,13 +6,30 @@
 #ifndef __ACIPHER_TA_H__
 #define __ACIPHER_TA_H__
 
+#include <stdint.h>
+
 /* UUID of the acipher example trusted application */
 #define TA_ACIPHER_UUID \
 	{ 0xa734eed9, 0xd6a1, 0x4244, { \
 		0xaa, 0x50, 0x7c, 0x99, 0x71, 0x9e, 0x7b, 0x7b } }
 
 /*
- * in	params[0].value.a key size
+ * A session has a session key, and named keys. Every command below that
+ * sets or uses the session key takes an optional key ID in params[3]
+ * (memref input, up to TEE_OBJECT_ID_MAX_LEN bytes) to work on the named
+ * key of this ID instead. A named key that is not yet in the session is
+ * loaded from secure storage, as with TA_ACIPHER_CMD_KEY_LOAD, unless the
+ * command sets it.
+ *
+ * The named keys of all sessions together are bounded: once the bound is
+ * reached, a session evicts its least recently used named key, and keys not
+ * in secure storage are then lost. A session fails with
+ * TEE_ERROR_OUT_OF_MEMORY when other sessions hold all the named keys.
+ */
+
+/*
+ * in	params[0].value.a key size, ignored for elliptic curve keys
+ * in	params[0].value.b TA_ACIPHER_KEY_xxx
  */
 #define TA_ACIPHER_CMD_GEN_KEY		0
 
@@ -22,4 +39,277 @@
  */
 #define TA_ACIPHER_CMD_ENCRYPT		1
 
+/*
+ * Generate one key for the pool of keys of a given size. TA_ACIPHER_CMD_GEN_KEY
+ * takes its key from the pool when one is ready. At most one key is
+ * generated per invoke, so that other sessions of the TA are not held for
+ * more than one key generation: call again while out params[1].value.b is
+ * not zero.
+ *
+ * in	params[0].value.a key size
+ * in	params[0].value.b target number of ready keys in the pool
+ * out	params[1].value.a number of ready keys in the pool
+ * out	params[1].value.b number of keys still missing to reach the target
+ */
+#define TA_ACIPHER_CMD_POOL_REFILL	2
+
+/*
+ * out	params[0].memref  array of struct acipher_pool_stats, one per pool
+ */
+#define TA_ACIPHER_CMD_POOL_STATS	3
+
+/* Maximum number of ready keys in a pool */
+#define TA_ACIPHER_POOL_MAX_DEPTH	8
+/* Maximum number of pools, that is of different key sizes */
+#define TA_ACIPHER_POOL_MAX_SIZES	4
+
+struct acipher_pool_stats {
+	uint32_t key_size;
+	uint32_t depth;		/* Keys ready in the pool */
+	uint32_t target;	/* Last target depth requested */
+	uint32_t hits;		/* GEN_KEY served from the pool */
+	uint32_t misses;	/* GEN_KEY that had to generate the key */
+	uint32_t generated;	/* Keys generated by POOL_REFILL */
+};
+
+/*
+ * in	params[0].memref  input, encrypted with TA_ACIPHER_CMD_ENCRYPT
+ * out	params[1].memref  output
+ */
+#define TA_ACIPHER_CMD_DECRYPT		4
+
+/*
+ * in	params[0].memref  digest
+ * out	params[1].memref  signature
+ * in	params[2].value.a TA_ACIPHER_ALG_xxx
+ */
+#define TA_ACIPHER_CMD_SIGN		5
+
+/*
+ * Returns TEE_ERROR_SIGNATURE_INVALID when the signature does not match.
+ *
+ * in	params[0].memref  digest
+ * in	params[1].memref  signature
+ * in	params[2].value.a TA_ACIPHER_ALG_xxx
+ */
+#define TA_ACIPHER_CMD_VERIFY		6
+
+/*
+ * Batched variants of the commands above, processing up to
+ * TA_ACIPHER_MAX_BATCH items in one invoke. Items are packed with a fixed
+ * size: the digest size of the algorithm, the signature size, and the
+ * modulus size (key size in bytes) for ciphertexts.
+ */
+
+/*
+ * in	params[0].memref  digests
+ * out	params[1].memref  signatures
+ * in	params[2].value.a TA_ACIPHER_ALG_xxx
+ */
+#define TA_ACIPHER_CMD_SIGN_BATCH	7
+
+/*
+ * in	params[0].memref  (digest, signature) pairs
+ * out	params[1].memref  array of uint32_t, result of each verification:
+ *			  TEE_SUCCESS or TEE_ERROR_SIGNATURE_INVALID
+ * in	params[2].value.a TA_ACIPHER_ALG_xxx
+ */
+#define TA_ACIPHER_CMD_VERIFY_BATCH	8
+
+/*
+ * in	params[0].memref  ciphertexts
+ * out	params[1].memref  one slot of TA_ACIPHER_DEC_SLOT_SIZE(modulus size)
+ *			  bytes per ciphertext: a struct acipher_dec_slot
+ *			  followed by the plaintext
+ */
+#define TA_ACIPHER_CMD_DECRYPT_BATCH	9
+
+#define TA_ACIPHER_MAX_BATCH		64
+
+/*
+ * Key agreement with the ECDH P-256 or X25519 session key. A P-256 public
+ * key that is not a point of the curve is rejected with
+ * TEE_ERROR_BAD_PARAMETERS.
+ *
+ * in	params[0].memref  public key of the peer: X || Y for P-256
+ * out	params[1].memref  shared secret
+ */
+#define TA_ACIPHER_CMD_DERIVE		10
+
+/*
+ * Envelope encryption of payloads of any size with the RSA session key: the
+ * payload is encrypted with a fresh AES-256 key in GCM mode, and the AES key
+ * is wrapped with RSAES-OAEP (SHA-256). An envelope is a struct
+ * acipher_envelope followed by the wrapped key, the encrypted payload and the
+ * GCM tag, see TA_ACIPHER_ENVELOPE_SIZE().
+ *
+ * in	params[0].memref  payload
+ * out	params[1].memref  envelope
+ */
+#define TA_ACIPHER_CMD_ENVELOPE_SEAL	11
+
+/*
+ * Envelopes are opened in a stream: OPEN_INIT unwraps the AES key, then
+ * OPEN_UPDATE decrypts the payload chunk by chunk and OPEN_FINAL checks the
+ * tag. The decrypted data must not be used before OPEN_FINAL succeeds.
+ *
+ * in	params[0].memref  struct acipher_envelope followed by the wrapped key
+ */
+#define TA_ACIPHER_CMD_ENVELOPE_OPEN_INIT	12
+
+/*
+ * in	params[0].memref  encrypted payload chunk
+ * out	params[1].memref  decrypted data
+ */
+#define TA_ACIPHER_CMD_ENVELOPE_OPEN_UPDATE	13
+
+/*
+ * Returns TEE_ERROR_MAC_INVALID when the envelope has been tampered with.
+ *
+ * in	params[0].memref  last encrypted payload chunk, may be empty
+ * out	params[1].memref  decrypted data
+ * in	params[2].memref  tag
+ */
+#define TA_ACIPHER_CMD_ENVELOPE_OPEN_FINAL	14
+
+#define TA_ACIPHER_ENVELOPE_IV_SIZE	12
+#define TA_ACIPHER_ENVELOPE_TAG_SIZE	16
+
+/* Header of an envelope, authenticated along with the payload */
+struct acipher_envelope {
+	uint32_t wrapped_key_len;	/* Size of the wrapped key */
+	uint32_t payload_len;		/* Size of the payload */
+	uint8_t iv[TA_ACIPHER_ENVELOPE_IV_SIZE];
+};
+
+#define TA_ACIPHER_ENVELOPE_SIZE(mod_len, payload_len) \
+	(sizeof(struct acipher_envelope) + (mod_len) + (payload_len) + \
+	 TA_ACIPHER_ENVELOPE_TAG_SIZE)
+
+/*
+ * Store the session key in secure storage under a caller chosen ID, up to
+ * TEE_OBJECT_ID_MAX_LEN (64) bytes, replacing any key stored under this ID.
+ *
+ * in	params[0].memref  key ID
+ */
+#define TA_ACIPHER_CMD_KEY_STORE	15
+
+/*
+ * Make a stored key the session key. Keys are kept in memory once loaded,
+ * so that later sessions loading them do not read secure storage again.
+ * Returns TEE_ERROR_ITEM_NOT_FOUND when no key is stored under this ID.
+ *
+ * in	params[0].memref  key ID
+ */
+#define TA_ACIPHER_CMD_KEY_LOAD		16
+
+/*
+ * Export the public part of the session key as a DER SubjectPublicKeyInfo,
+ * or its PEM encoding. Public key operations need no secret and can then be
+ * done in the normal world.
+ *
+ * in	params[0].value.a TA_ACIPHER_PUBKEY_xxx
+ * out	params[1].memref  public key
+ */
+#define TA_ACIPHER_CMD_EXPORT_PUBKEY	17
+
+/*
+ * Usage of the TA heap, shared by all sessions. Only supported when the TA
+ * is built with CFG_WITH_STATS=y, TEE_ERROR_NOT_SUPPORTED otherwise.
+ *
+ * out	params[0].value.a bytes allocated
+ * out	params[0].value.b maximum bytes allocated since the last reset
+ * out	params[1].value.a heap size
+ * in	params[2].value.a 1 to reset the maximum once read
+ */
+#define TA_ACIPHER_CMD_HEAP_STATS	18
+
+/*
+ * Import private keys encoded as DER PKCS#8 PrivateKeyInfo, or
+ * OneAsymmetricKey, up to TA_ACIPHER_MAX_BATCH per invoke. Each key is a
+ * struct acipher_key_import followed by the key ID and the DER key, see
+ * TA_ACIPHER_KEY_IMPORT_SIZE(). The keys are parsed by the TA, then either
+ * made the session key (TA_ACIPHER_IMPORT_SESSION, a single key with an
+ * empty ID), or stored in secure storage under their ID as with
+ * TA_ACIPHER_CMD_KEY_STORE (TA_ACIPHER_IMPORT_PERSIST).
+ *
+ * Elliptic curve keys must include their public key: the publicKey of the
+ * ECPrivateKey for P-256, the publicKey of a OneAsymmetricKey (version 2)
+ * for Ed25519 and X25519.
+ *
+ * in	params[0].memref  keys
+ * out	params[1].memref  array of uint32_t, result of the import of each key
+ * in	params[2].value.a TA_ACIPHER_IMPORT_xxx
+ */
+#define TA_ACIPHER_CMD_KEY_IMPORT	19
+
+#define TA_ACIPHER_IMPORT_SESSION	0
+#define TA_ACIPHER_IMPORT_PERSIST	1
+
+struct acipher_key_import {
+	/*
+	 * TA_ACIPHER_KEY_ECDSA_P256 or TA_ACIPHER_KEY_ECDH_P256 for P-256
+	 * keys, which can be used either way. Ignored for other keys, the
+	 * type of which is found in the DER key.
+	 */
+	uint32_t key_type;
+	uint32_t id_len;	/* Size of the key ID */
+	uint32_t der_len;	/* Size of the DER key */
+};
+
+#define TA_ACIPHER_KEY_IMPORT_SIZE(id_len, der_len) \
+	(sizeof(struct acipher_key_import) + (id_len) + (der_len))
+
+/*
+ * Sizes of the inputs and outputs of the operations with the session key,
+ * so that their buffers can be sized before the first invoke.
+ *
+ * out	params[0].memref  struct acipher_key_info
+ */
+#define TA_ACIPHER_CMD_KEY_INFO		20
+
+struct acipher_key_info {
+	uint32_t key_type;	/* TA_ACIPHER_KEY_xxx */
+	uint32_t key_size;	/* In bits */
+	/*
+	 * Size of the modulus or of the curve in bytes: size of RSA
+	 * ciphertexts and of the shared secrets of TA_ACIPHER_CMD_DERIVE
+	 */
+	uint32_t mod_len;
+	uint32_t sig_len;	/* Size of signatures, 0 if the key cannot sign */
+	/* Largest plaintext of TA_ACIPHER_CMD_ENCRYPT, 0 if not RSA */
+	uint32_t max_pt_pkcs1_v1_5;
+	/* Largest plaintext with RSAES-OAEP SHA-256, 0 if not RSA */
+	uint32_t max_pt_oaep_sha256;
+};
+
+/* Public key formats */
+#define TA_ACIPHER_PUBKEY_DER		0
+#define TA_ACIPHER_PUBKEY_PEM		1
+
+/* Key types */
+#define TA_ACIPHER_KEY_RSA		0
+#define TA_ACIPHER_KEY_ECDSA_P256	1
+#define TA_ACIPHER_KEY_ECDH_P256	2
+#define TA_ACIPHER_KEY_ED25519		3
+#define TA_ACIPHER_KEY_X25519		4
+
+/*
+ * Signature algorithms, all of them over a SHA-256 digest, which Ed25519
+ * signs as its message. RSA signatures are the size of the modulus, EC
+ * signatures twice the size of the curve (R || S).
+ */
+#define TA_ACIPHER_ALG_RSASSA_PKCS1_V1_5_SHA256	0
+#define TA_ACIPHER_ALG_RSASSA_PSS_SHA256	1
+#define TA_ACIPHER_ALG_ECDSA_P256_SHA256	2
+#define TA_ACIPHER_ALG_ED25519			3
+
+struct acipher_dec_slot {
+	uint32_t res;		/* TEE_Result of the decryption */
+	uint32_t len;		/* Plaintext size */
+};
+
+#define TA_ACIPHER_DEC_SLOT_SIZE(mod_len) \
+	(sizeof(struct acipher_dec_slot) + (mod_len))
+
 #endif /* __ACIPHER_TA_H */
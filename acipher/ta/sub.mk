@@ -1,2 +1,5 @@
 global-incdirs-y += include
 srcs-y += acipher_ta.c
+
+# TA_ACIPHER_CMD_HEAP_STATS needs OP-TEE built with CFG_WITH_STATS=y
+cppflags-$(CFG_WITH_STATS) += -DCFG_WITH_STATS=1
@@ -14,9 +14,22 @@
 
 #define TA_UUID				TA_ACIPHER_UUID
 
-#define TA_FLAGS			TA_FLAG_EXEC_DDR
+/*
+ * The key pools are shared by all sessions and outlive them, hence a single
+ * instance that is kept alive.
+ */
+#define TA_FLAGS			(TA_FLAG_EXEC_DDR | \
+					 TA_FLAG_SINGLE_INSTANCE | \
+					 TA_FLAG_MULTI_SESSION | \
+					 TA_FLAG_INSTANCE_KEEP_ALIVE)
 #define TA_STACK_SIZE			(2 * 1024)
-#define TA_DATA_SIZE			(32 * 1024)
+
+/*
+ * TA heap set aside for the named keys of all sessions, room for about 300
+ * keys, see MAX_NAMED_KEYS in acipher_ta.c.
+ */
+#define TA_NAMED_KEYS_SIZE		(128 * 1024)
+#define TA_DATA_SIZE			(32 * 1024 + TA_NAMED_KEYS_SIZE)
 
 #define TA_CURRENT_TA_EXT_PROPERTIES \
     { "gp.ta.description", USER_TA_PROP_TYPE_STRING, \
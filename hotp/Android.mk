@@ -7,7 +7,7 @@ include $(CLEAR_VARS)
 LOCAL_CFLAGS += -DANDROID_BUILD
 LOCAL_CFLAGS += -Wall
 
-LOCAL_SRC_FILES += host/main.c
+LOCAL_SRC_FILES += host/main.c host/bench.c
 
 LOCAL_C_INCLUDES := $(LOCAL_PATH)/ta/include \
 		    $(OPTEE_CLIENT_EXPORT)/include
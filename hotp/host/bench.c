@@ -0,0 +1,478 @@
+/*
+ * Copyright (c) 2017, Linaro Limited
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Load generator for the HOTP TA: M threads, each with its own session,
+ * drive HOTP generation or verification over N tokens. Throughput and
+ * latency of the invokes are reported as JSON on stdout.
+ *
+ * Thread i works on tokens i, i + M, i + 2M... in every mode, so that the
+ * modes are compared over the same tokens. In generate mode, the thread
+ * opens one session per token, registered with the key of the token.
+ */
+
+#include <err.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* OP-TEE TEE client API (built by optee_client) */
+#include <tee_client_api.h>
+
+/* For the UUID (found in the TA's h-file(s)) */
+#include <hotp_ta.h>
+
+#include "bench.h"
+
+/* Tokens used by the benchmark are registered from this user ID on */
+#define BENCH_USER_BASE		0x48000000
+
+/* A value that is never a valid HOTP, see RFC4226 section 5.3 */
+#define BENCH_BAD_HOTP		1000000
+
+/* Maximum number of sessions of a thread in generate mode */
+#define BENCH_MAX_SESSIONS	64
+
+enum bench_mode {
+	/* GET_HOTP, with the HMAC operation cached in each session */
+	BENCH_GENERATE,
+	/* GET_TOKEN_HOTP, with the HMAC operation set up at each call */
+	BENCH_GENERATE_TOKEN,
+	/* VERIFY_BATCH, rejected HOTPs so that the whole window is checked */
+	BENCH_VERIFY,
+	BENCH_NUM_MODES
+};
+
+static const char * const mode_names[BENCH_NUM_MODES] = {
+	[BENCH_GENERATE] = "generate",
+	[BENCH_GENERATE_TOKEN] = "generate-token",
+	[BENCH_VERIFY] = "verify",
+};
+
+struct bench_cfg {
+	enum bench_mode mode;
+	unsigned int threads;
+	unsigned int tokens;
+	unsigned int invokes;	/* per thread */
+	unsigned int batch;
+	unsigned int window;
+};
+
+struct bench_thread {
+	const struct bench_cfg *cfg;
+	unsigned int idx;
+	/* Released once every thread has its sessions and keys */
+	pthread_barrier_t *ready;
+	uint64_t *lat_ns;	/* latency of each invoke */
+	uint64_t end_ns;	/* end of the last invoke */
+	unsigned long codes;
+};
+
+static const uint8_t bench_key[] = {
+	0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38,
+	0x39, 0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36,
+	0x37, 0x38, 0x39, 0x30
+};
+
+/* Key of a benchmark token: bench_key with the token index mixed in. */
+static void token_key(unsigned int user, uint8_t key[sizeof(bench_key)])
+{
+	memcpy(key, bench_key, sizeof(bench_key));
+	key[16] ^= user >> 24;
+	key[17] ^= user >> 16;
+	key[18] ^= user >> 8;
+	key[19] ^= user;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void init_context(TEEC_Context *ctx)
+{
+	TEEC_Result res;
+
+	res = TEEC_InitializeContext(NULL, ctx);
+	if (res != TEEC_SUCCESS)
+		errx(1, "TEEC_InitializeContext failed with code 0x%x", res);
+}
+
+static void open_session(TEEC_Context *ctx, TEEC_Session *sess)
+{
+	TEEC_UUID uuid = TA_HOTP_UUID;
+	uint32_t err_origin;
+	TEEC_Result res;
+
+	res = TEEC_OpenSession(ctx, sess, &uuid, TEEC_LOGIN_PUBLIC, NULL,
+			       NULL, &err_origin);
+	if (res != TEEC_SUCCESS)
+		errx(1, "TEEC_Opensession failed with code 0x%x origin 0x%x",
+		     res, err_origin);
+}
+
+static void invoke(TEEC_Session *sess, uint32_t cmd, TEEC_Operation *op)
+{
+	uint32_t err_origin;
+	TEEC_Result res;
+
+	res = TEEC_InvokeCommand(sess, cmd, op, &err_origin);
+	if (res != TEEC_SUCCESS)
+		errx(1, "TEEC_InvokeCommand(%u) failed with code 0x%x "
+		     "origin 0x%x", cmd, res, err_origin);
+}
+
+/* Register the benchmark tokens, TA_HOTP_MAX_IMPORT at a time. */
+static void register_tokens(TEEC_Session *sess, unsigned int tokens)
+{
+	struct hotp_token_seed seeds[TA_HOTP_MAX_IMPORT];
+	TEEC_Operation op = { 0 };
+	unsigned int i, n;
+
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_VALUE_INPUT, TEEC_VALUE_OUTPUT,
+					 TEEC_NONE);
+	op.params[0].tmpref.buffer = seeds;
+	op.params[1].value.a = 0;
+
+	for (i = 0; i < tokens; i += n) {
+		for (n = 0; n < TA_HOTP_MAX_IMPORT && i + n < tokens; n++) {
+			memset(&seeds[n], 0, sizeof(seeds[n]));
+			seeds[n].user_id = BENCH_USER_BASE + i + n;
+			seeds[n].key_len = sizeof(bench_key);
+			token_key(i + n, seeds[n].key);
+		}
+
+		op.params[0].tmpref.size = n * sizeof(seeds[0]);
+		invoke(sess, TA_HOTP_CMD_IMPORT_TOKENS, &op);
+	}
+}
+
+/* Next token of the thread working on tokens first, first + M... */
+static unsigned int next_user(const struct bench_cfg *cfg, unsigned int first,
+			      unsigned int user)
+{
+	user += cfg->threads;
+	if (user >= cfg->tokens)
+		user = first;
+
+	return user;
+}
+
+static void *bench_thread(void *arg)
+{
+	struct bench_thread *t = arg;
+	const struct bench_cfg *cfg = t->cfg;
+	struct hotp_verify_req *reqs = NULL;
+	uint8_t key[sizeof(bench_key)];
+	uint64_t *counters = NULL;
+	uint32_t *bitmap = NULL;
+	TEEC_Operation op = { 0 };
+	TEEC_Context ctx;
+	TEEC_Session sess[BENCH_MAX_SESSIONS];
+	unsigned int num_sess = 1;
+	unsigned int user = t->idx;
+	unsigned int i, k = 0;
+	uint64_t start;
+
+	init_context(&ctx);
+
+	switch (cfg->mode) {
+	case BENCH_GENERATE:
+		num_sess = (cfg->tokens - t->idx + cfg->threads - 1) /
+			   cfg->threads;
+		op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+						 TEEC_NONE, TEEC_NONE,
+						 TEEC_NONE);
+		op.params[0].tmpref.buffer = key;
+		op.params[0].tmpref.size = sizeof(key);
+		for (k = 0; k < num_sess; k++) {
+			open_session(&ctx, &sess[k]);
+			token_key(t->idx + k * cfg->threads, key);
+			invoke(&sess[k], TA_HOTP_CMD_REGISTER_SHARED_KEY, &op);
+		}
+
+		op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_OUTPUT, TEEC_NONE,
+						 TEEC_NONE, TEEC_NONE);
+		break;
+	case BENCH_GENERATE_TOKEN:
+		open_session(&ctx, &sess[0]);
+		op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
+						 TEEC_VALUE_OUTPUT,
+						 TEEC_NONE, TEEC_NONE);
+		break;
+	case BENCH_VERIFY:
+		open_session(&ctx, &sess[0]);
+		reqs = calloc(cfg->batch, sizeof(*reqs));
+		counters = calloc(cfg->batch, sizeof(*counters));
+		bitmap = calloc((cfg->batch + 31) / 32, sizeof(*bitmap));
+		if (!reqs || !counters || !bitmap)
+			errx(1, "Cannot allocate a batch of %u", cfg->batch);
+
+		op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+						 TEEC_MEMREF_TEMP_OUTPUT,
+						 TEEC_MEMREF_TEMP_OUTPUT,
+						 TEEC_VALUE_INPUT);
+		op.params[0].tmpref.buffer = reqs;
+		op.params[0].tmpref.size = cfg->batch * sizeof(*reqs);
+		op.params[1].tmpref.buffer = counters;
+		op.params[2].tmpref.buffer = bitmap;
+		op.params[3].value.a = cfg->window;
+		break;
+	default:
+		errx(1, "Unexpected mode %d", cfg->mode);
+	}
+
+	pthread_barrier_wait(t->ready);
+
+	for (i = 0; i < cfg->invokes; i++) {
+		switch (cfg->mode) {
+		case BENCH_GENERATE:
+			k = i % num_sess;
+			break;
+		case BENCH_GENERATE_TOKEN:
+			op.params[0].value.a = BENCH_USER_BASE + user;
+			user = next_user(cfg, t->idx, user);
+			break;
+		case BENCH_VERIFY:
+			for (k = 0; k < cfg->batch; k++) {
+				reqs[k].user_id = BENCH_USER_BASE + user;
+				reqs[k].hotp = BENCH_BAD_HOTP;
+				user = next_user(cfg, t->idx, user);
+			}
+			op.params[1].tmpref.size = cfg->batch *
+						   sizeof(*counters);
+			op.params[2].tmpref.size = ((cfg->batch + 31) / 32) *
+						   sizeof(*bitmap);
+			k = 0;
+			break;
+		default:
+			break;
+		}
+
+		start = now_ns();
+		invoke(&sess[k], cfg->mode == BENCH_GENERATE ?
+				 TA_HOTP_CMD_GET_HOTP :
+				 cfg->mode == BENCH_GENERATE_TOKEN ?
+				 TA_HOTP_CMD_GET_TOKEN_HOTP :
+				 TA_HOTP_CMD_VERIFY_BATCH, &op);
+		t->lat_ns[i] = now_ns() - start;
+		t->codes += cfg->mode == BENCH_VERIFY ? cfg->batch : 1;
+	}
+	t->end_ns = now_ns();
+
+	free(reqs);
+	free(counters);
+	free(bitmap);
+	for (k = 0; k < num_sess; k++)
+		TEEC_CloseSession(&sess[k]);
+	TEEC_FinalizeContext(&ctx);
+
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile_us(const uint64_t *sorted, size_t n, unsigned int p)
+{
+	size_t idx = (n * p + 99) / 100;
+
+	if (idx)
+		idx--;
+	return sorted[idx] / 1000.0;
+}
+
+static void run_mode(const struct bench_cfg *cfg, bool first)
+{
+	size_t total = (size_t)cfg->threads * cfg->invokes;
+	struct bench_thread *threads;
+	pthread_barrier_t ready;
+	pthread_t *tids;
+	unsigned long codes = 0;
+	uint64_t *lat_ns;
+	uint64_t start, end = 0;
+	double seconds;
+	unsigned int i;
+
+	threads = calloc(cfg->threads, sizeof(*threads));
+	tids = calloc(cfg->threads, sizeof(*tids));
+	lat_ns = calloc(total, sizeof(*lat_ns));
+	if (!threads || !tids || !lat_ns)
+		errx(1, "Cannot allocate %zu latency samples", total);
+
+	if (pthread_barrier_init(&ready, NULL, cfg->threads + 1))
+		errx(1, "Cannot initialize barrier");
+
+	for (i = 0; i < cfg->threads; i++) {
+		threads[i].cfg = cfg;
+		threads[i].idx = i % cfg->tokens;
+		threads[i].ready = &ready;
+		threads[i].lat_ns = lat_ns + (size_t)i * cfg->invokes;
+		if (pthread_create(&tids[i], NULL, bench_thread, &threads[i]))
+			errx(1, "Cannot create thread %u", i);
+	}
+
+	/* Only time the invokes, not the session and key set up */
+	pthread_barrier_wait(&ready);
+	start = now_ns();
+	for (i = 0; i < cfg->threads; i++) {
+		pthread_join(tids[i], NULL);
+		codes += threads[i].codes;
+		if (threads[i].end_ns > end)
+			end = threads[i].end_ns;
+	}
+	seconds = (end - start) / 1e9;
+	pthread_barrier_destroy(&ready);
+
+	qsort(lat_ns, total, sizeof(*lat_ns), cmp_u64);
+
+	printf("%s  {\"mode\": \"%s\", \"threads\": %u, \"tokens\": %u, "
+	       "\"fits_token_cache\": %s, "
+	       "\"invokes\": %zu, \"batch\": %u, \"window\": %u, "
+	       "\"codes\": %lu, \"seconds\": %.6f, \"codes_per_s\": %.1f, "
+	       "\"latency_us\": {\"p50\": %.1f, \"p99\": %.1f, "
+	       "\"max\": %.1f}}",
+	       first ? "" : ",\n", mode_names[cfg->mode], cfg->threads,
+	       cfg->tokens,
+	       cfg->tokens <= TA_HOTP_TOKEN_CACHE_SIZE ? "true" : "false",
+	       total,
+	       cfg->mode == BENCH_VERIFY ? cfg->batch : 1, cfg->window,
+	       codes, seconds, seconds > 0 ? codes / seconds : 0.0,
+	       percentile_us(lat_ns, total, 50),
+	       percentile_us(lat_ns, total, 99),
+	       lat_ns[total - 1] / 1000.0);
+
+	free(threads);
+	free(tids);
+	free(lat_ns);
+}
+
+static void bench_usage(const char *pname)
+{
+	fprintf(stderr, "usage: %s bench [-m generate|generate-token|verify|all]"
+		" [-t threads] [-n tokens] [-i invokes per thread]"
+		" [-b batch size] [-w window]\n", pname);
+	exit(1);
+}
+
+static unsigned int parse_uint(const char *pname, const char *str,
+			       unsigned int min, unsigned int max)
+{
+	unsigned long val;
+	char *ep;
+
+	val = strtoul(str, &ep, 0);
+	if (*ep || val < min || val > max) {
+		warnx("bad value \"%s\", expected %u..%u", str, min, max);
+		bench_usage(pname);
+	}
+
+	return val;
+}
+
+int hotp_bench(int argc, char *argv[])
+{
+	struct bench_cfg cfg = {
+		.threads = 1,
+		.tokens = TA_HOTP_TOKEN_CACHE_SIZE,
+		.invokes = 1000,
+		.batch = 32,
+		.window = 4,
+	};
+	const char *pname = "optee_example_hotp";
+	int mode = -1;	/* All modes */
+	TEEC_Context ctx;
+	TEEC_Session sess;
+	bool first = true;
+	int opt;
+	int m;
+
+	while ((opt = getopt(argc, argv, "hm:t:n:i:b:w:")) != -1) {
+		switch (opt) {
+		case 'm':
+			if (!strcmp(optarg, "all")) {
+				mode = -1;
+				break;
+			}
+			for (mode = 0; mode < BENCH_NUM_MODES; mode++)
+				if (!strcmp(optarg, mode_names[mode]))
+					break;
+			if (mode == BENCH_NUM_MODES)
+				bench_usage(pname);
+			break;
+		case 't':
+			cfg.threads = parse_uint(pname, optarg, 1, 256);
+			break;
+		case 'n':
+			cfg.tokens = parse_uint(pname, optarg, 1, 1000000);
+			break;
+		case 'i':
+			cfg.invokes = parse_uint(pname, optarg, 1, 10000000);
+			break;
+		case 'b':
+			cfg.batch = parse_uint(pname, optarg, 1,
+					       TA_HOTP_MAX_BATCH);
+			break;
+		case 'w':
+			cfg.window = parse_uint(pname, optarg, 0,
+						TA_HOTP_MAX_WINDOW);
+			break;
+		default:
+			bench_usage(pname);
+		}
+	}
+	if (optind != argc)
+		bench_usage(pname);
+
+	/* Generate mode opens one session per token of each thread */
+	if ((cfg.tokens + cfg.threads - 1) / cfg.threads > BENCH_MAX_SESSIONS) {
+		if (mode == BENCH_GENERATE) {
+			warnx("generate mode runs %u tokens per thread at most",
+			      BENCH_MAX_SESSIONS);
+			bench_usage(pname);
+		}
+		if (mode < 0)
+			warnx("too many tokens per thread, skipping generate");
+	}
+
+	init_context(&ctx);
+	open_session(&ctx, &sess);
+	register_tokens(&sess, cfg.tokens);
+
+	printf("[\n");
+	for (m = 0; m < BENCH_NUM_MODES; m++) {
+		if (mode >= 0 && m != mode)
+			continue;
+		if (m == BENCH_GENERATE &&
+		    (cfg.tokens + cfg.threads - 1) / cfg.threads >
+		    BENCH_MAX_SESSIONS)
+			continue;
+		cfg.mode = m;
+		run_mode(&cfg, first);
+		first = false;
+	}
+	printf("\n]\n");
+
+	TEEC_CloseSession(&sess);
+	TEEC_FinalizeContext(&ctx);
+
+	return 0;
+}
@@ -0,0 +1,16 @@
+/*
+ * Copyright (c) 2017, Linaro Limited
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#ifndef __HOTP_BENCH_H__
+#define __HOTP_BENCH_H__
+
+/*
+ * Run the benchmark mode of the HOTP example, argv[0] being "bench".
+ * Returns the exit status of the program.
+ */
+int hotp_bench(int argc, char *argv[]);
+
+#endif
@@ -6,7 +6,9 @@
  */
 
 #include <err.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 /* OP-TEE TEE client API (built by optee_client) */
@@ -15,6 +17,8 @@
 /* For the UUID (found in the TA's h-file(s)) */
 #include <hotp_ta.h>
 
+#include "bench.h"
+
 struct test_value {
 	size_t count;
 	uint32_t expected;
@@ -36,7 +40,123 @@ struct test_value rfc4226_test_values[] = {
 	{ 9, 520489 }
 };
 
-int main(void)
+static void usage(const char *pname)
+{
+	fprintf(stderr, "usage: %s\n", pname);
+	fprintf(stderr, "       %s set-import-key <hex AES key>\n", pname);
+	fprintf(stderr, "       %s import <seed file> [wrapped]\n", pname);
+	fprintf(stderr, "       %s bench [options], see %s bench -h\n",
+		pname, pname);
+	exit(1);
+}
+
+static void set_import_key(TEEC_Session *sess, const char *hex)
+{
+	TEEC_Operation op = { 0 };
+	uint8_t key[32];
+	size_t key_len = strlen(hex) / 2;
+	uint32_t err_origin;
+	TEEC_Result res;
+	unsigned int byte;
+	size_t i;
+
+	if (strlen(hex) % 2 || key_len > sizeof(key))
+		errx(1, "Bad import key \"%s\"", hex);
+
+	for (i = 0; i < key_len; i++) {
+		if (sscanf(hex + 2 * i, "%2x", &byte) != 1)
+			errx(1, "Bad import key \"%s\"", hex);
+		key[i] = byte;
+	}
+
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_NONE,
+					 TEEC_NONE, TEEC_NONE);
+	op.params[0].tmpref.buffer = key;
+	op.params[0].tmpref.size = key_len;
+
+	res = TEEC_InvokeCommand(sess, TA_HOTP_CMD_SET_IMPORT_KEY, &op,
+				 &err_origin);
+	memset(key, 0, sizeof(key));
+	if (res != TEEC_SUCCESS)
+		errx(1, "TEEC_InvokeCommand failed with code 0x%x origin 0x%x",
+		     res, err_origin);
+}
+
+/*
+ * Stream a seed file through the TA. A plain seed file is an array of
+ * struct hotp_token_seed, sent TA_HOTP_MAX_IMPORT records at a time. A
+ * wrapped seed file is a sequence of segments as expected by
+ * TA_HOTP_CMD_IMPORT_TOKENS, each preceded by its size as a uint32_t.
+ */
+static void import_seed_file(TEEC_Context *ctx, TEEC_Session *sess,
+			     const char *path, bool wrapped)
+{
+	TEEC_SharedMemory shm = { 0 };
+	TEEC_Operation op = { 0 };
+	unsigned long total = 0;
+	uint32_t err_origin;
+	uint32_t seg_sz;
+	TEEC_Result res;
+	size_t n;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f)
+		err(1, "Cannot open %s", path);
+
+	/* One shared buffer for the whole file, no copy at each invoke */
+	shm.size = TA_HOTP_MAX_IMPORT * sizeof(struct hotp_token_seed) +
+		   TA_HOTP_IMPORT_NONCE_SIZE + TA_HOTP_IMPORT_TAG_SIZE;
+	shm.flags = TEEC_MEM_INPUT;
+	res = TEEC_AllocateSharedMemory(ctx, &shm);
+	if (res != TEEC_SUCCESS)
+		errx(1, "TEEC_AllocateSharedMemory failed with code 0x%x", res);
+
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_PARTIAL_INPUT,
+					 TEEC_VALUE_INPUT, TEEC_VALUE_OUTPUT,
+					 TEEC_NONE);
+	op.params[0].memref.parent = &shm;
+	op.params[0].memref.offset = 0;
+	op.params[1].value.a = wrapped ? TA_HOTP_IMPORT_WRAPPED : 0;
+
+	while (true) {
+		if (wrapped) {
+			if (fread(&seg_sz, sizeof(seg_sz), 1, f) != 1)
+				break;
+			if (seg_sz > shm.size)
+				errx(1, "Segment of %u bytes is too large",
+				     seg_sz);
+			if (fread(shm.buffer, 1, seg_sz, f) != seg_sz)
+				errx(1, "Truncated segment in %s", path);
+		} else {
+			n = fread(shm.buffer, sizeof(struct hotp_token_seed),
+				  TA_HOTP_MAX_IMPORT, f);
+			if (!n)
+				break;
+			seg_sz = n * sizeof(struct hotp_token_seed);
+		}
+
+		op.params[0].memref.size = seg_sz;
+		res = TEEC_InvokeCommand(sess, TA_HOTP_CMD_IMPORT_TOKENS, &op,
+					 &err_origin);
+		if (res != TEEC_SUCCESS)
+			errx(1, "TEEC_InvokeCommand failed with code 0x%x "
+			     "origin 0x%x after %lu users", res, err_origin,
+			     total);
+
+		total += op.params[2].value.a;
+	}
+
+	if (ferror(f))
+		err(1, "Cannot read %s", path);
+
+	fprintf(stdout, "Imported %lu users from %s\n", total, path);
+
+	TEEC_ReleaseSharedMemory(&shm);
+	fclose(f);
+}
+
+int main(int argc, char *argv[])
 {
 	TEEC_Context ctx;
 	TEEC_Operation op = { 0 };
@@ -48,6 +168,15 @@ int main(void)
 	uint32_t err_origin;
 	uint32_t hotp_value;
 
+	struct hotp_verify_req reqs[] = {
+		{ .user_id = 1, .hotp = 755224 },
+		{ .user_id = 2, .hotp = 755224 },
+		{ .user_id = 1, .hotp = 359152 },
+		{ .user_id = 1, .hotp = 359152 },
+	};
+	uint64_t counters[sizeof(reqs) / sizeof(reqs[0])];
+	uint32_t bitmap[1];
+
 	/*
 	 * Shared key K ("12345678901234567890"), this is the key used in
 	 * RFC4226 - Test Vectors.
@@ -58,6 +187,9 @@ int main(void)
 		0x37, 0x38, 0x39, 0x30
 	};
 
+	if (argc > 1 && !strcmp(argv[1], "bench"))
+		return hotp_bench(argc - 1, argv + 1);
+
 	/* Initialize a context connecting us to the TEE */
 	res = TEEC_InitializeContext(NULL, &ctx);
 	if (res != TEEC_SUCCESS)
@@ -69,6 +201,19 @@ int main(void)
 		errx(1, "TEEC_Opensession failed with code 0x%x origin 0x%x",
 		     res, err_origin);
 
+	if (argc > 1) {
+		if (!strcmp(argv[1], "set-import-key") && argc == 3)
+			set_import_key(&sess, argv[2]);
+		else if (!strcmp(argv[1], "import") && argc == 3)
+			import_seed_file(&ctx, &sess, argv[2], false);
+		else if (!strcmp(argv[1], "import") && argc == 4 &&
+			 !strcmp(argv[3], "wrapped"))
+			import_seed_file(&ctx, &sess, argv[2], true);
+		else
+			usage(argv[0]);
+		goto exit;
+	}
+
 	/* 1. Register the shared key */
 	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
 					 TEEC_NONE, TEEC_NONE, TEEC_NONE);
@@ -108,6 +253,84 @@ int main(void)
 				rfc4226_test_values[i].expected, hotp_value);
 		}
 	}
+
+	/* 3. Register the same shared key for user 1 */
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
+					 TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_NONE, TEEC_NONE);
+	op.params[0].value.a = 1;
+	op.params[1].tmpref.buffer = K;
+	op.params[1].tmpref.size = sizeof(K);
+
+	res = TEEC_InvokeCommand(&sess, TA_HOTP_CMD_REGISTER_TOKEN, &op,
+				 &err_origin);
+	if (res != TEEC_SUCCESS) {
+		fprintf(stderr, "TEEC_InvokeCommand failed with code 0x%x "
+			"origin 0x%x\n", res, err_origin);
+		goto exit;
+	}
+
+	/*
+	 * 4. Verify a batch of HOTPs in one invoke: the first and third
+	 *    requests are valid (counters 0 and 2, within the look-ahead
+	 *    window), user 2 is unknown and the last one is a replay.
+	 */
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_VALUE_INPUT);
+	op.params[0].tmpref.buffer = reqs;
+	op.params[0].tmpref.size = sizeof(reqs);
+	op.params[1].tmpref.buffer = counters;
+	op.params[1].tmpref.size = sizeof(counters);
+	op.params[2].tmpref.buffer = bitmap;
+	op.params[2].tmpref.size = sizeof(bitmap);
+	op.params[3].value.a = 3;
+
+	res = TEEC_InvokeCommand(&sess, TA_HOTP_CMD_VERIFY_BATCH, &op,
+				 &err_origin);
+	if (res != TEEC_SUCCESS) {
+		fprintf(stderr, "TEEC_InvokeCommand failed with code 0x%x "
+			"origin 0x%x\n", res, err_origin);
+		goto exit;
+	}
+
+	for (i = 0; i < sizeof(reqs) / sizeof(reqs[0]); i++)
+		fprintf(stdout, "Verify user %u HOTP %u: %s (counter %llu)\n",
+			reqs[i].user_id, reqs[i].hotp,
+			bitmap[i / 32] & (1U << (i % 32)) ? "ok" : "rejected",
+			(unsigned long long)counters[i]);
+
+	if (bitmap[0] != 0x5)
+		fprintf(stderr, "Got unexpected batch result from TEE! "
+			"Expected: 0x5, got: 0x%x\n", bitmap[0]);
+
+	/*
+	 * 5. Get the next HOTPs of user 1, counters are kept in the TA
+	 *    secure storage.
+	 */
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_VALUE_OUTPUT,
+					 TEEC_NONE, TEEC_NONE);
+	op.params[0].value.a = 1;
+
+	for (i = counters[2]; i < counters[2] + 2; i++) {
+		res = TEEC_InvokeCommand(&sess, TA_HOTP_CMD_GET_TOKEN_HOTP, &op,
+					 &err_origin);
+		if (res != TEEC_SUCCESS) {
+			fprintf(stderr, "TEEC_InvokeCommand failed with code "
+				"0x%x origin 0x%x\n", res, err_origin);
+			goto exit;
+		}
+
+		hotp_value = op.params[1].value.a;
+		fprintf(stdout, "HOTP of user 1: %d\n", hotp_value);
+
+		if (hotp_value != rfc4226_test_values[i].expected) {
+			fprintf(stderr, "Got unexpected HOTP from TEE! "
+				"Expected: %d, got: %d\n",
+				rfc4226_test_values[i].expected, hotp_value);
+		}
+	}
 exit:
 	TEEC_CloseSession(&sess);
 	TEEC_FinalizeContext(&ctx);
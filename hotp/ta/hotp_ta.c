@@ -5,6 +5,8 @@
  * SPDX-License-Identifier: BSD-2-Clause
  */
 #include <hotp_ta.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include <tee_internal_api_extensions.h>
 #include <tee_internal_api.h>
@@ -13,35 +15,78 @@
 #define SHA1_HASH_SIZE 20
 
 /* GP says that for HMAC SHA-1, max is 512 bits and min 80 bits. */
-#define MAX_KEY_SIZE 64 /* In bytes */
+#define MAX_KEY_SIZE TA_HOTP_MAX_KEY_SIZE /* In bytes */
 #define MIN_KEY_SIZE 10 /* In bytes */
 
 /* Dynamic Binary Code 2 Modulo, which is 10^6 according to the spec. */
 #define DBC2_MODULO 1000000
 
 /*
- * Currently this only supports a single key, in the future this could be
- * updated to support multiple users, all with different unique keys (stored
- * using secure storage).
+ * Session context: the counter as defined by RFC4226 for the key registered
+ * with TA_HOTP_CMD_REGISTER_SHARED_KEY, and the HMAC operation keyed with
+ * it. Each session has its own key, whereas the tokens registered with
+ * TA_HOTP_CMD_REGISTER_TOKEN are shared by all the sessions of the TA.
  */
-static uint8_t K[MAX_KEY_SIZE];
-static uint32_t K_len;
+struct hotp_session {
+	uint64_t counter;
+	TEE_OperationHandle op;
+};
 
-/* The counter as defined by RFC4226. */
-static uint8_t counter[] = { 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x0 };
+/*
+ * Users registered with TA_HOTP_CMD_REGISTER_TOKEN are kept in secure
+ * storage, in bucket objects of TOKENS_PER_BUCKET fixed size records: user
+ * ID N is stored in record (N % TOKENS_PER_BUCKET) of bucket
+ * (N / TOKENS_PER_BUCKET). A record can hence be read or updated in place
+ * without touching the rest of the bucket.
+ */
+#define TOKENS_PER_BUCKET 64
+
+/*
+ * The counter stored in a record is never below the counter in use: when
+ * generating HOTPs, the TA reserves COUNTER_BLOCK values with one storage
+ * write and serves them from RAM. Should the TA be restarted, it resumes
+ * from the end of the reserved block, so that a HOTP is never issued twice.
+ */
+#define COUNTER_BLOCK 16
+
+/* Number of users whose record is cached in RAM */
+#define MAX_TOKENS TA_HOTP_TOKEN_CACHE_SIZE
+
+struct hotp_token_rec {
+	uint32_t user_id;
+	uint32_t key_len;	/* 0 when the record is free */
+	uint8_t key[MAX_KEY_SIZE];
+	uint64_t counter;
+};
+
+/* Shared key and RFC4226 counter of one user. */
+struct hotp_token {
+	uint32_t user_id;
+	uint8_t key[MAX_KEY_SIZE];
+	uint32_t key_len;
+	uint64_t counter;
+	uint64_t reserved;	/* Counter value stored in secure storage */
+	uint64_t last_use;
+};
+
+static struct hotp_token tokens[MAX_TOKENS];
+static size_t num_tokens;
+static uint64_t use_count;
+
+/* ID of the object holding the key provisioned with SET_IMPORT_KEY. */
+#define IMPORT_KEY_OBJ_ID "hotp_import_key"
+
+/* AES-GCM decryption keyed with the import key, set up on first use. */
+static TEE_OperationHandle import_op = TEE_HANDLE_NULL;
 
 /*
- *  HMAC a block of memory to produce the authentication tag
+ *  Allocate an HMAC SHA-1 operation keyed with the given secret key
  *  @param key       The secret key
  *  @param keylen    The length of the secret key (bytes)
- *  @param in        The data to HMAC
- *  @param inlen     The length of the data to HMAC (bytes)
- *  @param out       [out] Destination of the authentication tag
- *  @param outlen    [in/out] Max size and resulting size of authentication tag
+ *  @param op        [out] The keyed operation, to be freed by the caller
  */
-static TEE_Result hmac_sha1(const uint8_t *key, const size_t keylen,
-			    const uint8_t *in, const size_t inlen,
-			    uint8_t *out, uint32_t *outlen)
+static TEE_Result alloc_hmac_sha1(const uint8_t *key, const size_t keylen,
+				  TEE_OperationHandle *op)
 {
 	TEE_Attribute attr = { 0 };
 	TEE_ObjectHandle key_handle = TEE_HANDLE_NULL;
@@ -51,9 +96,6 @@ static TEE_Result hmac_sha1(const uint8_t *key, const size_t keylen,
 	if (keylen < MIN_KEY_SIZE || keylen > MAX_KEY_SIZE)
 		return TEE_ERROR_BAD_PARAMETERS;
 
-	if (!in || !out || !outlen)
-		return TEE_ERROR_BAD_PARAMETERS;
-
 	/*
 	 * 1. Allocate cryptographic (operation) handle for the HMAC operation.
 	 *    Note that the expected size here is in bits (and therefore times
@@ -90,17 +132,18 @@ static TEE_Result hmac_sha1(const uint8_t *key, const size_t keylen,
 		goto exit;
 	}
 
-	/* 5. Associate the key (object) with the operation */
+	/*
+	 * 5. Associate the key (object) with the operation. The operation
+	 *    keeps its own copy of the key, so the key object can be freed.
+	 */
 	res = TEE_SetOperationKey(op_handle, key_handle);
 	if (res != TEE_SUCCESS) {
 		EMSG("0x%08x", res);
 		goto exit;
 	}
 
-	/* 6. Do the HMAC operations */
-	TEE_MACInit(op_handle, NULL, 0);
-	TEE_MACUpdate(op_handle, in, inlen);
-	res = TEE_MACComputeFinal(op_handle, NULL, 0, out, outlen);
+	*op = op_handle;
+	op_handle = TEE_HANDLE_NULL;
 exit:
 	if (op_handle != TEE_HANDLE_NULL)
 		TEE_FreeOperation(op_handle);
@@ -126,8 +169,236 @@ static void truncate(uint8_t *hmac_result, uint32_t *bin_code)
 	*bin_code %= DBC2_MODULO;
 }
 
-static TEE_Result register_shared_key(uint32_t param_types, TEE_Param params[4])
+/*
+ * Compute the HOTP value of a counter with an operation returned by
+ * alloc_hmac_sha1(). The operation can be reused for the next counter.
+ */
+static TEE_Result hotp_from_op(TEE_OperationHandle op, uint64_t counter_val,
+			       uint32_t *hotp_val)
+{
+	TEE_Result res = TEE_SUCCESS;
+	uint8_t msg[8];
+	uint8_t mac[SHA1_HASH_SIZE];
+	uint32_t mac_len = sizeof(mac);
+	int i;
+
+	/* The counter is hashed as a big endian 8-byte value. */
+	for (i = sizeof(msg) - 1; i >= 0; i--) {
+		msg[i] = counter_val & 0xff;
+		counter_val >>= 8;
+	}
+
+	TEE_MACInit(op, NULL, 0);
+	res = TEE_MACComputeFinal(op, msg, sizeof(msg), mac, &mac_len);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	truncate(mac, hotp_val);
+
+	return res;
+}
+
+static void bucket_obj_id(uint32_t user_id, char *obj_id, size_t obj_id_sz)
+{
+	snprintf(obj_id, obj_id_sz, "hotp_tokens_%08x",
+		 (unsigned int)(user_id / TOKENS_PER_BUCKET));
+}
+
+static uint32_t rec_offset(uint32_t user_id)
+{
+	return (user_id % TOKENS_PER_BUCKET) * sizeof(struct hotp_token_rec);
+}
+
+/*
+ * Open the bucket object holding the record of the user, creating the
+ * bucket when @create is set.
+ */
+static TEE_Result open_bucket(uint32_t user_id, bool create,
+			      TEE_ObjectHandle *object)
+{
+	const uint32_t flags = TEE_DATA_FLAG_ACCESS_READ |
+			       TEE_DATA_FLAG_ACCESS_WRITE;
+	char obj_id[TEE_OBJECT_ID_MAX_LEN];
+	TEE_Result res;
+
+	bucket_obj_id(user_id, obj_id, sizeof(obj_id));
+
+	res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE, obj_id,
+				       strlen(obj_id), flags, object);
+	if (res == TEE_ERROR_ITEM_NOT_FOUND && create)
+		res = TEE_CreatePersistentObject(TEE_STORAGE_PRIVATE, obj_id,
+						 strlen(obj_id), flags,
+						 TEE_HANDLE_NULL, NULL, 0,
+						 object);
+	if (res != TEE_SUCCESS && res != TEE_ERROR_ITEM_NOT_FOUND)
+		EMSG("Failed to open %s, res=0x%08x", obj_id, res);
+
+	return res;
+}
+
+/* Write @len bytes at @offset of the record of the user. */
+static TEE_Result write_rec(uint32_t user_id, uint32_t offset,
+			    const void *data, uint32_t len)
+{
+	TEE_ObjectHandle object;
+	TEE_Result res;
+
+	res = open_bucket(user_id, true, &object);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	res = TEE_SeekObjectData(object, rec_offset(user_id) + offset,
+				 TEE_DATA_SEEK_SET);
+	if (res == TEE_SUCCESS)
+		res = TEE_WriteObjectData(object, data, len);
+	if (res != TEE_SUCCESS)
+		EMSG("Failed to write record of user %u, res=0x%08x",
+		     user_id, res);
+
+	TEE_CloseObject(object);
+
+	return res;
+}
+
+static TEE_Result read_rec(uint32_t user_id, struct hotp_token_rec *rec)
+{
+	TEE_ObjectHandle object;
+	uint32_t read_bytes = 0;
+	TEE_Result res;
+
+	res = open_bucket(user_id, false, &object);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	res = TEE_SeekObjectData(object, rec_offset(user_id),
+				 TEE_DATA_SEEK_SET);
+	if (res == TEE_SUCCESS)
+		res = TEE_ReadObjectData(object, rec, sizeof(*rec),
+					 &read_bytes);
+
+	TEE_CloseObject(object);
+
+	if (res != TEE_SUCCESS)
+		return res;
+
+	/* Records past the end of the bucket or never written are free */
+	if (read_bytes != sizeof(*rec) || !rec->key_len ||
+	    rec->user_id != user_id)
+		return TEE_ERROR_ITEM_NOT_FOUND;
+
+	if (rec->key_len < MIN_KEY_SIZE || rec->key_len > MAX_KEY_SIZE)
+		return TEE_ERROR_CORRUPT_OBJECT;
+
+	return TEE_SUCCESS;
+}
+
+/*
+ * Make sure that the counter stored for the token is at least
+ * counter + ahead, so that it is safe to use the counter values below it.
+ */
+static TEE_Result reserve_counter(struct hotp_token *token, uint64_t ahead)
+{
+	uint64_t reserved = token->counter + ahead;
+	TEE_Result res;
+
+	if (reserved <= token->reserved)
+		return TEE_SUCCESS;
+
+	res = write_rec(token->user_id,
+			offsetof(struct hotp_token_rec, counter),
+			&reserved, sizeof(reserved));
+	if (res != TEE_SUCCESS)
+		return res;
+
+	token->reserved = reserved;
+
+	return TEE_SUCCESS;
+}
+
+static struct hotp_token *find_token(uint32_t user_id)
+{
+	size_t i;
+
+	for (i = 0; i < num_tokens; i++)
+		if (tokens[i].user_id == user_id)
+			return &tokens[i];
+
+	return NULL;
+}
+
+/*
+ * Drop a token from the RAM cache. The values of the reserved block that
+ * were not served are given back by storing the counter in use, so that the
+ * token resumes where it stopped when it is loaded again. Should that write
+ * fail, the stored counter is still ahead and only the block is lost.
+ */
+static void evict_token(struct hotp_token *token)
+{
+	if (token->counter < token->reserved &&
+	    write_rec(token->user_id, offsetof(struct hotp_token_rec, counter),
+		      &token->counter, sizeof(token->counter)) != TEE_SUCCESS)
+		EMSG("Lost counter block of user %u", token->user_id);
+}
+
+/* Get a free entry in the RAM cache, evicting one if needed. */
+static struct hotp_token *alloc_token(uint32_t user_id)
 {
+	struct hotp_token *token;
+	size_t i;
+
+	if (num_tokens < MAX_TOKENS) {
+		token = &tokens[num_tokens++];
+	} else {
+		token = &tokens[0];
+		for (i = 1; i < MAX_TOKENS; i++)
+			if (tokens[i].last_use < token->last_use)
+				token = &tokens[i];
+
+		evict_token(token);
+	}
+
+	memset(token, 0, sizeof(*token));
+	token->user_id = user_id;
+	token->last_use = ++use_count;
+
+	return token;
+}
+
+/*
+ * Get the token of a user, from the RAM cache or from secure storage.
+ * When loaded from secure storage, the token resumes from the stored
+ * counter, skipping any value that may have been reserved and used before.
+ */
+static TEE_Result get_token(uint32_t user_id, struct hotp_token **token)
+{
+	struct hotp_token_rec rec;
+	TEE_Result res;
+
+	*token = find_token(user_id);
+	if (*token) {
+		(*token)->last_use = ++use_count;
+		return TEE_SUCCESS;
+	}
+
+	res = read_rec(user_id, &rec);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	*token = alloc_token(user_id);
+	memcpy((*token)->key, rec.key, rec.key_len);
+	(*token)->key_len = rec.key_len;
+	(*token)->counter = rec.counter;
+	(*token)->reserved = rec.counter;
+
+	memset(&rec, 0, sizeof(rec));
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result register_shared_key(struct hotp_session *sess,
+				      uint32_t param_types, TEE_Param params[4])
+{
+	TEE_OperationHandle op = TEE_HANDLE_NULL;
 	TEE_Result res = TEE_SUCCESS;
 
 	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
@@ -140,22 +411,30 @@ static TEE_Result register_shared_key(uint32_t param_types, TEE_Param params[4])
 		return TEE_ERROR_BAD_PARAMETERS;
 	}
 
-	memset(K, 0, sizeof(K));
-	memcpy(K, params[0].memref.buffer, params[0].memref.size);
+	/*
+	 * The key is only needed to set up the HMAC operation, which is then
+	 * reused for every HOTP of the session.
+	 */
+	res = alloc_hmac_sha1(params[0].memref.buffer, params[0].memref.size,
+			      &op);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	if (sess->op != TEE_HANDLE_NULL)
+		TEE_FreeOperation(sess->op);
 
-	K_len = params[0].memref.size;
-	DMSG("Got shared key %s (%u bytes).", K, params[0].memref.size);
+	sess->op = op;
+	sess->counter = 0;
+	DMSG("Got shared key (%u bytes).", params[0].memref.size);
 
 	return res;
 }
 
-static TEE_Result get_hotp(uint32_t param_types, TEE_Param params[4])
+static TEE_Result get_hotp(struct hotp_session *sess, uint32_t param_types,
+			   TEE_Param params[4])
 {
 	TEE_Result res = TEE_SUCCESS;
 	uint32_t hotp_val;
-	uint8_t mac[SHA1_HASH_SIZE];
-	uint32_t mac_len = sizeof(mac);
-	int i;
 
 	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_OUTPUT,
 						   TEE_PARAM_TYPE_NONE,
@@ -167,21 +446,569 @@ static TEE_Result get_hotp(uint32_t param_types, TEE_Param params[4])
 		return TEE_ERROR_BAD_PARAMETERS;
 	}
 
-	res = hmac_sha1(K, K_len, counter, sizeof(counter), mac, &mac_len);
+	if (sess->op == TEE_HANDLE_NULL)
+		return TEE_ERROR_BAD_STATE;
 
-	/* Increment the counter. */
-	for (i = sizeof(counter) - 1; i >= 0; i--) {
-		if (++counter[i])
-			break;
-	}
+	res = hotp_from_op(sess->op, sess->counter, &hotp_val);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	sess->counter++;
 
-	truncate(mac, &hotp_val);
 	DMSG("HOTP is: %d", hotp_val);
 	params[0].value.a = hotp_val;
 
 	return res;
 }
 
+static TEE_Result register_token(uint32_t param_types, TEE_Param params[4])
+{
+	struct hotp_token_rec rec = { 0 };
+	struct hotp_token *token;
+	TEE_Result res;
+
+	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+						   TEE_PARAM_TYPE_MEMREF_INPUT,
+						   TEE_PARAM_TYPE_NONE,
+						   TEE_PARAM_TYPE_NONE);
+
+	if (param_types != exp_param_types) {
+		EMSG("Expected: 0x%x, got: 0x%x", exp_param_types, param_types);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	rec.key_len = params[1].memref.size;
+	if (rec.key_len < MIN_KEY_SIZE || rec.key_len > MAX_KEY_SIZE)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	rec.user_id = params[0].value.a;
+	memcpy(rec.key, params[1].memref.buffer, rec.key_len);
+
+	res = write_rec(rec.user_id, 0, &rec, sizeof(rec));
+	if (res != TEE_SUCCESS)
+		goto out;
+
+	token = find_token(rec.user_id);
+	if (!token)
+		token = alloc_token(rec.user_id);
+
+	memcpy(token->key, rec.key, rec.key_len);
+	token->key_len = rec.key_len;
+	token->counter = 0;
+	token->reserved = 0;
+	DMSG("Registered user %u (%u bytes key).", rec.user_id, rec.key_len);
+out:
+	memset(&rec, 0, sizeof(rec));
+
+	return res;
+}
+
+static TEE_Result get_token_hotp(uint32_t param_types, TEE_Param params[4])
+{
+	TEE_OperationHandle op = TEE_HANDLE_NULL;
+	struct hotp_token *token;
+	TEE_Result res;
+	uint32_t hotp_val;
+
+	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+						   TEE_PARAM_TYPE_VALUE_OUTPUT,
+						   TEE_PARAM_TYPE_NONE,
+						   TEE_PARAM_TYPE_NONE);
+
+	if (param_types != exp_param_types) {
+		EMSG("Expected: 0x%x, got: 0x%x", exp_param_types, param_types);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	res = get_token(params[0].value.a, &token);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	/* Only a counter value that is durably reserved can be served */
+	if (token->counter >= token->reserved) {
+		res = reserve_counter(token, COUNTER_BLOCK);
+		if (res != TEE_SUCCESS)
+			return res;
+	}
+
+	res = alloc_hmac_sha1(token->key, token->key_len, &op);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	res = hotp_from_op(op, token->counter, &hotp_val);
+	TEE_FreeOperation(op);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	token->counter++;
+	params[1].value.a = hotp_val;
+
+	return TEE_SUCCESS;
+}
+
+/*
+ * Look for the HOTP in the look-ahead window of @counter and resynchronize
+ * @counter when found.
+ */
+static TEE_Result verify_hotp(TEE_OperationHandle op, uint64_t *counter,
+			      uint32_t hotp_val, uint32_t window, bool *match)
+{
+	TEE_Result res = TEE_SUCCESS;
+	uint32_t val;
+	uint32_t i;
+
+	*match = false;
+
+	for (i = 0; i <= window; i++) {
+		res = hotp_from_op(op, *counter + i, &val);
+		if (res != TEE_SUCCESS)
+			return res;
+
+		if (val == hotp_val) {
+			*counter += i + 1;
+			*match = true;
+			break;
+		}
+	}
+
+	return res;
+}
+
+static TEE_Result verify_batch(uint32_t param_types, TEE_Param params[4])
+{
+	TEE_Result res = TEE_SUCCESS;
+	TEE_OperationHandle op = TEE_HANDLE_NULL;
+	struct hotp_verify_req *reqs = NULL;
+	struct hotp_token *token;
+	uint64_t *counters = NULL;
+	uint32_t *bitmap = NULL;
+	uint16_t *order = NULL;
+	uint64_t counter;
+	uint32_t counters_sz;
+	uint32_t bitmap_sz;
+	uint32_t window;
+	bool match;
+	size_t n, i, j, k;
+
+	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+						   TEE_PARAM_TYPE_MEMREF_OUTPUT,
+						   TEE_PARAM_TYPE_MEMREF_OUTPUT,
+						   TEE_PARAM_TYPE_VALUE_INPUT);
+
+	if (param_types != exp_param_types) {
+		EMSG("Expected: 0x%x, got: 0x%x", exp_param_types, param_types);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	n = params[0].memref.size / sizeof(*reqs);
+	if (!n || n > TA_HOTP_MAX_BATCH ||
+	    params[0].memref.size % sizeof(*reqs))
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	window = params[3].value.a;
+	if (window > TA_HOTP_MAX_WINDOW)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	counters_sz = n * sizeof(*counters);
+	bitmap_sz = ((n + 31) / 32) * sizeof(*bitmap);
+	if (params[1].memref.size < counters_sz ||
+	    params[2].memref.size < bitmap_sz) {
+		params[1].memref.size = counters_sz;
+		params[2].memref.size = bitmap_sz;
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+
+	/*
+	 * Work on a private copy of the requests: the normal world could
+	 * modify the shared buffer while we are processing it.
+	 */
+	reqs = TEE_Malloc(n * sizeof(*reqs), 0);
+	counters = TEE_Malloc(counters_sz, 0);
+	bitmap = TEE_Malloc(bitmap_sz, 0);
+	order = TEE_Malloc(n * sizeof(*order), 0);
+	if (!reqs || !counters || !bitmap || !order) {
+		res = TEE_ERROR_OUT_OF_MEMORY;
+		goto out;
+	}
+	TEE_MemMove(reqs, params[0].memref.buffer, n * sizeof(*reqs));
+
+	/*
+	 * Group the requests by user so that the HMAC operation of each user
+	 * is set up only once. The insertion sort is stable, hence requests
+	 * of a user are still verified in the order they were submitted.
+	 */
+	for (i = 0; i < n; i++) {
+		for (j = i; j > 0 &&
+		     reqs[order[j - 1]].user_id > reqs[i].user_id; j--)
+			order[j] = order[j - 1];
+		order[j] = i;
+	}
+
+	for (i = 0; i < n; i = j) {
+		uint32_t user_id = reqs[order[i]].user_id;
+
+		for (j = i + 1; j < n && reqs[order[j]].user_id == user_id; j++)
+			;
+
+		res = get_token(user_id, &token);
+		if (res == TEE_ERROR_ITEM_NOT_FOUND) {
+			DMSG("Unknown user %u", user_id);
+			res = TEE_SUCCESS;
+			continue;
+		}
+		if (res != TEE_SUCCESS)
+			goto out;
+
+		res = alloc_hmac_sha1(token->key, token->key_len, &op);
+		if (res != TEE_SUCCESS)
+			goto out;
+
+		/*
+		 * The token keeps its counter until the new one is stored, so
+		 * that HOTPs are not consumed when the command fails before.
+		 */
+		counter = token->counter;
+		for (k = i; k < j; k++) {
+			res = verify_hotp(op, &counter, reqs[order[k]].hotp,
+					  window, &match);
+			if (res != TEE_SUCCESS)
+				goto out;
+
+			if (match)
+				bitmap[order[k] / 32] |= 1U << (order[k] % 32);
+		}
+
+		TEE_FreeOperation(op);
+		op = TEE_HANDLE_NULL;
+
+		/*
+		 * Accepted HOTPs must not be accepted again after a restart:
+		 * store the new counter, once per user and batch.
+		 */
+		res = reserve_counter(token, counter - token->counter);
+		if (res != TEE_SUCCESS)
+			goto out;
+		token->counter = counter;
+
+		for (k = i; k < j; k++)
+			counters[order[k]] = token->counter;
+	}
+
+	TEE_MemMove(params[1].memref.buffer, counters, counters_sz);
+	TEE_MemMove(params[2].memref.buffer, bitmap, bitmap_sz);
+	params[1].memref.size = counters_sz;
+	params[2].memref.size = bitmap_sz;
+out:
+	if (op != TEE_HANDLE_NULL)
+		TEE_FreeOperation(op);
+	TEE_Free(reqs);
+	TEE_Free(counters);
+	TEE_Free(bitmap);
+	TEE_Free(order);
+
+	return res;
+}
+
+static TEE_Result set_import_key(uint32_t param_types, TEE_Param params[4])
+{
+	TEE_ObjectHandle key = TEE_HANDLE_NULL;
+	TEE_ObjectHandle object;
+	TEE_Attribute attr;
+	TEE_Result res;
+	uint32_t key_len;
+
+	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+						   TEE_PARAM_TYPE_NONE,
+						   TEE_PARAM_TYPE_NONE,
+						   TEE_PARAM_TYPE_NONE);
+
+	if (param_types != exp_param_types) {
+		EMSG("Expected: 0x%x, got: 0x%x", exp_param_types, param_types);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	key_len = params[0].memref.size;
+	if (key_len != 16 && key_len != 24 && key_len != 32)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = TEE_AllocateTransientObject(TEE_TYPE_AES, key_len * 8, &key);
+	if (res != TEE_SUCCESS) {
+		EMSG("0x%08x", res);
+		return res;
+	}
+
+	TEE_InitRefAttribute(&attr, TEE_ATTR_SECRET_VALUE,
+			     params[0].memref.buffer, key_len);
+
+	res = TEE_PopulateTransientObject(key, &attr, 1);
+	if (res != TEE_SUCCESS) {
+		EMSG("0x%08x", res);
+		goto out;
+	}
+
+	res = TEE_CreatePersistentObject(TEE_STORAGE_PRIVATE, IMPORT_KEY_OBJ_ID,
+					 strlen(IMPORT_KEY_OBJ_ID),
+					 TEE_DATA_FLAG_ACCESS_READ |
+					 TEE_DATA_FLAG_OVERWRITE,
+					 key, NULL, 0, &object);
+	if (res != TEE_SUCCESS) {
+		EMSG("TEE_CreatePersistentObject failed 0x%08x", res);
+		goto out;
+	}
+	TEE_CloseObject(object);
+
+	/* The next import sets up the operation with the new key */
+	if (import_op != TEE_HANDLE_NULL) {
+		TEE_FreeOperation(import_op);
+		import_op = TEE_HANDLE_NULL;
+	}
+out:
+	TEE_FreeTransientObject(key);
+
+	return res;
+}
+
+static TEE_Result load_import_op(void)
+{
+	TEE_OperationHandle op = TEE_HANDLE_NULL;
+	TEE_ObjectInfo info;
+	TEE_ObjectHandle key;
+	TEE_Result res;
+
+	if (import_op != TEE_HANDLE_NULL)
+		return TEE_SUCCESS;
+
+	res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE, IMPORT_KEY_OBJ_ID,
+				       strlen(IMPORT_KEY_OBJ_ID),
+				       TEE_DATA_FLAG_ACCESS_READ, &key);
+	if (res != TEE_SUCCESS) {
+		EMSG("No import key, res=0x%08x", res);
+		return res == TEE_ERROR_ITEM_NOT_FOUND ? TEE_ERROR_BAD_STATE :
+							 res;
+	}
+
+	res = TEE_GetObjectInfo1(key, &info);
+	if (res != TEE_SUCCESS)
+		goto out;
+
+	res = TEE_AllocateOperation(&op, TEE_ALG_AES_GCM, TEE_MODE_DECRYPT,
+				    info.keySize);
+	if (res != TEE_SUCCESS) {
+		EMSG("0x%08x", res);
+		goto out;
+	}
+
+	res = TEE_SetOperationKey(op, key);
+	if (res != TEE_SUCCESS) {
+		EMSG("0x%08x", res);
+		TEE_FreeOperation(op);
+		goto out;
+	}
+
+	import_op = op;
+out:
+	TEE_CloseObject(key);
+
+	return res;
+}
+
+/* Authenticate and decrypt a wrapped segment into @seeds. */
+static TEE_Result unwrap_seeds(const uint8_t *in, uint32_t in_sz,
+			       struct hotp_token_seed *seeds, uint32_t seeds_sz)
+{
+	const uint8_t *tag = in + in_sz - TA_HOTP_IMPORT_TAG_SIZE;
+	uint32_t out_sz = seeds_sz;
+	TEE_Result res;
+
+	res = load_import_op();
+	if (res != TEE_SUCCESS)
+		return res;
+
+	res = TEE_AEInit(import_op, in, TA_HOTP_IMPORT_NONCE_SIZE,
+			 TA_HOTP_IMPORT_TAG_SIZE * 8, 0, 0);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	res = TEE_AEDecryptFinal(import_op, in + TA_HOTP_IMPORT_NONCE_SIZE,
+				 seeds_sz, seeds, &out_sz, (void *)tag,
+				 TA_HOTP_IMPORT_TAG_SIZE);
+	if (res != TEE_SUCCESS) {
+		EMSG("Failed to unwrap segment, res=0x%08x", res);
+		return res;
+	}
+
+	if (out_sz != seeds_sz)
+		return TEE_ERROR_BAD_FORMAT;
+
+	return TEE_SUCCESS;
+}
+
+/*
+ * Write the records of @count seeds, all in the same bucket and sorted by
+ * user ID, with one write per run of consecutive user IDs.
+ */
+static TEE_Result write_bucket(const struct hotp_token_seed *seeds,
+			       const uint16_t *order, size_t count,
+			       struct hotp_token_rec *recs)
+{
+	const struct hotp_token_seed *seed;
+	struct hotp_token *token;
+	TEE_ObjectHandle object;
+	TEE_Result res;
+	uint32_t first;
+	size_t nrec, idx;
+	size_t k, m, r;
+
+	res = open_bucket(seeds[order[0]].user_id, true, &object);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	for (k = 0; k < count; k = m) {
+		first = seeds[order[k]].user_id;
+		nrec = 0;
+
+		for (m = k; m < count; m++) {
+			seed = &seeds[order[m]];
+
+			/* A later seed of the same user replaces the former */
+			if (nrec && seed->user_id == first + nrec - 1)
+				idx = nrec - 1;
+			else if (seed->user_id == first + nrec)
+				idx = nrec++;
+			else
+				break;
+
+			memset(&recs[idx], 0, sizeof(recs[idx]));
+			recs[idx].user_id = seed->user_id;
+			recs[idx].key_len = seed->key_len;
+			memcpy(recs[idx].key, seed->key, seed->key_len);
+		}
+
+		res = TEE_SeekObjectData(object, rec_offset(first),
+					 TEE_DATA_SEEK_SET);
+		if (res == TEE_SUCCESS)
+			res = TEE_WriteObjectData(object, recs,
+						  nrec * sizeof(*recs));
+		if (res != TEE_SUCCESS) {
+			EMSG("Failed to write records, res=0x%08x", res);
+			break;
+		}
+
+		/* Keep the RAM cache in line with the store */
+		for (r = 0; r < nrec; r++) {
+			token = find_token(recs[r].user_id);
+			if (!token)
+				continue;
+
+			memcpy(token->key, recs[r].key, recs[r].key_len);
+			token->key_len = recs[r].key_len;
+			token->counter = 0;
+			token->reserved = 0;
+		}
+	}
+
+	TEE_CloseObject(object);
+	memset(recs, 0, TOKENS_PER_BUCKET * sizeof(*recs));
+
+	return res;
+}
+
+static TEE_Result import_tokens(uint32_t param_types, TEE_Param params[4])
+{
+	struct hotp_token_seed *seeds = NULL;
+	struct hotp_token_rec *recs = NULL;
+	uint16_t *order = NULL;
+	const uint8_t *in;
+	uint32_t in_sz;
+	uint32_t seeds_sz;
+	uint32_t bucket;
+	TEE_Result res;
+	bool wrapped;
+	size_t n, i, j;
+
+	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+						   TEE_PARAM_TYPE_VALUE_INPUT,
+						   TEE_PARAM_TYPE_VALUE_OUTPUT,
+						   TEE_PARAM_TYPE_NONE);
+
+	if (param_types != exp_param_types) {
+		EMSG("Expected: 0x%x, got: 0x%x", exp_param_types, param_types);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	in = params[0].memref.buffer;
+	in_sz = params[0].memref.size;
+	wrapped = params[1].value.a & TA_HOTP_IMPORT_WRAPPED;
+
+	seeds_sz = in_sz;
+	if (wrapped) {
+		if (in_sz < TA_HOTP_IMPORT_NONCE_SIZE + TA_HOTP_IMPORT_TAG_SIZE)
+			return TEE_ERROR_BAD_PARAMETERS;
+		seeds_sz -= TA_HOTP_IMPORT_NONCE_SIZE + TA_HOTP_IMPORT_TAG_SIZE;
+	}
+
+	n = seeds_sz / sizeof(*seeds);
+	if (!n || n > TA_HOTP_MAX_IMPORT || seeds_sz % sizeof(*seeds))
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	seeds = TEE_Malloc(seeds_sz, 0);
+	order = TEE_Malloc(n * sizeof(*order), 0);
+	recs = TEE_Malloc(TOKENS_PER_BUCKET * sizeof(*recs), 0);
+	if (!seeds || !order || !recs) {
+		res = TEE_ERROR_OUT_OF_MEMORY;
+		goto out;
+	}
+
+	if (wrapped) {
+		res = unwrap_seeds(in, in_sz, seeds, seeds_sz);
+		if (res != TEE_SUCCESS)
+			goto out;
+	} else {
+		TEE_MemMove(seeds, in, seeds_sz);
+	}
+
+	for (i = 0; i < n; i++) {
+		if (seeds[i].key_len < MIN_KEY_SIZE ||
+		    seeds[i].key_len > MAX_KEY_SIZE) {
+			EMSG("Bad key size for user %u", seeds[i].user_id);
+			res = TEE_ERROR_BAD_PARAMETERS;
+			goto out;
+		}
+	}
+
+	/* Sort by user ID, stable so that the last seed of a user wins */
+	for (i = 0; i < n; i++) {
+		for (j = i; j > 0 &&
+		     seeds[order[j - 1]].user_id > seeds[i].user_id; j--)
+			order[j] = order[j - 1];
+		order[j] = i;
+	}
+
+	for (i = 0; i < n; i = j) {
+		bucket = seeds[order[i]].user_id / TOKENS_PER_BUCKET;
+
+		for (j = i + 1; j < n &&
+		     seeds[order[j]].user_id / TOKENS_PER_BUCKET == bucket; j++)
+			;
+
+		res = write_bucket(seeds, order + i, j - i, recs);
+		if (res != TEE_SUCCESS)
+			goto out;
+	}
+
+	params[2].value.a = n;
+	res = TEE_SUCCESS;
+out:
+	if (seeds) {
+		memset(seeds, 0, seeds_sz);
+		TEE_Free(seeds);
+	}
+	TEE_Free(order);
+	TEE_Free(recs);
+
+	return res;
+}
+
 /*******************************************************************************
  * Mandatory TA functions.
  ******************************************************************************/
@@ -192,12 +1019,15 @@ TEE_Result TA_CreateEntryPoint(void)
 
 void TA_DestroyEntryPoint(void)
 {
+	if (import_op != TEE_HANDLE_NULL)
+		TEE_FreeOperation(import_op);
 }
 
 TEE_Result TA_OpenSessionEntryPoint(uint32_t param_types,
 				    TEE_Param __unused params[4],
-				    void __unused **sess_ctx)
+				    void **sess_ctx)
 {
+	struct hotp_session *sess;
 	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_NONE,
 						   TEE_PARAM_TYPE_NONE,
 						   TEE_PARAM_TYPE_NONE,
@@ -205,23 +1035,51 @@ TEE_Result TA_OpenSessionEntryPoint(uint32_t param_types,
 	if (param_types != exp_param_types)
 		return TEE_ERROR_BAD_PARAMETERS;
 
+	sess = TEE_Malloc(sizeof(*sess), 0);
+	if (!sess)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	sess->op = TEE_HANDLE_NULL;
+
+	*sess_ctx = sess;
+
 	return TEE_SUCCESS;
 }
 
-void TA_CloseSessionEntryPoint(void __unused *sess_ctx)
+void TA_CloseSessionEntryPoint(void *sess_ctx)
 {
+	struct hotp_session *sess = sess_ctx;
+
+	if (sess->op != TEE_HANDLE_NULL)
+		TEE_FreeOperation(sess->op);
+	TEE_Free(sess);
 }
 
-TEE_Result TA_InvokeCommandEntryPoint(void __unused *sess_ctx,
+TEE_Result TA_InvokeCommandEntryPoint(void *sess_ctx,
 				      uint32_t cmd_id,
 				      uint32_t param_types, TEE_Param params[4])
 {
 	switch (cmd_id) {
 	case TA_HOTP_CMD_REGISTER_SHARED_KEY:
-		return register_shared_key(param_types, params);
+		return register_shared_key(sess_ctx, param_types, params);
 
 	case TA_HOTP_CMD_GET_HOTP:
-		return get_hotp(param_types, params);
+		return get_hotp(sess_ctx, param_types, params);
+
+	case TA_HOTP_CMD_REGISTER_TOKEN:
+		return register_token(param_types, params);
+
+	case TA_HOTP_CMD_VERIFY_BATCH:
+		return verify_batch(param_types, params);
+
+	case TA_HOTP_CMD_GET_TOKEN_HOTP:
+		return get_token_hotp(param_types, params);
+
+	case TA_HOTP_CMD_SET_IMPORT_KEY:
+		return set_import_key(param_types, params);
+
+	case TA_HOTP_CMD_IMPORT_TOKENS:
+		return import_tokens(param_types, params);
 
 	default:
 		return TEE_ERROR_BAD_PARAMETERS;
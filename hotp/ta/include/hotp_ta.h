@@ -7,6 +7,8 @@
 #ifndef __HOTP_TA_H__
 #define __HOTP_TA_H__
 
+#include <stdint.h>
+
 /*
  * This TA implements HOTP according to:
  * https://www.ietf.org/rfc/rfc4226.txt
@@ -20,4 +22,107 @@
 #define TA_HOTP_CMD_REGISTER_SHARED_KEY	0
 #define TA_HOTP_CMD_GET_HOTP		1
 
+/*
+ * TA_HOTP_CMD_REGISTER_TOKEN - Register the shared key of one user
+ * param[0] (value) a: user ID, b: unused
+ * param[1] (memref) shared key
+ * param[2] unused
+ * param[3] unused
+ *
+ * The key is kept in the TA secure storage and the counter of the user is
+ * reset to zero.
+ */
+#define TA_HOTP_CMD_REGISTER_TOKEN	2
+
+/*
+ * TA_HOTP_CMD_VERIFY_BATCH - Verify several (user ID, HOTP) pairs at once
+ * param[0] (memref) array of struct hotp_verify_req
+ * param[1] (memref) [out] array of uint64_t, one per request: the counter
+ *                  of the request's user once the batch has been processed
+ * param[2] (memref) [out] result bitmap as an array of uint32_t, bit (i % 32)
+ *                  of word (i / 32) is set when request i was verified
+ * param[3] (value) a: look-ahead window, b: unused
+ *
+ * A HOTP is accepted when it matches one of the counter values in
+ * [counter, counter + window]. The user's counter is then resynchronized
+ * past the matching value, as described in RFC4226 section 7.4. Requests
+ * for the same user are processed in the order they appear in the array.
+ */
+#define TA_HOTP_CMD_VERIFY_BATCH	3
+
+/* Maximum number of requests in one TA_HOTP_CMD_VERIFY_BATCH */
+#define TA_HOTP_MAX_BATCH		256
+
+/* Maximum look-ahead window accepted by TA_HOTP_CMD_VERIFY_BATCH */
+#define TA_HOTP_MAX_WINDOW		16
+
+/*
+ * TA_HOTP_CMD_GET_TOKEN_HOTP - Get the next HOTP of a registered user
+ * param[0] (value) a: user ID, b: unused
+ * param[1] (value) [out] a: HOTP, b: unused
+ * param[2] unused
+ * param[3] unused
+ *
+ * Counter values are reserved in blocks in secure storage: after a restart
+ * of the TA, the counter resumes from the end of the last reserved block.
+ */
+#define TA_HOTP_CMD_GET_TOKEN_HOTP	4
+
+/*
+ * Number of users the TA keeps in RAM. TA_HOTP_CMD_GET_TOKEN_HOTP and
+ * TA_HOTP_CMD_VERIFY_BATCH on a user that is not cached load it from secure
+ * storage, evicting the least recently used one.
+ */
+#define TA_HOTP_TOKEN_CACHE_SIZE	64
+
+/*
+ * TA_HOTP_CMD_SET_IMPORT_KEY - Provision the key wrapping seed segments
+ * param[0] (memref) AES key, 16, 24 or 32 bytes
+ * param[1] unused
+ * param[2] unused
+ * param[3] unused
+ *
+ * The key is kept in the TA secure storage. It is meant to be provisioned
+ * once, from a trusted environment, before wrapped seeds are imported.
+ */
+#define TA_HOTP_CMD_SET_IMPORT_KEY	5
+
+/*
+ * TA_HOTP_CMD_IMPORT_TOKENS - Register the users of a seed file segment
+ * param[0] (memref) segment, an array of struct hotp_token_seed or, when
+ *                  wrapped, a nonce of TA_HOTP_IMPORT_NONCE_SIZE bytes
+ *                  followed by the array encrypted with AES-GCM under the
+ *                  import key and by a tag of TA_HOTP_IMPORT_TAG_SIZE bytes
+ * param[1] (value) a: TA_HOTP_IMPORT_xxx flags, b: unused
+ * param[2] (value) [out] a: number of users registered, b: unused
+ * param[3] unused
+ *
+ * Counters of the imported users are reset to zero. The records are
+ * written to secure storage grouped by bucket, with one write per run of
+ * consecutive user IDs.
+ */
+#define TA_HOTP_CMD_IMPORT_TOKENS	6
+
+#define TA_HOTP_IMPORT_WRAPPED		(1 << 0)
+
+/* Maximum number of struct hotp_token_seed in one segment */
+#define TA_HOTP_MAX_IMPORT		128
+
+#define TA_HOTP_IMPORT_NONCE_SIZE	12
+#define TA_HOTP_IMPORT_TAG_SIZE		16
+
+/* Maximum size of a shared key, in bytes */
+#define TA_HOTP_MAX_KEY_SIZE		64
+
+struct hotp_token_seed {
+	uint32_t user_id;
+	uint32_t key_len;
+	uint8_t key[TA_HOTP_MAX_KEY_SIZE];
+};
+
+struct hotp_verify_req {
+	uint32_t user_id;
+	uint32_t hotp;
+};
+
 #endif
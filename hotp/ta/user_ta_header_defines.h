@@ -14,10 +14,15 @@
 
 #define TA_UUID		TA_HOTP_UUID
 
-#define TA_FLAGS	TA_FLAG_EXEC_DDR
+/*
+ * A single instance serves all the sessions, so that they share the token
+ * store. State specific to a session lives in its session context.
+ */
+#define TA_FLAGS	(TA_FLAG_EXEC_DDR | TA_FLAG_SINGLE_INSTANCE | \
+			 TA_FLAG_MULTI_SESSION)
 
 /* Provisioned stack size */
-#define TA_STACK_SIZE	(2 * 1024)
+#define TA_STACK_SIZE	(4 * 1024)
 
 /* Provisioned heap size for TEE_Malloc() and friends */
 #define TA_DATA_SIZE	(32 * 1024)
@@ -6,7 +6,8 @@ include $(CLEAR_VARS)
 LOCAL_CFLAGS += -DANDROID_BUILD
 LOCAL_CFLAGS += -Wall
 
-LOCAL_SRC_FILES += host/main.c
+LOCAL_SRC_FILES += host/main.c host/batch.c host/kvstore.c \
+		   host/list.c host/stream.c
 
 LOCAL_C_INCLUDES := $(LOCAL_PATH)/ta/include \
 		    $(OPTEE_CLIENT_EXPORT)/include
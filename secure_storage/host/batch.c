@@ -0,0 +1,362 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2017, Linaro Limited
+ */
+
+/*
+ * Reads and writes of many small objects packed in a few invokes, one
+ * world switch then covering many objects.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* OP-TEE TEE client API (built by optee_client) */
+#include <tee_client_api.h>
+
+/* TA API: UUID and command IDs */
+#include <secure_storage_ta.h>
+
+#include "batch.h"
+
+struct batch_buf {
+	char *data;
+	size_t size;
+};
+
+static TEEC_Result reserve(struct batch_buf *buf, size_t size)
+{
+	char *data;
+
+	if (size <= buf->size)
+		return TEEC_SUCCESS;
+
+	data = realloc(buf->data, size);
+	if (!data)
+		return TEEC_ERROR_OUT_OF_MEMORY;
+
+	buf->data = data;
+	buf->size = size;
+	return TEEC_SUCCESS;
+}
+
+static TEEC_Result check_items(struct batch_item *items, size_t count,
+			       bool put)
+{
+	size_t n;
+
+	for (n = 0; n < count; n++)
+		if (strlen(items[n].id) > TA_SECURE_STORAGE_ITEM_ID_MAX_LEN ||
+		    (put && items[n].data_len > UINT32_MAX))
+			return TEEC_ERROR_BAD_PARAMETERS;
+
+	return TEEC_SUCCESS;
+}
+
+/*
+ * Pack the IDs, and the data for @put, of the first items of @items that
+ * fit in @buf. The first item always is packed, @buf growing for it.
+ */
+static TEEC_Result pack_items(struct batch_buf *buf, struct batch_item *items,
+			      size_t count, bool put, size_t *packed,
+			      size_t *len)
+{
+	struct secure_storage_item item = { };
+	size_t offs = 0;
+	size_t sz;
+	size_t n;
+
+	for (n = 0; n < count; n++) {
+		item.id_len = strlen(items[n].id);
+		item.data_len = put ? items[n].data_len : 0;
+		sz = TA_SECURE_STORAGE_ITEM_SIZE(item.id_len, item.data_len);
+
+		if (sz > buf->size - offs) {
+			if (n)
+				break;
+			if (reserve(buf, sz))
+				return TEEC_ERROR_OUT_OF_MEMORY;
+		}
+
+		memcpy(buf->data + offs, &item, sizeof(item));
+		memcpy(buf->data + offs + sizeof(item), items[n].id,
+		       item.id_len);
+		if (put)
+			memcpy(buf->data + offs + sizeof(item) + item.id_len,
+			       items[n].data, item.data_len);
+		offs += sz;
+	}
+
+	*packed = n;
+	*len = offs;
+	return TEEC_SUCCESS;
+}
+
+TEEC_Result secure_object_put_batch(TEEC_Session *sess,
+				    struct batch_item *items, size_t count)
+{
+	struct batch_buf in = { };
+	TEEC_Operation op;
+	uint32_t *results;
+	uint32_t origin;
+	TEEC_Result res;
+	size_t packed;
+	size_t len;
+	size_t n;
+
+	res = check_items(items, count, true);
+	if (res != TEEC_SUCCESS)
+		return res;
+
+	results = calloc(count ? count : 1, sizeof(*results));
+	if (!results || reserve(&in, BATCH_BUF_SIZE)) {
+		res = TEEC_ERROR_OUT_OF_MEMORY;
+		goto out;
+	}
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_NONE, TEEC_NONE);
+
+	while (count) {
+		res = pack_items(&in, items, count, true, &packed, &len);
+		if (res != TEEC_SUCCESS)
+			goto out;
+
+		op.params[0].tmpref.buffer = in.data;
+		op.params[0].tmpref.size = len;
+		op.params[1].tmpref.buffer = results;
+		op.params[1].tmpref.size = packed * sizeof(*results);
+
+		res = TEEC_InvokeCommand(sess, TA_SECURE_STORAGE_CMD_BATCH_PUT,
+					 &op, &origin);
+		if (res != TEEC_SUCCESS) {
+			printf("Command BATCH_PUT failed: 0x%x / %u\n",
+			       res, origin);
+			goto out;
+		}
+
+		for (n = 0; n < packed; n++)
+			items[n].status = results[n];
+
+		items += packed;
+		count -= packed;
+	}
+
+out:
+	free(in.data);
+	free(results);
+	return res;
+}
+
+/* Unpack the @count results of a BATCH_GET of @buf into @items */
+static TEEC_Result unpack_items(struct batch_buf *buf, size_t len,
+				struct batch_item *items, size_t count)
+{
+	struct secure_storage_item item;
+	size_t offs = 0;
+	size_t n;
+
+	for (n = 0; n < count; n++) {
+		if (len - offs < sizeof(item))
+			return TEEC_ERROR_BAD_FORMAT;
+		memcpy(&item, buf->data + offs, sizeof(item));
+		offs += sizeof(item);
+		if (item.data_len > len - offs)
+			return TEEC_ERROR_BAD_FORMAT;
+
+		items[n].status = item.status;
+		items[n].data = NULL;
+		items[n].data_len = 0;
+		if (item.status == TEEC_SUCCESS) {
+			items[n].data = malloc(item.data_len ?
+					       item.data_len : 1);
+			if (!items[n].data)
+				return TEEC_ERROR_OUT_OF_MEMORY;
+			memcpy(items[n].data, buf->data + offs,
+			       item.data_len);
+			items[n].data_len = item.data_len;
+		}
+		offs += item.data_len;
+	}
+
+	return TEEC_SUCCESS;
+}
+
+TEEC_Result secure_object_get_batch(TEEC_Session *sess,
+				    struct batch_item *items, size_t count)
+{
+	struct batch_buf out = { };
+	struct batch_buf in = { };
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+	size_t packed;
+	size_t len;
+
+	res = check_items(items, count, false);
+	if (res != TEEC_SUCCESS)
+		return res;
+
+	if (reserve(&in, BATCH_BUF_SIZE) || reserve(&out, BATCH_BUF_SIZE)) {
+		res = TEEC_ERROR_OUT_OF_MEMORY;
+		goto out;
+	}
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_VALUE_OUTPUT, TEEC_NONE);
+
+	while (count) {
+		res = pack_items(&in, items, count, false, &packed, &len);
+		if (res != TEEC_SUCCESS)
+			goto out;
+
+		op.params[0].tmpref.buffer = in.data;
+		op.params[0].tmpref.size = len;
+		op.params[1].tmpref.buffer = out.data;
+		op.params[1].tmpref.size = out.size;
+
+		res = TEEC_InvokeCommand(sess, TA_SECURE_STORAGE_CMD_BATCH_GET,
+					 &op, &origin);
+		if (res == TEEC_ERROR_SHORT_BUFFER &&
+		    op.params[1].tmpref.size > out.size) {
+			/* The next object alone is larger than the buffer */
+			res = reserve(&out, op.params[1].tmpref.size);
+			if (res != TEEC_SUCCESS)
+				goto out;
+			continue;
+		}
+		if (res != TEEC_SUCCESS) {
+			printf("Command BATCH_GET failed: 0x%x / %u\n",
+			       res, origin);
+			goto out;
+		}
+
+		/* The objects read are fewer than the IDs sent when large */
+		packed = op.params[2].value.a;
+		if (!packed || packed > count) {
+			res = TEEC_ERROR_BAD_FORMAT;
+			goto out;
+		}
+
+		res = unpack_items(&out, op.params[1].tmpref.size, items,
+				   packed);
+		if (res != TEEC_SUCCESS)
+			goto out;
+
+		items += packed;
+		count -= packed;
+	}
+
+out:
+	free(out.data);
+	free(in.data);
+	return res;
+}
+
+TEEC_Result secure_object_stat(TEEC_Session *sess, struct batch_item *items,
+			       size_t count,
+			       struct secure_storage_object_stat *stats)
+{
+	struct batch_buf in = { };
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+	size_t packed;
+	size_t len;
+	size_t n;
+
+	res = check_items(items, count, false);
+	if (res != TEEC_SUCCESS)
+		return res;
+
+	if (reserve(&in, BATCH_BUF_SIZE))
+		return TEEC_ERROR_OUT_OF_MEMORY;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_NONE, TEEC_NONE);
+
+	while (count) {
+		res = pack_items(&in, items, count, false, &packed, &len);
+		if (res != TEEC_SUCCESS)
+			break;
+
+		op.params[0].tmpref.buffer = in.data;
+		op.params[0].tmpref.size = len;
+		op.params[1].tmpref.buffer = stats;
+		op.params[1].tmpref.size = packed * sizeof(*stats);
+
+		res = TEEC_InvokeCommand(sess, TA_SECURE_STORAGE_CMD_STAT,
+					 &op, &origin);
+		if (res != TEEC_SUCCESS) {
+			printf("Command STAT failed: 0x%x / %u\n", res, origin);
+			break;
+		}
+
+		for (n = 0; n < packed; n++)
+			items[n].status = stats[n].status;
+
+		items += packed;
+		stats += packed;
+		count -= packed;
+	}
+
+	free(in.data);
+	return res;
+}
+
+TEEC_Result secure_object_replace_batch(TEEC_Session *sess,
+					struct batch_item *items,
+					size_t count)
+{
+	struct batch_buf in = { };
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+	size_t packed;
+	size_t len = 0;
+	size_t n;
+
+	if (!count || count > TA_SECURE_STORAGE_REPLACE_MAX_ITEMS)
+		return TEEC_ERROR_BAD_PARAMETERS;
+
+	res = check_items(items, count, true);
+	if (res != TEEC_SUCCESS)
+		return res;
+
+	/* All the items go in the same invoke */
+	for (n = 0; n < count; n++)
+		len += TA_SECURE_STORAGE_ITEM_SIZE(strlen(items[n].id),
+						   items[n].data_len);
+	if (reserve(&in, len))
+		return TEEC_ERROR_OUT_OF_MEMORY;
+
+	res = pack_items(&in, items, count, true, &packed, &len);
+	if (res != TEEC_SUCCESS)
+		goto out;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_NONE,
+					 TEEC_NONE, TEEC_NONE);
+
+	op.params[0].tmpref.buffer = in.data;
+	op.params[0].tmpref.size = len;
+
+	res = TEEC_InvokeCommand(sess, TA_SECURE_STORAGE_CMD_BATCH_REPLACE,
+				 &op, &origin);
+	if (res != TEEC_SUCCESS)
+		printf("Command BATCH_REPLACE failed: 0x%x / %u\n", res, origin);
+
+	for (n = 0; n < count; n++)
+		items[n].status = res;
+out:
+	free(in.data);
+	return res;
+}
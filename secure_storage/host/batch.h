@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (c) 2017, Linaro Limited
+ */
+
+#ifndef __SECURE_STORAGE_BATCH_H__
+#define __SECURE_STORAGE_BATCH_H__
+
+#include <stddef.h>
+
+#include <tee_client_api.h>
+
+/* TA API: UUID and command IDs */
+#include <secure_storage_ta.h>
+
+/*
+ * Size of the packed item lists of each invoke. Items are sent in as few
+ * invokes as these buffers allow, a larger item in an invoke of its own.
+ */
+#define BATCH_BUF_SIZE		(64 * 1024)
+
+struct batch_item {
+	const char *id;
+	void *data;
+	size_t data_len;
+	TEEC_Result status;	/* Result of the item */
+};
+
+/*
+ * Create the persistent objects of @items with their data, replacing any
+ * object of the same ID. The status of each item is set, the return value
+ * only tells whether all the items were processed.
+ */
+TEEC_Result secure_object_put_batch(TEEC_Session *sess,
+				    struct batch_item *items, size_t count);
+
+/*
+ * Read the persistent objects of @items. The data of each item read with
+ * success is allocated, to be freed by the caller, and is NULL for the
+ * others. The status of each item is set, the return value only tells
+ * whether all the items were processed.
+ */
+TEEC_Result secure_object_get_batch(TEEC_Session *sess,
+				    struct batch_item *items, size_t count);
+
+/*
+ * Get the size and the metadata of the persistent objects of @items into
+ * @stats, one for each item, without reading their data. The status of
+ * each item is set as well.
+ */
+TEEC_Result secure_object_stat(TEEC_Session *sess, struct batch_item *items,
+			       size_t count,
+			       struct secure_storage_object_stat *stats);
+
+/*
+ * Replace or create the persistent objects of @items with their data,
+ * all of them or none, in a single invoke. At most
+ * TA_SECURE_STORAGE_REPLACE_MAX_ITEMS items, all with different IDs. The
+ * status of each item is set to the return value.
+ */
+TEEC_Result secure_object_replace_batch(TEEC_Session *sess,
+					struct batch_item *items,
+					size_t count);
+
+#endif /* __SECURE_STORAGE_BATCH_H__ */
@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2017, Linaro Limited
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+/* OP-TEE TEE client API (built by optee_client) */
+#include <tee_client_api.h>
+
+/* TA API: UUID and command IDs */
+#include <secure_storage_ta.h>
+
+#include "kvstore.h"
+
+/* Size of the list of keys of each scan invoke */
+#define KV_SCAN_BUF_SIZE	4096
+
+TEEC_Result kv_store_put(TEEC_Session *sess, const char *key,
+			 const void *value, size_t value_len)
+{
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_NONE, TEEC_NONE);
+
+	op.params[0].tmpref.buffer = (void *)key;
+	op.params[0].tmpref.size = strlen(key);
+
+	op.params[1].tmpref.buffer = (void *)value;
+	op.params[1].tmpref.size = value_len;
+
+	res = TEEC_InvokeCommand(sess, TA_SECURE_STORAGE_CMD_KV_PUT, &op,
+				 &origin);
+	if (res != TEEC_SUCCESS)
+		printf("Command KV_PUT failed: 0x%x / %u\n", res, origin);
+
+	return res;
+}
+
+TEEC_Result kv_store_get(TEEC_Session *sess, const char *key, void *value,
+			 size_t *value_len)
+{
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_NONE, TEEC_NONE);
+
+	op.params[0].tmpref.buffer = (void *)key;
+	op.params[0].tmpref.size = strlen(key);
+
+	op.params[1].tmpref.buffer = value;
+	op.params[1].tmpref.size = *value_len;
+
+	res = TEEC_InvokeCommand(sess, TA_SECURE_STORAGE_CMD_KV_GET, &op,
+				 &origin);
+	switch (res) {
+	case TEEC_SUCCESS:
+	case TEEC_ERROR_SHORT_BUFFER:
+		*value_len = op.params[1].tmpref.size;
+		break;
+	case TEEC_ERROR_ITEM_NOT_FOUND:
+		break;
+	default:
+		printf("Command KV_GET failed: 0x%x / %u\n", res, origin);
+	}
+
+	return res;
+}
+
+TEEC_Result kv_store_delete(TEEC_Session *sess, const char *key)
+{
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_NONE, TEEC_NONE, TEEC_NONE);
+
+	op.params[0].tmpref.buffer = (void *)key;
+	op.params[0].tmpref.size = strlen(key);
+
+	res = TEEC_InvokeCommand(sess, TA_SECURE_STORAGE_CMD_KV_DELETE, &op,
+				 &origin);
+	switch (res) {
+	case TEEC_SUCCESS:
+	case TEEC_ERROR_ITEM_NOT_FOUND:
+		break;
+	default:
+		printf("Command KV_DELETE failed: 0x%x / %u\n", res, origin);
+	}
+
+	return res;
+}
+
+TEEC_Result kv_store_scan(TEEC_Session *sess, const char *prefix,
+			  void (*cb)(const char *key, size_t key_len,
+				     void *arg),
+			  void *arg)
+{
+	struct secure_storage_item item;
+	char buf[KV_SCAN_BUF_SIZE];
+	uint32_t first = 0;
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+	size_t offs;
+	uint32_t n;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_VALUE_INOUT, TEEC_NONE);
+
+	op.params[0].tmpref.buffer = (void *)prefix;
+	op.params[0].tmpref.size = strlen(prefix);
+
+	/* The keys matching may change between invokes, never mind */
+	do {
+		op.params[1].tmpref.buffer = buf;
+		op.params[1].tmpref.size = sizeof(buf);
+		op.params[2].value.a = first;
+
+		res = TEEC_InvokeCommand(sess, TA_SECURE_STORAGE_CMD_KV_SCAN,
+					 &op, &origin);
+		if (res != TEEC_SUCCESS) {
+			printf("Command KV_SCAN failed: 0x%x / %u\n",
+			       res, origin);
+			return res;
+		}
+
+		for (n = 0, offs = 0; n < op.params[2].value.a; n++) {
+			if (op.params[1].tmpref.size - offs < sizeof(item))
+				return TEEC_ERROR_BAD_FORMAT;
+			memcpy(&item, buf + offs, sizeof(item));
+			offs += sizeof(item);
+			if (item.id_len > op.params[1].tmpref.size - offs)
+				return TEEC_ERROR_BAD_FORMAT;
+
+			cb(buf + offs, item.id_len, arg);
+			offs += item.id_len;
+		}
+
+		first += op.params[2].value.a;
+	} while (op.params[2].value.a && first < op.params[2].value.b);
+
+	return TEEC_SUCCESS;
+}
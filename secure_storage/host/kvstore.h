@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (c) 2017, Linaro Limited
+ */
+
+#ifndef __SECURE_STORAGE_KVSTORE_H__
+#define __SECURE_STORAGE_KVSTORE_H__
+
+#include <stddef.h>
+
+#include <tee_client_api.h>
+
+/*
+ * Key-value store of the TA, see TA_SECURE_STORAGE_CMD_KV_GET. Keys are
+ * strings here.
+ */
+
+TEEC_Result kv_store_put(TEEC_Session *sess, const char *key,
+			 const void *value, size_t value_len);
+
+/* @value_len is the size of @value, set to the size of the value */
+TEEC_Result kv_store_get(TEEC_Session *sess, const char *key, void *value,
+			 size_t *value_len);
+
+TEEC_Result kv_store_delete(TEEC_Session *sess, const char *key);
+
+/* Call @cb for each key starting with @prefix, in ascending order */
+TEEC_Result kv_store_scan(TEEC_Session *sess, const char *prefix,
+			  void (*cb)(const char *key, size_t key_len,
+				     void *arg),
+			  void *arg);
+
+#endif /* __SECURE_STORAGE_KVSTORE_H__ */
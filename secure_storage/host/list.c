@@ -0,0 +1,93 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2017, Linaro Limited
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* OP-TEE TEE client API (built by optee_client) */
+#include <tee_client_api.h>
+
+/* TA API: UUID and command IDs */
+#include <secure_storage_ta.h>
+
+#include "list.h"
+
+TEEC_Result secure_object_list(TEEC_Session *sess, bool internal,
+			       void (*cb)(const char *id, size_t id_len,
+					  uint32_t data_size, void *arg),
+			       void *arg)
+{
+	struct secure_storage_list_item item;
+	size_t buf_size = LIST_BUF_SIZE;
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+	size_t offs;
+	char *buf;
+	void *p;
+	uint32_t n;
+
+	buf = malloc(buf_size);
+	if (!buf)
+		return TEEC_ERROR_OUT_OF_MEMORY;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INOUT,
+					 TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_NONE, TEEC_NONE);
+	op.params[0].value.a = TA_SECURE_STORAGE_LIST_START;
+	op.params[0].value.b = internal;
+
+	while (true) {
+		op.params[1].tmpref.buffer = buf;
+		op.params[1].tmpref.size = buf_size;
+
+		res = TEEC_InvokeCommand(sess, TA_SECURE_STORAGE_CMD_LIST,
+					 &op, &origin);
+		if (res == TEEC_ERROR_SHORT_BUFFER &&
+		    op.params[1].tmpref.size > buf_size) {
+			/* The cursor stays on the object that did not fit */
+			p = realloc(buf, op.params[1].tmpref.size);
+			if (!p) {
+				res = TEEC_ERROR_OUT_OF_MEMORY;
+				break;
+			}
+			buf = p;
+			buf_size = op.params[1].tmpref.size;
+			op.params[0].value.a = TA_SECURE_STORAGE_LIST_NEXT;
+			continue;
+		}
+		if (res != TEEC_SUCCESS) {
+			printf("Command LIST failed: 0x%x / %u\n", res, origin);
+			break;
+		}
+
+		for (n = 0, offs = 0; n < op.params[0].value.a; n++) {
+			if (op.params[1].tmpref.size - offs < sizeof(item)) {
+				res = TEEC_ERROR_BAD_FORMAT;
+				goto out;
+			}
+			memcpy(&item, buf + offs, sizeof(item));
+			offs += sizeof(item);
+			if (item.id_len > op.params[1].tmpref.size - offs) {
+				res = TEEC_ERROR_BAD_FORMAT;
+				goto out;
+			}
+
+			cb(buf + offs, item.id_len, item.data_size, arg);
+			offs += item.id_len;
+		}
+
+		if (op.params[0].value.b)
+			break;
+		op.params[0].value.a = TA_SECURE_STORAGE_LIST_NEXT;
+	}
+
+out:
+	free(buf);
+	return res;
+}
@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (c) 2017, Linaro Limited
+ */
+
+#ifndef __SECURE_STORAGE_LIST_H__
+#define __SECURE_STORAGE_LIST_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <tee_client_api.h>
+
+/* Size of the page of objects listed at each invoke */
+#define LIST_BUF_SIZE		(64 * 1024)
+
+/*
+ * Call @cb for each persistent object of the TA, with its ID and the size
+ * of its data, including the internal objects of the TA if @internal is
+ * set. The listing uses the cursor of the session: a single listing at a
+ * time in a session.
+ */
+TEEC_Result secure_object_list(TEEC_Session *sess, bool internal,
+			       void (*cb)(const char *id, size_t id_len,
+					  uint32_t data_size, void *arg),
+			       void *arg);
+
+#endif /* __SECURE_STORAGE_LIST_H__ */
@@ -26,8 +26,13 @@
  */
 
 #include <err.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 /* OP-TEE TEE client API (built by optee_client) */
 #include <tee_client_api.h>
@@ -35,6 +40,11 @@
 /* TA API: UUID and command IDs */
 #include <secure_storage_ta.h>
 
+#include "batch.h"
+#include "kvstore.h"
+#include "list.h"
+#include "stream.h"
+
 /* TEE resources */
 struct test_ctx {
 	TEEC_Context ctx;
@@ -100,6 +110,67 @@ TEEC_Result read_secure_object(struct test_ctx *ctx, char *id,
 	return res;
 }
 
+/*
+ * Read an object into a buffer of its exact size, allocated and to be freed
+ * by the caller. The TA keeps the object open between the read that gets
+ * the size and the read of the data.
+ */
+TEEC_Result read_secure_object_alloc(struct test_ctx *ctx, char *id,
+			char **data, size_t *data_len)
+{
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+	size_t id_len = strlen(id);
+	char *buf;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_NONE, TEEC_NONE);
+
+	op.params[0].tmpref.buffer = id;
+	op.params[0].tmpref.size = id_len;
+
+	op.params[1].tmpref.buffer = NULL;
+	op.params[1].tmpref.size = 0;
+
+	res = TEEC_InvokeCommand(&ctx->sess,
+				 TA_SECURE_STORAGE_CMD_READ_RAW,
+				 &op, &origin);
+	if (res == TEEC_SUCCESS) {
+		/* Empty object */
+		*data = malloc(1);
+		*data_len = 0;
+		return *data ? TEEC_SUCCESS : TEEC_ERROR_OUT_OF_MEMORY;
+	}
+	if (res != TEEC_ERROR_SHORT_BUFFER) {
+		if (res != TEEC_ERROR_ITEM_NOT_FOUND)
+			printf("Command READ_RAW failed: 0x%x / %u\n",
+			       res, origin);
+		return res;
+	}
+
+	buf = malloc(op.params[1].tmpref.size);
+	if (!buf)
+		return TEEC_ERROR_OUT_OF_MEMORY;
+
+	op.params[1].tmpref.buffer = buf;
+
+	res = TEEC_InvokeCommand(&ctx->sess,
+				 TA_SECURE_STORAGE_CMD_READ_RAW,
+				 &op, &origin);
+	if (res != TEEC_SUCCESS) {
+		printf("Command READ_RAW failed: 0x%x / %u\n", res, origin);
+		free(buf);
+		return res;
+	}
+
+	*data = buf;
+	*data_len = op.params[1].tmpref.size;
+	return TEEC_SUCCESS;
+}
+
 TEEC_Result write_secure_object(struct test_ctx *ctx, char *id,
 			char *data, size_t data_len)
 {
@@ -164,17 +235,610 @@ TEEC_Result delete_secure_object(struct test_ctx *ctx, char *id)
 	return res;
 }
 
+TEEC_Result read_secure_object_at(struct test_ctx *ctx, char *id,
+			uint32_t offset, char *data, size_t *data_len)
+{
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+	size_t id_len = strlen(id);
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_VALUE_INPUT, TEEC_NONE);
+
+	op.params[0].tmpref.buffer = id;
+	op.params[0].tmpref.size = id_len;
+
+	op.params[1].tmpref.buffer = data;
+	op.params[1].tmpref.size = *data_len;
+
+	op.params[2].value.a = offset;
+
+	res = TEEC_InvokeCommand(&ctx->sess,
+				 TA_SECURE_STORAGE_CMD_READ_AT,
+				 &op, &origin);
+	switch (res) {
+	case TEEC_SUCCESS:
+		*data_len = op.params[1].tmpref.size;
+		break;
+	case TEEC_ERROR_ITEM_NOT_FOUND:
+		break;
+	default:
+		printf("Command READ_AT failed: 0x%x / %u\n", res, origin);
+	}
+
+	return res;
+}
+
+TEEC_Result write_secure_object_at(struct test_ctx *ctx, char *id,
+			uint32_t offset, char *data, size_t data_len)
+{
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+	size_t id_len = strlen(id);
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_VALUE_INPUT, TEEC_NONE);
+
+	op.params[0].tmpref.buffer = id;
+	op.params[0].tmpref.size = id_len;
+
+	op.params[1].tmpref.buffer = data;
+	op.params[1].tmpref.size = data_len;
+
+	op.params[2].value.a = offset;
+
+	res = TEEC_InvokeCommand(&ctx->sess,
+				 TA_SECURE_STORAGE_CMD_WRITE_AT,
+				 &op, &origin);
+	if (res != TEEC_SUCCESS)
+		printf("Command WRITE_AT failed: 0x%x / %u\n", res, origin);
+
+	return res;
+}
+
+TEEC_Result truncate_secure_object(struct test_ctx *ctx, char *id,
+			uint32_t size)
+{
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+	size_t id_len = strlen(id);
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT, TEEC_NONE,
+					 TEEC_VALUE_INPUT, TEEC_NONE);
+
+	op.params[0].tmpref.buffer = id;
+	op.params[0].tmpref.size = id_len;
+
+	op.params[2].value.a = size;
+
+	res = TEEC_InvokeCommand(&ctx->sess,
+				 TA_SECURE_STORAGE_CMD_TRUNCATE,
+				 &op, &origin);
+	if (res != TEEC_SUCCESS)
+		printf("Command TRUNCATE failed: 0x%x / %u\n", res, origin);
+
+	return res;
+}
+
+TEEC_Result replace_secure_object(struct test_ctx *ctx, char *id,
+			char *data, size_t data_len)
+{
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+	size_t id_len = strlen(id);
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_NONE, TEEC_NONE);
+
+	op.params[0].tmpref.buffer = id;
+	op.params[0].tmpref.size = id_len;
+
+	op.params[1].tmpref.buffer = data;
+	op.params[1].tmpref.size = data_len;
+
+	res = TEEC_InvokeCommand(&ctx->sess,
+				 TA_SECURE_STORAGE_CMD_REPLACE,
+				 &op, &origin);
+	if (res != TEEC_SUCCESS)
+		printf("Command REPLACE failed: 0x%x / %u\n", res, origin);
+
+	return res;
+}
+
+TEEC_Result get_cache_stats(struct test_ctx *ctx,
+			struct secure_storage_cache_stats *stats)
+{
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE,
+					 TEEC_NONE, TEEC_NONE);
+
+	op.params[0].tmpref.buffer = stats;
+	op.params[0].tmpref.size = sizeof(*stats);
+
+	res = TEEC_InvokeCommand(&ctx->sess,
+				 TA_SECURE_STORAGE_CMD_CACHE_STATS,
+				 &op, &origin);
+	if (res != TEEC_SUCCESS)
+		printf("Command CACHE_STATS failed: 0x%x / %u\n", res, origin);
+
+	return res;
+}
+
 #define TEST_OBJECT_SIZE	7000
+#define TEST_PATCH_OFFSET	3000
+#define TEST_PATCH_SIZE		1000
+#define TEST_TRUNCATED_SIZE	3500
+#define TEST_STREAM_SIZE	(3 * STREAM_CHUNK_SIZE + 1234)
+#define TEST_BATCH_COUNT	500
+#define TEST_KV_COUNT		300
+#define TEST_CACHE_READS	100
+#define TEST_REPLACE_COUNT	4
+
+/* Store a file larger than a chunk, read it back into another file */
+static void test_stream(struct test_ctx *ctx, char *id)
+{
+	char *data = malloc(TEST_STREAM_SIZE);
+	char *read_data = malloc(TEST_STREAM_SIZE);
+	FILE *in = tmpfile();
+	FILE *out = tmpfile();
+	TEEC_Result res;
+	size_t n;
+
+	if (!data || !read_data || !in || !out)
+		err(1, "Cannot prepare the streamed object");
+
+	for (n = 0; n < TEST_STREAM_SIZE; n++)
+		data[n] = n % 251;
+	if (fwrite(data, 1, TEST_STREAM_SIZE, in) != TEST_STREAM_SIZE ||
+	    fflush(in))
+		err(1, "Cannot write the file to store");
+	rewind(in);
+
+	printf("- Store a file of %d bytes by chunks\n", TEST_STREAM_SIZE);
+
+	res = secure_object_from_file(&ctx->ctx, &ctx->sess, id, fileno(in));
+	if (res != TEEC_SUCCESS)
+		errx(1, "Failed to store the file: 0x%x", res);
+
+	printf("- Read back the object by chunks into another file\n");
+
+	res = secure_object_to_file(&ctx->ctx, &ctx->sess, id, fileno(out));
+	if (res != TEEC_SUCCESS)
+		errx(1, "Failed to read the object into a file: 0x%x", res);
+
+	rewind(out);
+	if (fread(read_data, 1, TEST_STREAM_SIZE, out) != TEST_STREAM_SIZE ||
+	    fgetc(out) != EOF || memcmp(data, read_data, TEST_STREAM_SIZE))
+		errx(1, "Unexpected content found in secure storage");
+
+	printf("- Delete the object\n");
+
+	res = delete_secure_object(ctx, id);
+	if (res != TEEC_SUCCESS)
+		errx(1, "Failed to delete the object: 0x%x", res);
+
+	fclose(out);
+	fclose(in);
+	free(read_data);
+	free(data);
+}
+
+static void count_batch_object(const char *id, size_t id_len,
+			       uint32_t data_size, void *arg)
+{
+	if (id_len > 6 && !memcmp(id, "batch#", 6))
+		(*(size_t *)arg)++;
+}
+
+/* Store many small objects and read them back in a few invokes */
+static void test_batch(struct test_ctx *ctx)
+{
+	struct batch_item items[TEST_BATCH_COUNT];
+	struct batch_item get_items[TEST_BATCH_COUNT + 1];
+	char ids[TEST_BATCH_COUNT][16];
+	char data[TEST_BATCH_COUNT][64];
+	TEEC_Result res;
+	size_t count;
+	size_t n;
+
+	for (n = 0; n < TEST_BATCH_COUNT; n++) {
+		snprintf(ids[n], sizeof(ids[n]), "batch#%zu", n);
+		memset(data[n], n, sizeof(data[n]));
+		items[n].id = ids[n];
+		items[n].data = data[n];
+		items[n].data_len = n % sizeof(data[n]);
+	}
+
+	printf("- Store %d objects in batches\n", TEST_BATCH_COUNT);
+
+	res = secure_object_put_batch(&ctx->sess, items, TEST_BATCH_COUNT);
+	if (res != TEEC_SUCCESS)
+		errx(1, "Failed to store the objects: 0x%x", res);
+	for (n = 0; n < TEST_BATCH_COUNT; n++)
+		if (items[n].status != TEEC_SUCCESS)
+			errx(1, "Failed to store \"%s\": 0x%x", items[n].id,
+			     items[n].status);
+
+	printf("- Read back the objects, and one not found, in batches\n");
+
+	memset(get_items, 0, sizeof(get_items));
+	for (n = 0; n < TEST_BATCH_COUNT; n++)
+		get_items[n].id = ids[n];
+	get_items[TEST_BATCH_COUNT].id = "batch#none";
+
+	res = secure_object_get_batch(&ctx->sess, get_items,
+				      TEST_BATCH_COUNT + 1);
+	if (res != TEEC_SUCCESS)
+		errx(1, "Failed to read the objects: 0x%x", res);
+	for (n = 0; n < TEST_BATCH_COUNT; n++)
+		if (get_items[n].status != TEEC_SUCCESS ||
+		    get_items[n].data_len != items[n].data_len ||
+		    memcmp(get_items[n].data, data[n], items[n].data_len))
+			errx(1, "Unexpected content found in secure storage");
+	if (get_items[TEST_BATCH_COUNT].status != TEEC_ERROR_ITEM_NOT_FOUND)
+		errx(1, "Unexpected status when reading an object : 0x%x",
+		     get_items[TEST_BATCH_COUNT].status);
+
+	printf("- List the objects\n");
+
+	count = 0;
+	res = secure_object_list(&ctx->sess, false, count_batch_object,
+				 &count);
+	if (res != TEEC_SUCCESS)
+		errx(1, "Failed to list the objects: 0x%x", res);
+	if (count != TEST_BATCH_COUNT)
+		errx(1, "Unexpected number of objects: %zu", count);
+
+	printf("- Delete the objects\n");
+
+	for (n = 0; n < TEST_BATCH_COUNT; n++) {
+		free(get_items[n].data);
+		res = delete_secure_object(ctx, ids[n]);
+		if (res != TEEC_SUCCESS)
+			errx(1, "Failed to delete the object: 0x%x", res);
+	}
+}
+
+/* A small object read often is served from the cache of the TA */
+static void test_cache(struct test_ctx *ctx, char *id)
+{
+	struct secure_storage_cache_stats before;
+	struct secure_storage_cache_stats after;
+	char data[] = "log_level=2";
+	char update[] = "log_level=3";
+	char read_data[sizeof(data)];
+	TEEC_Result res;
+	size_t n;
+
+	printf("- Create a small object, read it %d times\n",
+	       TEST_CACHE_READS);
+
+	res = write_secure_object(ctx, id, data, sizeof(data));
+	if (res != TEEC_SUCCESS)
+		errx(1, "Failed to create an object in the secure storage");
+
+	res = get_cache_stats(ctx, &before);
+	if (res != TEEC_SUCCESS)
+		errx(1, "Failed to get the cache counters: 0x%x", res);
+
+	for (n = 0; n < TEST_CACHE_READS; n++) {
+		res = read_secure_object(ctx, id, read_data,
+					 sizeof(read_data));
+		if (res != TEEC_SUCCESS)
+			errx(1, "Failed to read an object from the secure storage");
+		if (memcmp(data, read_data, sizeof(data)))
+			errx(1, "Unexpected content found in secure storage");
+	}
+
+	res = get_cache_stats(ctx, &after);
+	if (res != TEEC_SUCCESS)
+		errx(1, "Failed to get the cache counters: 0x%x", res);
+
+	printf("- %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu32
+	       " objects cached in %" PRIu32 " bytes over %" PRIu32 "\n",
+	       after.hits - before.hits, after.misses - before.misses,
+	       after.count, after.size, after.capacity);
+	if (after.capacity && after.hits - before.hits != TEST_CACHE_READS - 1)
+		errx(1, "Unexpected number of cache hits");
+
+	printf("- Update the object, read it back\n");
+
+	res = write_secure_object(ctx, id, update, sizeof(update));
+	if (res != TEEC_SUCCESS)
+		errx(1, "Failed to update the object");
+
+	res = read_secure_object(ctx, id, read_data, sizeof(read_data));
+	if (res != TEEC_SUCCESS)
+		errx(1, "Failed to read an object from the secure storage");
+	if (memcmp(update, read_data, sizeof(update)))
+		errx(1, "Unexpected content found in secure storage");
+
+	printf("- Delete the object\n");
+
+	res = delete_secure_object(ctx, id);
+	if (res != TEEC_SUCCESS)
+		errx(1, "Failed to delete the object: 0x%x", res);
+
+	res = read_secure_object(ctx, id, read_data, sizeof(read_data));
+	if (res != TEEC_ERROR_ITEM_NOT_FOUND)
+		errx(1, "Unexpected status when reading an object : 0x%x", res);
+}
+
+static void count_tx_object(const char *id, size_t id_len,
+			    uint32_t data_size, void *arg)
+{
+	size_t prefix_len = strlen(TA_SECURE_STORAGE_TX_PREFIX);
+
+	if (id_len >= prefix_len &&
+	    !memcmp(id, TA_SECURE_STORAGE_TX_PREFIX, prefix_len))
+		(*(size_t *)arg)++;
+}
+
+/* Replace objects atomically, one and then several together */
+static void test_replace(struct test_ctx *ctx)
+{
+	struct batch_item items[TEST_REPLACE_COUNT];
+	char ids[TEST_REPLACE_COUNT][16];
+	char data[TEST_REPLACE_COUNT][32];
+	char read_data[32];
+	TEEC_Result res;
+	size_t count;
+	size_t n;
+
+	for (n = 0; n < TEST_REPLACE_COUNT; n++) {
+		snprintf(ids[n], sizeof(ids[n]), "replace#%zu", n);
+		snprintf(data[n], sizeof(data[n]), "version 1 of %zu", n);
+		items[n].id = ids[n];
+		items[n].data = data[n];
+		items[n].data_len = strlen(data[n]);
+	}
+
+	printf("- Create %d objects together\n", TEST_REPLACE_COUNT);
+
+	res = secure_object_replace_batch(&ctx->sess, items,
+					  TEST_REPLACE_COUNT);
+	if (res != TEEC_SUCCESS)
+		errx(1, "Failed to create the objects: 0x%x", res);
+
+	printf("- Replace one of them\n");
+
+	snprintf(data[0], sizeof(data[0]), "version 2 of 0");
+	items[0].data_len = strlen(data[0]);
+
+	res = replace_secure_object(ctx, ids[0], data[0], items[0].data_len);
+	if (res != TEEC_SUCCESS)
+		errx(1, "Failed to replace the object: 0x%x", res);
+
+	printf("- Replace all of them together\n");
+
+	for (n = 0; n < TEST_REPLACE_COUNT; n++) {
+		snprintf(data[n], sizeof(data[n]), "version 3 of %zu", n);
+		items[n].data_len = strlen(data[n]);
+	}
+
+	res = secure_object_replace_batch(&ctx->sess, items,
+					  TEST_REPLACE_COUNT);
+	if (res != TEEC_SUCCESS)
+		errx(1, "Failed to replace the objects: 0x%x", res);
+
+	printf("- Read back the objects\n");
+
+	for (n = 0; n < TEST_REPLACE_COUNT; n++) {
+		res = read_secure_object(ctx, ids[n], read_data,
+					 sizeof(read_data));
+		if (res != TEEC_SUCCESS)
+			errx(1, "Failed to read an object from the secure storage");
+		if (memcmp(data[n], read_data, items[n].data_len))
+			errx(1, "Unexpected content found in secure storage");
+	}
+
+	/* Temporary objects are internal, only listed on request */
+	count = 0;
+	res = secure_object_list(&ctx->sess, true, count_tx_object, &count);
+	if (res != TEEC_SUCCESS)
+		errx(1, "Failed to list the objects: 0x%x", res);
+	if (count)
+		errx(1, "Unexpected temporary objects left: %zu", count);
+
+	printf("- Delete the objects\n");
+
+	for (n = 0; n < TEST_REPLACE_COUNT; n++) {
+		res = delete_secure_object(ctx, ids[n]);
+		if (res != TEEC_SUCCESS)
+			errx(1, "Failed to delete the object: 0x%x", res);
+	}
+}
+
+static void count_key(const char *key, size_t key_len, void *arg)
+{
+	(*(size_t *)arg)++;
+}
+
+/* Many small values in the key-value store of the TA */
+static void test_kv(struct test_ctx *ctx)
+{
+	char value[TA_SECURE_STORAGE_KV_VALUE_MAX_LEN];
+	char read_value[TA_SECURE_STORAGE_KV_VALUE_MAX_LEN];
+	size_t value_len;
+	char key[32];
+	TEEC_Result res;
+	size_t count;
+	size_t n;
+
+	printf("- Put %d keys, under two prefixes\n", TEST_KV_COUNT);
+
+	for (n = 0; n < TEST_KV_COUNT; n++) {
+		snprintf(key, sizeof(key), "kv/%s/%zu", n % 3 ? "net" : "ui",
+			 n);
+		memset(value, n, sizeof(value));
+		res = kv_store_put(&ctx->sess, key, value, n % 40);
+		if (res != TEEC_SUCCESS)
+			errx(1, "Failed to put \"%s\": 0x%x", key, res);
+	}
+
+	printf("- Grow some values, delete others\n");
 
-int main(void)
+	for (n = 0; n < TEST_KV_COUNT; n += 10) {
+		snprintf(key, sizeof(key), "kv/%s/%zu", n % 3 ? "net" : "ui",
+			 n);
+		memset(value, ~n, sizeof(value));
+		res = kv_store_put(&ctx->sess, key, value, sizeof(value));
+		if (res != TEEC_SUCCESS)
+			errx(1, "Failed to put \"%s\": 0x%x", key, res);
+
+		snprintf(key, sizeof(key), "kv/%s/%zu",
+			 (n + 1) % 3 ? "net" : "ui", n + 1);
+		res = kv_store_delete(&ctx->sess, key);
+		if (res != TEEC_SUCCESS)
+			errx(1, "Failed to delete \"%s\": 0x%x", key, res);
+	}
+
+	printf("- Get the keys back\n");
+
+	for (n = 0; n < TEST_KV_COUNT; n++) {
+		snprintf(key, sizeof(key), "kv/%s/%zu", n % 3 ? "net" : "ui",
+			 n);
+		value_len = sizeof(read_value);
+		res = kv_store_get(&ctx->sess, key, read_value, &value_len);
+		if (n % 10 == 1) {
+			if (res != TEEC_ERROR_ITEM_NOT_FOUND)
+				errx(1, "Deleted key \"%s\" found", key);
+			continue;
+		}
+		if (res != TEEC_SUCCESS)
+			errx(1, "Failed to get \"%s\": 0x%x", key, res);
+
+		if (n % 10) {
+			memset(value, n, sizeof(value));
+			if (value_len != n % 40)
+				errx(1, "Unexpected size of \"%s\"", key);
+		} else {
+			memset(value, ~n, sizeof(value));
+			if (value_len != sizeof(value))
+				errx(1, "Unexpected size of \"%s\"", key);
+		}
+		if (memcmp(value, read_value, value_len))
+			errx(1, "Unexpected value of \"%s\"", key);
+	}
+
+	printf("- Scan the keys of a prefix\n");
+
+	count = 0;
+	res = kv_store_scan(&ctx->sess, "kv/ui/", count_key, &count);
+	if (res != TEEC_SUCCESS)
+		errx(1, "Failed to scan the keys: 0x%x", res);
+	/* n % 3 == 0 for "ui", not deleted when n % 10 == 1 */
+	if (count != 90)
+		errx(1, "Unexpected number of keys: %zu", count);
+
+	printf("- Delete the keys\n");
+
+	for (n = 0; n < TEST_KV_COUNT; n++) {
+		snprintf(key, sizeof(key), "kv/%s/%zu", n % 3 ? "net" : "ui",
+			 n);
+		res = kv_store_delete(&ctx->sess, key);
+		if (res != TEEC_SUCCESS && res != TEEC_ERROR_ITEM_NOT_FOUND)
+			errx(1, "Failed to delete \"%s\": 0x%x", key, res);
+	}
+
+	count = 0;
+	res = kv_store_scan(&ctx->sess, "", count_key, &count);
+	if (res != TEEC_SUCCESS || count)
+		errx(1, "Keys left in the store");
+}
+
+static void print_object(const char *id, size_t id_len, uint32_t data_size,
+			 void *arg)
+{
+	printf("%10" PRIu32 " %.*s\n", data_size, (int)id_len, id);
+}
+
+/* List the objects of the secure storage with their size */
+static int list_objects(void)
+{
+	struct test_ctx ctx;
+	TEEC_Result res;
+
+	prepare_tee_session(&ctx);
+	res = secure_object_list(&ctx.sess, false, print_object, NULL);
+	terminate_tee_session(&ctx);
+
+	if (res != TEEC_SUCCESS)
+		errx(1, "Failed to list the objects: 0x%x", res);
+	return 0;
+}
+
+/* Copy a file to or from the secure storage: put|get <object ID> <file> */
+static int stream_file(int argc, char *argv[])
+{
+	struct test_ctx ctx;
+	TEEC_Result res;
+	bool put;
+	int fd;
+
+	if (argc != 4 || (strcmp(argv[1], "put") && strcmp(argv[1], "get")))
+		errx(1, "Usage: %s [put|get <object ID> <file> | list]",
+		     argv[0]);
+	put = !strcmp(argv[1], "put");
+
+	if (put)
+		fd = open(argv[3], O_RDONLY);
+	else
+		fd = open(argv[3], O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		err(1, "Cannot open %s", argv[3]);
+
+	prepare_tee_session(&ctx);
+
+	if (put)
+		res = secure_object_from_file(&ctx.ctx, &ctx.sess, argv[2], fd);
+	else
+		res = secure_object_to_file(&ctx.ctx, &ctx.sess, argv[2], fd);
+
+	terminate_tee_session(&ctx);
+	close(fd);
+
+	if (res != TEEC_SUCCESS)
+		errx(1, "Failed to %s object \"%s\": 0x%x",
+		     put ? "store" : "read", argv[2], res);
+	return 0;
+}
+
+int main(int argc, char *argv[])
 {
 	struct test_ctx ctx;
 	char obj1_id[] = "object#1";		/* string identification for the object */
 	char obj2_id[] = "object#2";		/* string identification for the object */
+	char obj3_id[] = "object#3";		/* string identification for the object */
+	char obj4_id[] = "object#4";		/* string identification for the object */
 	char obj1_data[TEST_OBJECT_SIZE];
 	char read_data[TEST_OBJECT_SIZE];
+	struct secure_storage_object_stat stats[2];
+	struct batch_item stat_items[2] = { };
+	char *alloc_data;
+	size_t read_len;
 	TEEC_Result res;
 
+	if (argc == 2 && !strcmp(argv[1], "list"))
+		return list_objects();
+	if (argc > 1)
+		return stream_file(argc, argv);
+
 	printf("Prepare session with the TA\n");
 	prepare_tee_session(&ctx);
 
@@ -201,12 +865,106 @@ int main(void)
 	if (memcmp(obj1_data, read_data, sizeof(obj1_data)))
 		errx(1, "Unexpected content found in secure storage");
 
+	printf("- Get the size of the object, and of one not found\n");
+
+	stat_items[0].id = obj1_id;
+	stat_items[1].id = "object#none";
+
+	res = secure_object_stat(&ctx.sess, stat_items, 2, stats);
+	if (res != TEEC_SUCCESS)
+		errx(1, "Failed to get the size of the objects: 0x%x", res);
+	if (stats[0].status != TEEC_SUCCESS ||
+	    stats[0].data_size != sizeof(obj1_data))
+		errx(1, "Unexpected size found in secure storage");
+	if (stats[1].status != TEEC_ERROR_ITEM_NOT_FOUND)
+		errx(1, "Unexpected status when reading an object : 0x%x",
+		     stats[1].status);
+
+	printf("- Read back the object in a buffer of its size\n");
+
+	res = read_secure_object_alloc(&ctx, obj1_id, &alloc_data, &read_len);
+	if (res != TEEC_SUCCESS)
+		errx(1, "Failed to read an object from the secure storage");
+	if (read_len != sizeof(obj1_data) ||
+	    memcmp(obj1_data, alloc_data, read_len))
+		errx(1, "Unexpected content found in secure storage");
+	free(alloc_data);
+
+	printf("- Update part of the object, read back that part\n");
+
+	memset(obj1_data + TEST_PATCH_OFFSET, 0xB2, TEST_PATCH_SIZE);
+
+	res = write_secure_object_at(&ctx, obj1_id, TEST_PATCH_OFFSET,
+				     obj1_data + TEST_PATCH_OFFSET,
+				     TEST_PATCH_SIZE);
+	if (res != TEEC_SUCCESS)
+		errx(1, "Failed to update the object");
+
+	read_len = TEST_PATCH_SIZE;
+	res = read_secure_object_at(&ctx, obj1_id, TEST_PATCH_OFFSET,
+				    read_data, &read_len);
+	if (res != TEEC_SUCCESS)
+		errx(1, "Failed to read part of the object");
+	if (read_len != TEST_PATCH_SIZE ||
+	    memcmp(obj1_data + TEST_PATCH_OFFSET, read_data, read_len))
+		errx(1, "Unexpected content found in secure storage");
+
+	printf("- Truncate the object, read across its new end\n");
+
+	res = truncate_secure_object(&ctx, obj1_id, TEST_TRUNCATED_SIZE);
+	if (res != TEEC_SUCCESS)
+		errx(1, "Failed to truncate the object");
+
+	read_len = TEST_PATCH_SIZE;
+	res = read_secure_object_at(&ctx, obj1_id, TEST_PATCH_OFFSET,
+				    read_data, &read_len);
+	if (res != TEEC_SUCCESS)
+		errx(1, "Failed to read part of the object");
+	if (read_len != TEST_TRUNCATED_SIZE - TEST_PATCH_OFFSET ||
+	    memcmp(obj1_data + TEST_PATCH_OFFSET, read_data, read_len))
+		errx(1, "Unexpected content found in secure storage");
+
 	printf("- Delete the object\n");
 
 	res = delete_secure_object(&ctx, obj1_id);
 	if (res != TEEC_SUCCESS)
 		errx(1, "Failed to delete the object: 0x%x", res);
 
+	/*
+	 * Object larger than the shared memory buffers: stream it
+	 */
+	printf("\nTest on object \"%s\"\n", obj3_id);
+
+	test_stream(&ctx, obj3_id);
+
+	/*
+	 * Many small objects: batch them
+	 */
+	printf("\nTest on a batch of objects\n");
+
+	test_batch(&ctx);
+
+	/*
+	 * Small values in shared pages: the key-value store
+	 */
+	printf("\nTest on the key-value store\n");
+
+	test_kv(&ctx);
+
+	/*
+	 * Small object read often: served from the cache of the TA
+	 */
+	printf("\nTest on object \"%s\"\n", obj4_id);
+
+	test_cache(&ctx, obj4_id);
+
+	/*
+	 * Objects replaced together, without loss if the TA stops
+	 */
+	printf("\nTest on atomic replacements\n");
+
+	test_replace(&ctx);
+
 	/*
 	 * Non volatile storage: create object2 if not found, delete it if found
 	 */
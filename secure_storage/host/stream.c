@@ -0,0 +1,378 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2017, Linaro Limited
+ */
+
+/*
+ * Transfer of files to and from persistent objects by chunks. Two chunk
+ * buffers are used in turn: a thread does the file I/O on one while the TA
+ * is invoked on the other.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* OP-TEE TEE client API (built by optee_client) */
+#include <tee_client_api.h>
+
+/* TA API: UUID and command IDs */
+#include <secure_storage_ta.h>
+
+#include "stream.h"
+
+#define STREAM_BUFS	2
+
+/*
+ * Chunk buffers handed over between the thread invoking the TA and the
+ * thread doing the file I/O. A full buffer holds @len bytes for the
+ * consumer, an empty one is free for the producer. A zero length full
+ * buffer marks the end of the transfer.
+ */
+struct pipe {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	TEEC_SharedMemory shm[STREAM_BUFS];
+	size_t len[STREAM_BUFS];
+	bool full[STREAM_BUFS];
+	bool failed;		/* One side gave up, the other must stop */
+	int fd;
+	int file_errno;		/* Set when the file I/O failed */
+};
+
+static TEEC_Result pipe_init(struct pipe *p, TEEC_Context *ctx, int fd,
+			     uint32_t shm_flags)
+{
+	TEEC_Result res;
+	size_t n;
+
+	memset(p, 0, sizeof(*p));
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->cond, NULL);
+	p->fd = fd;
+
+	for (n = 0; n < STREAM_BUFS; n++) {
+		p->shm[n].size = STREAM_CHUNK_SIZE;
+		p->shm[n].flags = shm_flags;
+		res = TEEC_AllocateSharedMemory(ctx, p->shm + n);
+		if (res != TEEC_SUCCESS) {
+			printf("TEEC_AllocateSharedMemory failed: 0x%x\n",
+			       res);
+			while (n--)
+				TEEC_ReleaseSharedMemory(p->shm + n);
+			pthread_cond_destroy(&p->cond);
+			pthread_mutex_destroy(&p->lock);
+			return res;
+		}
+	}
+
+	return TEEC_SUCCESS;
+}
+
+static void pipe_release(struct pipe *p)
+{
+	size_t n;
+
+	for (n = 0; n < STREAM_BUFS; n++)
+		TEEC_ReleaseSharedMemory(p->shm + n);
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->lock);
+}
+
+/* Wait for buffer @n to be full or empty, false if the other side failed */
+static bool pipe_wait(struct pipe *p, size_t n, bool full)
+{
+	bool ok;
+
+	pthread_mutex_lock(&p->lock);
+	while (p->full[n] != full && !p->failed)
+		pthread_cond_wait(&p->cond, &p->lock);
+	ok = !p->failed;
+	pthread_mutex_unlock(&p->lock);
+
+	return ok;
+}
+
+/* Hand buffer @n over to the other side */
+static void pipe_post(struct pipe *p, size_t n, bool full, size_t len)
+{
+	pthread_mutex_lock(&p->lock);
+	p->len[n] = len;
+	p->full[n] = full;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+}
+
+static void pipe_fail(struct pipe *p)
+{
+	pthread_mutex_lock(&p->lock);
+	p->failed = true;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+}
+
+/* Producer of an upload: fills the chunks from the file */
+static void *file_reader(void *arg)
+{
+	struct pipe *p = arg;
+	size_t n = 0;
+	size_t len;
+	ssize_t r;
+
+	do {
+		if (!pipe_wait(p, n, false))
+			break;
+
+		/* Only the last chunk of the file is short */
+		len = 0;
+		while (len < STREAM_CHUNK_SIZE) {
+			r = read(p->fd, (char *)p->shm[n].buffer + len,
+				 STREAM_CHUNK_SIZE - len);
+			if (r < 0 && errno == EINTR)
+				continue;
+			if (r < 0) {
+				p->file_errno = errno;
+				pipe_fail(p);
+				return NULL;
+			}
+			if (!r)
+				break;
+			len += r;
+		}
+
+		pipe_post(p, n, true, len);
+		n = (n + 1) % STREAM_BUFS;
+	} while (len);
+
+	return NULL;
+}
+
+/* Consumer of a download: writes the chunks to the file */
+static void *file_writer(void *arg)
+{
+	struct pipe *p = arg;
+	size_t n = 0;
+	size_t len;
+	ssize_t r;
+
+	while (pipe_wait(p, n, true) && p->len[n]) {
+		len = 0;
+		while (len < p->len[n]) {
+			r = write(p->fd, (char *)p->shm[n].buffer + len,
+				  p->len[n] - len);
+			if (r < 0 && errno == EINTR)
+				continue;
+			if (r < 0) {
+				p->file_errno = errno;
+				pipe_fail(p);
+				return NULL;
+			}
+			len += r;
+		}
+
+		pipe_post(p, n, false, 0);
+		n = (n + 1) % STREAM_BUFS;
+	}
+
+	return NULL;
+}
+
+static TEEC_Result stream_open(TEEC_Session *sess, uint32_t cmd,
+			       const char *id, uint32_t *handle)
+{
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_VALUE_OUTPUT,
+					 TEEC_NONE, TEEC_NONE);
+
+	op.params[0].tmpref.buffer = (void *)id;
+	op.params[0].tmpref.size = strlen(id);
+
+	res = TEEC_InvokeCommand(sess, cmd, &op, &origin);
+	switch (res) {
+	case TEEC_SUCCESS:
+		*handle = op.params[1].value.a;
+		break;
+	case TEEC_ERROR_ITEM_NOT_FOUND:
+		break;
+	default:
+		printf("Command STREAM_OPEN failed: 0x%x / %u\n", res, origin);
+	}
+
+	return res;
+}
+
+static TEEC_Result stream_close(TEEC_Session *sess, uint32_t cmd,
+				uint32_t handle)
+{
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT, TEEC_NONE,
+					 TEEC_NONE, TEEC_NONE);
+
+	op.params[0].value.a = handle;
+
+	res = TEEC_InvokeCommand(sess, cmd, &op, &origin);
+	if (res != TEEC_SUCCESS)
+		printf("Command STREAM_%s failed: 0x%x / %u\n",
+		       cmd == TA_SECURE_STORAGE_CMD_STREAM_COMMIT ?
+		       "COMMIT" : "CLOSE", res, origin);
+
+	return res;
+}
+
+TEEC_Result secure_object_from_file(TEEC_Context *ctx, TEEC_Session *sess,
+				    const char *id, int fd)
+{
+	TEEC_Operation op;
+	uint32_t origin;
+	uint32_t handle;
+	TEEC_Result res;
+	struct pipe p;
+	pthread_t tid;
+	size_t n;
+
+	res = stream_open(sess, TA_SECURE_STORAGE_CMD_STREAM_OPEN_WRITE, id,
+			  &handle);
+	if (res != TEEC_SUCCESS)
+		return res;
+
+	res = pipe_init(&p, ctx, fd, TEEC_MEM_INPUT);
+	if (res != TEEC_SUCCESS)
+		goto out;
+
+	if (pthread_create(&tid, NULL, file_reader, &p)) {
+		printf("Cannot create the file reader thread\n");
+		res = TEEC_ERROR_GENERIC;
+		goto out_pipe;
+	}
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
+					 TEEC_MEMREF_PARTIAL_INPUT,
+					 TEEC_NONE, TEEC_NONE);
+	op.params[0].value.a = handle;
+
+	for (n = 0; ; n = (n + 1) % STREAM_BUFS) {
+		if (!pipe_wait(&p, n, true)) {
+			res = TEEC_ERROR_GENERIC;
+			break;
+		}
+		if (!p.len[n])
+			break;
+
+		op.params[1].memref.parent = p.shm + n;
+		op.params[1].memref.offset = 0;
+		op.params[1].memref.size = p.len[n];
+
+		res = TEEC_InvokeCommand(sess,
+					 TA_SECURE_STORAGE_CMD_STREAM_WRITE,
+					 &op, &origin);
+		if (res != TEEC_SUCCESS) {
+			printf("Command STREAM_WRITE failed: 0x%x / %u\n",
+			       res, origin);
+			pipe_fail(&p);
+			break;
+		}
+
+		pipe_post(&p, n, false, 0);
+	}
+
+	pthread_join(tid, NULL);
+	if (p.file_errno) {
+		printf("Cannot read the file: %s\n", strerror(p.file_errno));
+		res = TEEC_ERROR_GENERIC;
+	}
+out_pipe:
+	pipe_release(&p);
+out:
+	if (res == TEEC_SUCCESS)
+		return stream_close(sess, TA_SECURE_STORAGE_CMD_STREAM_COMMIT,
+				    handle);
+
+	/* Discards what was written */
+	stream_close(sess, TA_SECURE_STORAGE_CMD_STREAM_CLOSE, handle);
+	return res;
+}
+
+TEEC_Result secure_object_to_file(TEEC_Context *ctx, TEEC_Session *sess,
+				  const char *id, int fd)
+{
+	TEEC_Operation op;
+	uint32_t origin;
+	uint32_t handle;
+	TEEC_Result res;
+	struct pipe p;
+	pthread_t tid;
+	size_t len;
+	size_t n;
+
+	res = stream_open(sess, TA_SECURE_STORAGE_CMD_STREAM_OPEN_READ, id,
+			  &handle);
+	if (res != TEEC_SUCCESS)
+		return res;
+
+	res = pipe_init(&p, ctx, fd, TEEC_MEM_OUTPUT);
+	if (res != TEEC_SUCCESS)
+		goto out;
+
+	if (pthread_create(&tid, NULL, file_writer, &p)) {
+		printf("Cannot create the file writer thread\n");
+		res = TEEC_ERROR_GENERIC;
+		goto out_pipe;
+	}
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
+					 TEEC_MEMREF_PARTIAL_OUTPUT,
+					 TEEC_NONE, TEEC_NONE);
+	op.params[0].value.a = handle;
+
+	for (n = 0; ; n = (n + 1) % STREAM_BUFS) {
+		if (!pipe_wait(&p, n, false)) {
+			res = TEEC_ERROR_GENERIC;
+			break;
+		}
+
+		op.params[1].memref.parent = p.shm + n;
+		op.params[1].memref.offset = 0;
+		op.params[1].memref.size = STREAM_CHUNK_SIZE;
+
+		res = TEEC_InvokeCommand(sess,
+					 TA_SECURE_STORAGE_CMD_STREAM_READ,
+					 &op, &origin);
+		if (res != TEEC_SUCCESS) {
+			printf("Command STREAM_READ failed: 0x%x / %u\n",
+			       res, origin);
+			pipe_fail(&p);
+			break;
+		}
+
+		/* An empty chunk ends the transfer, on both sides */
+		len = op.params[1].memref.size;
+		pipe_post(&p, n, true, len);
+		if (!len)
+			break;
+	}
+
+	pthread_join(tid, NULL);
+	if (p.file_errno) {
+		printf("Cannot write the file: %s\n", strerror(p.file_errno));
+		res = TEEC_ERROR_GENERIC;
+	}
+out_pipe:
+	pipe_release(&p);
+out:
+	stream_close(sess, TA_SECURE_STORAGE_CMD_STREAM_CLOSE, handle);
+	return res;
+}
@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (c) 2017, Linaro Limited
+ */
+
+#ifndef __SECURE_STORAGE_STREAM_H__
+#define __SECURE_STORAGE_STREAM_H__
+
+#include <tee_client_api.h>
+
+/*
+ * Size of the chunks transferred at each invoke. Two chunk buffers are
+ * allocated in shared memory for each transfer.
+ */
+#define STREAM_CHUNK_SIZE	(128 * 1024)
+
+/*
+ * Store the content of @fd, read up to its end, in the persistent object
+ * @id, replacing any object of that ID atomically once the upload is
+ * committed. The next chunk is read from @fd while the TA writes the
+ * previous one to secure storage, so that the object can be much larger
+ * than shared memory. A failed upload is not committed: it leaves the
+ * previous object of that ID, if any, unchanged.
+ */
+TEEC_Result secure_object_from_file(TEEC_Context *ctx, TEEC_Session *sess,
+				    const char *id, int fd);
+
+/*
+ * Write the content of the persistent object @id to @fd. The previous
+ * chunk is written to @fd while the TA reads the next one from secure
+ * storage.
+ */
+TEEC_Result secure_object_to_file(TEEC_Context *ctx, TEEC_Session *sess,
+				  const char *id, int fd);
+
+#endif /* __SECURE_STORAGE_STREAM_H__ */
@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2017, Linaro Limited
+ */
+
+/*
+ * Cache of persistent objects open for reading. Opening an object looks it
+ * up in the directory of the storage and checks its hash tree, through RPC
+ * to the normal world: objects read often are opened once and kept open.
+ *
+ * The TA is single instance without multiple sessions, so the cache is
+ * shared by all the invokes. It is small enough to be searched linearly.
+ */
+
+#include <tee_internal_api.h>
+#include <tee_internal_api_extensions.h>
+
+#include "handles.h"
+
+struct cached_handle {
+	TEE_ObjectHandle object;	/* TEE_HANDLE_NULL when not in use */
+	char id[TEE_OBJECT_ID_MAX_LEN];
+	size_t id_len;
+	uint64_t last_use;
+};
+
+static struct cached_handle cache[HANDLE_CACHE_SIZE];
+static uint64_t use_count;
+
+static struct cached_handle *find_handle(const char *id, size_t id_len)
+{
+	size_t n;
+
+	for (n = 0; n < HANDLE_CACHE_SIZE; n++)
+		if (cache[n].object != TEE_HANDLE_NULL &&
+		    cache[n].id_len == id_len &&
+		    !TEE_MemCompare(cache[n].id, id, id_len))
+			return cache + n;
+
+	return NULL;
+}
+
+static void close_handle(struct cached_handle *entry)
+{
+	TEE_CloseObject(entry->object);
+	entry->object = TEE_HANDLE_NULL;
+}
+
+TEE_Result handle_cache_get(const char *id, size_t id_len,
+			    TEE_ObjectHandle *object)
+{
+	struct cached_handle *entry;
+	TEE_Result res;
+	size_t n;
+
+	if (id_len > TEE_OBJECT_ID_MAX_LEN)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	entry = find_handle(id, id_len);
+	if (entry) {
+		res = TEE_SeekObjectData(entry->object, 0, TEE_DATA_SEEK_SET);
+		if (res == TEE_SUCCESS) {
+			entry->last_use = ++use_count;
+			*object = entry->object;
+			return TEE_SUCCESS;
+		}
+		close_handle(entry);
+	} else {
+		/* A free entry, else the least recently used one */
+		entry = cache;
+		for (n = 0; n < HANDLE_CACHE_SIZE; n++) {
+			if (cache[n].object == TEE_HANDLE_NULL) {
+				entry = cache + n;
+				break;
+			}
+			if (cache[n].last_use < entry->last_use)
+				entry = cache + n;
+		}
+		if (entry->object != TEE_HANDLE_NULL)
+			close_handle(entry);
+	}
+
+	res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE, id, id_len,
+				       TEE_DATA_FLAG_ACCESS_READ |
+				       TEE_DATA_FLAG_SHARE_READ,
+				       &entry->object);
+	if (res != TEE_SUCCESS) {
+		entry->object = TEE_HANDLE_NULL;
+		return res;
+	}
+
+	TEE_MemMove(entry->id, id, id_len);
+	entry->id_len = id_len;
+	entry->last_use = ++use_count;
+	*object = entry->object;
+	return TEE_SUCCESS;
+}
+
+void handle_cache_drop(const char *id, size_t id_len)
+{
+	struct cached_handle *entry = find_handle(id, id_len);
+
+	if (entry)
+		close_handle(entry);
+}
+
+void handle_cache_release(void)
+{
+	size_t n;
+
+	for (n = 0; n < HANDLE_CACHE_SIZE; n++)
+		if (cache[n].object != TEE_HANDLE_NULL)
+			close_handle(cache + n);
+}
@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (c) 2017, Linaro Limited
+ */
+
+#ifndef __HANDLES_H__
+#define __HANDLES_H__
+
+#include <stddef.h>
+#include <tee_internal_api.h>
+
+/* Number of objects kept open for reading */
+#define HANDLE_CACHE_SIZE	8
+
+/*
+ * Get a handle on the persistent object @id opened for reading and shared
+ * for reading, its data position at 0. The object is opened at the first
+ * call and kept open for the next ones, the least recently used object
+ * being closed for room. The handle belongs to the cache: it must not be
+ * closed and is only valid until the next call to the cache.
+ */
+TEE_Result handle_cache_get(const char *id, size_t id_len,
+			    TEE_ObjectHandle *object);
+
+/*
+ * Close the object @id if it is open. It must be called before the object
+ * is written, truncated, renamed or deleted: opening it for that would
+ * otherwise conflict with the open handle.
+ */
+void handle_cache_drop(const char *id, size_t id_len);
+
+/* Close all the objects, at the end of the TA instance */
+void handle_cache_release(void);
+
+#endif /* __HANDLES_H__ */
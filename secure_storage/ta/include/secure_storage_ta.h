@@ -27,6 +27,8 @@
 #ifndef __SECURE_STORAGE_H__
 #define __SECURE_STORAGE_H__
 
+#include <stdint.h>
+
 /* UUID of the trusted application */
 #define TA_SECURE_STORAGE_UUID \
 		{ 0xf4e750bb, 0x1437, 0x4fbf, \
@@ -34,7 +36,10 @@
 /*
  * TA_SECURE_STORAGE_CMD_READ_RAW - Create and fill a secure storage file
  * param[0] (memref) ID used the identify the persistent object
- * param[1] (memref) Raw data dumped from the persistent object
+ * param[1] (memref) Raw data dumped from the persistent object. When it is
+ *                   too small, TEE_ERROR_SHORT_BUFFER and the size of the
+ *                   data: the object is kept open, the READ_RAW with a
+ *                   larger buffer that follows does not open it again
  * param[2] unused
  * param[3] unused
  */
@@ -58,4 +63,314 @@
  */
 #define TA_SECURE_STORAGE_CMD_DELETE		2
 
+/*
+ * TA_SECURE_STORAGE_CMD_READ_AT - Read part of a persistent object
+ * param[0] (memref) ID used the identify the persistent object
+ * param[1] (memref) Raw data read from the object, at most the size of the
+ *                   buffer: shorter when the end of the object is reached
+ * param[2] (value) a: offset in the object
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_READ_AT		3
+
+/*
+ * TA_SECURE_STORAGE_CMD_WRITE_AT - Write part of a persistent object
+ * The object is created if it does not exist, and is extended with zeroes
+ * when written past its end. Only the written range is rewritten in
+ * secure storage, not the whole object.
+ * param[0] (memref) ID used the identify the persistent object
+ * param[1] (memref) Raw data to be written at the offset
+ * param[2] (value) a: offset in the object
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_WRITE_AT		4
+
+/*
+ * TA_SECURE_STORAGE_CMD_TRUNCATE - Change the size of a persistent object
+ * param[0] (memref) ID used the identify the persistent object
+ * param[1] unused
+ * param[2] (value) a: new size, the object is extended with zeroes if larger,
+ *                  INT32_MAX at most as offsets of WRITE_AT
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_TRUNCATE		5
+
+/*
+ * Streaming access, for objects larger than what fits in one shared memory
+ * buffer. An object is opened into a stream handle of the session, then
+ * transferred chunk by chunk. A session streams at most
+ * TA_SECURE_STORAGE_MAX_STREAMS objects at the same time, and closing the
+ * session closes its streams.
+ */
+#define TA_SECURE_STORAGE_MAX_STREAMS		4
+
+/*
+ * TA_SECURE_STORAGE_CMD_STREAM_OPEN_WRITE - Create a persistent object to be
+ * written by chunks. An existing object of the same ID is replaced when the
+ * stream is committed, atomically as with TA_SECURE_STORAGE_CMD_REPLACE.
+ * Until then, an existing object keeps its data, and the data written is
+ * discarded if the stream is closed.
+ * param[0] (memref) ID used the identify the persistent object, of
+ *                   TA_SECURE_STORAGE_ITEM_ID_MAX_LEN bytes at most
+ * param[1] (value) a: output stream handle
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_STREAM_OPEN_WRITE	6
+
+/*
+ * TA_SECURE_STORAGE_CMD_STREAM_WRITE - Append a chunk to a stream opened
+ * for writing
+ * param[0] (value) a: stream handle
+ * param[1] (memref) Raw data to append to the object
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_STREAM_WRITE	7
+
+/*
+ * TA_SECURE_STORAGE_CMD_STREAM_COMMIT - Close a stream opened for writing,
+ * keeping the object written. The stream is closed even if this fails, in
+ * which case the object keeps its previous data
+ * param[0] (value) a: stream handle
+ * param[1] unused
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_STREAM_COMMIT	8
+
+/*
+ * TA_SECURE_STORAGE_CMD_STREAM_OPEN_READ - Open a persistent object to be
+ * read by chunks
+ * param[0] (memref) ID used the identify the persistent object
+ * param[1] (value) a: output stream handle, b: output size of the object
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_STREAM_OPEN_READ	9
+
+/*
+ * TA_SECURE_STORAGE_CMD_STREAM_READ - Read the next chunk of a stream opened
+ * for reading
+ * param[0] (value) a: stream handle
+ * param[1] (memref) Raw data read from the object, at most the size of the
+ *                   buffer: shorter when the end of the object is reached,
+ *                   empty once it has been read whole
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_STREAM_READ	10
+
+/*
+ * TA_SECURE_STORAGE_CMD_STREAM_CLOSE - Close a stream. A stream opened for
+ * writing and not committed is discarded.
+ * param[0] (value) a: stream handle
+ * param[1] unused
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_STREAM_CLOSE	11
+
+/*
+ * TA_SECURE_STORAGE_CMD_BATCH_PUT - Create and fill several persistent
+ * objects, as TA_SECURE_STORAGE_CMD_WRITE_RAW does for one
+ * param[0] (memref) Packed items: each a struct secure_storage_item followed
+ *                   by the object ID and the data, see
+ *                   TA_SECURE_STORAGE_ITEM_SIZE()
+ * param[1] (memref) Array of uint32_t, result of the write of each object
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_BATCH_PUT		12
+
+/*
+ * TA_SECURE_STORAGE_CMD_BATCH_GET - Read several persistent objects, as
+ * TA_SECURE_STORAGE_CMD_READ_RAW does for one
+ * param[0] (memref) Packed items with an object ID and no data
+ * param[1] (memref) Packed items, one for each object ID in order, with the
+ *                   result of the read in status, no ID, and the data of
+ *                   the object when it was read. Filled up to the first
+ *                   object that does not fit: when not even the first one
+ *                   fits, TEE_ERROR_SHORT_BUFFER and the size it needs.
+ * param[2] (value) a: output number of objects in param[1]
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_BATCH_GET		13
+
+/* Object IDs of the batch commands are at most that long */
+#define TA_SECURE_STORAGE_ITEM_ID_MAX_LEN	64
+
+struct secure_storage_item {
+	uint32_t status;	/* TEE_Result of BATCH_GET, 0 in requests */
+	uint32_t id_len;
+	uint32_t data_len;
+};
+
+#define TA_SECURE_STORAGE_ITEM_SIZE(id_len, data_len) \
+	(sizeof(struct secure_storage_item) + (id_len) + (data_len))
+
+/*
+ * Key-value store of the TA, for many small values. Values are packed in
+ * shared pages of secure storage, indexed by the TA. The pages are
+ * persistent objects with IDs starting with TA_SECURE_STORAGE_KV_PREFIX:
+ * the other commands reject such IDs with TEE_ERROR_BAD_PARAMETERS.
+ */
+#define TA_SECURE_STORAGE_KV_PREFIX		".kv."
+#define TA_SECURE_STORAGE_KV_KEY_MAX_LEN	64
+#define TA_SECURE_STORAGE_KV_VALUE_MAX_LEN	1024
+
+/*
+ * TA_SECURE_STORAGE_CMD_KV_GET - Get the value of a key
+ * param[0] (memref) Key
+ * param[1] (memref) Value: TEE_ERROR_SHORT_BUFFER and the size of the value
+ *                   when it does not fit
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_KV_GET		14
+
+/*
+ * TA_SECURE_STORAGE_CMD_KV_PUT - Set the value of a key
+ * param[0] (memref) Key, of 1 to TA_SECURE_STORAGE_KV_KEY_MAX_LEN bytes
+ * param[1] (memref) Value, of TA_SECURE_STORAGE_KV_VALUE_MAX_LEN bytes at
+ *                   most
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_KV_PUT		15
+
+/*
+ * TA_SECURE_STORAGE_CMD_KV_DELETE - Delete a key and its value
+ * param[0] (memref) Key
+ * param[1] unused
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_KV_DELETE		16
+
+/*
+ * TA_SECURE_STORAGE_CMD_KV_SCAN - List the keys starting with a prefix, in
+ * ascending order
+ * param[0] (memref) Prefix, empty for all the keys
+ * param[1] (memref) Packed items with a key and no data, as many as fit:
+ *                   TEE_ERROR_SHORT_BUFFER and the size it needs when not
+ *                   even the first one fits
+ * param[2] (value) a: index of the first key to list among the matching
+ *                  keys, output number of keys listed
+ *                  b: output number of matching keys
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_KV_SCAN		17
+
+/*
+ * TA_SECURE_STORAGE_CMD_LIST - List the persistent objects of the TA, by
+ * pages. The position in the listing is kept by the session, each invoke
+ * goes on from where the previous one stopped, and the objects are not
+ * opened. The internal objects of the TA, of IDs starting with
+ * TA_SECURE_STORAGE_KV_PREFIX or TA_SECURE_STORAGE_TX_PREFIX, are only
+ * listed on request.
+ * param[0] (value) a: TA_SECURE_STORAGE_LIST_START to list from the first
+ *                  object, TA_SECURE_STORAGE_LIST_NEXT to go on, output
+ *                  number of objects listed
+ *                  b: with TA_SECURE_STORAGE_LIST_START, 1 to list the
+ *                  internal objects too, else 0; output 1 once all the
+ *                  objects are listed, else 0
+ * param[1] (memref) Packed struct secure_storage_list_item, each followed
+ *                   by the ID of the object, as many as fit:
+ *                   TEE_ERROR_SHORT_BUFFER and the size it needs when not
+ *                   even the next one fits
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_LIST		18
+
+#define TA_SECURE_STORAGE_LIST_START		0
+#define TA_SECURE_STORAGE_LIST_NEXT		1
+
+struct secure_storage_list_item {
+	uint32_t id_len;
+	uint32_t data_size;	/* Size of the data of the object */
+};
+
+#define TA_SECURE_STORAGE_LIST_ITEM_SIZE(id_len) \
+	(sizeof(struct secure_storage_list_item) + (id_len))
+
+/*
+ * TA_SECURE_STORAGE_CMD_STAT - Get the size and the metadata of many
+ * persistent objects, without reading their data
+ * param[0] (memref) Packed items with an ID and no data, as for
+ *                   TA_SECURE_STORAGE_CMD_BATCH_GET
+ * param[1] (memref) Array of struct secure_storage_object_stat, one for
+ *                   each ID: TEE_ERROR_SHORT_BUFFER and the size it needs
+ *                   when too small
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_STAT		19
+
+struct secure_storage_object_stat {
+	uint32_t status;	/* TEE_SUCCESS, or why the object was not found */
+	uint32_t object_type;
+	uint32_t data_size;	/* Size of the data of the object */
+};
+
+/*
+ * TA_SECURE_STORAGE_CMD_CACHE_STATS - Get the counters of the cache of
+ * small objects that serves TA_SECURE_STORAGE_CMD_READ_RAW,
+ * TA_SECURE_STORAGE_CMD_READ_AT and TA_SECURE_STORAGE_CMD_BATCH_GET from TA
+ * memory
+ * param[0] (memref) struct secure_storage_cache_stats
+ * param[1] unused
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_CACHE_STATS	20
+
+struct secure_storage_cache_stats {
+	uint64_t hits;		/* Reads served from the cache */
+	uint64_t misses;	/* Reads that went to secure storage */
+	uint64_t evictions;	/* Objects dropped for room */
+	uint32_t count;		/* Objects in the cache */
+	uint32_t size;		/* Bytes used by these objects */
+	uint32_t capacity;	/* Bytes the cache can use */
+	uint32_t reserved;
+};
+
+/*
+ * Replacements of objects. The new data is written to temporary objects,
+ * then a journal commits the replacement and the temporary objects are
+ * renamed over the objects they replace. The journal and the temporary
+ * objects are persistent objects with IDs starting with
+ * TA_SECURE_STORAGE_TX_PREFIX, which the commands on objects reject with
+ * TEE_ERROR_BAD_PARAMETERS as they do for TA_SECURE_STORAGE_KV_PREFIX. A
+ * replacement interrupted, by a reboot for instance, is completed or undone
+ * when the TA starts again.
+ */
+#define TA_SECURE_STORAGE_TX_PREFIX		".tx."
+#define TA_SECURE_STORAGE_REPLACE_MAX_ITEMS	16
+
+/*
+ * TA_SECURE_STORAGE_CMD_REPLACE - Replace or create a persistent object
+ * atomically: the object keeps its previous data unless it has all of
+ * the new data
+ * param[0] (memref) ID used the identify the persistent object, of
+ *                   TA_SECURE_STORAGE_ITEM_ID_MAX_LEN bytes at most
+ * param[1] (memref) Raw data to store in the persistent object
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_REPLACE		21
+
+/*
+ * TA_SECURE_STORAGE_CMD_BATCH_REPLACE - Replace or create many persistent
+ * objects together: either all of them get their new data or none does
+ * param[0] (memref) Packed items, as for TA_SECURE_STORAGE_CMD_BATCH_PUT:
+ *                   TA_SECURE_STORAGE_REPLACE_MAX_ITEMS at most, all with
+ *                   different IDs
+ * param[1] unused
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_BATCH_REPLACE	22
+
 #endif /* __SECURE_STORAGE_H__ */
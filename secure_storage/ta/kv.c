@@ -0,0 +1,675 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2017, Linaro Limited
+ */
+
+/*
+ * Key-value store packing small values in pages of secure storage.
+ *
+ * A page is a persistent object of KV_PAGE_SIZE bytes: a struct
+ * kv_page_hdr followed by records, each a struct kv_rec, the key and the
+ * value. Pages are numbered from 0 without holes: a page left empty is
+ * kept to be filled again.
+ *
+ * The index of the keys is an array sorted by key, in TA memory, rebuilt
+ * from the pages when the store is first used. It gives the page and the
+ * offset of the record of each key, and sorting it makes prefix scans a
+ * binary search and a walk.
+ *
+ * Updating a key writes a single page: its page when the new value fits
+ * there, another page when it does not. A page is always written whole,
+ * with only its live records, so its free space needs no other tracking
+ * than the size of these records. When a key moves to another page, the
+ * new page is written before the old page drops its record. Pages are
+ * stamped with a sequence number at each write so that, if the TA stops
+ * between both writes, the record of the most recently written page wins
+ * at the next load. Such a stale record must be dropped before its key is
+ * deleted though, or it would come back at the next load.
+ */
+
+#include <inttypes.h>
+#include <secure_storage_ta.h>
+#include <stdio.h>
+#include <tee_internal_api.h>
+#include <tee_internal_api_extensions.h>
+
+#include "handles.h"
+#include "kv.h"
+
+#define KV_PAGE_SIZE		4096
+#define KV_PAGE_ID_MAX_LEN	32
+
+struct kv_page_hdr {
+	uint32_t seq;		/* Sequence number of the last write */
+	uint32_t len;		/* Size of the records following */
+};
+
+struct kv_rec {
+	uint8_t key_len;
+	uint8_t reserved;
+	uint16_t value_len;
+};
+
+#define KV_REC_SIZE(key_len, value_len) \
+	(sizeof(struct kv_rec) + (key_len) + (value_len))
+
+#define KV_PAGE_CAPACITY	(KV_PAGE_SIZE - sizeof(struct kv_page_hdr))
+
+struct kv_entry {
+	char *key;
+	uint8_t key_len;
+	uint16_t value_len;
+	uint16_t offs;		/* Offset of the record in the page */
+	uint32_t page;
+};
+
+struct kv_page {
+	uint32_t seq;
+	uint32_t used;		/* Size of the live records */
+	bool stale;		/* Holds a record of a key moved away */
+};
+
+struct kv {
+	struct kv_entry *entries;	/* Sorted by key */
+	size_t entry_count;
+	size_t entry_max;
+	struct kv_page *pages;
+	size_t page_count;
+	size_t page_max;
+	uint32_t seq;			/* Highest sequence number used */
+	uint8_t in[KV_PAGE_SIZE];	/* Page read */
+	uint8_t out[KV_PAGE_SIZE];	/* Page written */
+};
+
+static struct kv *kv;
+
+static int key_cmp(const char *key1, size_t key1_len, const char *key2,
+		   size_t key2_len)
+{
+	int32_t res = TEE_MemCompare(key1, key2, key1_len < key2_len ?
+					       key1_len : key2_len);
+
+	if (res)
+		return res;
+	return (key1_len > key2_len) - (key1_len < key2_len);
+}
+
+/* Position of @key in the index, or where it is to be inserted */
+static size_t find_key(const char *key, size_t key_len, bool *found)
+{
+	size_t lo = 0;
+	size_t hi = kv->entry_count;
+	size_t mid;
+	int res;
+
+	*found = false;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		res = key_cmp(kv->entries[mid].key, kv->entries[mid].key_len,
+			      key, key_len);
+		if (!res) {
+			*found = true;
+			return mid;
+		}
+		if (res < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* Make room for @count elements of @size bytes in the array @array */
+static TEE_Result grow(void **array, size_t *max, size_t count, size_t size)
+{
+	size_t new_max = *max ? *max * 2 : 16;
+	void *p;
+
+	if (count <= *max)
+		return TEE_SUCCESS;
+
+	p = TEE_Realloc(*array, new_max * size);
+	if (!p)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	*array = p;
+	*max = new_max;
+	return TEE_SUCCESS;
+}
+
+static TEE_Result insert_entry(size_t pos, const char *key, size_t key_len)
+{
+	struct kv_entry *entry;
+	TEE_Result res;
+	char *k;
+
+	res = grow((void **)&kv->entries, &kv->entry_max,
+		   kv->entry_count + 1, sizeof(*entry));
+	if (res != TEE_SUCCESS)
+		return res;
+
+	k = TEE_Malloc(key_len, 0);
+	if (!k)
+		return TEE_ERROR_OUT_OF_MEMORY;
+	TEE_MemMove(k, key, key_len);
+
+	entry = kv->entries + pos;
+	TEE_MemMove(entry + 1, entry,
+		    (kv->entry_count - pos) * sizeof(*entry));
+	kv->entry_count++;
+
+	TEE_MemFill(entry, 0, sizeof(*entry));
+	entry->key = k;
+	entry->key_len = key_len;
+	return TEE_SUCCESS;
+}
+
+static void remove_entry(size_t pos)
+{
+	struct kv_entry *entry = kv->entries + pos;
+
+	TEE_Free(entry->key);
+	kv->entry_count--;
+	TEE_MemMove(entry, entry + 1,
+		    (kv->entry_count - pos) * sizeof(*entry));
+}
+
+static size_t page_id(uint32_t page, char id[KV_PAGE_ID_MAX_LEN])
+{
+	return snprintf(id, KV_PAGE_ID_MAX_LEN,
+			TA_SECURE_STORAGE_KV_PREFIX "page.%" PRIu32, page);
+}
+
+static TEE_Result read_page(uint32_t page, uint8_t *buf)
+{
+	char id[KV_PAGE_ID_MAX_LEN];
+	TEE_ObjectHandle object;
+	uint32_t read_bytes;
+	TEE_Result res;
+
+	res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE,
+				       id, page_id(page, id),
+				       TEE_DATA_FLAG_ACCESS_READ |
+				       TEE_DATA_FLAG_SHARE_READ,
+				       &object);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	res = TEE_ReadObjectData(object, buf, KV_PAGE_SIZE, &read_bytes);
+	if (res == TEE_SUCCESS && read_bytes != KV_PAGE_SIZE)
+		res = TEE_ERROR_CORRUPT_OBJECT;
+	if (res != TEE_SUCCESS)
+		EMSG("Failed to read KV page %" PRIu32 ", res=0x%08x",
+		     page, res);
+
+	TEE_CloseObject(object);
+	return res;
+}
+
+static TEE_Result write_page(uint32_t page, const uint8_t *buf)
+{
+	char id[KV_PAGE_ID_MAX_LEN];
+	TEE_ObjectHandle object;
+	TEE_Result res;
+	size_t id_len = page_id(page, id);
+
+	/* kv_get() keeps hot pages open */
+	handle_cache_drop(id, id_len);
+
+	/* Pages are written whole, in a single update of the object */
+	if (page == kv->page_count) {
+		res = TEE_CreatePersistentObject(TEE_STORAGE_PRIVATE,
+					id, id_len,
+					TEE_DATA_FLAG_ACCESS_WRITE |
+					TEE_DATA_FLAG_OVERWRITE,
+					TEE_HANDLE_NULL,
+					buf, KV_PAGE_SIZE,
+					&object);
+	} else {
+		res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE,
+					       id, id_len,
+					       TEE_DATA_FLAG_ACCESS_WRITE,
+					       &object);
+		if (res == TEE_SUCCESS) {
+			res = TEE_WriteObjectData(object, buf, KV_PAGE_SIZE);
+			if (res != TEE_SUCCESS)
+				TEE_CloseObject(object);
+		}
+	}
+	if (res != TEE_SUCCESS) {
+		EMSG("Failed to write KV page %" PRIu32 ", res=0x%08x",
+		     page, res);
+		return res;
+	}
+
+	TEE_CloseObject(object);
+	return TEE_SUCCESS;
+}
+
+/*
+ * Get the record at @offs of the page @buf, the key at @key. False past the
+ * last record of the page.
+ */
+static bool get_rec(const uint8_t *buf, size_t offs, struct kv_rec *rec,
+		    const char **key)
+{
+	struct kv_page_hdr hdr;
+	size_t end;
+
+	TEE_MemMove(&hdr, buf, sizeof(hdr));
+	if (hdr.len > KV_PAGE_CAPACITY)
+		return false;
+	end = sizeof(hdr) + hdr.len;
+
+	if (offs >= end || end - offs < sizeof(*rec))
+		return false;
+
+	TEE_MemMove(rec, buf + offs, sizeof(*rec));
+	if (!rec->key_len || rec->key_len > TA_SECURE_STORAGE_KV_KEY_MAX_LEN ||
+	    KV_REC_SIZE(rec->key_len, rec->value_len) > end - offs)
+		return false;
+
+	*key = (const char *)buf + offs + sizeof(*rec);
+	return true;
+}
+
+static bool is_live(uint32_t page, size_t offs, const char *key,
+		    size_t key_len)
+{
+	struct kv_entry *entry;
+	bool found;
+
+	entry = kv->entries + find_key(key, key_len, &found);
+	return found && entry->page == page && entry->offs == offs;
+}
+
+/*
+ * Write @page anew with its live records, but the one of @key, and with
+ * @value for @key when @add is set. The records moved get their new
+ * offset in the index, the offset of the record of @key is returned in
+ * @offs.
+ */
+static TEE_Result rewrite_page(uint32_t page, const char *key,
+			       size_t key_len, bool add, const void *value,
+			       size_t value_len, uint16_t *offs)
+{
+	struct kv_page_hdr hdr = { };
+	const char *rec_key;
+	struct kv_rec rec;
+	struct kv_entry *entry;
+	TEE_Result res;
+	size_t in_offs;
+	size_t out_offs = sizeof(hdr);
+	bool found;
+
+	if (page < kv->page_count) {
+		res = read_page(page, kv->in);
+		if (res != TEE_SUCCESS)
+			return res;
+
+		for (in_offs = sizeof(hdr);
+		     get_rec(kv->in, in_offs, &rec, &rec_key);
+		     in_offs += KV_REC_SIZE(rec.key_len, rec.value_len)) {
+			if (!key_cmp(rec_key, rec.key_len, key, key_len) ||
+			    !is_live(page, in_offs, rec_key, rec.key_len))
+				continue;
+
+			TEE_MemMove(kv->out + out_offs, kv->in + in_offs,
+				    KV_REC_SIZE(rec.key_len, rec.value_len));
+			out_offs += KV_REC_SIZE(rec.key_len, rec.value_len);
+		}
+	}
+
+	*offs = out_offs;
+	if (add) {
+		rec.key_len = key_len;
+		rec.reserved = 0;
+		rec.value_len = value_len;
+		TEE_MemMove(kv->out + out_offs, &rec, sizeof(rec));
+		TEE_MemMove(kv->out + out_offs + sizeof(rec), key, key_len);
+		TEE_MemMove(kv->out + out_offs + sizeof(rec) + key_len, value,
+			    value_len);
+		out_offs += KV_REC_SIZE(key_len, value_len);
+	}
+
+	hdr.seq = kv->seq + 1;
+	hdr.len = out_offs - sizeof(hdr);
+	TEE_MemMove(kv->out, &hdr, sizeof(hdr));
+	TEE_MemFill(kv->out + out_offs, 0, KV_PAGE_SIZE - out_offs);
+
+	res = write_page(page, kv->out);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	kv->seq = hdr.seq;
+	kv->pages[page].seq = hdr.seq;
+	kv->pages[page].used = hdr.len;
+	kv->pages[page].stale = false;
+	if (page == kv->page_count)
+		kv->page_count++;
+
+	/* Records before the one of @key may have moved */
+	for (in_offs = sizeof(hdr); in_offs < *offs;
+	     in_offs += KV_REC_SIZE(rec.key_len, rec.value_len)) {
+		get_rec(kv->out, in_offs, &rec, &rec_key);
+		entry = kv->entries + find_key(rec_key, rec.key_len, &found);
+		entry->offs = in_offs;
+	}
+
+	return TEE_SUCCESS;
+}
+
+static void free_kv(void)
+{
+	size_t n;
+
+	for (n = 0; n < kv->entry_count; n++)
+		TEE_Free(kv->entries[n].key);
+	TEE_Free(kv->entries);
+	TEE_Free(kv->pages);
+	TEE_Free(kv);
+	kv = NULL;
+}
+
+/* Add the records of @page, read in kv->in, to the index */
+static TEE_Result load_page(uint32_t page)
+{
+	struct kv_page_hdr hdr;
+	struct kv_entry *entry;
+	const char *key;
+	struct kv_rec rec;
+	TEE_Result res;
+	size_t offs;
+	size_t pos;
+	bool found;
+
+	TEE_MemMove(&hdr, kv->in, sizeof(hdr));
+	if (hdr.len > KV_PAGE_CAPACITY) {
+		EMSG("Corrupt KV page %" PRIu32, page);
+		return TEE_ERROR_CORRUPT_OBJECT;
+	}
+
+	res = grow((void **)&kv->pages, &kv->page_max, page + 1,
+		   sizeof(*kv->pages));
+	if (res != TEE_SUCCESS)
+		return res;
+
+	kv->pages[page].seq = hdr.seq;
+	kv->pages[page].used = 0;
+	kv->pages[page].stale = false;
+	if (hdr.seq > kv->seq)
+		kv->seq = hdr.seq;
+
+	for (offs = sizeof(hdr); get_rec(kv->in, offs, &rec, &key);
+	     offs += KV_REC_SIZE(rec.key_len, rec.value_len)) {
+		pos = find_key(key, rec.key_len, &found);
+		if (found) {
+			/* Left by an interrupted move: the newest wins */
+			entry = kv->entries + pos;
+			if (kv->pages[entry->page].seq > hdr.seq) {
+				kv->pages[page].stale = true;
+				continue;
+			}
+			kv->pages[entry->page].used -=
+				KV_REC_SIZE(entry->key_len, entry->value_len);
+			kv->pages[entry->page].stale = true;
+		} else {
+			res = insert_entry(pos, key, rec.key_len);
+			if (res != TEE_SUCCESS)
+				return res;
+			entry = kv->entries + pos;
+		}
+
+		entry->page = page;
+		entry->offs = offs;
+		entry->value_len = rec.value_len;
+		kv->pages[page].used += KV_REC_SIZE(rec.key_len,
+						    rec.value_len);
+	}
+
+	kv->page_count = page + 1;
+	return TEE_SUCCESS;
+}
+
+static TEE_Result load_kv(void)
+{
+	TEE_Result res;
+	uint32_t page;
+
+	if (kv)
+		return TEE_SUCCESS;
+
+	kv = TEE_Malloc(sizeof(*kv), 0);
+	if (!kv)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	for (page = 0; ; page++) {
+		res = read_page(page, kv->in);
+		if (res == TEE_ERROR_ITEM_NOT_FOUND)
+			return TEE_SUCCESS;
+		if (res == TEE_SUCCESS)
+			res = load_page(page);
+		if (res != TEE_SUCCESS) {
+			free_kv();
+			return res;
+		}
+	}
+}
+
+TEE_Result kv_get(const char *key, size_t key_len, void *value,
+		  size_t *value_len)
+{
+	char id[KV_PAGE_ID_MAX_LEN];
+	struct kv_entry *entry;
+	TEE_ObjectHandle object;
+	uint32_t read_bytes;
+	TEE_Result res;
+	size_t id_len;
+	bool found;
+
+	res = load_kv();
+	if (res != TEE_SUCCESS)
+		return res;
+
+	entry = kv->entries + find_key(key, key_len, &found);
+	if (!found)
+		return TEE_ERROR_ITEM_NOT_FOUND;
+
+	if (entry->value_len > *value_len) {
+		*value_len = entry->value_len;
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+
+	/* The pages of hot keys stay open */
+	id_len = page_id(entry->page, id);
+	res = handle_cache_get(id, id_len, &object);
+	if (res != TEE_SUCCESS) {
+		EMSG("Failed to open KV page, res=0x%08x", res);
+		return res;
+	}
+
+	res = TEE_SeekObjectData(object, entry->offs + sizeof(struct kv_rec) +
+				 entry->key_len, TEE_DATA_SEEK_SET);
+	if (res == TEE_SUCCESS)
+		res = TEE_ReadObjectData(object, value, entry->value_len,
+					 &read_bytes);
+	if (res == TEE_SUCCESS && read_bytes != entry->value_len)
+		res = TEE_ERROR_CORRUPT_OBJECT;
+	if (res == TEE_SUCCESS) {
+		*value_len = read_bytes;
+	} else {
+		EMSG("Failed to read KV page, res=0x%08x", res);
+		/* Open the page again next time rather than reuse the handle */
+		handle_cache_drop(id, id_len);
+	}
+
+	return res;
+}
+
+TEE_Result kv_put(const char *key, size_t key_len, const void *value,
+		  size_t value_len)
+{
+	size_t rec_size = KV_REC_SIZE(key_len, value_len);
+	struct kv_entry *entry = NULL;
+	uint32_t old_page = 0;
+	TEE_Result res;
+	uint32_t page;
+	uint16_t offs;
+	size_t pos;
+	bool found;
+
+	if (!key_len || key_len > TA_SECURE_STORAGE_KV_KEY_MAX_LEN ||
+	    value_len > TA_SECURE_STORAGE_KV_VALUE_MAX_LEN)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = load_kv();
+	if (res != TEE_SUCCESS)
+		return res;
+
+	pos = find_key(key, key_len, &found);
+	if (found) {
+		entry = kv->entries + pos;
+		old_page = entry->page;
+	}
+
+	/* The page of the key when the new value fits, else the first fit */
+	if (found && kv->pages[old_page].used + rec_size -
+		     KV_REC_SIZE(entry->key_len, entry->value_len) <=
+		     KV_PAGE_CAPACITY) {
+		page = old_page;
+	} else {
+		for (page = 0; page < kv->page_count; page++)
+			if (kv->pages[page].used + rec_size <= KV_PAGE_CAPACITY)
+				break;
+	}
+
+	/* Allocations first, not to fail once the page is written */
+	res = grow((void **)&kv->pages, &kv->page_max, kv->page_count + 1,
+		   sizeof(*kv->pages));
+	if (res == TEE_SUCCESS && !found)
+		res = insert_entry(pos, key, key_len);
+	if (res != TEE_SUCCESS)
+		return res;
+	entry = kv->entries + pos;
+
+	res = rewrite_page(page, key, key_len, true, value, value_len,
+			   &offs);
+	if (res != TEE_SUCCESS) {
+		if (!found)
+			remove_entry(pos);
+		return res;
+	}
+
+	entry->page = page;
+	entry->offs = offs;
+	entry->value_len = value_len;
+
+	/*
+	 * The old record now is stale. If it cannot be dropped now, it is
+	 * before the next delete.
+	 */
+	if (found && old_page != page &&
+	    rewrite_page(old_page, key, key_len, false, NULL, 0,
+			 &offs) != TEE_SUCCESS)
+		kv->pages[old_page].stale = true;
+
+	return TEE_SUCCESS;
+}
+
+TEE_Result kv_delete(const char *key, size_t key_len)
+{
+	struct kv_entry *entry;
+	TEE_Result res;
+	uint32_t page;
+	uint16_t offs;
+	size_t pos;
+	bool found;
+
+	res = load_kv();
+	if (res != TEE_SUCCESS)
+		return res;
+
+	pos = find_key(key, key_len, &found);
+	if (!found)
+		return TEE_ERROR_ITEM_NOT_FOUND;
+
+	for (page = 0; page < kv->page_count; page++) {
+		if (!kv->pages[page].stale)
+			continue;
+		res = rewrite_page(page, NULL, 0, false, NULL, 0, &offs);
+		if (res != TEE_SUCCESS)
+			return res;
+	}
+
+	entry = kv->entries + pos;
+	res = rewrite_page(entry->page, key, key_len, false, NULL, 0,
+			   &offs);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	remove_entry(pos);
+	return TEE_SUCCESS;
+}
+
+TEE_Result kv_scan(const char *prefix, size_t prefix_len, size_t first,
+		   void *out, size_t *out_len, size_t *count, size_t *total)
+{
+	struct secure_storage_item item = { };
+	struct kv_entry *entry;
+	size_t out_offs = 0;
+	TEE_Result res;
+	size_t start;
+	size_t end;
+	size_t sz;
+	bool found;
+
+	res = load_kv();
+	if (res != TEE_SUCCESS)
+		return res;
+
+	/* The keys starting with @prefix follow the prefix itself */
+	start = find_key(prefix, prefix_len, &found);
+	for (end = start; end < kv->entry_count; end++) {
+		entry = kv->entries + end;
+		if (entry->key_len < prefix_len ||
+		    TEE_MemCompare(entry->key, prefix, prefix_len))
+			break;
+	}
+
+	*total = end - start;
+	*count = 0;
+	if (first >= *total) {
+		*out_len = 0;
+		return TEE_SUCCESS;
+	}
+
+	for (entry = kv->entries + start + first;
+	     entry < kv->entries + end; entry++) {
+		sz = TA_SECURE_STORAGE_ITEM_SIZE(entry->key_len, 0);
+		if (sz > *out_len - out_offs) {
+			if (*count)
+				break;
+
+			/* Not even the first key fits, tell its size */
+			*out_len = sz;
+			return TEE_ERROR_SHORT_BUFFER;
+		}
+
+		item.id_len = entry->key_len;
+		TEE_MemMove((char *)out + out_offs, &item, sizeof(item));
+		TEE_MemMove((char *)out + out_offs + sizeof(item), entry->key,
+			    entry->key_len);
+		out_offs += sz;
+		(*count)++;
+	}
+
+	*out_len = out_offs;
+	return TEE_SUCCESS;
+}
+
+void kv_release(void)
+{
+	if (kv)
+		free_kv();
+}
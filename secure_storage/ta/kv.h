@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (c) 2017, Linaro Limited
+ */
+
+#ifndef __KV_H__
+#define __KV_H__
+
+#include <stddef.h>
+#include <tee_internal_api.h>
+
+/*
+ * Key-value store over secure storage, see TA_SECURE_STORAGE_CMD_KV_GET.
+ * The index of the keys is loaded from the pages at the first call. Keys
+ * and prefixes are read more than once: they must be in TA memory, not in
+ * shared memory.
+ */
+
+TEE_Result kv_get(const char *key, size_t key_len, void *value,
+		  size_t *value_len);
+TEE_Result kv_put(const char *key, size_t key_len, const void *value,
+		  size_t value_len);
+TEE_Result kv_delete(const char *key, size_t key_len);
+
+/*
+ * List the keys starting with @prefix from the @first one of them, as
+ * packed struct secure_storage_item in @out. @count is set to the number
+ * of keys listed, @total to the number of keys starting with @prefix.
+ */
+TEE_Result kv_scan(const char *prefix, size_t prefix_len, size_t first,
+		   void *out, size_t *out_len, size_t *count, size_t *total);
+
+/* Free the index, at the end of the TA instance */
+void kv_release(void);
+
+#endif /* __KV_H__ */
@@ -30,6 +30,58 @@
 #include <tee_internal_api.h>
 #include <tee_internal_api_extensions.h>
 
+#include "handles.h"
+#include "kv.h"
+#include "tx.h"
+#include "values.h"
+
+/* An object being transferred by chunks */
+struct stream {
+	TEE_ObjectHandle object;	/* TEE_HANDLE_NULL when not in use */
+	bool write;			/* opened by STREAM_OPEN_WRITE */
+	/* Object replaced when a write stream is committed */
+	char id[TA_SECURE_STORAGE_ITEM_ID_MAX_LEN];
+	uint32_t id_len;
+};
+
+/* Position in TA_SECURE_STORAGE_CMD_LIST */
+struct list_cursor {
+	TEE_ObjectEnumHandle enumerator;	/* NULL until a listing */
+	bool done;			/* The enumerator reached the end */
+	bool pending;			/* Object got but not listed yet */
+	bool internal;			/* Internal objects are listed */
+	char id[TEE_OBJECT_ID_MAX_LEN];
+	uint32_t id_len;
+	uint32_t data_size;
+};
+
+struct ss_session {
+	struct stream streams[TA_SECURE_STORAGE_MAX_STREAMS];
+	struct list_cursor list;
+};
+
+/* Forget what the caches hold of an object, before it changes */
+static void drop_cached(const char *obj_id, size_t obj_id_sz)
+{
+	handle_cache_drop(obj_id, obj_id_sz);
+	value_cache_drop(obj_id, obj_id_sz);
+}
+
+/*
+ * Objects of the key-value store and of replacements are only changed by
+ * kv.c and tx.c: their IDs are not accepted from the client.
+ */
+static bool reserved_id(const char *obj_id, size_t obj_id_sz)
+{
+	const size_t kv_len = sizeof(TA_SECURE_STORAGE_KV_PREFIX) - 1;
+	const size_t tx_len = sizeof(TA_SECURE_STORAGE_TX_PREFIX) - 1;
+
+	return (obj_id_sz >= kv_len &&
+		!TEE_MemCompare(obj_id, TA_SECURE_STORAGE_KV_PREFIX, kv_len)) ||
+	       (obj_id_sz >= tx_len &&
+		!TEE_MemCompare(obj_id, TA_SECURE_STORAGE_TX_PREFIX, tx_len));
+}
+
 static TEE_Result delete_object(uint32_t param_types, TEE_Param params[4])
 {
 	const uint32_t exp_param_types =
@@ -54,6 +106,11 @@ static TEE_Result delete_object(uint32_t param_types, TEE_Param params[4])
 		return TEE_ERROR_OUT_OF_MEMORY;
 
 	TEE_MemMove(obj_id, params[0].memref.buffer, obj_id_sz);
+	if (reserved_id(obj_id, obj_id_sz)) {
+		TEE_Free(obj_id);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+	drop_cached(obj_id, obj_id_sz);
 
 	/*
 	 * Check object exists and delete it
@@ -88,6 +145,7 @@ static TEE_Result create_raw_object(uint32_t param_types, TEE_Param params[4])
 	size_t obj_id_sz;
 	char *data;
 	size_t data_sz;
+	char *copy = NULL;
 	uint32_t obj_data_flag;
 
 	/*
@@ -102,10 +160,26 @@ static TEE_Result create_raw_object(uint32_t param_types, TEE_Param params[4])
 		return TEE_ERROR_OUT_OF_MEMORY;
 
 	TEE_MemMove(obj_id, params[0].memref.buffer, obj_id_sz);
+	if (reserved_id(obj_id, obj_id_sz)) {
+		TEE_Free(obj_id);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+	handle_cache_drop(obj_id, obj_id_sz);
 
 	data = (char *)params[1].memref.buffer;
 	data_sz = params[1].memref.size;
 
+	/* A small object may be cached: write the copy that is cached */
+	if (data_sz <= VALUE_CACHE_VALUE_MAX_LEN) {
+		copy = TEE_Malloc(data_sz, 0);
+		if (!copy) {
+			TEE_Free(obj_id);
+			return TEE_ERROR_OUT_OF_MEMORY;
+		}
+		TEE_MemMove(copy, data, data_sz);
+		data = copy;
+	}
+
 	/*
 	 * Create object in secure storage and fill with data
 	 */
@@ -122,8 +196,7 @@ static TEE_Result create_raw_object(uint32_t param_types, TEE_Param params[4])
 					&object);
 	if (res != TEE_SUCCESS) {
 		EMSG("TEE_CreatePersistentObject failed 0x%08x", res);
-		TEE_Free(obj_id);
-		return res;
+		goto exit;
 	}
 
 	res = TEE_WriteObjectData(object, data, data_sz);
@@ -133,6 +206,13 @@ static TEE_Result create_raw_object(uint32_t param_types, TEE_Param params[4])
 	} else {
 		TEE_CloseObject(object);
 	}
+exit:
+	/* Write through the cache */
+	if (res == TEE_SUCCESS && copy)
+		value_cache_put(obj_id, obj_id_sz, copy, data_sz, false);
+	else
+		value_cache_drop(obj_id, obj_id_sz);
+	TEE_Free(copy);
 	TEE_Free(obj_id);
 	return res;
 }
@@ -152,6 +232,9 @@ static TEE_Result read_raw_object(uint32_t param_types, TEE_Param params[4])
 	size_t obj_id_sz;
 	char *data;
 	size_t data_sz;
+	const void *cached;
+	size_t cached_sz;
+	char *copy = NULL;
 
 	/*
 	 * Safely get the invocation parameters
@@ -165,23 +248,34 @@ static TEE_Result read_raw_object(uint32_t param_types, TEE_Param params[4])
 		return TEE_ERROR_OUT_OF_MEMORY;
 
 	TEE_MemMove(obj_id, params[0].memref.buffer, obj_id_sz);
+	if (reserved_id(obj_id, obj_id_sz)) {
+		TEE_Free(obj_id);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
 
 	data = (char *)params[1].memref.buffer;
 	data_sz = params[1].memref.size;
 
+	/* Small objects read often are served from TA memory */
+	if (value_cache_get(obj_id, obj_id_sz, &cached, &cached_sz)) {
+		res = TEE_SUCCESS;
+		if (cached_sz > data_sz)
+			res = TEE_ERROR_SHORT_BUFFER;
+		else
+			TEE_MemMove(data, cached, cached_sz);
+		params[1].memref.size = cached_sz;
+		goto exit;
+	}
+
 	/*
 	 * Check the object exist and can be dumped into output buffer
-	 * then dump it.
+	 * then dump it. The object stays open for the next reads, the one
+	 * following a short buffer in particular.
 	 */
-	res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE,
-					obj_id, obj_id_sz,
-					TEE_DATA_FLAG_ACCESS_READ |
-					TEE_DATA_FLAG_SHARE_READ,
-					&object);
+	res = handle_cache_get(obj_id, obj_id_sz, &object);
 	if (res != TEE_SUCCESS) {
 		EMSG("Failed to open persistent object, res=0x%08x", res);
-		TEE_Free(obj_id);
-		return res;
+		goto exit;
 	}
 
 	res = TEE_GetObjectInfo1(object, &object_info);
@@ -200,51 +294,1180 @@ static TEE_Result read_raw_object(uint32_t param_types, TEE_Param params[4])
 		goto exit;
 	}
 
-	res = TEE_ReadObjectData(object, data, object_info.dataSize,
-				 &read_bytes);
+	/* A small object is read in TA memory first, to be cached */
+	if (object_info.dataSize <= VALUE_CACHE_VALUE_MAX_LEN) {
+		copy = TEE_Malloc(object_info.dataSize, 0);
+		if (!copy) {
+			res = TEE_ERROR_OUT_OF_MEMORY;
+			goto exit;
+		}
+	}
+
+	res = TEE_ReadObjectData(object, copy ? copy : data,
+				 object_info.dataSize, &read_bytes);
 	if (res != TEE_SUCCESS || read_bytes != object_info.dataSize) {
 		EMSG("TEE_ReadObjectData failed 0x%08x, read %" PRIu32 " over %u",
 				res, read_bytes, object_info.dataSize);
+		handle_cache_drop(obj_id, obj_id_sz);
 		goto exit;
 	}
 
+	if (copy) {
+		TEE_MemMove(data, copy, read_bytes);
+		value_cache_put(obj_id, obj_id_sz, copy, read_bytes, true);
+	}
+
 	/* Return the number of byte effectively filled */
 	params[1].memref.size = read_bytes;
 exit:
-	TEE_CloseObject(object);
+	TEE_Free(copy);
 	TEE_Free(obj_id);
 	return res;
 }
 
-TEE_Result TA_CreateEntryPoint(void)
+/*
+ * Open a persistent object for partial access. When @create is set, an
+ * object that does not exist yet is created empty.
+ */
+static TEE_Result open_object(char *obj_id, size_t obj_id_sz,
+			      uint32_t obj_data_flag, bool create,
+			      TEE_ObjectHandle *object)
 {
-	/* Nothing to do */
-	return TEE_SUCCESS;
+	TEE_Result res;
+
+	res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE,
+					obj_id, obj_id_sz,
+					obj_data_flag, object);
+	if (res == TEE_ERROR_ITEM_NOT_FOUND && create)
+		res = TEE_CreatePersistentObject(TEE_STORAGE_PRIVATE,
+					obj_id, obj_id_sz,
+					obj_data_flag |
+					TEE_DATA_FLAG_ACCESS_WRITE_META,
+					TEE_HANDLE_NULL,
+					NULL, 0,
+					object);
+	if (res != TEE_SUCCESS && res != TEE_ERROR_ITEM_NOT_FOUND)
+		EMSG("Failed to open persistent object, res=0x%08x", res);
+
+	return res;
 }
 
-void TA_DestroyEntryPoint(void)
+static TEE_Result read_object_at(uint32_t param_types, TEE_Param params[4])
 {
-	/* Nothing to do */
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_MEMREF_OUTPUT,
+				TEE_PARAM_TYPE_VALUE_INPUT,
+				TEE_PARAM_TYPE_NONE);
+	TEE_ObjectHandle object;
+	TEE_Result res;
+	uint32_t read_bytes;
+	uint32_t offset;
+	char *obj_id;
+	size_t obj_id_sz;
+	const void *cached;
+	size_t cached_sz;
+
+	/*
+	 * Safely get the invocation parameters
+	 */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	/* Seek offsets are signed */
+	offset = params[2].value.a;
+	if (offset > INT32_MAX)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	obj_id_sz = params[0].memref.size;
+	obj_id = TEE_Malloc(obj_id_sz, 0);
+	if (!obj_id)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	TEE_MemMove(obj_id, params[0].memref.buffer, obj_id_sz);
+	if (reserved_id(obj_id, obj_id_sz)) {
+		TEE_Free(obj_id);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	if (value_cache_get(obj_id, obj_id_sz, &cached, &cached_sz)) {
+		/* Reading past the end of the object reads nothing */
+		read_bytes = 0;
+		if (offset < cached_sz) {
+			read_bytes = cached_sz - offset;
+			if (read_bytes > params[1].memref.size)
+				read_bytes = params[1].memref.size;
+			TEE_MemMove(params[1].memref.buffer,
+				    (const char *)cached + offset, read_bytes);
+		}
+		params[1].memref.size = read_bytes;
+		res = TEE_SUCCESS;
+		goto exit;
+	}
+
+	res = handle_cache_get(obj_id, obj_id_sz, &object);
+	if (res != TEE_SUCCESS) {
+		if (res != TEE_ERROR_ITEM_NOT_FOUND)
+			EMSG("Failed to open persistent object, res=0x%08x",
+			     res);
+		goto exit;
+	}
+
+	/* Reading past the end of the object reads nothing */
+	res = TEE_SeekObjectData(object, offset, TEE_DATA_SEEK_SET);
+	if (res != TEE_SUCCESS) {
+		EMSG("TEE_SeekObjectData failed 0x%08x", res);
+		goto exit;
+	}
+
+	res = TEE_ReadObjectData(object, params[1].memref.buffer,
+				 params[1].memref.size, &read_bytes);
+	if (res != TEE_SUCCESS) {
+		EMSG("TEE_ReadObjectData failed 0x%08x", res);
+		handle_cache_drop(obj_id, obj_id_sz);
+		goto exit;
+	}
+
+	/* Return the number of byte effectively filled */
+	params[1].memref.size = read_bytes;
+exit:
+	TEE_Free(obj_id);
+	return res;
 }
 
-TEE_Result TA_OpenSessionEntryPoint(uint32_t __unused param_types,
-				    TEE_Param __unused params[4],
-				    void __unused **session)
+static TEE_Result write_object_at(uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_VALUE_INPUT,
+				TEE_PARAM_TYPE_NONE);
+	TEE_ObjectHandle object;
+	TEE_Result res;
+	uint32_t offset;
+	char *obj_id;
+	size_t obj_id_sz;
+
+	/*
+	 * Safely get the invocation parameters
+	 */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	offset = params[2].value.a;
+	if (offset > INT32_MAX ||
+	    params[1].memref.size > TEE_DATA_MAX_POSITION - offset)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	obj_id_sz = params[0].memref.size;
+	obj_id = TEE_Malloc(obj_id_sz, 0);
+	if (!obj_id)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	TEE_MemMove(obj_id, params[0].memref.buffer, obj_id_sz);
+	if (reserved_id(obj_id, obj_id_sz)) {
+		TEE_Free(obj_id);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+	drop_cached(obj_id, obj_id_sz);
+
+	res = open_object(obj_id, obj_id_sz,
+			  TEE_DATA_FLAG_ACCESS_READ | TEE_DATA_FLAG_ACCESS_WRITE,
+			  true, &object);
+	TEE_Free(obj_id);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	/* Seeking past the end fills the gap with zeroes once written */
+	res = TEE_SeekObjectData(object, offset, TEE_DATA_SEEK_SET);
+	if (res != TEE_SUCCESS) {
+		EMSG("TEE_SeekObjectData failed 0x%08x", res);
+		goto exit;
+	}
+
+	res = TEE_WriteObjectData(object, params[1].memref.buffer,
+				  params[1].memref.size);
+	if (res != TEE_SUCCESS)
+		EMSG("TEE_WriteObjectData failed 0x%08x", res);
+exit:
+	TEE_CloseObject(object);
+	return res;
+}
+
+static TEE_Result truncate_object(uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_VALUE_INPUT,
+				TEE_PARAM_TYPE_NONE);
+	TEE_ObjectHandle object;
+	TEE_Result res;
+	char *obj_id;
+	size_t obj_id_sz;
+
+	/*
+	 * Safely get the invocation parameters
+	 */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	/* Positions are bounded as in WRITE_AT */
+	if (params[2].value.a > INT32_MAX)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	obj_id_sz = params[0].memref.size;
+	obj_id = TEE_Malloc(obj_id_sz, 0);
+	if (!obj_id)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	TEE_MemMove(obj_id, params[0].memref.buffer, obj_id_sz);
+	if (reserved_id(obj_id, obj_id_sz)) {
+		TEE_Free(obj_id);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+	drop_cached(obj_id, obj_id_sz);
+
+	res = open_object(obj_id, obj_id_sz, TEE_DATA_FLAG_ACCESS_WRITE,
+			  false, &object);
+	TEE_Free(obj_id);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	res = TEE_TruncateObjectData(object, params[2].value.a);
+	if (res != TEE_SUCCESS)
+		EMSG("TEE_TruncateObjectData failed 0x%08x", res);
+
+	TEE_CloseObject(object);
+	return res;
+}
+
+/*
+ * Get the header and the ID of the item at @offs in the packed items of
+ * @list. They are copied out of shared memory before they are checked.
+ */
+static TEE_Result get_item(TEE_Param *list, size_t offs,
+			   struct secure_storage_item *item,
+			   char id[TA_SECURE_STORAGE_ITEM_ID_MAX_LEN])
+{
+	size_t rem = list->memref.size - offs;
+
+	if (rem < sizeof(*item))
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	TEE_MemMove(item, (char *)list->memref.buffer + offs, sizeof(*item));
+	rem -= sizeof(*item);
+
+	if (item->id_len > TA_SECURE_STORAGE_ITEM_ID_MAX_LEN ||
+	    item->id_len > rem || item->data_len > rem - item->id_len)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	TEE_MemMove(id, (char *)list->memref.buffer + offs + sizeof(*item),
+		    item->id_len);
+	if (reserved_id(id, item->id_len))
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	return TEE_SUCCESS;
+}
+
+/* Count the packed items of @list, all of them valid */
+static TEE_Result count_items(TEE_Param *list, size_t *count)
 {
-	/* Nothing to do */
+	char id[TA_SECURE_STORAGE_ITEM_ID_MAX_LEN];
+	struct secure_storage_item item;
+	TEE_Result res;
+	size_t offs;
+
+	*count = 0;
+	for (offs = 0; offs < list->memref.size;
+	     offs += TA_SECURE_STORAGE_ITEM_SIZE(item.id_len, item.data_len)) {
+		res = get_item(list, offs, &item, id);
+		if (res != TEE_SUCCESS)
+			return res;
+		(*count)++;
+	}
+
 	return TEE_SUCCESS;
 }
 
-void TA_CloseSessionEntryPoint(void __unused *session)
+static TEE_Result batch_put(uint32_t param_types, TEE_Param params[4])
 {
-	/* Nothing to do */
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_MEMREF_OUTPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	char obj_id[TA_SECURE_STORAGE_ITEM_ID_MAX_LEN];
+	struct secure_storage_item item;
+	TEE_ObjectHandle object;
+	uint32_t *results;
+	TEE_Result res;
+	char *value;
+	char *data;
+	size_t count;
+	size_t offs;
+	size_t n;
+
+	/*
+	 * Safely get the invocation parameters
+	 */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	/* Nothing is written unless the whole list is valid */
+	res = count_items(params, &count);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	if (params[1].memref.size < count * sizeof(uint32_t)) {
+		params[1].memref.size = count * sizeof(uint32_t);
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+	results = params[1].memref.buffer;
+
+	value = TEE_Malloc(VALUE_CACHE_VALUE_MAX_LEN, 0);
+	if (!value)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	for (n = 0, offs = 0; n < count; n++,
+	     offs += TA_SECURE_STORAGE_ITEM_SIZE(item.id_len, item.data_len)) {
+		/* Checked again, the list is still in shared memory */
+		res = get_item(params, offs, &item, obj_id);
+		if (res != TEE_SUCCESS)
+			goto out;
+
+		handle_cache_drop(obj_id, item.id_len);
+
+		/* A small object may be cached: write the copy that is cached */
+		data = (char *)params[0].memref.buffer + offs + sizeof(item) +
+		       item.id_len;
+		if (item.data_len <= VALUE_CACHE_VALUE_MAX_LEN) {
+			TEE_MemMove(value, data, item.data_len);
+			data = value;
+		}
+
+		/* Created with its data at once, as a single update */
+		res = TEE_CreatePersistentObject(TEE_STORAGE_PRIVATE,
+					obj_id, item.id_len,
+					TEE_DATA_FLAG_ACCESS_READ |
+					TEE_DATA_FLAG_ACCESS_WRITE |
+					TEE_DATA_FLAG_ACCESS_WRITE_META |
+					TEE_DATA_FLAG_OVERWRITE,
+					TEE_HANDLE_NULL,
+					data, item.data_len,
+					&object);
+		if (res == TEE_SUCCESS)
+			TEE_CloseObject(object);
+		else
+			EMSG("TEE_CreatePersistentObject failed 0x%08x", res);
+
+		/* Write through the cache */
+		if (res == TEE_SUCCESS && data == value)
+			value_cache_put(obj_id, item.id_len, value,
+					item.data_len, false);
+		else
+			value_cache_drop(obj_id, item.id_len);
+
+		results[n] = res;
+	}
+
+	params[1].memref.size = count * sizeof(uint32_t);
+	res = TEE_SUCCESS;
+out:
+	TEE_Free(value);
+	return res;
 }
 
-TEE_Result TA_InvokeCommandEntryPoint(void __unused *session,
-				      uint32_t command,
-				      uint32_t param_types,
-				      TEE_Param params[4])
+/*
+ * Read an object into the packed item at @out, of @out_sz bytes at most.
+ * Returns the size of the item, nothing is written to @out when it is
+ * larger than @out_sz.
+ */
+static size_t get_object(char *obj_id, size_t obj_id_sz, char *out,
+			 size_t out_sz)
 {
+	struct secure_storage_item item = { };
+	TEE_ObjectInfo object_info;
+	TEE_ObjectHandle object;
+	uint32_t read_bytes;
+	const void *cached;
+	size_t cached_sz;
+	TEE_Result res;
+
+	/* Cache misses are not added: a batch must not evict hot objects */
+	if (value_cache_get(obj_id, obj_id_sz, &cached, &cached_sz)) {
+		if (TA_SECURE_STORAGE_ITEM_SIZE(0, cached_sz) > out_sz)
+			return TA_SECURE_STORAGE_ITEM_SIZE(0, cached_sz);
+
+		TEE_MemMove(out + sizeof(item), cached, cached_sz);
+		item.data_len = cached_sz;
+		res = TEE_SUCCESS;
+		goto out;
+	}
+
+	res = open_object(obj_id, obj_id_sz,
+			  TEE_DATA_FLAG_ACCESS_READ | TEE_DATA_FLAG_SHARE_READ,
+			  false, &object);
+	if (res != TEE_SUCCESS)
+		goto out;
+
+	res = TEE_GetObjectInfo1(object, &object_info);
+	if (res != TEE_SUCCESS) {
+		EMSG("TEE_GetObjectInfo1 failed 0x%08x", res);
+		goto close;
+	}
+
+	if (TA_SECURE_STORAGE_ITEM_SIZE(0, object_info.dataSize) > out_sz) {
+		TEE_CloseObject(object);
+		return TA_SECURE_STORAGE_ITEM_SIZE(0, object_info.dataSize);
+	}
+
+	res = TEE_ReadObjectData(object, out + sizeof(item),
+				 object_info.dataSize, &read_bytes);
+	if (res != TEE_SUCCESS || read_bytes != object_info.dataSize) {
+		EMSG("TEE_ReadObjectData failed 0x%08x, read %" PRIu32 " over %u",
+				res, read_bytes, object_info.dataSize);
+		if (res == TEE_SUCCESS)
+			res = TEE_ERROR_CORRUPT_OBJECT;
+		goto close;
+	}
+	item.data_len = read_bytes;
+close:
+	TEE_CloseObject(object);
+out:
+	if (sizeof(item) > out_sz)
+		return sizeof(item);
+
+	item.status = res;
+	TEE_MemMove(out, &item, sizeof(item));
+	return TA_SECURE_STORAGE_ITEM_SIZE(0, item.data_len);
+}
+
+static TEE_Result batch_get(uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_MEMREF_OUTPUT,
+				TEE_PARAM_TYPE_VALUE_OUTPUT,
+				TEE_PARAM_TYPE_NONE);
+	char obj_id[TA_SECURE_STORAGE_ITEM_ID_MAX_LEN];
+	struct secure_storage_item item;
+	char *out = params[1].memref.buffer;
+	size_t out_offs = 0;
+	size_t count = 0;
+	size_t offs;
+	size_t sz;
+
+	/*
+	 * Safely get the invocation parameters
+	 */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	for (offs = 0; offs < params[0].memref.size;
+	     offs += TA_SECURE_STORAGE_ITEM_SIZE(item.id_len, item.data_len)) {
+		if (get_item(params, offs, &item, obj_id) != TEE_SUCCESS ||
+		    item.data_len)
+			return TEE_ERROR_BAD_PARAMETERS;
+
+		sz = get_object(obj_id, item.id_len, out + out_offs,
+				params[1].memref.size - out_offs);
+		if (sz > params[1].memref.size - out_offs) {
+			if (count)
+				break;
+
+			/* Not even the first object fits, tell its size */
+			params[1].memref.size = sz;
+			return TEE_ERROR_SHORT_BUFFER;
+		}
+
+		out_offs += sz;
+		count++;
+	}
+
+	params[1].memref.size = out_offs;
+	params[2].value.a = count;
+	params[2].value.b = 0;
+	return TEE_SUCCESS;
+}
+
+static TEE_Result stat_objects(uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_MEMREF_OUTPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	char obj_id[TA_SECURE_STORAGE_ITEM_ID_MAX_LEN];
+	struct secure_storage_object_stat stat;
+	struct secure_storage_item item;
+	TEE_ObjectInfo object_info;
+	TEE_ObjectHandle object;
+	TEE_Result res;
+	size_t count;
+	size_t offs;
+	size_t n;
+
+	/*
+	 * Safely get the invocation parameters
+	 */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = count_items(params, &count);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	if (params[1].memref.size < count * sizeof(stat)) {
+		params[1].memref.size = count * sizeof(stat);
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+
+	for (n = 0, offs = 0; n < count; n++,
+	     offs += TA_SECURE_STORAGE_ITEM_SIZE(item.id_len, item.data_len)) {
+		/* Checked again, the list is still in shared memory */
+		res = get_item(params, offs, &item, obj_id);
+		if (res != TEE_SUCCESS || item.data_len)
+			return TEE_ERROR_BAD_PARAMETERS;
+
+		/* No access requested: the metadata is all that is needed */
+		TEE_MemFill(&stat, 0, sizeof(stat));
+		res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE,
+					obj_id, item.id_len,
+					TEE_DATA_FLAG_SHARE_READ |
+					TEE_DATA_FLAG_SHARE_WRITE,
+					&object);
+		if (res == TEE_SUCCESS) {
+			res = TEE_GetObjectInfo1(object, &object_info);
+			if (res == TEE_SUCCESS) {
+				stat.object_type = object_info.objectType;
+				stat.data_size = object_info.dataSize;
+			}
+			TEE_CloseObject(object);
+		}
+		stat.status = res;
+
+		TEE_MemMove((char *)params[1].memref.buffer +
+			    n * sizeof(stat), &stat, sizeof(stat));
+	}
+
+	params[1].memref.size = count * sizeof(stat);
+	return TEE_SUCCESS;
+}
+
+static TEE_Result replace_object(uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	char obj_id[TA_SECURE_STORAGE_ITEM_ID_MAX_LEN];
+	struct tx_item item;
+
+	/*
+	 * Safely get the invocation parameters
+	 */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	if (params[0].memref.size > sizeof(obj_id))
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	TEE_MemMove(obj_id, params[0].memref.buffer, params[0].memref.size);
+	if (reserved_id(obj_id, params[0].memref.size))
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	item.id = obj_id;
+	item.id_len = params[0].memref.size;
+	item.data = params[1].memref.buffer;
+	item.data_len = params[1].memref.size;
+
+	return tx_replace(&item, 1);
+}
+
+static TEE_Result batch_replace(uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	struct secure_storage_item item;
+	struct tx_item *items;
+	TEE_Result res;
+	char *obj_ids;
+	char *obj_id;
+	size_t count;
+	size_t offs;
+	size_t n;
+
+	/*
+	 * Safely get the invocation parameters
+	 */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = count_items(params, &count);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	if (!count || count > TA_SECURE_STORAGE_REPLACE_MAX_ITEMS)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	items = TEE_Malloc(count * sizeof(*items), 0);
+	obj_ids = TEE_Malloc(count * TA_SECURE_STORAGE_ITEM_ID_MAX_LEN, 0);
+	if (!items || !obj_ids) {
+		res = TEE_ERROR_OUT_OF_MEMORY;
+		goto out;
+	}
+
+	for (n = 0, offs = 0; n < count; n++,
+	     offs += TA_SECURE_STORAGE_ITEM_SIZE(item.id_len, item.data_len)) {
+		/* Checked again, the list is still in shared memory */
+		/* The IDs are copied, the data is read once */
+		obj_id = obj_ids + n * TA_SECURE_STORAGE_ITEM_ID_MAX_LEN;
+		res = get_item(params, offs, &item, obj_id);
+		if (res != TEE_SUCCESS)
+			goto out;
+
+		items[n].id = obj_id;
+		items[n].id_len = item.id_len;
+		items[n].data = (char *)params[0].memref.buffer + offs +
+				sizeof(item) + item.id_len;
+		items[n].data_len = item.data_len;
+	}
+
+	res = tx_replace(items, count);
+out:
+	TEE_Free(obj_ids);
+	TEE_Free(items);
+	return res;
+}
+
+static TEE_Result cache_stats(uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_OUTPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	struct secure_storage_cache_stats stats;
+
+	/*
+	 * Safely get the invocation parameters
+	 */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	if (params[0].memref.size < sizeof(stats)) {
+		params[0].memref.size = sizeof(stats);
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+
+	value_cache_get_stats(&stats);
+	TEE_MemMove(params[0].memref.buffer, &stats, sizeof(stats));
+	params[0].memref.size = sizeof(stats);
+	return TEE_SUCCESS;
+}
+
+/* Copy the key, or prefix, of @param out of shared memory */
+static TEE_Result get_kv_key(TEE_Param *param, char *key, size_t *key_len)
+{
+	if (param->memref.size > TA_SECURE_STORAGE_KV_KEY_MAX_LEN)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	*key_len = param->memref.size;
+	TEE_MemMove(key, param->memref.buffer, *key_len);
+	return TEE_SUCCESS;
+}
+
+static TEE_Result kv_cmd_get(uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_MEMREF_OUTPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	char key[TA_SECURE_STORAGE_KV_KEY_MAX_LEN];
+	size_t value_len = params[1].memref.size;
+	size_t key_len;
+	TEE_Result res;
+
+	/*
+	 * Safely get the invocation parameters
+	 */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = get_kv_key(params, key, &key_len);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	res = kv_get(key, key_len, params[1].memref.buffer, &value_len);
+	if (res == TEE_SUCCESS || res == TEE_ERROR_SHORT_BUFFER)
+		params[1].memref.size = value_len;
+
+	return res;
+}
+
+static TEE_Result kv_cmd_put(uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	char key[TA_SECURE_STORAGE_KV_KEY_MAX_LEN];
+	size_t key_len;
+	TEE_Result res;
+
+	/*
+	 * Safely get the invocation parameters
+	 */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = get_kv_key(params, key, &key_len);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	/* The value is copied once, into the page written */
+	return kv_put(key, key_len, params[1].memref.buffer,
+		      params[1].memref.size);
+}
+
+static TEE_Result kv_cmd_delete(uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	char key[TA_SECURE_STORAGE_KV_KEY_MAX_LEN];
+	size_t key_len;
+	TEE_Result res;
+
+	/*
+	 * Safely get the invocation parameters
+	 */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = get_kv_key(params, key, &key_len);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	return kv_delete(key, key_len);
+}
+
+static TEE_Result kv_cmd_scan(uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_MEMREF_OUTPUT,
+				TEE_PARAM_TYPE_VALUE_INOUT,
+				TEE_PARAM_TYPE_NONE);
+	char prefix[TA_SECURE_STORAGE_KV_KEY_MAX_LEN];
+	size_t out_len = params[1].memref.size;
+	size_t prefix_len;
+	size_t count;
+	size_t total;
+	TEE_Result res;
+
+	/*
+	 * Safely get the invocation parameters
+	 */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = get_kv_key(params, prefix, &prefix_len);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	res = kv_scan(prefix, prefix_len, params[2].value.a,
+		      params[1].memref.buffer, &out_len, &count, &total);
+	if (res == TEE_SUCCESS || res == TEE_ERROR_SHORT_BUFFER)
+		params[1].memref.size = out_len;
+	if (res == TEE_SUCCESS) {
+		params[2].value.a = count;
+		params[2].value.b = total;
+	}
+
+	return res;
+}
+
+static struct stream *get_stream(struct ss_session *sess, uint32_t handle)
+{
+	if (handle >= TA_SECURE_STORAGE_MAX_STREAMS ||
+	    sess->streams[handle].object == TEE_HANDLE_NULL)
+		return NULL;
+
+	return sess->streams + handle;
+}
+
+static void close_stream(struct stream *stream)
+{
+	/* A write stream that was not committed leaves nothing behind */
+	if (stream->write)
+		TEE_CloseAndDeletePersistentObject1(stream->object);
+	else
+		TEE_CloseObject(stream->object);
+
+	stream->object = TEE_HANDLE_NULL;
+	stream->write = false;
+}
+
+static TEE_Result stream_open(struct ss_session *sess, uint32_t param_types,
+			      TEE_Param params[4], bool write)
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_VALUE_OUTPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	TEE_ObjectInfo object_info;
+	struct stream *stream = NULL;
+	TEE_Result res;
+	char *obj_id;
+	size_t obj_id_sz;
+	size_t n;
+
+	/*
+	 * Safely get the invocation parameters
+	 */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	for (n = 0; n < TA_SECURE_STORAGE_MAX_STREAMS; n++) {
+		if (sess->streams[n].object == TEE_HANDLE_NULL) {
+			stream = sess->streams + n;
+			break;
+		}
+	}
+	if (!stream)
+		return TEE_ERROR_BUSY;
+
+	obj_id_sz = params[0].memref.size;
+	if (write && obj_id_sz > TA_SECURE_STORAGE_ITEM_ID_MAX_LEN)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	obj_id = TEE_Malloc(obj_id_sz, 0);
+	if (!obj_id)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	TEE_MemMove(obj_id, params[0].memref.buffer, obj_id_sz);
+	if (reserved_id(obj_id, obj_id_sz)) {
+		TEE_Free(obj_id);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	if (write) {
+		/*
+		 * The data goes to a temporary object, renamed over the
+		 * object when the stream is committed: until then the object
+		 * keeps its previous data.
+		 */
+		res = tx_create_temp(n, TEE_DATA_FLAG_ACCESS_WRITE,
+				     &stream->object);
+		if (res == TEE_SUCCESS) {
+			TEE_MemMove(stream->id, obj_id, obj_id_sz);
+			stream->id_len = obj_id_sz;
+		}
+	} else {
+		res = open_object(obj_id, obj_id_sz,
+				  TEE_DATA_FLAG_ACCESS_READ |
+				  TEE_DATA_FLAG_SHARE_READ,
+				  false, &stream->object);
+	}
+	TEE_Free(obj_id);
+	if (res != TEE_SUCCESS) {
+		stream->object = TEE_HANDLE_NULL;
+		return res;
+	}
+	stream->write = write;
+
+	params[1].value.a = n;
+	params[1].value.b = 0;
+
+	if (!write) {
+		res = TEE_GetObjectInfo1(stream->object, &object_info);
+		if (res != TEE_SUCCESS) {
+			EMSG("TEE_GetObjectInfo1 failed 0x%08x", res);
+			close_stream(stream);
+			return res;
+		}
+		params[1].value.b = object_info.dataSize;
+	}
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result stream_write(struct ss_session *sess, uint32_t param_types,
+			       TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+				TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	struct stream *stream;
+	TEE_Result res;
+
+	/*
+	 * Safely get the invocation parameters
+	 */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	stream = get_stream(sess, params[0].value.a);
+	if (!stream || !stream->write)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = TEE_WriteObjectData(stream->object, params[1].memref.buffer,
+				  params[1].memref.size);
+	if (res != TEE_SUCCESS)
+		EMSG("TEE_WriteObjectData failed 0x%08x", res);
+
+	return res;
+}
+
+static TEE_Result stream_read(struct ss_session *sess, uint32_t param_types,
+			      TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+				TEE_PARAM_TYPE_MEMREF_OUTPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	struct stream *stream;
+	uint32_t read_bytes;
+	TEE_Result res;
+
+	/*
+	 * Safely get the invocation parameters
+	 */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	stream = get_stream(sess, params[0].value.a);
+	if (!stream || stream->write)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = TEE_ReadObjectData(stream->object, params[1].memref.buffer,
+				 params[1].memref.size, &read_bytes);
+	if (res != TEE_SUCCESS) {
+		EMSG("TEE_ReadObjectData failed 0x%08x", res);
+		return res;
+	}
+
+	/* Return the number of byte effectively filled */
+	params[1].memref.size = read_bytes;
+	return TEE_SUCCESS;
+}
+
+static TEE_Result stream_close(struct ss_session *sess, uint32_t param_types,
+			       TEE_Param params[4], bool commit)
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	struct stream *stream;
+	TEE_Result res;
+
+	/*
+	 * Safely get the invocation parameters
+	 */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	stream = get_stream(sess, params[0].value.a);
+	if (!stream || (commit && !stream->write))
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	if (!commit) {
+		close_stream(stream);
+		return TEE_SUCCESS;
+	}
+
+	/* The stream is closed, the object replaced or left as it was */
+	res = tx_commit_temp(stream->object, stream->id, stream->id_len);
+	stream->object = TEE_HANDLE_NULL;
+	stream->write = false;
+	return res;
+}
+
+static TEE_Result list_objects(struct ss_session *sess, uint32_t param_types,
+			       TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INOUT,
+				TEE_PARAM_TYPE_MEMREF_OUTPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	struct list_cursor *cur = &sess->list;
+	struct secure_storage_list_item item;
+	char *out = params[1].memref.buffer;
+	TEE_ObjectInfo object_info;
+	size_t out_offs = 0;
+	size_t count = 0;
+	TEE_Result res;
+	size_t sz;
+
+	/*
+	 * Safely get the invocation parameters
+	 */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	if (params[0].value.a == TA_SECURE_STORAGE_LIST_START) {
+		if (cur->enumerator) {
+			TEE_ResetPersistentObjectEnumerator(cur->enumerator);
+		} else {
+			res = TEE_AllocatePersistentObjectEnumerator(
+							&cur->enumerator);
+			if (res != TEE_SUCCESS) {
+				EMSG("TEE_AllocatePersistentObjectEnumerator failed 0x%08x",
+				     res);
+				cur->enumerator = TEE_HANDLE_NULL;
+				return res;
+			}
+		}
+
+		cur->pending = false;
+		cur->internal = params[0].value.b;
+		res = TEE_StartPersistentObjectEnumerator(cur->enumerator,
+							  TEE_STORAGE_PRIVATE);
+		cur->done = res == TEE_ERROR_ITEM_NOT_FOUND;
+		if (res != TEE_SUCCESS && !cur->done) {
+			EMSG("TEE_StartPersistentObjectEnumerator failed 0x%08x",
+			     res);
+			return res;
+		}
+	} else if (params[0].value.a != TA_SECURE_STORAGE_LIST_NEXT ||
+		   !cur->enumerator) {
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	while (true) {
+		/* An object that did not fit is listed first */
+		if (!cur->pending && !cur->done) {
+			cur->id_len = sizeof(cur->id);
+			res = TEE_GetNextPersistentObject(cur->enumerator,
+							  &object_info,
+							  cur->id,
+							  &cur->id_len);
+			if (res == TEE_ERROR_ITEM_NOT_FOUND) {
+				cur->done = true;
+			} else if (res != TEE_SUCCESS) {
+				EMSG("TEE_GetNextPersistentObject failed 0x%08x",
+				     res);
+				return res;
+			} else if (!cur->internal &&
+				   reserved_id(cur->id, cur->id_len)) {
+				/* No command takes it, do not list it */
+				continue;
+			} else {
+				cur->pending = true;
+				cur->data_size = object_info.dataSize;
+			}
+		}
+		if (!cur->pending)
+			break;
+
+		sz = TA_SECURE_STORAGE_LIST_ITEM_SIZE(cur->id_len);
+		if (sz > params[1].memref.size - out_offs) {
+			if (count)
+				break;
+
+			/* Not even the next object fits, tell its size */
+			params[1].memref.size = sz;
+			return TEE_ERROR_SHORT_BUFFER;
+		}
+
+		item.id_len = cur->id_len;
+		item.data_size = cur->data_size;
+		TEE_MemMove(out + out_offs, &item, sizeof(item));
+		TEE_MemMove(out + out_offs + sizeof(item), cur->id,
+			    cur->id_len);
+		out_offs += sz;
+		count++;
+		cur->pending = false;
+	}
+
+	params[0].value.a = count;
+	params[0].value.b = cur->done && !cur->pending;
+	params[1].memref.size = out_offs;
+	return TEE_SUCCESS;
+}
+
+TEE_Result TA_CreateEntryPoint(void)
+{
+	/*
+	 * No object may be used while a replacement is half done: if it
+	 * cannot be completed now, each command tries again.
+	 */
+	tx_init();
+	return TEE_SUCCESS;
+}
+
+void TA_DestroyEntryPoint(void)
+{
+	kv_release();
+	handle_cache_release();
+	value_cache_release();
+}
+
+TEE_Result TA_OpenSessionEntryPoint(uint32_t __unused param_types,
+				    TEE_Param __unused params[4],
+				    void **session)
+{
+	struct ss_session *sess;
+
+	/* TEE_Malloc() zero-fills: no stream is open */
+	sess = TEE_Malloc(sizeof(*sess), 0);
+	if (!sess)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	*session = sess;
+	return TEE_SUCCESS;
+}
+
+void TA_CloseSessionEntryPoint(void *session)
+{
+	struct ss_session *sess = session;
+	size_t n;
+
+	for (n = 0; n < TA_SECURE_STORAGE_MAX_STREAMS; n++)
+		if (sess->streams[n].object != TEE_HANDLE_NULL)
+			close_stream(sess->streams + n);
+
+	if (sess->list.enumerator)
+		TEE_FreePersistentObjectEnumerator(sess->list.enumerator);
+
+	TEE_Free(sess);
+}
+
+TEE_Result TA_InvokeCommandEntryPoint(void *session,
+				      uint32_t command,
+				      uint32_t param_types,
+				      TEE_Param params[4])
+{
+	TEE_Result res;
+
+	/*
+	 * Objects are not used while a replacement is half done. Streams can
+	 * still be closed: their objects may be what keeps the replacement
+	 * from completing.
+	 */
+	if (command != TA_SECURE_STORAGE_CMD_STREAM_CLOSE) {
+		res = tx_recover();
+		if (res != TEE_SUCCESS)
+			return res;
+	}
+
 	switch (command) {
 	case TA_SECURE_STORAGE_CMD_WRITE_RAW:
 		return create_raw_object(param_types, params);
@@ -252,6 +1475,46 @@ TEE_Result TA_InvokeCommandEntryPoint(void __unused *session,
 		return read_raw_object(param_types, params);
 	case TA_SECURE_STORAGE_CMD_DELETE:
 		return delete_object(param_types, params);
+	case TA_SECURE_STORAGE_CMD_READ_AT:
+		return read_object_at(param_types, params);
+	case TA_SECURE_STORAGE_CMD_WRITE_AT:
+		return write_object_at(param_types, params);
+	case TA_SECURE_STORAGE_CMD_TRUNCATE:
+		return truncate_object(param_types, params);
+	case TA_SECURE_STORAGE_CMD_STREAM_OPEN_WRITE:
+		return stream_open(session, param_types, params, true);
+	case TA_SECURE_STORAGE_CMD_STREAM_WRITE:
+		return stream_write(session, param_types, params);
+	case TA_SECURE_STORAGE_CMD_STREAM_COMMIT:
+		return stream_close(session, param_types, params, true);
+	case TA_SECURE_STORAGE_CMD_STREAM_OPEN_READ:
+		return stream_open(session, param_types, params, false);
+	case TA_SECURE_STORAGE_CMD_STREAM_READ:
+		return stream_read(session, param_types, params);
+	case TA_SECURE_STORAGE_CMD_STREAM_CLOSE:
+		return stream_close(session, param_types, params, false);
+	case TA_SECURE_STORAGE_CMD_BATCH_PUT:
+		return batch_put(param_types, params);
+	case TA_SECURE_STORAGE_CMD_BATCH_GET:
+		return batch_get(param_types, params);
+	case TA_SECURE_STORAGE_CMD_KV_GET:
+		return kv_cmd_get(param_types, params);
+	case TA_SECURE_STORAGE_CMD_KV_PUT:
+		return kv_cmd_put(param_types, params);
+	case TA_SECURE_STORAGE_CMD_KV_DELETE:
+		return kv_cmd_delete(param_types, params);
+	case TA_SECURE_STORAGE_CMD_KV_SCAN:
+		return kv_cmd_scan(param_types, params);
+	case TA_SECURE_STORAGE_CMD_LIST:
+		return list_objects(session, param_types, params);
+	case TA_SECURE_STORAGE_CMD_STAT:
+		return stat_objects(param_types, params);
+	case TA_SECURE_STORAGE_CMD_CACHE_STATS:
+		return cache_stats(param_types, params);
+	case TA_SECURE_STORAGE_CMD_REPLACE:
+		return replace_object(param_types, params);
+	case TA_SECURE_STORAGE_CMD_BATCH_REPLACE:
+		return batch_replace(param_types, params);
 	default:
 		EMSG("Command ID 0x%x is not supported", command);
 		return TEE_ERROR_NOT_SUPPORTED;
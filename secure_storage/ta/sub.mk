@@ -1,2 +1,6 @@
 global-incdirs-y += include
 srcs-y += secure_storage_ta.c
+srcs-y += kv.c
+srcs-y += handles.c
+srcs-y += values.c
+srcs-y += tx.c
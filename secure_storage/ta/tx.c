@@ -0,0 +1,525 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2017, Linaro Limited
+ */
+
+/*
+ * Atomic replacement of objects, by temporary objects and a journal.
+ *
+ * A replacement writes the journal with the IDs of the objects to replace,
+ * in the prepared state. Then it writes the new data of each object to a
+ * temporary object of its own. Then it writes the journal again, in the
+ * committed state: this single update is the point where the replacement
+ * takes place. Last, each temporary object is renamed over the object it
+ * replaces, and the journal is deleted.
+ *
+ * An object cannot be renamed over an existing one, so the old object is
+ * deleted right before the rename. If the TA stops in between, the
+ * temporary object is still there and the journal is still committed.
+ *
+ * Every write of the journal and of a temporary object is a single update
+ * of the object, either done or not. Recovery reads the journal, if any. A
+ * prepared journal means nothing was replaced: the temporary objects are
+ * deleted. A committed journal means the replacement must complete: the
+ * temporary objects that are left are renamed. Both can be done again if
+ * the TA stops while they are being done.
+ *
+ * A stream written with TA_SECURE_STORAGE_CMD_STREAM_OPEN_WRITE goes to a
+ * temporary object of its own, which is renamed as temporary object 0 of a
+ * replacement of one object when the stream is committed.
+ */
+
+#include <inttypes.h>
+#include <secure_storage_ta.h>
+#include <stdio.h>
+#include <tee_internal_api.h>
+#include <tee_internal_api_extensions.h>
+
+#include "handles.h"
+#include "tx.h"
+#include "values.h"
+
+#define TX_JOURNAL_ID		TA_SECURE_STORAGE_TX_PREFIX "journal"
+#define TX_TEMP_ID_MAX_LEN	16
+
+#define TX_PREPARED		1
+#define TX_COMMITTED		2
+
+struct tx_journal_hdr {
+	uint32_t state;
+	uint32_t count;
+};
+
+struct tx_journal_entry {
+	uint32_t id_len;
+	char id[TA_SECURE_STORAGE_ITEM_ID_MAX_LEN];
+};
+
+#define TX_JOURNAL_SIZE(count) \
+	(sizeof(struct tx_journal_hdr) + \
+	 (count) * sizeof(struct tx_journal_entry))
+
+/* A replacement may be left to complete or undo: the journal must be read */
+static bool tx_pending = true;
+
+static size_t temp_id(uint32_t n, char id[TX_TEMP_ID_MAX_LEN])
+{
+	return snprintf(id, TX_TEMP_ID_MAX_LEN,
+			TA_SECURE_STORAGE_TX_PREFIX "%" PRIu32, n);
+}
+
+static size_t stream_temp_id(uint32_t n, char id[TX_TEMP_ID_MAX_LEN])
+{
+	return snprintf(id, TX_TEMP_ID_MAX_LEN,
+			TA_SECURE_STORAGE_TX_PREFIX "stream%" PRIu32, n);
+}
+
+/* Delete the object @id, if it exists */
+static TEE_Result delete_id(const char *id, size_t id_len)
+{
+	TEE_ObjectHandle object;
+	TEE_Result res;
+
+	res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE, id, id_len,
+				       TEE_DATA_FLAG_ACCESS_WRITE_META,
+				       &object);
+	if (res == TEE_ERROR_ITEM_NOT_FOUND)
+		return TEE_SUCCESS;
+	if (res != TEE_SUCCESS)
+		return res;
+
+	return TEE_CloseAndDeletePersistentObject1(object);
+}
+
+static TEE_Result write_journal(struct tx_journal_hdr *journal)
+{
+	TEE_ObjectHandle object;
+	TEE_Result res;
+
+	res = TEE_CreatePersistentObject(TEE_STORAGE_PRIVATE,
+					 TX_JOURNAL_ID, sizeof(TX_JOURNAL_ID) - 1,
+					 TEE_DATA_FLAG_ACCESS_WRITE_META |
+					 TEE_DATA_FLAG_OVERWRITE,
+					 TEE_HANDLE_NULL,
+					 journal, TX_JOURNAL_SIZE(journal->count),
+					 &object);
+	if (res != TEE_SUCCESS) {
+		EMSG("Failed to write the journal, res=0x%08x", res);
+		return res;
+	}
+
+	TEE_CloseObject(object);
+	return TEE_SUCCESS;
+}
+
+static TEE_Result delete_journal(void)
+{
+	TEE_Result res;
+
+	res = delete_id(TX_JOURNAL_ID, sizeof(TX_JOURNAL_ID) - 1);
+	if (res != TEE_SUCCESS)
+		EMSG("Failed to delete the journal, res=0x%08x", res);
+
+	return res;
+}
+
+/*
+ * Rename the temporary object @n over the object of @entry. @temp is the
+ * temporary object if it is open, it is closed. A temporary object that
+ * is not found was renamed already.
+ */
+static TEE_Result rename_temp(uint32_t n, TEE_ObjectHandle temp,
+			      const struct tx_journal_entry *entry)
+{
+	char id[TX_TEMP_ID_MAX_LEN];
+	TEE_Result res;
+
+	if (temp == TEE_HANDLE_NULL) {
+		res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE,
+					       id, temp_id(n, id),
+					       TEE_DATA_FLAG_ACCESS_WRITE_META,
+					       &temp);
+		if (res == TEE_ERROR_ITEM_NOT_FOUND)
+			return TEE_SUCCESS;
+		if (res != TEE_SUCCESS)
+			return res;
+	}
+
+	handle_cache_drop(entry->id, entry->id_len);
+	value_cache_drop(entry->id, entry->id_len);
+
+	res = delete_id(entry->id, entry->id_len);
+	if (res == TEE_SUCCESS)
+		res = TEE_RenamePersistentObject(temp, entry->id,
+						 entry->id_len);
+	if (res != TEE_SUCCESS)
+		EMSG("Failed to replace an object, res=0x%08x", res);
+
+	TEE_CloseObject(temp);
+	return res;
+}
+
+/* Delete the temporary objects of a replacement that did not commit */
+static TEE_Result undo(uint32_t count)
+{
+	char id[TX_TEMP_ID_MAX_LEN];
+	TEE_Result res;
+	uint32_t n;
+
+	for (n = 0; n < count; n++) {
+		res = delete_id(id, temp_id(n, id));
+		if (res != TEE_SUCCESS)
+			return res;
+	}
+
+	return delete_journal();
+}
+
+TEE_Result tx_recover(void)
+{
+	struct tx_journal_hdr *journal = NULL;
+	struct tx_journal_entry *entries;
+	struct tx_journal_hdr hdr;
+	TEE_ObjectHandle object;
+	uint32_t read_bytes;
+	TEE_Result res;
+	uint32_t n;
+
+	if (!tx_pending)
+		return TEE_SUCCESS;
+
+	res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE,
+				       TX_JOURNAL_ID, sizeof(TX_JOURNAL_ID) - 1,
+				       TEE_DATA_FLAG_ACCESS_READ, &object);
+	if (res == TEE_ERROR_ITEM_NOT_FOUND) {
+		tx_pending = false;
+		return TEE_SUCCESS;
+	}
+	if (res != TEE_SUCCESS)
+		goto corrupt;
+
+	res = TEE_ReadObjectData(object, &hdr, sizeof(hdr), &read_bytes);
+	if (res == TEE_SUCCESS &&
+	    (read_bytes != sizeof(hdr) ||
+	     hdr.count > TA_SECURE_STORAGE_REPLACE_MAX_ITEMS ||
+	     (hdr.state != TX_PREPARED && hdr.state != TX_COMMITTED)))
+		res = TEE_ERROR_CORRUPT_OBJECT;
+	if (res == TEE_SUCCESS) {
+		journal = TEE_Malloc(TX_JOURNAL_SIZE(hdr.count), 0);
+		if (!journal)
+			res = TEE_ERROR_OUT_OF_MEMORY;
+	}
+	if (res == TEE_SUCCESS) {
+		*journal = hdr;
+		entries = (struct tx_journal_entry *)(journal + 1);
+		res = TEE_ReadObjectData(object, entries,
+					 hdr.count * sizeof(*entries),
+					 &read_bytes);
+		if (res == TEE_SUCCESS &&
+		    read_bytes != hdr.count * sizeof(*entries))
+			res = TEE_ERROR_CORRUPT_OBJECT;
+		for (n = 0; res == TEE_SUCCESS && n < hdr.count; n++)
+			if (entries[n].id_len > TA_SECURE_STORAGE_ITEM_ID_MAX_LEN)
+				res = TEE_ERROR_CORRUPT_OBJECT;
+	}
+	TEE_CloseObject(object);
+corrupt:
+	/*
+	 * Nothing can be done with a journal that does not parse, but it
+	 * must not keep the TA from working: drop it with the temporary
+	 * objects it may refer to.
+	 */
+	if (res == TEE_ERROR_CORRUPT_OBJECT) {
+		EMSG("Discarding a corrupt replacement journal");
+		res = undo(TA_SECURE_STORAGE_REPLACE_MAX_ITEMS);
+		goto out;
+	}
+	if (res != TEE_SUCCESS)
+		goto out;
+
+	if (journal->state == TX_PREPARED) {
+		res = undo(journal->count);
+		goto out;
+	}
+
+	for (n = 0; n < journal->count; n++) {
+		res = rename_temp(n, TEE_HANDLE_NULL, entries + n);
+		if (res != TEE_SUCCESS)
+			goto out;
+	}
+	res = delete_journal();
+out:
+	if (res != TEE_SUCCESS)
+		EMSG("Failed to recover a replacement, res=0x%08x", res);
+	tx_pending = res != TEE_SUCCESS;
+	TEE_Free(journal);
+	return res;
+}
+
+/*
+ * Check that the object of @entry is not open, so that it can be deleted
+ * when the replacement is committed. An open object would otherwise make
+ * the replacement fail past its commit, until the object is closed.
+ */
+static TEE_Result check_target(const struct tx_journal_entry *entry)
+{
+	TEE_ObjectHandle object;
+	TEE_Result res;
+
+	/* Handles kept by the cache do not count */
+	handle_cache_drop(entry->id, entry->id_len);
+
+	res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE,
+				       entry->id, entry->id_len,
+				       TEE_DATA_FLAG_ACCESS_WRITE_META,
+				       &object);
+	if (res == TEE_ERROR_ITEM_NOT_FOUND)
+		return TEE_SUCCESS;
+	if (res != TEE_SUCCESS) {
+		EMSG("Cannot replace an object, res=0x%08x", res);
+		return res;
+	}
+
+	TEE_CloseObject(object);
+	return TEE_SUCCESS;
+}
+
+/* Delete the open temporary objects of a replacement that did not commit */
+static void undo_temps(TEE_ObjectHandle *temps, uint32_t count)
+{
+	uint32_t n;
+
+	for (n = 0; n < count; n++) {
+		if (temps[n] != TEE_HANDLE_NULL) {
+			TEE_CloseAndDeletePersistentObject1(temps[n]);
+			temps[n] = TEE_HANDLE_NULL;
+		}
+	}
+	if (delete_journal() != TEE_SUCCESS)
+		tx_pending = true;
+}
+
+/*
+ * Commit the replacement of @journal, the temporary objects of which are
+ * written and open in @temps, then rename them. The temporary objects are
+ * closed, and deleted if the replacement does not commit.
+ */
+static TEE_Result commit(struct tx_journal_hdr *journal,
+			 TEE_ObjectHandle *temps)
+{
+	struct tx_journal_entry *entries;
+	TEE_Result res;
+	uint32_t n;
+
+	entries = (struct tx_journal_entry *)(journal + 1);
+
+	for (n = 0; n < journal->count; n++) {
+		res = check_target(entries + n);
+		if (res != TEE_SUCCESS) {
+			undo_temps(temps, journal->count);
+			return res;
+		}
+	}
+
+	journal->state = TX_COMMITTED;
+	res = write_journal(journal);
+	if (res != TEE_SUCCESS) {
+		undo_temps(temps, journal->count);
+		return res;
+	}
+
+	/* Committed: a failure from here is completed by recovery */
+	for (n = 0; n < journal->count; n++) {
+		res = rename_temp(n, temps[n], entries + n);
+		temps[n] = TEE_HANDLE_NULL;
+		if (res != TEE_SUCCESS) {
+			tx_pending = true;
+			for (n++; n < journal->count; n++) {
+				TEE_CloseObject(temps[n]);
+				temps[n] = TEE_HANDLE_NULL;
+			}
+			return res;
+		}
+	}
+
+	/* The objects are replaced, even if the journal stays */
+	if (delete_journal() != TEE_SUCCESS)
+		tx_pending = true;
+
+	return TEE_SUCCESS;
+}
+
+static bool check_items(const struct tx_item *items, size_t count)
+{
+	size_t n;
+	size_t m;
+
+	if (!count || count > TA_SECURE_STORAGE_REPLACE_MAX_ITEMS)
+		return false;
+
+	for (n = 0; n < count; n++) {
+		if (items[n].id_len > TA_SECURE_STORAGE_ITEM_ID_MAX_LEN)
+			return false;
+		/* An object is replaced once */
+		for (m = 0; m < n; m++)
+			if (items[m].id_len == items[n].id_len &&
+			    !TEE_MemCompare(items[m].id, items[n].id,
+					    items[n].id_len))
+				return false;
+	}
+
+	return true;
+}
+
+TEE_Result tx_replace(const struct tx_item *items, size_t count)
+{
+	struct tx_journal_hdr *journal;
+	struct tx_journal_entry *entries;
+	TEE_ObjectHandle *temps;
+	char id[TX_TEMP_ID_MAX_LEN];
+	TEE_Result res;
+	uint32_t n;
+
+	if (!check_items(items, count))
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	/* The previous replacement must be over */
+	res = tx_recover();
+	if (res != TEE_SUCCESS)
+		return res;
+
+	journal = TEE_Malloc(TX_JOURNAL_SIZE(count), 0);
+	temps = TEE_Malloc(count * sizeof(*temps), 0);
+	if (!journal || !temps) {
+		res = TEE_ERROR_OUT_OF_MEMORY;
+		goto out;
+	}
+
+	journal->state = TX_PREPARED;
+	journal->count = count;
+	entries = (struct tx_journal_entry *)(journal + 1);
+	for (n = 0; n < count; n++) {
+		entries[n].id_len = items[n].id_len;
+		TEE_MemMove(entries[n].id, items[n].id, items[n].id_len);
+	}
+
+	res = write_journal(journal);
+	if (res != TEE_SUCCESS)
+		goto out;
+
+	/* Each temporary object is created with its data, a single update */
+	for (n = 0; n < count; n++) {
+		res = TEE_CreatePersistentObject(TEE_STORAGE_PRIVATE,
+						 id, temp_id(n, id),
+						 TEE_DATA_FLAG_ACCESS_WRITE_META |
+						 TEE_DATA_FLAG_OVERWRITE,
+						 TEE_HANDLE_NULL,
+						 items[n].data,
+						 items[n].data_len,
+						 temps + n);
+		if (res != TEE_SUCCESS) {
+			EMSG("TEE_CreatePersistentObject failed 0x%08x", res);
+			temps[n] = TEE_HANDLE_NULL;
+			goto undo;
+		}
+	}
+
+	res = commit(journal, temps);
+	goto out;
+
+undo:
+	undo_temps(temps, count);
+out:
+	TEE_Free(temps);
+	TEE_Free(journal);
+	return res;
+}
+
+TEE_Result tx_create_temp(uint32_t n, uint32_t flags, TEE_ObjectHandle *temp)
+{
+	char id[TX_TEMP_ID_MAX_LEN];
+	TEE_Result res;
+
+	res = TEE_CreatePersistentObject(TEE_STORAGE_PRIVATE,
+					 id, stream_temp_id(n, id),
+					 flags | TEE_DATA_FLAG_ACCESS_WRITE_META |
+					 TEE_DATA_FLAG_OVERWRITE,
+					 TEE_HANDLE_NULL, NULL, 0, temp);
+	if (res != TEE_SUCCESS)
+		EMSG("TEE_CreatePersistentObject failed 0x%08x", res);
+
+	return res;
+}
+
+TEE_Result tx_commit_temp(TEE_ObjectHandle temp, const char *id,
+			  size_t id_len)
+{
+	struct tx_journal_hdr *journal = NULL;
+	struct tx_journal_entry *entry;
+	char tid[TX_TEMP_ID_MAX_LEN];
+	size_t tid_len;
+	TEE_Result res;
+
+	if (id_len > TA_SECURE_STORAGE_ITEM_ID_MAX_LEN) {
+		res = TEE_ERROR_BAD_PARAMETERS;
+		goto err;
+	}
+
+	/* The previous replacement must be over */
+	res = tx_recover();
+	if (res != TEE_SUCCESS)
+		goto err;
+
+	journal = TEE_Malloc(TX_JOURNAL_SIZE(1), 0);
+	if (!journal) {
+		res = TEE_ERROR_OUT_OF_MEMORY;
+		goto err;
+	}
+
+	journal->state = TX_PREPARED;
+	journal->count = 1;
+	entry = (struct tx_journal_entry *)(journal + 1);
+	entry->id_len = id_len;
+	TEE_MemMove(entry->id, id, id_len);
+
+	res = write_journal(journal);
+	if (res != TEE_SUCCESS)
+		goto err;
+
+	tid_len = temp_id(0, tid);
+	res = delete_id(tid, tid_len);
+	if (res == TEE_SUCCESS)
+		res = TEE_RenamePersistentObject(temp, tid, tid_len);
+	if (res != TEE_SUCCESS) {
+		EMSG("Failed to rename a stream, res=0x%08x", res);
+		undo_temps(&temp, 1);
+		goto out;
+	}
+
+	res = commit(journal, &temp);
+	goto out;
+
+err:
+	TEE_CloseAndDeletePersistentObject1(temp);
+out:
+	TEE_Free(journal);
+	return res;
+}
+
+void tx_init(void)
+{
+	char id[TX_TEMP_ID_MAX_LEN];
+	TEE_Result res;
+	uint32_t n;
+
+	/* No session is open yet: temporary objects of streams are stale */
+	for (n = 0; n < TA_SECURE_STORAGE_MAX_STREAMS; n++) {
+		res = delete_id(id, stream_temp_id(n, id));
+		if (res != TEE_SUCCESS)
+			EMSG("Failed to delete %s, res=0x%08x", id, res);
+	}
+
+	/* On failure, the objects wait for a command to recover */
+	tx_pending = true;
+	tx_recover();
+}
@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (c) 2017, Linaro Limited
+ */
+
+#ifndef __TX_H__
+#define __TX_H__
+
+#include <stddef.h>
+#include <tee_internal_api.h>
+
+/*
+ * Atomic replacement of objects, see TA_SECURE_STORAGE_CMD_REPLACE. The IDs
+ * are read more than once: they must be in TA memory, not in shared
+ * memory. The data is read once and may be in shared memory.
+ */
+struct tx_item {
+	const char *id;
+	size_t id_len;
+	const void *data;
+	size_t data_len;
+};
+
+/*
+ * Replace or create the objects of @items, all of them or none. Nothing is
+ * changed unless the items are valid.
+ */
+TEE_Result tx_replace(const struct tx_item *items, size_t count);
+
+/*
+ * Create the temporary object of stream @n of the session, opened with
+ * @flags and TEE_DATA_FLAG_ACCESS_WRITE_META, to be passed to
+ * tx_commit_temp() or deleted. A temporary object of the stream left by an
+ * earlier run of the TA is replaced.
+ */
+TEE_Result tx_create_temp(uint32_t n, uint32_t flags, TEE_ObjectHandle *temp);
+
+/*
+ * Replace or create the object @id with the data of @temp, from
+ * tx_create_temp(), atomically as tx_replace() does. @temp is closed, and
+ * deleted unless the replacement commits.
+ */
+TEE_Result tx_commit_temp(TEE_ObjectHandle temp, const char *id,
+			  size_t id_len);
+
+/*
+ * Complete or undo the replacement that was interrupted, if any: when the
+ * TA starts, or after a replacement failed past its commit. It must be
+ * called before the objects are used, and does nothing once no replacement
+ * is left. A journal that does not parse is logged and discarded.
+ */
+TEE_Result tx_recover(void);
+
+/*
+ * Recover as tx_recover() does when the TA starts, and delete the temporary
+ * objects of streams that were not committed before the TA stopped. A
+ * journal that does not parse is discarded.
+ */
+void tx_init(void);
+
+#endif /* __TX_H__ */
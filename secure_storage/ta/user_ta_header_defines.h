@@ -38,7 +38,12 @@
 
 #define TA_FLAGS			(TA_FLAG_EXEC_DDR | TA_FLAG_SINGLE_INSTANCE)
 #define TA_STACK_SIZE			(2 * 1024)
-#define TA_DATA_SIZE			(32 * 1024)
+/*
+ * Heap taken by the cache of small objects, out of TA_DATA_SIZE. Set to 0
+ * to disable the cache.
+ */
+#define TA_VALUE_CACHE_SIZE		(64 * 1024)
+#define TA_DATA_SIZE			(256 * 1024 + TA_VALUE_CACHE_SIZE)
 
 #define TA_CURRENT_TA_EXT_PROPERTIES \
     { "gp.ta.description", USER_TA_PROP_TYPE_STRING, \
@@ -0,0 +1,184 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2017, Linaro Limited
+ */
+
+/*
+ * Cache of the data of small objects read often. A hit serves the object
+ * from TA memory without any RPC to the normal world.
+ *
+ * The objects are found by a hash of their ID, and kept in a list from the
+ * most to the least recently used one: the objects at the end of the list
+ * are dropped first when the cache is full. The size of the cache counts
+ * the data, the ID and the entry of each object, so that it bounds the
+ * heap taken from TA_DATA_SIZE.
+ */
+
+#include <tee_internal_api.h>
+#include <tee_internal_api_extensions.h>
+#include <user_ta_header_defines.h>
+
+#include "values.h"
+
+#define VALUE_CACHE_BUCKETS	64
+
+struct cached_value {
+	struct cached_value *hash_next;	/* Next in the bucket */
+	struct cached_value *prev;	/* More recently used */
+	struct cached_value *next;	/* Less recently used */
+	size_t id_len;
+	size_t len;
+	char buf[];			/* ID followed by the data */
+};
+
+#define CACHED_VALUE_SIZE(id_len, len) \
+	(sizeof(struct cached_value) + (id_len) + (len))
+
+static struct cached_value *buckets[VALUE_CACHE_BUCKETS];
+static struct cached_value *lru_first;
+static struct cached_value *lru_last;
+static size_t cache_size;
+static size_t cache_count;
+static uint64_t hits;
+static uint64_t misses;
+static uint64_t evictions;
+
+/* FNV-1a */
+static size_t bucket_of(const char *id, size_t id_len)
+{
+	uint32_t h = 2166136261U;
+	size_t n;
+
+	for (n = 0; n < id_len; n++)
+		h = (h ^ (uint8_t)id[n]) * 16777619U;
+
+	return h % VALUE_CACHE_BUCKETS;
+}
+
+static struct cached_value **find_value(const char *id, size_t id_len)
+{
+	struct cached_value **v = buckets + bucket_of(id, id_len);
+
+	while (*v && ((*v)->id_len != id_len ||
+		      TEE_MemCompare((*v)->buf, id, id_len)))
+		v = &(*v)->hash_next;
+
+	return v;
+}
+
+static void lru_unlink(struct cached_value *v)
+{
+	if (v->prev)
+		v->prev->next = v->next;
+	else
+		lru_first = v->next;
+	if (v->next)
+		v->next->prev = v->prev;
+	else
+		lru_last = v->prev;
+}
+
+static void lru_push(struct cached_value *v)
+{
+	v->prev = NULL;
+	v->next = lru_first;
+	if (lru_first)
+		lru_first->prev = v;
+	else
+		lru_last = v;
+	lru_first = v;
+}
+
+/* Remove the value @v points to */
+static void remove_value(struct cached_value **v)
+{
+	struct cached_value *value = *v;
+
+	*v = value->hash_next;
+	lru_unlink(value);
+	cache_size -= CACHED_VALUE_SIZE(value->id_len, value->len);
+	cache_count--;
+	TEE_Free(value);
+}
+
+bool value_cache_get(const char *id, size_t id_len, const void **data,
+		     size_t *len)
+{
+	struct cached_value *v = *find_value(id, id_len);
+
+	if (!v) {
+		misses++;
+		return false;
+	}
+
+	hits++;
+	lru_unlink(v);
+	lru_push(v);
+	*data = v->buf + v->id_len;
+	*len = v->len;
+	return true;
+}
+
+void value_cache_put(const char *id, size_t id_len, const void *data,
+		     size_t len, bool add)
+{
+	size_t sz = CACHED_VALUE_SIZE(id_len, len);
+	struct cached_value **v = find_value(id, id_len);
+	struct cached_value *value;
+
+	if (*v)
+		remove_value(v);
+	else if (!add)
+		return;
+
+	if (id_len > TEE_OBJECT_ID_MAX_LEN ||
+	    len > VALUE_CACHE_VALUE_MAX_LEN || sz > TA_VALUE_CACHE_SIZE)
+		return;
+
+	while (cache_size + sz > TA_VALUE_CACHE_SIZE) {
+		remove_value(find_value(lru_last->buf, lru_last->id_len));
+		evictions++;
+	}
+
+	/* Not caching is never an error */
+	value = TEE_Malloc(sz, 0);
+	if (!value)
+		return;
+
+	value->id_len = id_len;
+	value->len = len;
+	TEE_MemMove(value->buf, id, id_len);
+	TEE_MemMove(value->buf + id_len, data, len);
+
+	v = buckets + bucket_of(id, id_len);
+	value->hash_next = *v;
+	*v = value;
+	lru_push(value);
+	cache_size += sz;
+	cache_count++;
+}
+
+void value_cache_drop(const char *id, size_t id_len)
+{
+	struct cached_value **v = find_value(id, id_len);
+
+	if (*v)
+		remove_value(v);
+}
+
+void value_cache_get_stats(struct secure_storage_cache_stats *stats)
+{
+	stats->hits = hits;
+	stats->misses = misses;
+	stats->evictions = evictions;
+	stats->count = cache_count;
+	stats->size = cache_size;
+	stats->capacity = TA_VALUE_CACHE_SIZE;
+	stats->reserved = 0;
+}
+
+void value_cache_release(void)
+{
+	while (lru_first)
+		remove_value(find_value(lru_first->buf, lru_first->id_len));
+}
@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (c) 2017, Linaro Limited
+ */
+
+#ifndef __VALUES_H__
+#define __VALUES_H__
+
+#include <secure_storage_ta.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <tee_internal_api.h>
+
+/* Objects larger than this are never cached */
+#define VALUE_CACHE_VALUE_MAX_LEN	(4 * 1024)
+
+/*
+ * Cache of the data of small objects, in TA memory, up to
+ * TA_VALUE_CACHE_SIZE bytes. It is written through: the objects are always
+ * written to secure storage, and the cache updated or dropped along.
+ */
+
+/*
+ * Get the cached data of the object @id. The data is valid until the next
+ * call to the cache. False on a miss.
+ */
+bool value_cache_get(const char *id, size_t id_len, const void **data,
+		     size_t *len);
+
+/*
+ * Cache @data as the data of the object @id, which was just read from or
+ * written to secure storage. An object not cached yet is only added when
+ * @add is set, writes only update the objects already cached. The least
+ * recently used objects are dropped for room. @data must be in TA memory:
+ * what is cached must be what is stored.
+ */
+void value_cache_put(const char *id, size_t id_len, const void *data,
+		     size_t len, bool add);
+
+/* Drop the object @id from the cache, before it is changed or deleted */
+void value_cache_drop(const char *id, size_t id_len);
+
+void value_cache_get_stats(struct secure_storage_cache_stats *stats);
+
+/* Free the cache, at the end of the TA instance */
+void value_cache_release(void);
+
+#endif /* __VALUES_H__ */